@@ -1,2 +0,0 @@
-glslc.exe shader.vert -o vert.spv
-glslc.exe shader.frag -o frag.spv
\ No newline at end of file
@@ -0,0 +1,28 @@
+#version 450
+
+layout(push_constant) uniform Feedback
+{
+    mat4 mvp;
+    // width, height, mip count
+    vec4 info;
+    // page size, lod bias, group
+    vec4 params;
+} feedback;
+
+layout(location = 0) in vec2 fragTexCoord;
+
+// page x, page y, mip, group
+layout(location = 0) out uvec4 outPage;
+
+void main()
+{
+    // Same level selection as shader.frag, biased by the lower resolution of this pass
+    vec2 texel = fract(fragTexCoord) * feedback.info.xy;
+    vec2 dx = dFdx(fragTexCoord * feedback.info.xy);
+    vec2 dy = dFdy(fragTexCoord * feedback.info.xy);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + feedback.params.y;
+    int mip = clamp(int(floor(lod)), 0, int(feedback.info.z) - 1);
+
+    uvec2 page = uvec2(texel / (feedback.params.x * exp2(float(mip))));
+    outPage = uvec4(page, uint(mip), uint(feedback.params.z));
+}
@@ -0,0 +1,21 @@
+#version 450
+
+layout(push_constant) uniform Feedback
+{
+    mat4 mvp;
+    // width, height, mip count
+    vec4 info;
+    // page size, lod bias, group
+    vec4 params;
+} feedback;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec2 fragTexCoord;
+
+void main()
+{
+    gl_Position = feedback.mvp * vec4(inPosition, 1.0);
+    fragTexCoord = inTexCoord;
+}
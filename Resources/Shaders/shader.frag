@@ -1,9 +1,31 @@
 #version 450
 
+// sRGB colour, RG normal xy, RG roughness and metalness
 layout (binding = 2) uniform sampler2D diffuse;
 layout (binding = 3) uniform sampler2D normal;
 layout (binding = 4) uniform sampler2D metallic;
 
+// Virtual texturing: a page table per texture slot, the slots above then hold the physical page cache
+layout (binding = 5) uniform usampler2D diffusePages;
+layout (binding = 6) uniform usampler2D normalPages;
+layout (binding = 7) uniform usampler2D metallicPages;
+
+// Material features (eMaterialConstant), a pipeline is specialised for every combination the materials use
+// so the maps a material does not have cost nothing
+layout(constant_id = 0) const bool HAS_DIFFUSE_MAP = true;
+layout(constant_id = 1) const bool HAS_NORMAL_MAP = true;
+layout(constant_id = 2) const bool HAS_METALLIC_ROUGHNESS_MAP = true;
+layout(constant_id = 3) const bool ALPHA_MASK = false;
+layout(constant_id = 4) const float ALPHA_CUTOFF = 0.5;
+
+layout(push_constant) uniform VirtualTextures
+{
+    // width, height, mip count
+    vec4 textures[3];
+    // cache size in texels, page size, page border, enabled
+    vec4 cache;
+} virtualTextures;
+
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
@@ -13,19 +35,74 @@ layout(location = 0) out vec4 outColor;
 
 
 
+vec4 sampleVirtual(sampler2D pageCache, usampler2D pageTable, vec4 info)
+{
+    // Level from the unwrapped uvs, fract would make the derivatives jump at the seams
+    vec2 texel = fract(fragTexCoord) * info.xy;
+    vec2 dx = dFdx(fragTexCoord * info.xy);
+    vec2 dy = dFdy(fragTexCoord * info.xy);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+    int mip = clamp(int(floor(lod)), 0, int(info.z) - 1);
+
+    // The entry points at the page itself or the closest coarser one that is resident
+    float pageSize = virtualTextures.cache.y;
+    float border = virtualTextures.cache.z;
+    uvec4 entry = texelFetch(pageTable, ivec2(texel / (pageSize * exp2(float(mip)))), mip);
+    vec2 inPage = fract(texel / (pageSize * exp2(float(entry.z))));
+    vec2 physical = vec2(entry.xy) * (pageSize + 2.0 * border) + border + inPage * pageSize;
+    return textureLod(pageCache, physical / virtualTextures.cache.x, 0.0);
+}
+
 void main() 
 {
     float LightIntensity = 0.5;
     vec3 lightDirection = normalize(vec3(0.,0.,-1.));
 
-    vec4 diffuseColor = texture(diffuse, fragTexCoord);
-    vec4 normalColor = texture(normal, fragTexCoord);
-    vec4 metallicColor = texture(metallic, fragTexCoord);
+    // glTF defaults for missing maps: white, a flat normal, fully rough and not metallic
+    vec4 diffuseColor = vec4(1.0);
+    vec4 normalColor = vec4(0.5, 0.5, 0.0, 0.0);
+    vec4 metallicColor = vec4(1.0, 0.0, 0.0, 0.0);
+    if (virtualTextures.cache.w > 0.5)
+    {
+        if (HAS_DIFFUSE_MAP)
+        {
+            diffuseColor = sampleVirtual(diffuse, diffusePages, virtualTextures.textures[0]);
+        }
+        if (HAS_NORMAL_MAP)
+        {
+            normalColor = sampleVirtual(normal, normalPages, virtualTextures.textures[1]);
+        }
+        if (HAS_METALLIC_ROUGHNESS_MAP)
+        {
+            metallicColor = sampleVirtual(metallic, metallicPages, virtualTextures.textures[2]);
+        }
+    }
+    else
+    {
+        if (HAS_DIFFUSE_MAP)
+        {
+            diffuseColor = texture(diffuse, fragTexCoord);
+        }
+        if (HAS_NORMAL_MAP)
+        {
+            normalColor = texture(normal, fragTexCoord);
+        }
+        if (HAS_METALLIC_ROUGHNESS_MAP)
+        {
+            metallicColor = texture(metallic, fragTexCoord);
+        }
+    }
+    if (ALPHA_MASK && diffuseColor.a < ALPHA_CUTOFF)
+    {
+        discard;
+    }
 
     float ambientintensity = 0.2;
     vec3 normal;
+    // Only xy is stored, z of a unit tangent space normal is always positive
+    normal.xy = normalColor.xy * 2.0 - 1.0;
+    normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
     // Not correct
-    normal = normalColor.xyz * 2.0 - 1.0;
     normal = normalize(normal * TBN);
 
     vec3 lightcolor = vec3(1.) * max(0.,dot(-lightDirection, normal));
@@ -6,11 +6,11 @@ layout(binding = 0) uniform UniformBufferObject
     mat4 proj;
 } ubo;
 
-layout(binding = 1) uniform ModelMatrix 
+// Transform of every draw of the frame, a draw's first instance is its index
+layout(std430, binding = 1) readonly buffer Draws
 {
-    mat4 model;
-  
-} matrix;
+    mat4 models[];
+} draws;
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
@@ -25,12 +25,13 @@ layout(location = 2) out mat3 TBN;
 
 void main()
 {
-    gl_Position = ubo.proj * ubo.view * matrix.model * vec4(inPosition, 1.0);
+    mat4 model = draws.models[gl_InstanceIndex];
+    gl_Position = ubo.proj * ubo.view * model * vec4(inPosition, 1.0);
     fragColor = inColor;
    
-   	vec3 normal = normalize(inNormal * inverse(mat3(matrix.model)));
-	vec3 tangent = normalize(inTangent.xyz * inverse(mat3(matrix.model)));
-	vec3 biTangent = normalize(cross(inNormal, inTangent.xyz) * inverse(mat3(matrix.model)));
+   	vec3 normal = normalize(inNormal * inverse(mat3(model)));
+	vec3 tangent = normalize(inTangent.xyz * inverse(mat3(model)));
+	vec3 biTangent = normalize(cross(inNormal, inTangent.xyz) * inverse(mat3(model)));
 	TBN = mat3(tangent, biTangent, normal);
 
     fragTexCoord = inTexCoord;
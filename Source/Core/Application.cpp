@@ -3,8 +3,92 @@
 #include "Window.h"
 #include "Rendering/Shader.h"
 #include "Rendering/Texture.h"
+#include "Rendering/ModelLoader.h"
+#include "Rendering/TextureStreaming.h"
+#include "Rendering/VirtualTexture.h"
+#include "Rendering/SamplerCache.h"
+#include "Rendering/PipelineCache.h"
+#include "Rendering/ShaderReflection.h"
+#include "Rendering/GeometryPool.h"
+#include "Rendering/GpuCulling.h"
+#include "Rendering/OcclusionRasterizer.h"
+#include "AssetCache.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <chrono>
+#include <filesystem>
+#include <cmath>
+
+namespace
+{
+	// Draws copies of the model in a grid, first with a Model::Draw per copy and then with one
+	// Model::DrawInstanced, and compares how long submitting and recording them takes
+	class InstancingBenchmark
+	{
+	public:
+		InstancingBenchmark(uint32_t count, const glm::mat4& orientation)
+		{
+			const float spacing = 2.5f;
+			uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(count))));
+			m_GridSize = side * spacing;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				glm::vec3 position((i % side + 0.5f) * spacing - m_GridSize * 0.5f, (i / side + 0.5f) * spacing - m_GridSize * 0.5f, 0.0f);
+				m_Transforms.push_back(glm::translate(glm::mat4(1.0f), position) * orientation);
+			}
+		}
+
+		const std::vector<glm::mat4>& GetTransforms() const { return m_Transforms; }
+		bool IsInstanced() const { return m_Frame >= c_FramesPerPath; }
+
+		// Looks at the whole grid
+		void SetView(VulkanProject::UniformBufferObject& ubo, float aspect) const
+		{
+			ubo.view = glm::lookAt(glm::vec3(0.0f, -m_GridSize * 0.6f, m_GridSize * 0.5f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+			ubo.proj = glm::perspective(glm::radians(45.0f), aspect, 0.1f, m_GridSize * 2.0f);
+			ubo.proj[1][1] *= -1;
+		}
+
+		// Returns false once both paths are measured, after printing the results
+		bool AddFrame(float recordMilliseconds, float frameMilliseconds, const VulkanProject::CommandEncoder::Stats& binds)
+		{
+			uint32_t path = IsInstanced() ? 1 : 0;
+			m_Binds[path] = binds;
+			// the first frames of each path fill the caches and grow the per frame buffers
+			if (m_Frame % c_FramesPerPath >= c_WarmupFrames)
+			{
+				m_RecordTime[path] += recordMilliseconds;
+				m_FrameTime[path] += frameMilliseconds;
+			}
+			if (++m_Frame < 2 * c_FramesPerPath)
+			{
+				return true;
+			}
+
+			const float measured = static_cast<float>(c_FramesPerPath - c_WarmupFrames);
+			printf("Instancing benchmark, %zu copies, average of %u frames\n", m_Transforms.size(), c_FramesPerPath - c_WarmupFrames);
+			const char* names[2] = { "Model::Draw per copy", "Model::DrawInstanced" };
+			for (uint32_t i = 0; i < 2; i++)
+			{
+				printf("  %-22s %8.3f ms recording, %8.3f ms per frame, %u binds issued, %u dropped\n", names[i],
+					m_RecordTime[i] / measured, m_FrameTime[i] / measured, m_Binds[i].issued, m_Binds[i].elided);
+			}
+			return false;
+		}
+
+	private:
+		static const uint32_t c_WarmupFrames = 60;
+		static const uint32_t c_FramesPerPath = 360;
+
+		std::vector<glm::mat4> m_Transforms;
+		float m_GridSize = 0.0f;
+		uint32_t m_Frame = 0;
+		float m_RecordTime[2] = {};
+		float m_FrameTime[2] = {};
+		// of the last frame of each path
+		VulkanProject::CommandEncoder::Stats m_Binds[2];
+	};
+}
+
 VulkanProject::Application::Application(VulkanProject::AppConfig& info)
 {
 	// Creating window
@@ -12,14 +96,31 @@ VulkanProject::Application::Application(VulkanProject::AppConfig& info)
 
 	// Initialising rendering
 	m_Graphics = new Graphics(m_Window);
-	m_Graphics->Init(info.windowWidth, info.windowHeight, info.name);
+	m_Graphics->Init(info.windowWidth, info.windowHeight, info.name, info.pipelineCachePath);
 
 	glm::vec4 color = { 0.5f,0.3f,0.5f, 1.f };
 	Renderer::SetClearColor(color);
+	Renderer::SetRecordingThreads(info.recordingThreads);
+
+	GeometryPool::Init(info.geometryPoolVertices, info.geometryPoolIndices);
+	SamplerCache::Init();
+	LayoutCache::Init();
+	PipelineCache::Init();
+	AssetCache::Init(info.assetCacheDirectory, info.assetCacheSize);
+	TextureStreaming::Init(info.textureMemoryBudget);
+	VirtualTexturing::Init(info.virtualTextureCachePages);
+	if (info.gpuCulling)
+	{
+		GpuCulling::Init();
+	}
 
 	PipelineDesc desc;
-	desc.vertexShaderPath = "Resources/Shaders/vert.spv"; 
-	desc.fragmentShaderPath = "Resources/Shaders/frag.spv"; 
+	desc.vertexShaderPath = "Resources/Shaders/shader.vert";
+	desc.fragmentShaderPath = "Resources/Shaders/shader.frag";
+	// Compiled up front, the permutation of fully textured materials
+	desc.state.SetConstant(eMaterialConstant::DiffuseMap, 1u);
+	desc.state.SetConstant(eMaterialConstant::NormalMap, 1u);
+	desc.state.SetConstant(eMaterialConstant::MetallicRoughnessMap, 1u);
 
 	const std::vector<Vertex> vertices =
 	{
@@ -40,38 +141,126 @@ VulkanProject::Application::Application(VulkanProject::AppConfig& info)
 	{
 		0, 1, 2, 2, 3, 0,
 	};
-	Model model("Resources/Models/glTF/DamagedHelmet.gltf");
-	
-	//Mesh mesh{ vertices, indices };
-	//Mesh mesh1{ vertices1, indices };
-	//Texture texture{ "Resources/Textures/statue-1275469_1280.jpg" };
-	GraphicsPipeline pipeline(desc);
-
-	pipeline.Bind();
-	// Main loop
-	while (m_Window->Update())
+	// Prefer the offline cooked model, it loads without any parsing or vertex processing
+	std::string modelPath = "Resources/Models/Cooked/glTF-Binary/DamagedHelmet.vpmodel";
+	if (!std::filesystem::exists(modelPath))
+	{
+		modelPath = "Resources/Models/glTF-Binary/DamagedHelmet.glb";
+	}
+	// Everything using the device and the subsystems is gone before they shut down
 	{
-		static auto startTime = std::chrono::high_resolution_clock::now();
-
-		auto currentTime = std::chrono::high_resolution_clock::now();
-		float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
-
-		UniformBufferObject ubo{};
-		glm::mat4 modelMatrix = glm::rotate(glm::mat4(1.0f),  glm::radians(90.f), glm::vec3(1.0f, 1.0f, 0.0f));
-		modelMatrix = glm::rotate(modelMatrix, glm::radians(90.f), glm::vec3(0.0f, 1.0f, 0.0f));
-		modelMatrix = glm::rotate(modelMatrix, time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.proj = glm::perspective(glm::radians(45.0f), m_Window->m_Width / (float)m_Window->m_Height, 0.1f, 10.0f);
-		ubo.proj[1][1] *= -1;
-
-		m_Graphics->BeginFrame();
-
-		pipeline.UpdateBuffers(ubo);
-		model.Draw(modelMatrix, pipeline);
-		pipeline.BindData();
-		//mesh1.Draw(ubo.model);
-		m_Graphics->EndFrame();
-		
+		// Streams in while the main loop is already running. Declared after the model, so the loader is done
+		// with it first.
+		std::shared_ptr<Model> model;
+		ModelLoader loader;
+		model = loader.Load(modelPath);
+		model->SetBoxOccluders(info.boxOccluders);
+	
+		//Mesh mesh{ vertices, indices };
+		//Mesh mesh1{ vertices1, indices };
+		//Texture texture{ "Resources/Textures/statue-1275469_1280.jpg" };
+		GraphicsPipeline pipeline(desc);
+
+		// Stands in for GpuCulling where it is not available
+		std::unique_ptr<OcclusionRasterizer> occlusion;
+		if (info.cpuOcclusion && info.boxOccluders && !GpuCulling::IsEnabled())
+		{
+			occlusion = std::make_unique<OcclusionRasterizer>();
+		}
+		// Boxes inside the model's primitives, gathered again every frame while it streams in
+		std::vector<OcclusionRasterizer::Occluder> occluders;
+
+		glm::mat4 orientation = glm::rotate(glm::mat4(1.0f), glm::radians(90.f), glm::vec3(1.0f, 1.0f, 0.0f));
+		orientation = glm::rotate(orientation, glm::radians(90.f), glm::vec3(0.0f, 1.0f, 0.0f));
+		std::unique_ptr<InstancingBenchmark> benchmark;
+		if (info.instancingBenchmark > 0)
+		{
+			benchmark = std::make_unique<InstancingBenchmark>(info.instancingBenchmark, orientation);
+		}
+
+		pipeline.SetStatic(info.staticScene);
+		pipeline.Bind();
+		auto lastFrameTime = std::chrono::high_resolution_clock::now();
+		// Main loop
+		while (m_Window->Update())
+		{
+			static auto startTime = std::chrono::high_resolution_clock::now();
+
+			auto currentTime = std::chrono::high_resolution_clock::now();
+			float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+			float frameMilliseconds = std::chrono::duration<float, std::milli>(currentTime - lastFrameTime).count();
+			lastFrameTime = currentTime;
+
+			UniformBufferObject ubo{};
+			glm::mat4 modelMatrix = glm::rotate(orientation, time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+			glm::vec3 eye = glm::vec3(2.0f, 2.0f, 2.0f);
+			if (info.staticScene)
+			{
+				// Only the camera moves, it circles the model
+				modelMatrix = orientation;
+				eye = glm::vec3(glm::rotate(glm::mat4(1.0f), -time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)) * glm::vec4(eye, 1.0f));
+			}
+			ubo.view = glm::lookAt(eye, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+			ubo.proj = glm::perspective(glm::radians(45.0f), m_Window->m_Width / (float)m_Window->m_Height, 0.1f, 10.0f);
+			ubo.proj[1][1] *= -1;
+			if (benchmark)
+			{
+				benchmark->SetView(ubo, m_Window->m_Width / (float)m_Window->m_Height);
+			}
+
+			loader.Update();
+			pipeline.Update();
+			TextureStreaming::Update();
+			TextureStreaming::SetView(ubo.view, ubo.proj, static_cast<float>(m_Window->m_Height));
+			VirtualTexturing::SetView(ubo.view, ubo.proj);
+
+			m_Graphics->BeginFrame();
+
+			pipeline.UpdateBuffers(ubo);
+			if (occlusion)
+			{
+				occlusion->Begin(ubo.proj * ubo.view);
+				occluders.clear();
+				if (!benchmark)
+				{
+					model->GetOccluders(occluders);
+				}
+				for (const OcclusionRasterizer::Occluder& occluder : occluders)
+				{
+					occlusion->AddOccluder(occluder, modelMatrix);
+				}
+				occlusion->Rasterize();
+			}
+			auto recordStart = std::chrono::high_resolution_clock::now();
+			if (!benchmark)
+			{
+				model->Draw(modelMatrix, pipeline, occlusion.get());
+			}
+			else if (benchmark->IsInstanced())
+			{
+				model->DrawInstanced(benchmark->GetTransforms(), pipeline);
+			}
+			else
+			{
+				for (const glm::mat4& transform : benchmark->GetTransforms())
+				{
+					model->Draw(transform, pipeline);
+				}
+			}
+			pipeline.Flush();
+			float recordMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - recordStart).count();
+			//mesh1.Draw(ubo.model);
+			m_Graphics->EndFrame();
+
+			// Measured once the model is completely loaded
+			if (benchmark && loader.IsIdle() && !benchmark->AddFrame(recordMilliseconds, frameMilliseconds, Renderer::GetLastFrameStats()))
+			{
+				break;
+			}
+		}
+
+		// The frames in flight still use the pipeline's buffers
+		vkDeviceWaitIdle(Renderer::GetDevice());
 	}
 	ShutDown();
 	
@@ -80,6 +269,14 @@ VulkanProject::Application::Application(VulkanProject::AppConfig& info)
 void VulkanProject::Application::ShutDown()
 {
 	// Shutting down inverse order
+	GpuCulling::Shutdown();
+	VirtualTexturing::Shutdown();
+	TextureStreaming::Shutdown();
+	AssetCache::Shutdown();
+	PipelineCache::Shutdown();
+	LayoutCache::Shutdown();
+	SamplerCache::Shutdown();
+	GeometryPool::Shutdown();
 
 	m_Graphics->Shutdown();
 	m_Graphics = nullptr;
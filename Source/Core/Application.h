@@ -1,6 +1,7 @@
 #pragma once
 #include "Defines.h"
 #include <string>
+#include <cstdint>
 
 namespace VulkanProject
 {
@@ -13,6 +14,44 @@ namespace VulkanProject
 		std::string name = "Window";
 		uint windowWidth = 800;
 		uint windowHeight = 600;
+
+		// Derived asset data (decoded textures, processed geometry) is cached here between runs
+		std::string assetCacheDirectory = "Cache";
+		uint64_t assetCacheSize = 1024ull * 1024 * 1024;
+
+		// GPU memory for streamed texture mip levels, the tails of every texture are always resident
+		uint64_t textureMemoryBudget = 512ull * 1024 * 1024;
+
+		// Pages on each side of the virtual texture cache, 32 is a 4352x4352 RGBA8 image
+		uint32_t virtualTextureCachePages = 32;
+
+		// Shared vertex and index buffers every mesh is suballocated from, about 60 MB and 16 MB
+		uint32_t geometryPoolVertices = 1024 * 1024;
+		uint32_t geometryPoolIndices = 4 * 1024 * 1024;
+
+		// Frustum and occlusion culling of the draws in compute shaders, against the depth of what was visible last frame
+		bool gpuCulling = true;
+		// Occlusion culling on the CPU against simplified occluders, used when GPU culling is off or not supported
+		bool cpuOcclusion = true;
+		// Boxes inside the model's primitives as the occluders of cpuOcclusion. Only for models of closed, solid
+		// meshes, a hollow or open mesh would hide what is visible through it. Without it there are no occluders.
+		bool boxOccluders = false;
+
+		// Threads recording draws into secondary command buffers when there are enough draw calls, 0 is
+		// every thread of the shared pool and the main thread
+		uint32_t recordingThreads = 0;
+
+		// Records the scene's draws once and replays them every frame until the scene changes, the model stands
+		// still and the camera circles it instead
+		bool staticScene = false;
+
+		// Copies of the model to draw in a grid instead of the scene, once with a Model::Draw per copy and once
+		// with Model::DrawInstanced, then the timings of both are printed and the application closes. 0 is off.
+		uint32_t instancingBenchmark = 0;
+
+		// Driver compiled pipelines, reused when the device and driver match. Kept out of assetCacheDirectory,
+		// the AssetCache would count it as one of its entries and evict or clear it.
+		std::string pipelineCachePath = "PipelineCache/pipelines.bin";
 	};
 
 	class Application
@@ -0,0 +1,348 @@
+#include "AssetCache.h"
+#include "MappedFile.h"
+#include <stdexcept>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	const uint32_t c_EntryMagic = 0x43445056; // "VPDC"
+	const uint32_t c_EntryVersion = 1;
+	const char* c_EntryExtension = ".bin";
+	const char* c_StatsFile = "stats.txt";
+
+	struct EntryHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint64_t size;
+	};
+
+	struct CacheData
+	{
+		std::mutex mutex;
+		std::filesystem::path directory;
+		uint64_t maxSize = 0;
+		uint64_t totalSize = 0;
+		VulkanProject::AssetCache::Stats stats;
+		unsigned int tempCounter = 0;
+	};
+
+	static CacheData* data = nullptr;
+
+	std::filesystem::path GetEntryPath(const std::filesystem::path& directory, uint64_t key)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+		return directory / (std::string(name) + c_EntryExtension);
+	}
+
+	bool IsEntry(const std::filesystem::directory_entry& entry)
+	{
+		return entry.is_regular_file() && entry.path().extension() == c_EntryExtension;
+	}
+
+	VulkanProject::AssetCache::Stats ReadStats(const std::filesystem::path& directory)
+	{
+		VulkanProject::AssetCache::Stats stats;
+		std::ifstream file(directory / c_StatsFile);
+		std::string name;
+		uint64_t value;
+		while (file >> name >> value)
+		{
+			if (name == "hits") stats.hits = value;
+			else if (name == "misses") stats.misses = value;
+			else if (name == "bytesRead") stats.bytesRead = value;
+			else if (name == "bytesWritten") stats.bytesWritten = value;
+			else if (name == "evictions") stats.evictions = value;
+		}
+		return stats;
+	}
+
+	// Removes the least recently used entries until the cache is back under budget, called with the mutex held
+	void Evict()
+	{
+		struct Candidate
+		{
+			std::filesystem::path path;
+			std::filesystem::file_time_type lastUse;
+			uint64_t size;
+		};
+
+		std::error_code error;
+		std::vector<Candidate> candidates;
+		for (const auto& entry : std::filesystem::directory_iterator(data->directory, error))
+		{
+			if (IsEntry(entry))
+			{
+				candidates.push_back({ entry.path(), entry.last_write_time(error), entry.file_size(error) });
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.lastUse < b.lastUse; });
+
+		// Evict down to 90% so the next few stores do not scan the directory again
+		uint64_t target = data->maxSize - data->maxSize / 10;
+		for (const auto& candidate : candidates)
+		{
+			if (data->totalSize <= target)
+			{
+				break;
+			}
+			// Entries that are still mapped can not be removed on every platform, they are skipped
+			if (std::filesystem::remove(candidate.path, error))
+			{
+				data->totalSize -= std::min(candidate.size, data->totalSize);
+				data->stats.evictions++;
+			}
+		}
+	}
+}
+
+VulkanProject::Hasher& VulkanProject::Hasher::Add(const void* bytes, size_t size)
+{
+	// FNV-1a over 8 byte words, the tail is hashed per byte
+	const uint64_t prime = 0x100000001b3ull;
+	const unsigned char* data = static_cast<const unsigned char*>(bytes);
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		m_Hash = (m_Hash ^ word) * prime;
+	}
+	for (; i < size; i++)
+	{
+		m_Hash = (m_Hash ^ data[i]) * prime;
+	}
+	m_Length += size;
+	return *this;
+}
+
+uint64_t VulkanProject::Hasher::Get() const
+{
+	// Mix in the length so inputs that only differ in how they were split do not collide, then avalanche
+	uint64_t hash = m_Hash ^ m_Length;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+void VulkanProject::AssetCache::Init(const std::string& directory, uint64_t maxSizeInBytes)
+{
+	if (data != nullptr)
+	{
+		throw std::runtime_error("asset cache is already initialised!");
+	}
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	if (error)
+	{
+		throw std::runtime_error("failed to create asset cache directory: " + directory);
+	}
+
+	data = new CacheData();
+	data->directory = directory;
+	data->maxSize = maxSizeInBytes;
+	for (const auto& entry : std::filesystem::directory_iterator(data->directory, error))
+	{
+		if (IsEntry(entry))
+		{
+			data->totalSize += entry.file_size(error);
+		}
+		// Left over from a run that was killed while storing
+		else if (entry.path().extension().string().rfind(".tmp", 0) == 0)
+		{
+			std::filesystem::remove(entry.path(), error);
+		}
+	}
+
+	// The budget may have been lowered since the last run
+	if (data->totalSize > data->maxSize)
+	{
+		Evict();
+	}
+}
+
+void VulkanProject::AssetCache::Shutdown()
+{
+	if (data == nullptr)
+	{
+		return;
+	}
+
+	// Statistics accumulate over runs so the report covers cold and warm starts
+	Stats total = ReadStats(data->directory);
+	total.hits += data->stats.hits;
+	total.misses += data->stats.misses;
+	total.bytesRead += data->stats.bytesRead;
+	total.bytesWritten += data->stats.bytesWritten;
+	total.evictions += data->stats.evictions;
+
+	std::ofstream file(data->directory / c_StatsFile, std::ios::trunc);
+	file << "hits " << total.hits << "\n";
+	file << "misses " << total.misses << "\n";
+	file << "bytesRead " << total.bytesRead << "\n";
+	file << "bytesWritten " << total.bytesWritten << "\n";
+	file << "evictions " << total.evictions << "\n";
+
+	delete data;
+	data = nullptr;
+}
+
+VulkanProject::AssetCache::Entry VulkanProject::AssetCache::Load(uint64_t key)
+{
+	Entry entry;
+	if (data == nullptr)
+	{
+		return entry;
+	}
+
+	std::filesystem::path path = GetEntryPath(data->directory, key);
+	std::error_code error;
+	if (std::filesystem::exists(path, error))
+	{
+		try
+		{
+			entry.file = std::make_unique<MappedFile>(path.string());
+		}
+		catch (const std::exception&)
+		{
+			entry.file.reset();
+		}
+	}
+
+	EntryHeader header{};
+	if (entry.file && entry.file->GetSize() >= sizeof(EntryHeader))
+	{
+		memcpy(&header, entry.file->GetData(), sizeof(EntryHeader));
+	}
+
+	std::lock_guard<std::mutex> lock(data->mutex);
+	// A truncated or foreign file is treated as a miss and overwritten by the next Store
+	if (header.magic != c_EntryMagic || header.version != c_EntryVersion || header.key != key ||
+		header.size != entry.file->GetSize() - sizeof(EntryHeader))
+	{
+		data->stats.misses++;
+		return Entry();
+	}
+
+	entry.data = entry.file->GetData() + sizeof(EntryHeader);
+	entry.size = static_cast<size_t>(header.size);
+	data->stats.hits++;
+	data->stats.bytesRead += header.size;
+
+	// The modification time doubles as last use for eviction
+	std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+	return entry;
+}
+
+void VulkanProject::AssetCache::Store(uint64_t key, const void* bytes, size_t size)
+{
+	// An entry larger than the whole budget would only evict everything else
+	if (data == nullptr || sizeof(EntryHeader) + size > data->maxSize)
+	{
+		return;
+	}
+
+	EntryHeader header{};
+	header.magic = c_EntryMagic;
+	header.version = c_EntryVersion;
+	header.key = key;
+	header.size = size;
+
+	std::filesystem::path path = GetEntryPath(data->directory, key);
+	std::filesystem::path tempPath;
+	{
+		std::lock_guard<std::mutex> lock(data->mutex);
+		tempPath = path;
+		tempPath += ".tmp" + std::to_string(data->tempCounter++);
+	}
+
+	// Written under a temporary name first so a crash never leaves a half written entry behind
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(size));
+		if (!file.good())
+		{
+			file.close();
+			std::error_code error;
+			std::filesystem::remove(tempPath, error);
+			return;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(data->mutex);
+	std::error_code error;
+	uint64_t previousSize = std::filesystem::exists(path, error) ? std::filesystem::file_size(path, error) : 0;
+	std::filesystem::rename(tempPath, path, error);
+	if (error)
+	{
+		std::filesystem::remove(tempPath, error);
+		return;
+	}
+
+	data->totalSize += sizeof(header) + size;
+	data->totalSize -= std::min(previousSize, data->totalSize);
+	data->stats.bytesWritten += sizeof(header) + size;
+	if (data->totalSize > data->maxSize)
+	{
+		Evict();
+	}
+}
+
+void VulkanProject::AssetCache::PrintStats(const std::string& directory)
+{
+	uint64_t entryCount = 0;
+	uint64_t totalSize = 0;
+	std::error_code error;
+	for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+	{
+		if (IsEntry(entry))
+		{
+			entryCount++;
+			totalSize += entry.file_size(error);
+		}
+	}
+
+	Stats stats = ReadStats(directory);
+	uint64_t lookups = stats.hits + stats.misses;
+	double hitRate = lookups > 0 ? 100.0 * static_cast<double>(stats.hits) / static_cast<double>(lookups) : 0.0;
+
+	printf("Asset cache: %s\n", directory.c_str());
+	printf("  entries:       %llu (%.2f MB)\n", static_cast<unsigned long long>(entryCount), totalSize / (1024.0 * 1024.0));
+	printf("  hits:          %llu\n", static_cast<unsigned long long>(stats.hits));
+	printf("  misses:        %llu\n", static_cast<unsigned long long>(stats.misses));
+	printf("  hit rate:      %.1f%%\n", hitRate);
+	printf("  read:          %.2f MB\n", stats.bytesRead / (1024.0 * 1024.0));
+	printf("  written:       %.2f MB\n", stats.bytesWritten / (1024.0 * 1024.0));
+	printf("  evictions:     %llu\n", static_cast<unsigned long long>(stats.evictions));
+}
+
+void VulkanProject::AssetCache::Clear(const std::string& directory)
+{
+	if (data != nullptr)
+	{
+		throw std::runtime_error("asset cache can not be cleared while it is in use!");
+	}
+
+	std::error_code error;
+	for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+	{
+		if (IsEntry(entry))
+		{
+			std::filesystem::remove(entry.path(), error);
+		}
+	}
+	std::filesystem::remove(std::filesystem::path(directory) / c_StatsFile, error);
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace VulkanProject
+{
+    class MappedFile;
+
+    // 64 bit hash used to key derived data, not meant to be cryptographically secure
+    class Hasher
+    {
+    public:
+        Hasher& Add(const void* data, size_t size);
+        Hasher& Add(const std::string& text) { return Add(text.data(), text.size()); }
+        Hasher& Add(uint64_t value) { return Add(&value, sizeof(value)); }
+        uint64_t Get() const;
+
+    private:
+        uint64_t m_Hash = 0xcbf29ce484222325ull;
+        uint64_t m_Length = 0;
+    };
+
+    // On disk cache of derived asset data (decoded pixels, processed vertices, ...).
+    // Keys are expected to cover the source bytes, the importer version and the import settings,
+    // so a changed input simply misses and the stale entry ages out of the cache.
+    namespace AssetCache
+    {
+        struct Entry
+        {
+            std::unique_ptr<MappedFile> file;
+            const unsigned char* data = nullptr;
+            size_t size = 0;
+
+            explicit operator bool() const { return data != nullptr; }
+        };
+
+        struct Stats
+        {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t bytesRead = 0;
+            uint64_t bytesWritten = 0;
+            uint64_t evictions = 0;
+        };
+
+        // Without Init the cache is disabled, every Load misses and Store does nothing
+        void Init(const std::string& directory, uint64_t maxSizeInBytes);
+        void Shutdown();
+
+        Entry Load(uint64_t key);
+        void Store(uint64_t key, const void* data, size_t size);
+
+        // Prints the statistics of all runs that used the cache in directory
+        void PrintStats(const std::string& directory);
+        void Clear(const std::string& directory);
+    }
+}
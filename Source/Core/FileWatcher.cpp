@@ -0,0 +1,138 @@
+#include "FileWatcher.h"
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace
+{
+	std::string Normalize(const std::filesystem::path& path)
+	{
+		return path.lexically_normal().generic_string();
+	}
+
+	std::filesystem::file_time_type GetWriteTime(const std::string& path)
+	{
+		std::error_code error;
+		std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+		return error ? std::filesystem::file_time_type::min() : time;
+	}
+}
+
+VulkanProject::FileWatcher::FileWatcher()
+{
+#ifdef __linux__
+	m_Inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+VulkanProject::FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+	if (m_Inotify >= 0)
+	{
+		close(m_Inotify);
+	}
+#endif
+}
+
+void VulkanProject::FileWatcher::Watch(const std::string& path)
+{
+	std::string file = Normalize(path);
+	if (m_Files.count(file))
+	{
+		return;
+	}
+	m_Files[file] = GetWriteTime(file);
+
+#ifdef __linux__
+	if (m_Inotify < 0)
+	{
+		return;
+	}
+	// Editors often save by writing a new file and renaming it over the old one, which only the directory sees
+	std::string directory = std::filesystem::path(file).parent_path().string();
+	int watch = inotify_add_watch(m_Inotify, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (watch >= 0)
+	{
+		m_Directories[watch] = directory;
+	}
+#endif
+}
+
+void VulkanProject::FileWatcher::Clear()
+{
+#ifdef __linux__
+	for (const auto& directory : m_Directories)
+	{
+		inotify_rm_watch(m_Inotify, directory.first);
+	}
+	m_Directories.clear();
+#endif
+	m_Files.clear();
+}
+
+std::vector<std::string> VulkanProject::FileWatcher::GetChanges()
+{
+	std::vector<std::string> changes;
+#ifdef __linux__
+	if (m_Inotify >= 0)
+	{
+		alignas(inotify_event) char buffer[4096];
+		bool overflow = false;
+		while (true)
+		{
+			ssize_t size = read(m_Inotify, buffer, sizeof(buffer));
+			if (size <= 0)
+			{
+				// EAGAIN once the queue is drained
+				break;
+			}
+			for (ssize_t offset = 0; offset < size;)
+			{
+				const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+				offset += sizeof(inotify_event) + event->len;
+				if (event->mask & IN_Q_OVERFLOW)
+				{
+					overflow = true;
+					continue;
+				}
+				auto directory = m_Directories.find(event->wd);
+				if (directory == m_Directories.end() || event->len == 0)
+				{
+					continue;
+				}
+				std::string file = Normalize(std::filesystem::path(directory->second) / event->name);
+				if (m_Files.count(file) && std::find(changes.begin(), changes.end(), file) == changes.end())
+				{
+					changes.push_back(file);
+				}
+			}
+		}
+		if (overflow)
+		{
+			// Events were dropped, whatever was watched might have changed
+			changes.clear();
+			for (const auto& file : m_Files)
+			{
+				changes.push_back(file.first);
+			}
+		}
+		return changes;
+	}
+#endif
+
+	for (auto& file : m_Files)
+	{
+		std::filesystem::file_time_type time = GetWriteTime(file.first);
+		if (time != file.second)
+		{
+			file.second = time;
+			changes.push_back(file.first);
+		}
+	}
+	return changes;
+}
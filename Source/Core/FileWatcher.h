@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+
+namespace VulkanProject
+{
+    // Reports files that were written since the last call. On Linux the directories of the watched files
+    // are watched through inotify, everywhere else (or when inotify is not available) the write times are polled.
+    class FileWatcher
+    {
+    public:
+        FileWatcher();
+        ~FileWatcher();
+
+        FileWatcher(const FileWatcher&) = delete;
+        FileWatcher& operator=(const FileWatcher&) = delete;
+
+        // Watching a file that does not exist yet is fine, it shows up once it is created
+        void Watch(const std::string& path);
+        void Clear();
+
+        // Never blocks, every changed file is reported once however often it was written
+        std::vector<std::string> GetChanges();
+
+    private:
+        // watched file to its last seen write time, the time is only used when polling
+        std::unordered_map<std::string, std::filesystem::file_time_type> m_Files;
+
+        // platform specific
+        int m_Inotify = -1;
+        // inotify watch descriptor to directory
+        std::unordered_map<int, std::string> m_Directories;
+    };
+}
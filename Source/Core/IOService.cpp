@@ -0,0 +1,515 @@
+#include "IOService.h"
+#include <stdexcept>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace
+{
+	// user_data of the NOPs the completion thread gets besides the reads, requests are pointers and never 0 or 1
+	const uint64_t c_StopCompletions = 0;
+	const uint64_t c_WakeCompletions = 1;
+}
+
+struct VulkanProject::IOService::Request
+{
+	RequestID id = 0;
+	std::string path;
+	Callback callback;
+	std::vector<unsigned char> data;
+	std::exception_ptr error;
+#ifdef __linux__
+	int file = -1;
+	size_t done = 0;
+	iovec target{};
+#endif
+};
+
+#ifdef __linux__
+// Minimal io_uring setup through the raw syscalls, one submitter at a time (under IOService::m_Mutex)
+// and the completion thread as the only consumer
+struct VulkanProject::IOService::Ring
+{
+	int fd = -1;
+	void* sqRing = MAP_FAILED;
+	size_t sqRingSize = 0;
+	void* cqRing = MAP_FAILED;
+	size_t cqRingSize = 0;
+	void* sqeMemory = MAP_FAILED;
+	size_t sqeMemorySize = 0;
+
+	unsigned* sqTail = nullptr;
+	unsigned* sqMask = nullptr;
+	unsigned* sqArray = nullptr;
+	io_uring_sqe* sqes = nullptr;
+	unsigned* cqHead = nullptr;
+	unsigned* cqTail = nullptr;
+	unsigned* cqMask = nullptr;
+	io_uring_cqe* cqes = nullptr;
+
+	~Ring()
+	{
+		if (sqeMemory != MAP_FAILED)
+		{
+			munmap(sqeMemory, sqeMemorySize);
+		}
+		if (cqRing != MAP_FAILED && cqRing != sqRing)
+		{
+			munmap(cqRing, cqRingSize);
+		}
+		if (sqRing != MAP_FAILED)
+		{
+			munmap(sqRing, sqRingSize);
+		}
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+	}
+
+	// False when the kernel does not support io_uring or it is disabled
+	bool Init(unsigned int entries)
+	{
+		io_uring_params params{};
+		fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMapping)
+		{
+			sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+		}
+
+		sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sqRing == MAP_FAILED)
+		{
+			return false;
+		}
+		cqRing = singleMapping ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED)
+		{
+			return false;
+		}
+		sqeMemorySize = params.sq_entries * sizeof(io_uring_sqe);
+		sqeMemory = mmap(nullptr, sqeMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqeMemory == MAP_FAILED)
+		{
+			return false;
+		}
+
+		unsigned char* sq = static_cast<unsigned char*>(sqRing);
+		sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		sqes = static_cast<io_uring_sqe*>(sqeMemory);
+
+		unsigned char* cq = static_cast<unsigned char*>(cqRing);
+		cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+		return true;
+	}
+
+	void Push(const io_uring_sqe& sqe)
+	{
+		unsigned tail = *sqTail;
+		unsigned index = tail & *sqMask;
+		sqes[index] = sqe;
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+		int result;
+		do
+		{
+			result = static_cast<int>(syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0));
+		} while (result < 0 && errno == EINTR);
+		if (result < 0)
+		{
+			throw std::runtime_error("failed to submit read to io_uring!");
+		}
+	}
+
+	bool Pop(io_uring_cqe& cqe)
+	{
+		unsigned head = *cqHead;
+		if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+		{
+			return false;
+		}
+		cqe = cqes[head & *cqMask];
+		__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	// Blocks until at least one completion is available
+	void Wait()
+	{
+		syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+	}
+};
+#else
+struct VulkanProject::IOService::Ring
+{
+};
+#endif
+
+VulkanProject::IOService::IOService(unsigned int queueDepth, unsigned int fallbackThreads, bool allowIOUring) : m_QueueDepth(std::max(1u, queueDepth))
+{
+#ifdef __linux__
+	if (allowIOUring)
+	{
+		auto ring = std::make_unique<Ring>();
+		if (ring->Init(m_QueueDepth))
+		{
+			m_Ring = std::move(ring);
+			m_Threads.emplace_back(&IOService::CompletionLoop, this);
+			return;
+		}
+	}
+#endif
+
+	for (unsigned int i = 0; i < std::max(1u, fallbackThreads); i++)
+	{
+		m_Threads.emplace_back(&IOService::FallbackLoop, this);
+	}
+}
+
+VulkanProject::IOService::~IOService()
+{
+	std::vector<std::shared_ptr<Request>> cancelled;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+		for (auto& queue : m_Pending)
+		{
+			cancelled.insert(cancelled.end(), queue.begin(), queue.end());
+			queue.clear();
+		}
+	}
+	for (auto& request : cancelled)
+	{
+		Complete(*request, std::make_exception_ptr(std::runtime_error("read cancelled: " + request->path)));
+	}
+	m_Condition.notify_all();
+
+#ifdef __linux__
+	if (m_Ring)
+	{
+		// A NOP without a request wakes the completion thread up one last time
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Condition.wait(lock, [this]() { return m_InFlight.empty(); });
+		io_uring_sqe sqe{};
+		sqe.opcode = IORING_OP_NOP;
+		sqe.user_data = c_StopCompletions;
+		m_Ring->Push(sqe);
+	}
+#endif
+
+	for (auto& thread : m_Threads)
+	{
+		thread.join();
+	}
+}
+
+VulkanProject::IOService::RequestID VulkanProject::IOService::Read(const std::string& path, Callback callback, ePriority priority)
+{
+	auto request = std::make_shared<Request>();
+	request->path = path;
+	request->callback = std::move(callback);
+
+	RequestID id;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Stopping)
+		{
+			throw std::runtime_error("io service is shutting down!");
+		}
+		request->id = m_NextID++;
+		id = request->id;
+		m_Pending[static_cast<int>(priority)].push_back(request);
+		// Files that fail to open or are empty complete straight away, on the completion thread like the rest
+		if (m_Ring && !m_WakePending)
+		{
+			m_WakePending = true;
+			WakeCompletionThread();
+		}
+	}
+	if (!m_Ring)
+	{
+		m_Condition.notify_one();
+	}
+	return id;
+}
+
+std::future<std::vector<unsigned char>> VulkanProject::IOService::Read(const std::string& path, ePriority priority, RequestID* id)
+{
+	auto promise = std::make_shared<std::promise<std::vector<unsigned char>>>();
+	std::future<std::vector<unsigned char>> future = promise->get_future();
+	RequestID requestID = Read(path, [promise](std::vector<unsigned char>&& data, std::exception_ptr error)
+	{
+		if (error)
+		{
+			promise->set_exception(error);
+		}
+		else
+		{
+			promise->set_value(std::move(data));
+		}
+	}, priority);
+
+	if (id != nullptr)
+	{
+		*id = requestID;
+	}
+	return future;
+}
+
+bool VulkanProject::IOService::Cancel(RequestID id)
+{
+	std::shared_ptr<Request> cancelled;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (auto& queue : m_Pending)
+		{
+			auto it = std::find_if(queue.begin(), queue.end(), [id](const std::shared_ptr<Request>& request) { return request->id == id; });
+			if (it != queue.end())
+			{
+				cancelled = *it;
+				queue.erase(it);
+				break;
+			}
+		}
+	}
+
+	if (!cancelled)
+	{
+		return false;
+	}
+	Complete(*cancelled, std::make_exception_ptr(std::runtime_error("read cancelled: " + cancelled->path)));
+	return true;
+}
+
+VulkanProject::IOService& VulkanProject::IOService::GetShared()
+{
+	static IOService service;
+	return service;
+}
+
+std::shared_ptr<VulkanProject::IOService::Request> VulkanProject::IOService::PopPending()
+{
+	for (int priority = 2; priority >= 0; priority--)
+	{
+		if (!m_Pending[priority].empty())
+		{
+			std::shared_ptr<Request> request = std::move(m_Pending[priority].front());
+			m_Pending[priority].pop_front();
+			return request;
+		}
+	}
+	return nullptr;
+}
+
+std::vector<std::shared_ptr<VulkanProject::IOService::Request>> VulkanProject::IOService::Dispatch()
+{
+	// Called with m_Mutex held
+	std::vector<std::shared_ptr<Request>> completed;
+#ifdef __linux__
+	while (m_InFlight.size() < m_QueueDepth)
+	{
+		std::shared_ptr<Request> request = PopPending();
+		if (!request)
+		{
+			break;
+		}
+
+		struct stat status;
+		request->file = open(request->path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (request->file < 0 || fstat(request->file, &status) != 0)
+		{
+			if (request->file >= 0)
+			{
+				close(request->file);
+			}
+			request->error = std::make_exception_ptr(std::runtime_error("failed to open file: " + request->path));
+			completed.push_back(request);
+			continue;
+		}
+
+		request->data.resize(static_cast<size_t>(status.st_size));
+		if (request->data.empty())
+		{
+			close(request->file);
+			completed.push_back(request);
+			continue;
+		}
+
+		m_InFlight.push_back(request);
+		SubmitRead(*request);
+	}
+#endif
+	return completed;
+}
+
+void VulkanProject::IOService::SubmitRead(Request& request)
+{
+#ifdef __linux__
+	// Large files can come back in pieces, the rest is resubmitted from where the last read ended
+	request.target.iov_base = request.data.data() + request.done;
+	request.target.iov_len = request.data.size() - request.done;
+
+	io_uring_sqe sqe{};
+	sqe.opcode = IORING_OP_READV;
+	sqe.fd = request.file;
+	sqe.addr = reinterpret_cast<uint64_t>(&request.target);
+	sqe.len = 1;
+	sqe.off = request.done;
+	sqe.user_data = reinterpret_cast<uint64_t>(&request);
+	m_Ring->Push(sqe);
+#endif
+}
+
+void VulkanProject::IOService::WakeCompletionThread()
+{
+#ifdef __linux__
+	io_uring_sqe sqe{};
+	sqe.opcode = IORING_OP_NOP;
+	sqe.user_data = c_WakeCompletions;
+	m_Ring->Push(sqe);
+#endif
+}
+
+void VulkanProject::IOService::CompletionLoop()
+{
+#ifdef __linux__
+	while (true)
+	{
+		io_uring_cqe cqe;
+		if (!m_Ring->Pop(cqe))
+		{
+			m_Ring->Wait();
+			continue;
+		}
+		if (cqe.user_data == c_StopCompletions)
+		{
+			return;
+		}
+		if (cqe.user_data == c_WakeCompletions)
+		{
+			std::vector<std::shared_ptr<Request>> completed;
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_WakePending = false;
+				completed = Dispatch();
+			}
+			for (auto& done : completed)
+			{
+				Complete(*done, done->error);
+			}
+			continue;
+		}
+
+		std::shared_ptr<Request> finished;
+		std::vector<std::shared_ptr<Request>> completed;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			auto it = std::find_if(m_InFlight.begin(), m_InFlight.end(), [&](const std::shared_ptr<Request>& request) { return reinterpret_cast<uint64_t>(request.get()) == cqe.user_data; });
+			Request& request = **it;
+
+			if (cqe.res < 0)
+			{
+				request.error = std::make_exception_ptr(std::runtime_error("failed to read file: " + request.path + " (" + strerror(-cqe.res) + ")"));
+			}
+			else if (cqe.res == 0)
+			{
+				request.error = std::make_exception_ptr(std::runtime_error("file got shorter while reading: " + request.path));
+			}
+			else
+			{
+				request.done += static_cast<size_t>(cqe.res);
+			}
+
+			if (request.error || request.done == request.data.size())
+			{
+				close(request.file);
+				finished = std::move(*it);
+				m_InFlight.erase(it);
+				completed = Dispatch();
+			}
+			else
+			{
+				SubmitRead(request);
+			}
+		}
+
+		if (finished)
+		{
+			Complete(*finished, finished->error);
+			for (auto& done : completed)
+			{
+				Complete(*done, done->error);
+			}
+			m_Condition.notify_all();
+		}
+	}
+#endif
+}
+
+void VulkanProject::IOService::FallbackLoop()
+{
+	while (true)
+	{
+		std::shared_ptr<Request> request;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Condition.wait(lock, [this]() { return m_Stopping || !m_Pending[0].empty() || !m_Pending[1].empty() || !m_Pending[2].empty(); });
+			request = PopPending();
+			if (!request)
+			{
+				return;
+			}
+		}
+
+		std::ifstream file(request->path, std::ios::ate | std::ios::binary);
+		if (!file.is_open())
+		{
+			request->error = std::make_exception_ptr(std::runtime_error("failed to open file: " + request->path));
+		}
+		else
+		{
+			request->data.resize(static_cast<size_t>(file.tellg()));
+			file.seekg(0);
+			file.read(reinterpret_cast<char*>(request->data.data()), static_cast<std::streamsize>(request->data.size()));
+			if (!file.good())
+			{
+				request->error = std::make_exception_ptr(std::runtime_error("failed to read file: " + request->path));
+			}
+		}
+		Complete(*request, request->error);
+	}
+}
+
+void VulkanProject::IOService::Complete(Request& request, std::exception_ptr error)
+{
+	if (error)
+	{
+		request.data.clear();
+	}
+	request.callback(std::move(request.data), error);
+}
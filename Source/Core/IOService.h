@@ -0,0 +1,84 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <exception>
+#include <cstdint>
+
+namespace VulkanProject
+{
+    // Reads whole files into memory asynchronously. On Linux reads are batched through io_uring,
+    // everywhere else (or when the kernel does not support it) a few reader threads do blocking reads.
+    // Requests wait in a priority queue until there is room in flight, higher priorities go first.
+    class IOService
+    {
+    public:
+        enum class ePriority
+        {
+            Low = 0,
+            Normal = 1,
+            High = 2
+        };
+
+        // Runs on an I/O thread, keep it short: hand the data to a ThreadPool job for decoding. Never runs inside
+        // Read, only requests cancelled by Cancel or the destructor are completed on the thread calling those.
+        // error is set (and data empty) when the read failed or was cancelled.
+        using Callback = std::function<void(std::vector<unsigned char>&& data, std::exception_ptr error)>;
+        using RequestID = uint64_t;
+
+        // queueDepth is the number of reads in flight at once
+        IOService(unsigned int queueDepth = 64, unsigned int fallbackThreads = 4, bool allowIOUring = true);
+        // Requests that have not started are cancelled, reads in flight are waited for
+        ~IOService();
+
+        IOService(const IOService&) = delete;
+        IOService& operator=(const IOService&) = delete;
+
+        RequestID Read(const std::string& path, Callback callback, ePriority priority = ePriority::Normal);
+        // The future throws when the read failed or was cancelled
+        std::future<std::vector<unsigned char>> Read(const std::string& path, ePriority priority = ePriority::Normal, RequestID* id = nullptr);
+
+        // Only requests still waiting in the queue can be cancelled, their callback gets an error.
+        // Returns false when the read has already started or finished.
+        bool Cancel(RequestID id);
+
+        bool IsUsingIOUring() const { return m_Ring != nullptr; }
+
+        // Service shared by the loaders, created on first use
+        static IOService& GetShared();
+
+    private:
+        struct Request;
+        struct Ring;
+
+        std::shared_ptr<Request> PopPending();
+        // Moves pending requests into the ring while there is room, requests that fail to open are returned
+        std::vector<std::shared_ptr<Request>> Dispatch();
+        void SubmitRead(Request& request);
+        // Has the completion thread dispatch the pending requests, new requests are never opened on the caller's thread
+        void WakeCompletionThread();
+        void CompletionLoop();
+        void FallbackLoop();
+        static void Complete(Request& request, std::exception_ptr error);
+
+        std::mutex m_Mutex;
+        std::condition_variable m_Condition;
+        // one queue per priority
+        std::deque<std::shared_ptr<Request>> m_Pending[3];
+        std::vector<std::shared_ptr<Request>> m_InFlight;
+        RequestID m_NextID = 1;
+        unsigned int m_QueueDepth;
+        bool m_Stopping = false;
+        // a wake up is in the ring and not handled yet, one is enough for any number of new requests
+        bool m_WakePending = false;
+
+        std::unique_ptr<Ring> m_Ring;
+        std::vector<std::thread> m_Threads;
+    };
+}
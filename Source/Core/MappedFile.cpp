@@ -0,0 +1,115 @@
+#include "MappedFile.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+VulkanProject::MappedFile::MappedFile(const std::string& path)
+{
+	m_File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_File == INVALID_HANDLE_VALUE)
+	{
+		m_File = nullptr;
+		throw std::runtime_error("failed to open file: " + path);
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_File, &size))
+	{
+		CloseHandle(m_File);
+		throw std::runtime_error("failed to query file size: " + path);
+	}
+	m_Size = static_cast<size_t>(size.QuadPart);
+
+	// Mapping an empty file is an error on windows
+	if (m_Size == 0)
+	{
+		return;
+	}
+
+	m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_Mapping == nullptr)
+	{
+		CloseHandle(m_File);
+		throw std::runtime_error("failed to map file: " + path);
+	}
+
+	m_Data = static_cast<const unsigned char*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_Data == nullptr)
+	{
+		CloseHandle(m_Mapping);
+		CloseHandle(m_File);
+		throw std::runtime_error("failed to map file: " + path);
+	}
+}
+
+VulkanProject::MappedFile::~MappedFile()
+{
+	if (m_Data != nullptr)
+	{
+		UnmapViewOfFile(m_Data);
+	}
+	if (m_Mapping != nullptr)
+	{
+		CloseHandle(m_Mapping);
+	}
+	if (m_File != nullptr)
+	{
+		CloseHandle(m_File);
+	}
+}
+#else
+VulkanProject::MappedFile::MappedFile(const std::string& path)
+{
+	m_File = open(path.c_str(), O_RDONLY);
+	if (m_File < 0)
+	{
+		throw std::runtime_error("failed to open file: " + path);
+	}
+
+	struct stat info;
+	if (fstat(m_File, &info) != 0)
+	{
+		close(m_File);
+		throw std::runtime_error("failed to query file size: " + path);
+	}
+	m_Size = static_cast<size_t>(info.st_size);
+
+	if (m_Size == 0)
+	{
+		return;
+	}
+
+	void* mapping = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, m_File, 0);
+	if (mapping == MAP_FAILED)
+	{
+		close(m_File);
+		throw std::runtime_error("failed to map file: " + path);
+	}
+
+	// The file is read front to back when uploading
+	madvise(mapping, m_Size, MADV_SEQUENTIAL);
+	m_Data = static_cast<const unsigned char*>(mapping);
+}
+
+VulkanProject::MappedFile::~MappedFile()
+{
+	if (m_Data != nullptr)
+	{
+		munmap(const_cast<unsigned char*>(m_Data), m_Size);
+	}
+	if (m_File >= 0)
+	{
+		close(m_File);
+	}
+}
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+namespace VulkanProject
+{
+    // Read only view of a whole file, backed by the OS page cache
+    class MappedFile
+    {
+    public:
+        MappedFile(const std::string& path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const unsigned char* GetData() const { return m_Data; }
+        size_t GetSize() const { return m_Size; }
+
+    private:
+        const unsigned char* m_Data = nullptr;
+        size_t m_Size = 0;
+
+        // platform specific
+#ifdef _WIN32
+        void* m_File = nullptr;
+        void* m_Mapping = nullptr;
+#else
+        int m_File = -1;
+#endif
+    };
+}
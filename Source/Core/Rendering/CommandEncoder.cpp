@@ -0,0 +1,150 @@
+#include "CommandEncoder.h"
+#include <cstring>
+
+void VulkanProject::CommandEncoder::Begin(VkCommandBuffer commandBuffer)
+{
+	m_CommandBuffer = commandBuffer;
+	m_Stats = Stats();
+	Invalidate();
+}
+
+void VulkanProject::CommandEncoder::Invalidate()
+{
+	m_Graphics = BindPoint();
+	m_Compute = BindPoint();
+	for (VertexBinding& binding : m_VertexBindings)
+	{
+		binding = VertexBinding();
+	}
+	m_IndexBuffer = VK_NULL_HANDLE;
+	m_HasViewport = false;
+	m_HasScissor = false;
+}
+
+VulkanProject::CommandEncoder::BindPoint& VulkanProject::CommandEncoder::GetBindPoint(VkPipelineBindPoint bindPoint)
+{
+	return bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ? m_Compute : m_Graphics;
+}
+
+bool VulkanProject::CommandEncoder::Issue(bool changes)
+{
+	if (changes)
+	{
+		m_Stats.issued++;
+	}
+	else
+	{
+		m_Stats.elided++;
+	}
+	return changes;
+}
+
+void VulkanProject::CommandEncoder::BindPipeline(VkPipelineBindPoint bindPoint, VkPipeline pipeline)
+{
+	BindPoint& bound = GetBindPoint(bindPoint);
+	if (Issue(bound.pipeline != pipeline))
+	{
+		vkCmdBindPipeline(m_CommandBuffer, bindPoint, pipeline);
+		bound.pipeline = pipeline;
+	}
+}
+
+void VulkanProject::CommandEncoder::BindDescriptorSets(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t firstSet, uint32_t setCount, const VkDescriptorSet* sets,
+	uint32_t dynamicOffsetCount, const uint32_t* dynamicOffsets)
+{
+	BindPoint& bound = GetBindPoint(bindPoint);
+	// Too many to remember, issued and nothing about the layout is known afterwards
+	if (firstSet + setCount > c_MaxSets || dynamicOffsetCount > c_MaxDynamicOffsets)
+	{
+		Issue(true);
+		vkCmdBindDescriptorSets(m_CommandBuffer, bindPoint, layout, firstSet, setCount, sets, dynamicOffsetCount, dynamicOffsets);
+		bound = BindPoint{ bound.pipeline };
+		return;
+	}
+
+	bool changes = bound.layout != layout;
+	for (uint32_t i = 0; i < setCount && !changes; i++)
+	{
+		changes = bound.sets[firstSet + i] != sets[i];
+	}
+	// A call without offsets binds sets without dynamic descriptors, the sets alone decide then
+	if (!changes && dynamicOffsetCount > 0)
+	{
+		changes = bound.dynamicFirstSet != firstSet || bound.dynamicSetCount != setCount || bound.dynamicOffsetCount != dynamicOffsetCount ||
+			memcmp(bound.dynamicOffsets, dynamicOffsets, sizeof(uint32_t) * dynamicOffsetCount) != 0;
+	}
+	if (!Issue(changes))
+	{
+		return;
+	}
+
+	vkCmdBindDescriptorSets(m_CommandBuffer, bindPoint, layout, firstSet, setCount, sets, dynamicOffsetCount, dynamicOffsets);
+	if (bound.layout != layout)
+	{
+		// the sets of another layout may have been disturbed
+		bound = BindPoint{ bound.pipeline };
+		bound.layout = layout;
+	}
+	for (uint32_t i = 0; i < setCount; i++)
+	{
+		bound.sets[firstSet + i] = sets[i];
+	}
+	if (dynamicOffsetCount > 0)
+	{
+		bound.dynamicFirstSet = firstSet;
+		bound.dynamicSetCount = setCount;
+		bound.dynamicOffsetCount = dynamicOffsetCount;
+		memcpy(bound.dynamicOffsets, dynamicOffsets, sizeof(uint32_t) * dynamicOffsetCount);
+	}
+}
+
+void VulkanProject::CommandEncoder::BindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, const VkBuffer* buffers, const VkDeviceSize* offsets)
+{
+	bool changes = firstBinding + bindingCount > c_MaxVertexBindings;
+	for (uint32_t i = 0; i < bindingCount && !changes; i++)
+	{
+		const VertexBinding& binding = m_VertexBindings[firstBinding + i];
+		changes = binding.buffer != buffers[i] || binding.offset != offsets[i];
+	}
+	if (!Issue(changes))
+	{
+		return;
+	}
+
+	vkCmdBindVertexBuffers(m_CommandBuffer, firstBinding, bindingCount, buffers, offsets);
+	for (uint32_t i = 0; i < bindingCount && firstBinding + i < c_MaxVertexBindings; i++)
+	{
+		m_VertexBindings[firstBinding + i] = { buffers[i], offsets[i] };
+	}
+}
+
+void VulkanProject::CommandEncoder::BindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType indexType)
+{
+	if (Issue(m_IndexBuffer != buffer || m_IndexOffset != offset || m_IndexType != indexType))
+	{
+		vkCmdBindIndexBuffer(m_CommandBuffer, buffer, offset, indexType);
+		m_IndexBuffer = buffer;
+		m_IndexOffset = offset;
+		m_IndexType = indexType;
+	}
+}
+
+void VulkanProject::CommandEncoder::SetViewport(const VkViewport& viewport)
+{
+	if (Issue(!m_HasViewport || memcmp(&m_Viewport, &viewport, sizeof(VkViewport)) != 0))
+	{
+		vkCmdSetViewport(m_CommandBuffer, 0, 1, &viewport);
+		m_Viewport = viewport;
+		m_HasViewport = true;
+	}
+}
+
+void VulkanProject::CommandEncoder::SetScissor(const VkRect2D& scissor)
+{
+	if (Issue(!m_HasScissor || memcmp(&m_Scissor, &scissor, sizeof(VkRect2D)) != 0))
+	{
+		vkCmdSetScissor(m_CommandBuffer, 0, 1, &scissor);
+		m_Scissor = scissor;
+		m_HasScissor = true;
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "Core/Includes.h"
+#include <cstdint>
+
+namespace VulkanProject
+{
+    // Records state changes into a command buffer and drops the ones that would not change anything.
+    // Only sees what goes through it, call Invalidate after recording into the command buffer directly.
+    class CommandEncoder
+    {
+    public:
+        struct Stats
+        {
+            // calls that reached the command buffer and calls that were dropped
+            uint32_t issued = 0;
+            uint32_t elided = 0;
+        };
+
+        // Starts tracking an empty command buffer, the stats start over
+        void Begin(VkCommandBuffer commandBuffer);
+        // Forgets what is bound, the next calls are all issued
+        void Invalidate();
+        VkCommandBuffer GetCommandBuffer() const { return m_CommandBuffer; }
+        const Stats& GetStats() const { return m_Stats; }
+
+        void BindPipeline(VkPipelineBindPoint bindPoint, VkPipeline pipeline);
+        // Sets bound with another layout count as not bound
+        void BindDescriptorSets(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t firstSet, uint32_t setCount, const VkDescriptorSet* sets,
+            uint32_t dynamicOffsetCount = 0, const uint32_t* dynamicOffsets = nullptr);
+        void BindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, const VkBuffer* buffers, const VkDeviceSize* offsets);
+        void BindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType indexType);
+        // Viewport and scissor 0
+        void SetViewport(const VkViewport& viewport);
+        void SetScissor(const VkRect2D& scissor);
+
+    private:
+        static const uint32_t c_MaxSets = 4;
+        static const uint32_t c_MaxDynamicOffsets = 8;
+        static const uint32_t c_MaxVertexBindings = 8;
+
+        // graphics and compute are bound separately
+        struct BindPoint
+        {
+            VkPipeline pipeline = VK_NULL_HANDLE;
+            VkPipelineLayout layout = VK_NULL_HANDLE;
+            VkDescriptorSet sets[c_MaxSets] = {};
+            // of the last call with dynamic offsets, they are only known per call and not per set
+            uint32_t dynamicFirstSet = 0;
+            uint32_t dynamicSetCount = 0;
+            uint32_t dynamicOffsetCount = 0;
+            uint32_t dynamicOffsets[c_MaxDynamicOffsets] = {};
+        };
+        struct VertexBinding
+        {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceSize offset = 0;
+        };
+
+        BindPoint& GetBindPoint(VkPipelineBindPoint bindPoint);
+        // Counts the call and returns whether it has to be issued
+        bool Issue(bool changes);
+
+        VkCommandBuffer m_CommandBuffer = VK_NULL_HANDLE;
+        Stats m_Stats;
+
+        BindPoint m_Graphics;
+        BindPoint m_Compute;
+        VertexBinding m_VertexBindings[c_MaxVertexBindings];
+        VkBuffer m_IndexBuffer = VK_NULL_HANDLE;
+        VkDeviceSize m_IndexOffset = 0;
+        VkIndexType m_IndexType = VK_INDEX_TYPE_UINT32;
+        bool m_HasViewport = false;
+        VkViewport m_Viewport{};
+        bool m_HasScissor = false;
+        VkRect2D m_Scissor{};
+    };
+}
@@ -0,0 +1,118 @@
+#include "ComputePipeline.h"
+#include "Graphics.h"
+#include "ShaderCompiler.h"
+#include <stdexcept>
+#include <chrono>
+
+VulkanProject::ComputePipeline::ComputePipeline(const std::string& path, const std::vector<std::string>& defines) : m_Path(path)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	ShaderCompiler::Result shader = ShaderCompiler::Compile(path, VK_SHADER_STAGE_COMPUTE_BIT, defines);
+	m_Interface = ShaderReflection::Reflect(shader.code, VK_SHADER_STAGE_COMPUTE_BIT);
+	if (m_Interface.GetSetCount() != 1)
+	{
+		throw std::runtime_error("compute pipelines have to use exactly one descriptor set!");
+	}
+	m_DescriptorSetLayout = LayoutCache::GetDescriptorSetLayout(ShaderReflection::GetSetLayoutBindings(m_Interface, 0, {}));
+	m_PipelineLayout = LayoutCache::GetPipelineLayout({ m_DescriptorSetLayout }, m_Interface.pushConstants);
+
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = shader.code.size();
+	moduleInfo.pCode = reinterpret_cast<const uint32_t*>(shader.code.data());
+
+	VkShaderModule shaderModule;
+	if (vkCreateShaderModule(Renderer::GetDevice(), &moduleInfo, nullptr, &shaderModule) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create shader module!");
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = m_PipelineLayout;
+
+	VkResult result = vkCreateComputePipelines(Renderer::GetDevice(), Renderer::GetPipelineCache(), 1, &pipelineInfo, nullptr, &m_Pipeline);
+	// The pipeline does not need the module anymore
+	vkDestroyShaderModule(Renderer::GetDevice(), shaderModule, nullptr);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create compute pipeline!");
+	}
+
+	float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("Compute pipeline %s created in %.2f ms\n", path.c_str(), milliseconds);
+}
+
+VulkanProject::ComputePipeline::~ComputePipeline()
+{
+	vkDestroyPipeline(Renderer::GetDevice(), m_Pipeline, nullptr);
+	// The layouts belong to the LayoutCache
+}
+
+const VulkanProject::ShaderInterface::Binding& VulkanProject::ComputePipeline::GetBinding(uint32_t binding) const
+{
+	for (const ShaderInterface::Binding& declared : m_Interface.bindings)
+	{
+		if (declared.binding == binding)
+		{
+			return declared;
+		}
+	}
+	throw std::runtime_error("compute shader " + m_Path + " does not declare binding " + std::to_string(binding) + "!");
+}
+
+void VulkanProject::ComputePipeline::WriteBuffer(VkDescriptorSet descriptorSet, uint32_t binding, VkBuffer buffer, VkDeviceSize range) const
+{
+	VkDescriptorBufferInfo bufferInfo{};
+	bufferInfo.buffer = buffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = range;
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = descriptorSet;
+	descriptorWrite.dstBinding = binding;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = GetBinding(binding).type;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pBufferInfo = &bufferInfo;
+	vkUpdateDescriptorSets(Renderer::GetDevice(), 1, &descriptorWrite, 0, nullptr);
+}
+
+void VulkanProject::ComputePipeline::WriteImage(VkDescriptorSet descriptorSet, uint32_t binding, VkImageView view, VkImageLayout layout, VkSampler sampler) const
+{
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.imageLayout = layout;
+	imageInfo.imageView = view;
+	imageInfo.sampler = sampler;
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = descriptorSet;
+	descriptorWrite.dstBinding = binding;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = GetBinding(binding).type;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(Renderer::GetDevice(), 1, &descriptorWrite, 0, nullptr);
+}
+
+void VulkanProject::ComputePipeline::Dispatch(VkDescriptorSet descriptorSet, uint32_t groupsX, uint32_t groupsY, const void* pushConstants) const
+{
+	VkCommandBuffer commandBuffer = Renderer::GetCommandBuffer();
+	Renderer::GetEncoder().BindPipeline(VK_PIPELINE_BIND_POINT_COMPUTE, m_Pipeline);
+	Renderer::GetEncoder().BindDescriptorSets(VK_PIPELINE_BIND_POINT_COMPUTE, m_PipelineLayout, 0, 1, &descriptorSet);
+	if (m_Interface.pushConstants.size > 0)
+	{
+		if (pushConstants == nullptr)
+		{
+			throw std::runtime_error("compute shader " + m_Path + " needs push constants!");
+		}
+		vkCmdPushConstants(commandBuffer, m_PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, m_Interface.pushConstants.offset, m_Interface.pushConstants.size, pushConstants);
+	}
+	vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+}
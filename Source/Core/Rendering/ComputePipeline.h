@@ -0,0 +1,40 @@
+#pragma once
+#include "Core/Includes.h"
+#include "ShaderReflection.h"
+#include <string>
+#include <vector>
+
+namespace VulkanProject
+{
+    // Compute shader compiled at runtime, its layouts follow from what it declares like for GraphicsPipeline.
+    // Dispatches go into the frame's command buffer and have to be recorded outside of the main render pass.
+    class ComputePipeline
+    {
+    public:
+        // defines go to the ShaderCompiler, so one source can give several pipelines
+        ComputePipeline(const std::string& path, const std::vector<std::string>& defines = {});
+        ~ComputePipeline();
+
+        ComputePipeline(const ComputePipeline&) = delete;
+        ComputePipeline& operator=(const ComputePipeline&) = delete;
+
+        const ShaderInterface& GetInterface() const { return m_Interface; }
+        VkDescriptorSetLayout GetDescriptorSetLayout() const { return m_DescriptorSetLayout; }
+
+        // The descriptor type of the binding is the one the shader declares
+        void WriteBuffer(VkDescriptorSet descriptorSet, uint32_t binding, VkBuffer buffer, VkDeviceSize range = VK_WHOLE_SIZE) const;
+        void WriteImage(VkDescriptorSet descriptorSet, uint32_t binding, VkImageView view, VkImageLayout layout, VkSampler sampler = VK_NULL_HANDLE) const;
+
+        // Binds the pipeline and descriptorSet as set 0. pushConstants has to hold as many bytes as the shader declares.
+        void Dispatch(VkDescriptorSet descriptorSet, uint32_t groupsX, uint32_t groupsY = 1, const void* pushConstants = nullptr) const;
+
+    private:
+        const ShaderInterface::Binding& GetBinding(uint32_t binding) const;
+
+        std::string m_Path;
+        ShaderInterface m_Interface;
+        VkDescriptorSetLayout m_DescriptorSetLayout;
+        VkPipelineLayout m_PipelineLayout;
+        VkPipeline m_Pipeline = VK_NULL_HANDLE;
+    };
+}
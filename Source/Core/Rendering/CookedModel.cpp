@@ -0,0 +1,341 @@
+#include "CookedModel.h"
+#include <stdexcept>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <unordered_map>
+#include <algorithm>
+
+namespace
+{
+	template <typename T> void AppendSection(std::vector<unsigned char>& blob, std::vector<VulkanProject::CookedModel::Section>& sections, VulkanProject::CookedModel::eSectionType type, const T* elements, size_t count)
+	{
+		using namespace VulkanProject::CookedModel;
+
+		size_t offset = (blob.size() + c_SectionAlignment - 1) & ~(c_SectionAlignment - 1);
+		size_t size = sizeof(T) * count;
+		blob.resize(offset + size);
+		if (size > 0)
+		{
+			memcpy(blob.data() + offset, elements, size);
+		}
+
+		Section section{};
+		section.type = type;
+		section.offset = offset;
+		section.size = size;
+		sections.push_back(section);
+	}
+
+	template <typename T> void GetSection(const unsigned char* data, const VulkanProject::CookedModel::Section& section, const T*& elements, uint32_t& count)
+	{
+		if (section.size % sizeof(T) != 0 || section.offset % alignof(T) != 0)
+		{
+			throw std::runtime_error("cooked model section is misaligned!");
+		}
+		elements = reinterpret_cast<const T*>(data + section.offset);
+		count = static_cast<uint32_t>(section.size / sizeof(T));
+	}
+}
+
+std::string VulkanProject::CookedModel::View::GetString(uint32_t offset) const
+{
+	if (offset == c_NoString)
+	{
+		return std::string();
+	}
+	if (offset >= stringsSize)
+	{
+		throw std::runtime_error("cooked model string out of range!");
+	}
+	size_t length = strnlen(strings + offset, static_cast<size_t>(stringsSize - offset));
+	return std::string(strings + offset, length);
+}
+
+bool VulkanProject::CookedModel::IsCookedModel(const std::string& path)
+{
+	return std::filesystem::path(path).extension() == c_Extension;
+}
+
+VulkanProject::CookedModel::View VulkanProject::CookedModel::Parse(const unsigned char* data, size_t size)
+{
+	if (size < sizeof(Header))
+	{
+		throw std::runtime_error("cooked model is truncated!");
+	}
+
+	Header header;
+	memcpy(&header, data, sizeof(Header));
+	if (header.magic != c_Magic)
+	{
+		throw std::runtime_error("file is not a cooked model!");
+	}
+	if (header.version != c_Version || header.vertexStride != sizeof(Vertex))
+	{
+		throw std::runtime_error("cooked model is out of date, recook it!");
+	}
+	if (sizeof(Header) + sizeof(Section) * static_cast<uint64_t>(header.sectionCount) > size)
+	{
+		throw std::runtime_error("cooked model is truncated!");
+	}
+
+	View view;
+	const Section* sections = reinterpret_cast<const Section*>(data + sizeof(Header));
+	for (uint32_t i = 0; i < header.sectionCount; i++)
+	{
+		const Section& section = sections[i];
+		if (section.offset > size || section.size > size - section.offset)
+		{
+			throw std::runtime_error("cooked model section out of range!");
+		}
+
+		switch (section.type)
+		{
+		case eSectionType::Nodes: GetSection(data, section, view.nodes, view.nodeCount); break;
+		case eSectionType::Children: GetSection(data, section, view.children, view.childCount); break;
+		case eSectionType::RootNodes: GetSection(data, section, view.rootNodes, view.rootNodeCount); break;
+		case eSectionType::Meshes: GetSection(data, section, view.meshes, view.meshCount); break;
+		case eSectionType::Primitives: GetSection(data, section, view.primitives, view.primitiveCount); break;
+		case eSectionType::Vertices: GetSection(data, section, view.vertices, view.vertexCount); break;
+		case eSectionType::Indices: GetSection(data, section, view.indices, view.indexCount); break;
+		case eSectionType::Strings:
+			view.strings = reinterpret_cast<const char*>(data + section.offset);
+			view.stringsSize = section.size;
+			break;
+		// Unknown sections are skipped so newer cookers can add optional data
+		default: break;
+		}
+	}
+
+	// Validate the cross references once so drawing can trust them
+	for (uint32_t i = 0; i < view.meshCount; i++)
+	{
+		if (static_cast<uint64_t>(view.meshes[i].firstPrimitive) + view.meshes[i].primitiveCount > view.primitiveCount)
+		{
+			throw std::runtime_error("cooked model mesh out of range!");
+		}
+	}
+	for (uint32_t i = 0; i < view.primitiveCount; i++)
+	{
+		const PrimitiveEntry& primitive = view.primitives[i];
+		if (static_cast<uint64_t>(primitive.firstVertex) + primitive.vertexCount > view.vertexCount ||
+			static_cast<uint64_t>(primitive.firstIndex) + primitive.indexCount > view.indexCount)
+		{
+			throw std::runtime_error("cooked model primitive out of range!");
+		}
+	}
+	for (uint32_t i = 0; i < view.nodeCount; i++)
+	{
+		const NodeEntry& node = view.nodes[i];
+		if (static_cast<uint64_t>(node.firstChild) + node.childCount > view.childCount || node.mesh >= static_cast<int32_t>(view.meshCount))
+		{
+			throw std::runtime_error("cooked model node out of range!");
+		}
+	}
+	for (uint32_t i = 0; i < view.childCount; i++)
+	{
+		if (view.children[i] >= view.nodeCount)
+		{
+			throw std::runtime_error("cooked model node out of range!");
+		}
+	}
+	for (uint32_t i = 0; i < view.rootNodeCount; i++)
+	{
+		if (view.rootNodes[i] >= view.nodeCount)
+		{
+			throw std::runtime_error("cooked model node out of range!");
+		}
+	}
+
+	return view;
+}
+
+uint32_t VulkanProject::CookedModel::PackSampler(const SamplerState& sampler)
+{
+	uint32_t packed = 0;
+	packed |= sampler.magFilter == VK_FILTER_NEAREST ? 1u : 0u;
+	packed |= sampler.minFilter == VK_FILTER_NEAREST ? 2u : 0u;
+	packed |= sampler.mipmapMode == VK_SAMPLER_MIPMAP_MODE_NEAREST ? 4u : 0u;
+	packed |= (static_cast<uint32_t>(sampler.addressModeU) & 3u) << 3;
+	packed |= (static_cast<uint32_t>(sampler.addressModeV) & 3u) << 5;
+	packed |= sampler.anisotropyEnable ? 0u : 128u;
+	packed |= sampler.maxLod == 0.0f ? 256u : 0u;
+	return packed;
+}
+
+VulkanProject::SamplerState VulkanProject::CookedModel::UnpackSampler(uint32_t packed)
+{
+	SamplerState sampler;
+	sampler.magFilter = packed & 1u ? VK_FILTER_NEAREST : VK_FILTER_LINEAR;
+	sampler.minFilter = packed & 2u ? VK_FILTER_NEAREST : VK_FILTER_LINEAR;
+	sampler.mipmapMode = packed & 4u ? VK_SAMPLER_MIPMAP_MODE_NEAREST : VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	sampler.addressModeU = static_cast<VkSamplerAddressMode>((packed >> 3) & 3u);
+	sampler.addressModeV = static_cast<VkSamplerAddressMode>((packed >> 5) & 3u);
+	sampler.anisotropyEnable = packed & 128u ? VK_FALSE : VK_TRUE;
+	sampler.maxLod = packed & 256u ? 0.0f : VK_LOD_CLAMP_NONE;
+	return sampler;
+}
+
+uint32_t VulkanProject::CookedModel::PackPipelineState(const PipelineState& state)
+{
+	uint32_t packed = 0;
+	packed |= state.cullMode == VK_CULL_MODE_NONE ? 1u : 0u;
+	packed |= state.blendEnable ? 2u : 0u;
+	// The cutoff is in [0, 1], 16 bits of it are plenty
+	if (state.GetConstant(eMaterialConstant::AlphaMask) != 0)
+	{
+		packed |= 4u;
+		packed |= static_cast<uint32_t>(std::clamp(state.GetFloatConstant(eMaterialConstant::AlphaCutoff), 0.0f, 1.0f) * 65535.0f + 0.5f) << 16;
+	}
+	return packed;
+}
+
+VulkanProject::PipelineState VulkanProject::CookedModel::UnpackPipelineState(uint32_t packed)
+{
+	PipelineState state;
+	if (packed & 1u)
+	{
+		state.cullMode = VK_CULL_MODE_NONE;
+	}
+	if (packed & 2u)
+	{
+		state.blendEnable = VK_TRUE;
+		state.depthWriteEnable = VK_FALSE;
+	}
+	if (packed & 4u)
+	{
+		state.SetConstant(eMaterialConstant::AlphaMask, 1u);
+		state.SetFloatConstant(eMaterialConstant::AlphaCutoff, static_cast<float>(packed >> 16) / 65535.0f);
+	}
+	return state;
+}
+
+void VulkanProject::CookedModel::Write(const ModelData& model, const std::string& path)
+{
+	std::vector<NodeEntry> nodes;
+	std::vector<uint32_t> children;
+	std::vector<MeshEntry> meshes;
+	std::vector<PrimitiveEntry> primitives;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<char> strings;
+
+	std::filesystem::path cookedDirectory = std::filesystem::absolute(path).parent_path();
+	std::unordered_map<const unsigned char*, uint32_t> embeddedImages;
+	auto addString = [&](const TextureSource& texture) -> uint32_t
+	{
+		if (!texture.IsValid())
+		{
+			return c_NoString;
+		}
+
+		std::string texturePath = texture.path;
+		// Images embedded in a .glb are extracted next to the cooked model
+		if (texture.data != nullptr)
+		{
+			auto existing = embeddedImages.find(texture.data);
+			if (existing != embeddedImages.end())
+			{
+				return existing->second;
+			}
+
+			bool isPNG = texture.size >= 4 && memcmp(texture.data, "\x89PNG", 4) == 0;
+			std::filesystem::path imagePath = std::filesystem::path(path);
+			imagePath.replace_filename(imagePath.stem().string() + "_" + std::to_string(embeddedImages.size()) + (isPNG ? ".png" : ".jpg"));
+			std::ofstream image(imagePath, std::ios::binary | std::ios::trunc);
+			image.write(reinterpret_cast<const char*>(texture.data), static_cast<std::streamsize>(texture.size));
+			if (!image.good())
+			{
+				throw std::runtime_error("failed to write image: " + imagePath.string());
+			}
+			texturePath = imagePath.string();
+		}
+
+		std::filesystem::path absolute = std::filesystem::absolute(texturePath);
+		std::filesystem::path relative = absolute.lexically_relative(cookedDirectory);
+		// Different drives have no relative path, keep the absolute one
+		std::string stored = relative.empty() ? absolute.generic_string() : relative.generic_string();
+		uint32_t offset = static_cast<uint32_t>(strings.size());
+		strings.insert(strings.end(), stored.begin(), stored.end());
+		strings.push_back('\0');
+
+		if (texture.data != nullptr)
+		{
+			embeddedImages[texture.data] = offset;
+		}
+		return offset;
+	};
+
+	for (const auto& node : model.nodes)
+	{
+		NodeEntry entry{};
+		memcpy(entry.transform, &node.transform[0][0], sizeof(entry.transform));
+		entry.mesh = node.mesh;
+		entry.firstChild = static_cast<uint32_t>(children.size());
+		entry.childCount = static_cast<uint32_t>(node.children.size());
+		children.insert(children.end(), node.children.begin(), node.children.end());
+		nodes.push_back(entry);
+	}
+
+	for (const auto& mesh : model.meshes)
+	{
+		MeshEntry meshEntry{};
+		meshEntry.firstPrimitive = static_cast<uint32_t>(primitives.size());
+		meshEntry.primitiveCount = static_cast<uint32_t>(mesh.size());
+		meshes.push_back(meshEntry);
+
+		for (const auto& primitive : mesh)
+		{
+			PrimitiveEntry entry{};
+			entry.firstVertex = static_cast<uint32_t>(vertices.size());
+			entry.vertexCount = static_cast<uint32_t>(primitive.vertices.size());
+			entry.firstIndex = static_cast<uint32_t>(indices.size());
+			entry.indexCount = static_cast<uint32_t>(primitive.indices.size());
+			entry.texturePath = addString(primitive.texture);
+			entry.normalTexturePath = addString(primitive.normalTexture);
+			entry.metalic_roughnessTexturePath = addString(primitive.metalic_roughnessTexture);
+			entry.samplers[0] = PackSampler(primitive.texture.sampler);
+			entry.samplers[1] = PackSampler(primitive.normalTexture.sampler);
+			entry.samplers[2] = PackSampler(primitive.metalic_roughnessTexture.sampler);
+			entry.state = PackPipelineState(primitive.state);
+			primitives.push_back(entry);
+
+			vertices.insert(vertices.end(), primitive.vertices.begin(), primitive.vertices.end());
+			indices.insert(indices.end(), primitive.indices.begin(), primitive.indices.end());
+		}
+	}
+
+	std::vector<uint32_t> rootNodes(model.rootNodes.begin(), model.rootNodes.end());
+
+	// Section data is laid out after the header and section table, which have a known size
+	const uint32_t sectionCount = static_cast<uint32_t>(eSectionType::Count);
+	std::vector<unsigned char> blob(sizeof(Header) + sizeof(Section) * sectionCount);
+	std::vector<Section> sections;
+	AppendSection(blob, sections, eSectionType::Nodes, nodes.data(), nodes.size());
+	AppendSection(blob, sections, eSectionType::Children, children.data(), children.size());
+	AppendSection(blob, sections, eSectionType::RootNodes, rootNodes.data(), rootNodes.size());
+	AppendSection(blob, sections, eSectionType::Meshes, meshes.data(), meshes.size());
+	AppendSection(blob, sections, eSectionType::Primitives, primitives.data(), primitives.size());
+	AppendSection(blob, sections, eSectionType::Vertices, vertices.data(), vertices.size());
+	AppendSection(blob, sections, eSectionType::Indices, indices.data(), indices.size());
+	AppendSection(blob, sections, eSectionType::Strings, strings.data(), strings.size());
+
+	Header header{};
+	header.magic = c_Magic;
+	header.version = c_Version;
+	header.vertexStride = sizeof(Vertex);
+	header.sectionCount = sectionCount;
+	memcpy(blob.data(), &header, sizeof(Header));
+	memcpy(blob.data() + sizeof(Header), sections.data(), sizeof(Section) * sections.size());
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("failed to open file: " + path);
+	}
+	file.write(reinterpret_cast<const char*>(blob.data()), static_cast<std::streamsize>(blob.size()));
+	if (!file.good())
+	{
+		throw std::runtime_error("failed to write cooked model: " + path);
+	}
+}
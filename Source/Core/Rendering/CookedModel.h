@@ -0,0 +1,125 @@
+#pragma once
+#include "ModelImporter.h"
+#include <cstdint>
+#include <string>
+
+namespace VulkanProject
+{
+    // Offline cooked model, laid out so the vertex and index sections can be copied to the GPU as is.
+    //
+    // File layout:
+    //   Header
+    //   Section[sectionCount]
+    //   section data, every section starts on a c_SectionAlignment boundary
+    namespace CookedModel
+    {
+        const uint32_t c_Magic = 0x444D5056; // "VPMD"
+        const uint32_t c_Version = 3;
+        const uint64_t c_SectionAlignment = 16;
+        const uint32_t c_NoString = 0xFFFFFFFF;
+        const std::string c_Extension = ".vpmodel";
+
+        enum class eSectionType : uint32_t
+        {
+            Nodes = 0,
+            Children = 1,
+            RootNodes = 2,
+            Meshes = 3,
+            Primitives = 4,
+            Vertices = 5,
+            Indices = 6,
+            Strings = 7,
+
+            Count
+        };
+
+        struct Header
+        {
+            uint32_t magic;
+            uint32_t version;
+            // sizeof(Vertex) of the cooker, the vertex section is only valid for the same layout
+            uint32_t vertexStride;
+            uint32_t sectionCount;
+        };
+
+        struct Section
+        {
+            eSectionType type;
+            uint32_t padding;
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        struct NodeEntry
+        {
+            float transform[16];
+            int32_t mesh;
+            uint32_t firstChild;
+            uint32_t childCount;
+            uint32_t padding;
+        };
+
+        struct MeshEntry
+        {
+            uint32_t firstPrimitive;
+            uint32_t primitiveCount;
+        };
+
+        struct PrimitiveEntry
+        {
+            // in elements, relative to the start of the vertex and index sections
+            uint32_t firstVertex;
+            uint32_t vertexCount;
+            uint32_t firstIndex;
+            uint32_t indexCount;
+
+            // offsets into the string section, c_NoString when not present
+            uint32_t texturePath;
+            uint32_t normalTexturePath;
+            uint32_t metalic_roughnessTexturePath;
+            // PackSampler of each texture slot
+            uint32_t samplers[3];
+            // PackPipelineState of the material
+            uint32_t state;
+        };
+
+        // Sampler states a glTF file can express fit in a few bits
+        uint32_t PackSampler(const SamplerState& sampler);
+        SamplerState UnpackSampler(uint32_t packed);
+        // Only the culling, blending and alpha masking a glTF material can change
+        uint32_t PackPipelineState(const PipelineState& state);
+        PipelineState UnpackPipelineState(uint32_t packed);
+
+        // Validated typed pointers into a cooked model that is already in memory
+        struct View
+        {
+            const NodeEntry* nodes = nullptr;
+            uint32_t nodeCount = 0;
+            const uint32_t* children = nullptr;
+            uint32_t childCount = 0;
+            const uint32_t* rootNodes = nullptr;
+            uint32_t rootNodeCount = 0;
+            const MeshEntry* meshes = nullptr;
+            uint32_t meshCount = 0;
+            const PrimitiveEntry* primitives = nullptr;
+            uint32_t primitiveCount = 0;
+            const Vertex* vertices = nullptr;
+            uint32_t vertexCount = 0;
+            const uint32_t* indices = nullptr;
+            uint32_t indexCount = 0;
+            const char* strings = nullptr;
+            uint64_t stringsSize = 0;
+
+            // empty when offset is c_NoString
+            std::string GetString(uint32_t offset) const;
+        };
+
+        bool IsCookedModel(const std::string& path);
+
+        // Throws when the data is not a cooked model of this version and vertex layout
+        View Parse(const unsigned char* data, size_t size);
+
+        // Texture paths are stored relative to the directory of the cooked file, embedded images are written next to it
+        void Write(const ModelData& model, const std::string& path);
+    }
+}
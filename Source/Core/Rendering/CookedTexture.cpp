@@ -0,0 +1,112 @@
+#include "CookedTexture.h"
+#include <stdexcept>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+
+bool VulkanProject::CookedTexture::IsCookedTexture(const std::string& path)
+{
+	return std::filesystem::path(path).extension() == c_Extension;
+}
+
+uint64_t VulkanProject::CookedTexture::GetLevelSize(eFormat format, uint32_t width, uint32_t height)
+{
+	uint64_t blocks = static_cast<uint64_t>((width + 3) / 4) * ((height + 3) / 4);
+	switch (format)
+	{
+	case eFormat::RGBA8_SRGB: return static_cast<uint64_t>(width) * height * 4;
+	case eFormat::BC1_SRGB: return blocks * 8;
+	case eFormat::BC3_SRGB: return blocks * 16;
+	case eFormat::RG8_UNORM: return static_cast<uint64_t>(width) * height * 2;
+	case eFormat::BC5_UNORM: return blocks * 16;
+	}
+	throw std::runtime_error("unknown cooked texture format!");
+}
+
+VulkanProject::CookedTexture::View VulkanProject::CookedTexture::Parse(const unsigned char* data, size_t size)
+{
+	if (size < sizeof(Header))
+	{
+		throw std::runtime_error("cooked texture is truncated!");
+	}
+
+	View view;
+	memcpy(&view.header, data, sizeof(Header));
+	if (view.header.magic != c_Magic)
+	{
+		throw std::runtime_error("file is not a cooked texture!");
+	}
+	if (view.header.version != c_Version)
+	{
+		throw std::runtime_error("cooked texture is out of date, recook it!");
+	}
+	if (view.header.mipCount == 0 || view.header.mipCount > 32 || sizeof(Header) + sizeof(Level) * static_cast<uint64_t>(view.header.mipCount) > size)
+	{
+		throw std::runtime_error("cooked texture is truncated!");
+	}
+
+	view.levels = reinterpret_cast<const Level*>(data + sizeof(Header));
+	view.data = data;
+
+	uint32_t width = view.header.width;
+	uint32_t height = view.header.height;
+	for (uint32_t i = 0; i < view.header.mipCount; i++)
+	{
+		const Level& level = view.levels[i];
+		if (level.width != width || level.height != height || level.size != GetLevelSize(view.header.format, width, height) ||
+			level.offset > size || level.size > size - level.offset)
+		{
+			throw std::runtime_error("cooked texture level out of range!");
+		}
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return view;
+}
+
+void VulkanProject::CookedTexture::Write(const std::string& path, eFormat format, const std::vector<LevelData>& levels)
+{
+	if (levels.empty())
+	{
+		throw std::runtime_error("cooked texture needs at least one level!");
+	}
+
+	Header header{};
+	header.magic = c_Magic;
+	header.version = c_Version;
+	header.format = format;
+	header.width = levels[0].width;
+	header.height = levels[0].height;
+	header.mipCount = static_cast<uint32_t>(levels.size());
+
+	std::vector<Level> table(levels.size());
+	uint64_t offset = sizeof(Header) + sizeof(Level) * levels.size();
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		offset = (offset + c_LevelAlignment - 1) & ~(c_LevelAlignment - 1);
+		table[i].offset = offset;
+		table[i].size = levels[i].data.size();
+		table[i].width = levels[i].width;
+		table[i].height = levels[i].height;
+		offset += table[i].size;
+	}
+
+	std::vector<unsigned char> blob(offset, 0);
+	memcpy(blob.data(), &header, sizeof(Header));
+	memcpy(blob.data() + sizeof(Header), table.data(), sizeof(Level) * table.size());
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		memcpy(blob.data() + table[i].offset, levels[i].data.data(), levels[i].data.size());
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("failed to open file: " + path);
+	}
+	file.write(reinterpret_cast<const char*>(blob.data()), static_cast<std::streamsize>(blob.size()));
+	if (!file.good())
+	{
+		throw std::runtime_error("failed to write cooked texture: " + path);
+	}
+}
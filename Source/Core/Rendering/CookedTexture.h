@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace VulkanProject
+{
+    // Offline cooked texture holding a full mip chain in its GPU format.
+    //
+    // File layout:
+    //   Header
+    //   Level[mipCount], largest level first
+    //   level data, every level starts on a c_LevelAlignment boundary
+    namespace CookedTexture
+    {
+        const uint32_t c_Magic = 0x58545056; // "VPTX"
+        const uint32_t c_Version = 1;
+        const uint64_t c_LevelAlignment = 16;
+        const std::string c_Extension = ".vptex";
+
+        enum class eFormat : uint32_t
+        {
+            RGBA8_SRGB = 0,
+            // 4x4 blocks of 8 bytes, no alpha
+            BC1_SRGB = 1,
+            // 4x4 blocks of 16 bytes, interpolated alpha
+            BC3_SRGB = 2,
+            // linear two channel data: normal xy, roughness and metalness
+            RG8_UNORM = 3,
+            // 4x4 blocks of 16 bytes, two interpolated channels
+            BC5_UNORM = 4
+        };
+
+        struct Header
+        {
+            uint32_t magic;
+            uint32_t version;
+            eFormat format;
+            uint32_t width;
+            uint32_t height;
+            uint32_t mipCount;
+        };
+
+        struct Level
+        {
+            uint64_t offset;
+            uint64_t size;
+            uint32_t width;
+            uint32_t height;
+        };
+
+        // Mip level in memory before it is written
+        struct LevelData
+        {
+            uint32_t width;
+            uint32_t height;
+            std::vector<unsigned char> data;
+        };
+
+        // Validated pointers into a cooked texture that is already in memory
+        struct View
+        {
+            Header header;
+            const Level* levels = nullptr;
+            // level offsets are relative to the start of the file
+            const unsigned char* data = nullptr;
+        };
+
+        bool IsCookedTexture(const std::string& path);
+
+        // Bytes one level of width x height takes in format
+        uint64_t GetLevelSize(eFormat format, uint32_t width, uint32_t height);
+
+        // Throws when the data is not a cooked texture of this version
+        View Parse(const unsigned char* data, size_t size);
+
+        void Write(const std::string& path, eFormat format, const std::vector<LevelData>& levels);
+    }
+}
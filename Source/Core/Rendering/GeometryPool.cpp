@@ -0,0 +1,172 @@
+#include "GeometryPool.h"
+#include "Graphics.h"
+#include "Texture.h"
+#include <vector>
+#include <mutex>
+#include <stdexcept>
+
+namespace
+{
+	// First fit over sorted free ranges, neighbours are merged again when a range is freed
+	struct RangeAllocator
+	{
+		struct Range
+		{
+			uint32_t offset;
+			uint32_t size;
+		};
+		std::vector<Range> free;
+		uint32_t used = 0;
+
+		void Reset(uint32_t capacity)
+		{
+			free = { { 0, capacity } };
+			used = 0;
+		}
+
+		bool Allocate(uint32_t size, uint32_t& offset)
+		{
+			for (auto it = free.begin(); it != free.end(); ++it)
+			{
+				if (it->size < size)
+				{
+					continue;
+				}
+				offset = it->offset;
+				it->offset += size;
+				it->size -= size;
+				if (it->size == 0)
+				{
+					free.erase(it);
+				}
+				used += size;
+				return true;
+			}
+			return false;
+		}
+
+		void Free(uint32_t offset, uint32_t size)
+		{
+			if (size == 0)
+			{
+				return;
+			}
+			used -= size;
+			auto next = free.begin();
+			while (next != free.end() && next->offset < offset)
+			{
+				++next;
+			}
+			next = free.insert(next, { offset, size });
+			if (next + 1 != free.end() && next->offset + next->size == (next + 1)->offset)
+			{
+				next->size += (next + 1)->size;
+				free.erase(next + 1);
+			}
+			if (next != free.begin() && (next - 1)->offset + (next - 1)->size == next->offset)
+			{
+				(next - 1)->size += next->size;
+				free.erase(next);
+			}
+		}
+	};
+
+	struct GeometryPoolData
+	{
+		std::mutex mutex;
+		VkBuffer vertexBuffer = VK_NULL_HANDLE;
+		VkDeviceMemory vertexMemory = VK_NULL_HANDLE;
+		VkBuffer indexBuffer = VK_NULL_HANDLE;
+		VkDeviceMemory indexMemory = VK_NULL_HANDLE;
+		RangeAllocator vertices;
+		RangeAllocator indices;
+	};
+
+	static GeometryPoolData* data = nullptr;
+}
+
+void VulkanProject::GeometryPool::Init(uint32_t vertexCapacity, uint32_t indexCapacity)
+{
+	if (data)
+	{
+		throw std::runtime_error("geometry pool is already initialised!");
+	}
+	data = new GeometryPoolData();
+
+	Renderer::CreateBuffer(static_cast<VkDeviceSize>(vertexCapacity) * sizeof(Vertex), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, data->vertexBuffer, data->vertexMemory);
+	Renderer::CreateBuffer(static_cast<VkDeviceSize>(indexCapacity) * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, data->indexBuffer, data->indexMemory);
+	data->vertices.Reset(vertexCapacity);
+	data->indices.Reset(indexCapacity);
+}
+
+void VulkanProject::GeometryPool::Shutdown()
+{
+	if (!data)
+	{
+		return;
+	}
+	vkDestroyBuffer(Renderer::GetDevice(), data->indexBuffer, nullptr);
+	vkFreeMemory(Renderer::GetDevice(), data->indexMemory, nullptr);
+	vkDestroyBuffer(Renderer::GetDevice(), data->vertexBuffer, nullptr);
+	vkFreeMemory(Renderer::GetDevice(), data->vertexMemory, nullptr);
+	delete data;
+	data = nullptr;
+}
+
+VulkanProject::GeometryPool::Allocation VulkanProject::GeometryPool::Allocate(uint32_t vertexCount, uint32_t indexCount)
+{
+	if (!data)
+	{
+		throw std::runtime_error("geometry pool is not initialised!");
+	}
+
+	std::lock_guard<std::mutex> lock(data->mutex);
+	Allocation allocation;
+	allocation.vertexCount = vertexCount;
+	allocation.indexCount = indexCount;
+	if (!data->vertices.Allocate(vertexCount, allocation.firstVertex))
+	{
+		throw std::runtime_error("geometry pool is out of vertices!");
+	}
+	if (!data->indices.Allocate(indexCount, allocation.firstIndex))
+	{
+		data->vertices.Free(allocation.firstVertex, vertexCount);
+		throw std::runtime_error("geometry pool is out of indices!");
+	}
+	return allocation;
+}
+
+void VulkanProject::GeometryPool::Free(const Allocation& allocation)
+{
+	if (!data)
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(data->mutex);
+	data->vertices.Free(allocation.firstVertex, allocation.vertexCount);
+	data->indices.Free(allocation.firstIndex, allocation.indexCount);
+}
+
+VkBuffer VulkanProject::GeometryPool::GetVertexBuffer()
+{
+	return data->vertexBuffer;
+}
+
+VkBuffer VulkanProject::GeometryPool::GetIndexBuffer()
+{
+	return data->indexBuffer;
+}
+
+uint32_t VulkanProject::GeometryPool::GetUsedVertices()
+{
+	std::lock_guard<std::mutex> lock(data->mutex);
+	return data->vertices.used;
+}
+
+uint32_t VulkanProject::GeometryPool::GetUsedIndices()
+{
+	std::lock_guard<std::mutex> lock(data->mutex);
+	return data->indices.used;
+}
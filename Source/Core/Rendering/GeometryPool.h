@@ -0,0 +1,33 @@
+#pragma once
+#include "Core/Includes.h"
+#include <cstdint>
+
+namespace VulkanProject
+{
+    // One vertex and one index buffer every mesh is suballocated from, so all draws share the same
+    // bindings and a whole pass can go into a single indirect draw.
+    namespace GeometryPool
+    {
+        struct Allocation
+        {
+            // in elements, the vertex offset and first index of the mesh's draws
+            uint32_t firstVertex = 0;
+            uint32_t vertexCount = 0;
+            uint32_t firstIndex = 0;
+            uint32_t indexCount = 0;
+        };
+
+        // Needs the device, capacities in vertices and indices
+        void Init(uint32_t vertexCapacity, uint32_t indexCapacity);
+        void Shutdown();
+
+        // Thread safe, throws when the pool is full
+        Allocation Allocate(uint32_t vertexCount, uint32_t indexCount);
+        void Free(const Allocation& allocation);
+
+        VkBuffer GetVertexBuffer();
+        VkBuffer GetIndexBuffer();
+        uint32_t GetUsedVertices();
+        uint32_t GetUsedIndices();
+    }
+}
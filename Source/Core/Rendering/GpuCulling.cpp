@@ -0,0 +1,348 @@
+#include "GpuCulling.h"
+#include "Graphics.h"
+#include "ComputePipeline.h"
+#include "SamplerCache.h"
+#include "RenderGraph.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+	const VkFormat c_PyramidFormat = VK_FORMAT_R32_SFLOAT;
+	// Enough for 2^16 pixels on the longest side, the last level has to be 1x1
+	const uint32_t c_MaxPyramidLevels = 16;
+	// Local sizes of cull.comp and depthpyramid.comp
+	const uint32_t c_CullGroupSize = 64;
+	const uint32_t c_PyramidGroupSize = 8;
+
+	// CullData of cull.comp
+	struct CullData
+	{
+		glm::mat4 viewProjection;
+		glm::vec4 planes[6];
+		glm::vec4 pyramid;
+		glm::vec4 viewport;
+		uint32_t drawCount;
+		uint32_t padding[3];
+	};
+
+	// Push constants of depthpyramid.comp
+	struct PyramidLevel
+	{
+		glm::ivec2 sourceSize;
+		glm::ivec2 destinationSize;
+	};
+
+	struct FrameResources
+	{
+		VkBuffer constants = VK_NULL_HANDLE;
+		VkDeviceMemory constantsMemory = VK_NULL_HANDLE;
+		void* constantsMapped = nullptr;
+		// the sets of both passes and of every pyramid level, reset by CullEarly
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	};
+
+	struct GpuCullingData
+	{
+		std::unique_ptr<VulkanProject::ComputePipeline> cullEarly;
+		std::unique_ptr<VulkanProject::ComputePipeline> cullLate;
+		std::unique_ptr<VulkanProject::ComputePipeline> depthPyramid;
+		VkSampler sampler = VK_NULL_HANDLE;
+
+		// Follows the depth buffer size. The pyramid is a transient image of the graph, rebuilt every frame
+		// so the frames in flight share it.
+		VkExtent2D extent = { 0, 0 };
+		glm::ivec2 pyramidSize = glm::ivec2(0);
+		uint32_t pyramidLevels = 0;
+		// the pyramid levels and the late pass
+		VulkanProject::RenderGraph graph;
+
+		// uint per draw index, kept from one frame to the next
+		VkBuffer visibility = VK_NULL_HANDLE;
+		VkDeviceMemory visibilityMemory = VK_NULL_HANDLE;
+		uint32_t visibilityCapacity = 0;
+
+		std::vector<FrameResources> frames;
+	};
+
+	static GpuCullingData* data = nullptr;
+
+	uint32_t GetGroupCount(uint32_t count, uint32_t groupSize)
+	{
+		return (count + groupSize - 1) / groupSize;
+	}
+
+	void Barrier(VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+	{
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		vkCmdPipelineBarrier(VulkanProject::Renderer::GetCommandBuffer(), srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	// Planes of a [0, 1] depth projection with the normals pointing inwards, normalised for sphere tests
+	void GetFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+	{
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+		{
+			rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+		}
+		planes[0] = rows[3] + rows[0];
+		planes[1] = rows[3] - rows[0];
+		planes[2] = rows[3] + rows[1];
+		planes[3] = rows[3] - rows[1];
+		planes[4] = rows[2];
+		planes[5] = rows[3] - rows[2];
+		for (int i = 0; i < 6; i++)
+		{
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+		}
+	}
+
+	// Level 0 is half the depth buffer rounded up, every level halves again down to 1x1
+	void UpdatePyramidSize()
+	{
+		VkExtent2D extent = VulkanProject::Renderer::GetSwapChainExtent();
+		if (extent.width == data->extent.width && extent.height == data->extent.height)
+		{
+			return;
+		}
+
+		data->extent = extent;
+		data->pyramidSize = glm::ivec2((extent.width + 1) / 2, (extent.height + 1) / 2);
+		data->pyramidLevels = 1;
+		for (glm::ivec2 size = data->pyramidSize; size.x > 1 || size.y > 1; size = (size + 1) / 2)
+		{
+			data->pyramidLevels++;
+		}
+		if (data->pyramidLevels > c_MaxPyramidLevels)
+		{
+			throw std::runtime_error("depth buffer is too large for the depth pyramid!");
+		}
+	}
+
+	// New draw indices start out visible, the early pass then draws them if they are in the frustum
+	void ReserveVisibility(uint32_t count)
+	{
+		if (count <= data->visibilityCapacity)
+		{
+			return;
+		}
+		if (data->visibility != VK_NULL_HANDLE)
+		{
+			// The frames in flight still cull with it
+			vkDeviceWaitIdle(VulkanProject::Renderer::GetDevice());
+			vkDestroyBuffer(VulkanProject::Renderer::GetDevice(), data->visibility, nullptr);
+			vkFreeMemory(VulkanProject::Renderer::GetDevice(), data->visibilityMemory, nullptr);
+		}
+		data->visibilityCapacity = std::max(count, data->visibilityCapacity * 2);
+		VulkanProject::Renderer::CreateBuffer(static_cast<VkDeviceSize>(data->visibilityCapacity) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, data->visibility, data->visibilityMemory);
+		vkCmdFillBuffer(VulkanProject::Renderer::GetCommandBuffer(), data->visibility, 0, VK_WHOLE_SIZE, 1);
+	}
+
+	VkDescriptorSet AllocateDescriptorSet(FrameResources& frame, const VulkanProject::ComputePipeline& pipeline)
+	{
+		VkDescriptorSetLayout layout = pipeline.GetDescriptorSetLayout();
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = frame.descriptorPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &layout;
+
+		VkDescriptorSet descriptorSet;
+		if (vkAllocateDescriptorSets(VulkanProject::Renderer::GetDevice(), &allocInfo, &descriptorSet) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate culling descriptor set!");
+		}
+		return descriptorSet;
+	}
+
+	// Bindings 0 to 4 are the same for both passes
+	VkDescriptorSet WriteCullSet(FrameResources& frame, const VulkanProject::ComputePipeline& pipeline, const VulkanProject::GpuCulling::DrawList& draws, VkBuffer culled)
+	{
+		VkDescriptorSet descriptorSet = AllocateDescriptorSet(frame, pipeline);
+		pipeline.WriteBuffer(descriptorSet, 0, frame.constants, sizeof(CullData));
+		pipeline.WriteBuffer(descriptorSet, 1, draws.bounds);
+		pipeline.WriteBuffer(descriptorSet, 2, draws.commands);
+		pipeline.WriteBuffer(descriptorSet, 3, culled);
+		pipeline.WriteBuffer(descriptorSet, 4, data->visibility);
+		return descriptorSet;
+	}
+}
+
+void VulkanProject::GpuCulling::Init()
+{
+	if (data)
+	{
+		throw std::runtime_error("gpu culling is already initialised!");
+	}
+	data = new GpuCullingData();
+	if (!Renderer::GetEnabledFeatures().drawIndirectFirstInstance || !Renderer::IsDepthSampled())
+	{
+		printf("GPU culling disabled, the device cannot draw indirect with a first instance or sample depth\n");
+		return;
+	}
+
+	// One source, the late pass also samples the depth pyramid
+	data->cullEarly = std::make_unique<ComputePipeline>("Resources/Shaders/cull.comp");
+	data->cullLate = std::make_unique<ComputePipeline>("Resources/Shaders/cull.comp", std::vector<std::string>{ "LATE" });
+	data->depthPyramid = std::make_unique<ComputePipeline>("Resources/Shaders/depthpyramid.comp");
+
+	SamplerState samplerState;
+	samplerState.magFilter = VK_FILTER_NEAREST;
+	samplerState.minFilter = VK_FILTER_NEAREST;
+	samplerState.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerState.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerState.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerState.anisotropyEnable = VK_FALSE;
+	data->sampler = SamplerCache::Get(samplerState);
+
+	std::vector<VkDescriptorPoolSize> poolSizes = ShaderReflection::GetPoolSizes(data->cullEarly->GetInterface(), 1);
+	for (const VkDescriptorPoolSize& size : ShaderReflection::GetPoolSizes(data->cullLate->GetInterface(), 1))
+	{
+		poolSizes.push_back(size);
+	}
+	for (const VkDescriptorPoolSize& size : ShaderReflection::GetPoolSizes(data->depthPyramid->GetInterface(), c_MaxPyramidLevels))
+	{
+		poolSizes.push_back(size);
+	}
+
+	data->frames.resize(MAX_FRAMES_IN_FLIGHT);
+	for (FrameResources& frame : data->frames)
+	{
+		Renderer::CreateBuffer(sizeof(CullData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			frame.constants, frame.constantsMemory);
+		vkMapMemory(Renderer::GetDevice(), frame.constantsMemory, 0, sizeof(CullData), 0, &frame.constantsMapped);
+
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = 2 + c_MaxPyramidLevels;
+		if (vkCreateDescriptorPool(Renderer::GetDevice(), &poolInfo, nullptr, &frame.descriptorPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create culling descriptor pool!");
+		}
+	}
+}
+
+void VulkanProject::GpuCulling::Shutdown()
+{
+	if (!data)
+	{
+		return;
+	}
+	VkDevice device = Renderer::GetDevice();
+	vkDeviceWaitIdle(device);
+
+	for (FrameResources& frame : data->frames)
+	{
+		vkDestroyDescriptorPool(device, frame.descriptorPool, nullptr);
+		vkDestroyBuffer(device, frame.constants, nullptr);
+		vkFreeMemory(device, frame.constantsMemory, nullptr);
+	}
+	vkDestroyBuffer(device, data->visibility, nullptr);
+	vkFreeMemory(device, data->visibilityMemory, nullptr);
+	// The sampler belongs to the SamplerCache
+
+	delete data;
+	data = nullptr;
+}
+
+bool VulkanProject::GpuCulling::IsEnabled()
+{
+	return data && data->cullEarly != nullptr;
+}
+
+void VulkanProject::GpuCulling::CullEarly(const DrawList& draws, VkBuffer culled)
+{
+	FrameResources& frame = data->frames[Renderer::GetCurrentFrame()];
+	// BeginFrame waited for the frame that used these last
+	vkResetDescriptorPool(Renderer::GetDevice(), frame.descriptorPool, 0);
+	UpdatePyramidSize();
+	ReserveVisibility(draws.count);
+
+	CullData cull{};
+	cull.viewProjection = draws.viewProjection;
+	GetFrustumPlanes(draws.viewProjection, cull.planes);
+	cull.pyramid = glm::vec4(data->pyramidSize.x, data->pyramidSize.y, data->pyramidLevels, 0.0f);
+	cull.viewport = glm::vec4(data->extent.width, data->extent.height, 0.0f, 0.0f);
+	cull.drawCount = draws.count;
+	memcpy(frame.constantsMapped, &cull, sizeof(cull));
+
+	// The visibility was last written by the previous frame's late pass or just cleared
+	Barrier(VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	VkDescriptorSet descriptorSet = WriteCullSet(frame, *data->cullEarly, draws, culled);
+	data->cullEarly->Dispatch(descriptorSet, GetGroupCount(draws.count, c_CullGroupSize));
+	Barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+}
+
+void VulkanProject::GpuCulling::CullLate(const DrawList& draws, VkBuffer culled)
+{
+	using eUsage = RenderGraph::eUsage;
+	FrameResources& frame = data->frames[Renderer::GetCurrentFrame()];
+	RenderGraph& graph = data->graph;
+	graph.Reset();
+
+	// The early draws wrote it and the late draws test and write it again
+	RenderGraph::ImageDesc depthDesc;
+	depthDesc.format = Renderer::GetDepthFormat();
+	depthDesc.extent = data->extent;
+	RenderGraph::Handle depth = graph.ImportImage(Renderer::GetDepthImage(), Renderer::GetDepthView(), depthDesc, eUsage::DepthAttachment, eUsage::DepthAttachment);
+	RenderGraph::Handle visibility = graph.ImportBuffer(data->visibility, eUsage::ComputeStorageReadWrite);
+	// Written by the host, and drawn from once the main render pass resumes
+	RenderGraph::Handle bounds = graph.ImportBuffer(draws.bounds, eUsage::None);
+	RenderGraph::Handle commands = graph.ImportBuffer(draws.commands, eUsage::None);
+	RenderGraph::Handle culledCommands = graph.ImportBuffer(culled, eUsage::None, eUsage::IndirectRead);
+
+	RenderGraph::ImageDesc pyramidDesc;
+	pyramidDesc.format = c_PyramidFormat;
+	pyramidDesc.extent = { static_cast<uint32_t>(data->pyramidSize.x), static_cast<uint32_t>(data->pyramidSize.y) };
+	pyramidDesc.mipLevels = data->pyramidLevels;
+	pyramidDesc.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	RenderGraph::Handle pyramid = graph.CreateImage(pyramidDesc);
+
+	glm::ivec2 sourceSize = glm::ivec2(data->extent.width, data->extent.height);
+	for (uint32_t level = 0; level < data->pyramidLevels; level++)
+	{
+		PyramidLevel constants;
+		constants.sourceSize = sourceSize;
+		constants.destinationSize = (sourceSize + 1) / 2;
+		// Level 0 is built from the depth buffer, every other level from the one below
+		const RenderGraph::Handle source = level == 0 ? depth : pyramid;
+		const uint32_t sourceLevel = level == 0 ? 0 : level - 1;
+
+		RenderGraph::Handle pass = graph.AddPass("depth pyramid", [&frame, &graph, source, sourceLevel, pyramid, level, constants](VkCommandBuffer)
+		{
+			VkDescriptorSet descriptorSet = AllocateDescriptorSet(frame, *data->depthPyramid);
+			data->depthPyramid->WriteImage(descriptorSet, 0, graph.GetImageView(source, sourceLevel), graph.GetLayout(source, eUsage::ComputeSampled), data->sampler);
+			data->depthPyramid->WriteImage(descriptorSet, 1, graph.GetImageView(pyramid, level), graph.GetLayout(pyramid, eUsage::ComputeStorageWrite));
+			data->depthPyramid->Dispatch(descriptorSet, GetGroupCount(constants.destinationSize.x, c_PyramidGroupSize), GetGroupCount(constants.destinationSize.y, c_PyramidGroupSize), &constants);
+		});
+		graph.Read(pass, source, eUsage::ComputeSampled, sourceLevel);
+		graph.Write(pass, pyramid, eUsage::ComputeStorageWrite, level);
+		sourceSize = constants.destinationSize;
+	}
+
+	RenderGraph::Handle pass = graph.AddPass("late cull", [&frame, &graph, &draws, culled, pyramid](VkCommandBuffer)
+	{
+		VkDescriptorSet descriptorSet = WriteCullSet(frame, *data->cullLate, draws, culled);
+		data->cullLate->WriteImage(descriptorSet, 5, graph.GetImageView(pyramid, 0, data->pyramidLevels), graph.GetLayout(pyramid, eUsage::ComputeSampled), data->sampler);
+		data->cullLate->Dispatch(descriptorSet, GetGroupCount(draws.count, c_CullGroupSize));
+	});
+	graph.Read(pass, bounds, eUsage::ComputeStorageRead);
+	graph.Read(pass, commands, eUsage::ComputeStorageRead);
+	graph.Read(pass, pyramid, eUsage::ComputeSampled, 0, data->pyramidLevels);
+	graph.Write(pass, visibility, eUsage::ComputeStorageReadWrite);
+	graph.Write(pass, culledCommands, eUsage::ComputeStorageWrite);
+
+	graph.Compile();
+	graph.Execute(Renderer::GetCommandBuffer());
+}
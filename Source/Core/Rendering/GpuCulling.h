@@ -0,0 +1,39 @@
+#pragma once
+#include "Core/Includes.h"
+#include <cstdint>
+
+namespace VulkanProject
+{
+    // Frustum and occlusion culling on the GPU with two phases. The early pass draws what was visible last
+    // frame, a depth pyramid (the farthest depth of every 2x2 block, level after level) is built from its depth
+    // buffer, and the late pass tests every draw against it and draws what became visible. The culled draws
+    // keep their slot in the indirect buffer with an instance count of 0.
+    namespace GpuCulling
+    {
+        // Needs the LayoutCache, the SamplerCache and the AssetCache. Stays disabled when the device cannot
+        // draw indirect with a first instance or cannot sample its depth format.
+        void Init();
+        // Waits for the device
+        void Shutdown();
+        bool IsEnabled();
+
+        // Draws of one flush, one element per draw in each buffer
+        struct DrawList
+        {
+            // vec4 per draw, world space bounding sphere center and radius
+            VkBuffer bounds = VK_NULL_HANDLE;
+            // VkDrawIndexedIndirectCommand per draw
+            VkBuffer commands = VK_NULL_HANDLE;
+            uint32_t count = 0;
+            glm::mat4 viewProjection = glm::mat4(1.0f);
+        };
+
+        // One draw list per frame, both outside of the main render pass. A draw's visibility is remembered
+        // by its index, draws that move to another index are only drawn a frame later by the early pass.
+        // Writes the commands of the draws that were visible last frame and are in the frustum to culled.
+        void CullEarly(const DrawList& draws, VkBuffer culled);
+        // After the early draws. Writes the commands of the draws that pass the frustum and the depth pyramid
+        // but were not drawn by the early pass to culled.
+        void CullLate(const DrawList& draws, VkBuffer culled);
+    }
+}
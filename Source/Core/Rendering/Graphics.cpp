@@ -1,33 +1,89 @@
 #include "Graphics.h"
 #include "Core/Window.h"
+#include "Core/ThreadPool.h"
 
 #include <iostream>
 #include <vector>
 #include <set>
 #include <fstream>
 #include <array>
+#include <filesystem>
 #include "HelperFunctions.h"
  
 
 
+// What the Renderer functions record into, the frame's command buffer or a secondary one of RecordParallel
+struct Recording
+{
+	VkCommandBuffer m_CommandBuffer = VK_NULL_HANDLE;
+	VulkanProject::CommandEncoder m_Encoder;
+	// what the next draw uses, bound by the first draw that comes after BindPipeline
+	VkPipeline m_Pipeline = VK_NULL_HANDLE;
+	VkPipelineLayout m_PipelineLayout = VK_NULL_HANDLE;
+	bool m_PipelinePending = false;
+};
+
+// Secondary command buffers of one recording job and frame in flight, reset when the frame starts again
+struct RecordingPool
+{
+	VkCommandPool m_Pool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> m_Buffers;
+	uint32_t m_Used = 0;
+};
+
 struct RenderData
 {
 	VkRenderPass m_RenderPass;
+	// same attachments as m_RenderPass but loads them, continues the frame after EndRenderPass
+	VkRenderPass m_ResumeRenderPass;
+	VkFramebuffer m_Framebuffer = VK_NULL_HANDLE;
 	VkDevice m_Device = nullptr;
 	VkPhysicalDevice m_PhysicalDevice = VK_NULL_HANDLE;
 	
-	VkPipeline m_BoundPipeline;
-	VkPipelineLayout m_PipelineLayout;
+	// set while the main render pass is being recorded
+	bool m_InRenderPass = false;
+	// begun by the next recording, or by EndRenderPass for the clear
+	VkRenderPass m_PendingRenderPass = VK_NULL_HANDLE;
+	// the main render pass was begun for RecordParallel, inline recording has to resume it first
+	bool m_SecondaryContents = false;
 	VkClearValue m_ClearColor = { 0.f,0.f,0.f,0.f };
 	std::vector<VkCommandBuffer> m_CommandBuffers;
 	uint32_t m_CurrentFrame = 0;
 	VkCommandPool m_CommandPool;
+	uint32_t m_GraphicsFamily = 0;
 	VkQueue m_GraphicsQueue = nullptr;
 	VkExtent2D m_SwapChainExtent;
-
-	std::vector<VkDeviceSize> m_Offset;
+	VkPipelineCache m_PipelineCache = VK_NULL_HANDLE;
+
+	VkPhysicalDeviceFeatures m_EnabledFeatures{};
+	// the frame's command buffer, every bind of it goes through its encoder
+	Recording m_Main;
+	VulkanProject::CommandEncoder::Stats m_LastFrameStats;
+
+	// 0 for every thread of the shared pool and the caller
+	uint32_t m_RecordingThreads = 0;
+	// per frame in flight, one per job of RecordParallel
+	std::vector<std::vector<RecordingPool>> m_RecordingPools;
+	std::vector<Recording> m_Jobs;
+	// binds of the secondary command buffers recorded this frame
+	VulkanProject::CommandEncoder::Stats m_SecondaryStats;
+	// static recordings are recorded one at a time on the main thread, the pool frees them one by one
+	VkCommandPool m_StaticPool = VK_NULL_HANDLE;
+	Recording m_Static;
+	// counts the swap chains created, static recordings are recorded again for a new one
+	uint32_t m_SwapChainGeneration = 1;
+
+	VkImage m_DepthImage;
+	VkDeviceMemory m_DepthImageMemory;
+	VkImageView m_DepthImageView;
+	// sampled by compute passes when the format allows it
+	bool m_DepthSampled = false;
+
+	std::function<void(VkCommandBuffer)> m_PostPassCallback;
 };
 static RenderData* data;
+// set on the threads running a RecordParallel job
+static thread_local Recording* t_Recording = nullptr;
 
 
 VulkanProject::Graphics::Graphics(Window* window) : m_WindowInstance(window)
@@ -36,19 +92,229 @@ VulkanProject::Graphics::Graphics(Window* window) : m_WindowInstance(window)
 	
 }
 
+// The clearing pass starts the frame, the resuming one picks up after compute work in between
+static VkRenderPass CreateMainRenderPass(VkFormat colorFormat, bool resume)
+{
+	VkAttachmentDescription colorAttachment{};
+	colorAttachment.format = colorFormat;
+	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	colorAttachment.loadOp = resume ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	colorAttachment.initialLayout = resume ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_UNDEFINED;
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	// Stored so compute passes can build the depth pyramid from it
+	VkAttachmentDescription depthAttachment{};
+	depthAttachment.format = VulkanProject::findDepthFormat(data->m_PhysicalDevice);
+	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depthAttachment.loadOp = resume ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = resume ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference colorAttachmentRef{};
+	colorAttachmentRef.attachment = 0;
+	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference depthAttachmentRef{};
+	depthAttachmentRef.attachment = 1;
+	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpass{};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorAttachmentRef;
+	subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+	VkSubpassDependency dependency{};
+	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependency.dstSubpass = 0;
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
+	VkRenderPassCreateInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+	renderPassInfo.pAttachments = attachments.data();
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = 1;
+	renderPassInfo.pDependencies = &dependency;
+
+	VkRenderPass renderPass;
+	if (vkCreateRenderPass(data->m_Device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create render pass!");
+	}
+	return renderPass;
+}
+
+// Viewport and scissor covering the frame, dropped when they are already set
+static void SetViewport(VulkanProject::CommandEncoder& encoder)
+{
+	VkViewport viewport{};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)data->m_SwapChainExtent.width;
+	viewport.height = (float)data->m_SwapChainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	encoder.SetViewport(viewport);
+
+	VkRect2D scissor{};
+	scissor.offset = { 0, 0 };
+	scissor.extent = data->m_SwapChainExtent;
+	encoder.SetScissor(scissor);
+}
+
+// Begins renderPass on the frame's framebuffer. Inline contents get the viewport and scissor, which is dropped
+// when resuming with the same extent.
+static void BeginMainRenderPass(VkRenderPass renderPass, VkSubpassContents contents)
+{
+	VkCommandBuffer commandBuffer = data->m_CommandBuffers[data->m_CurrentFrame];
+
+	VkRenderPassBeginInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = data->m_Framebuffer;
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = data->m_SwapChainExtent;
+
+
+	std::array<VkClearValue, 2> clearValues{};
+	clearValues[0].color = data->m_ClearColor.color;
+	clearValues[1].depthStencil = { 1.0f, 0 };
+
+	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	renderPassInfo.pClearValues = clearValues.data();
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
+	data->m_InRenderPass = true;
+	data->m_PendingRenderPass = VK_NULL_HANDLE;
+	data->m_SecondaryContents = contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS;
+	if (!data->m_SecondaryContents)
+	{
+		SetViewport(data->m_Main.m_Encoder);
+	}
+}
+
+// The recording of the calling thread. On the main thread the caller is about to record commands, so the
+// main render pass is begun or continued with inline contents first.
+static Recording& BeginRecording()
+{
+	if (t_Recording != nullptr)
+	{
+		return *t_Recording;
+	}
+	if (data->m_PendingRenderPass != VK_NULL_HANDLE)
+	{
+		BeginMainRenderPass(data->m_PendingRenderPass, VK_SUBPASS_CONTENTS_INLINE);
+	}
+	else if (data->m_InRenderPass && data->m_SecondaryContents)
+	{
+		vkCmdEndRenderPass(data->m_CommandBuffers[data->m_CurrentFrame]);
+		BeginMainRenderPass(data->m_ResumeRenderPass, VK_SUBPASS_CONTENTS_INLINE);
+	}
+	return data->m_Main;
+}
+
+// Begins the secondary command buffer of recording and runs record with the Renderer functions recording into it
+static void RecordSecondary(Recording& recording, VkCommandBufferUsageFlags flags, const VkCommandBufferInheritanceInfo& inheritance, const std::function<void()>& record)
+{
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = flags | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritance;
+	if (vkBeginCommandBuffer(recording.m_CommandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to begin recording secondary command buffer!");
+	}
+	recording.m_Encoder.Begin(recording.m_CommandBuffer);
+	SetViewport(recording.m_Encoder);
+
+	// The caller's thread takes part in ParallelFor, the previous value is put back for it
+	Recording* previous = t_Recording;
+	t_Recording = &recording;
+	try
+	{
+		record();
+	}
+	catch (...)
+	{
+		t_Recording = previous;
+		throw;
+	}
+	t_Recording = previous;
+
+	if (vkEndCommandBuffer(recording.m_CommandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record secondary command buffer!");
+	}
+}
+
+// Binds of the secondary command buffers count towards the frame they were recorded in
+static void AddSecondaryStats(const Recording& recording)
+{
+	const VulkanProject::CommandEncoder::Stats& stats = recording.m_Encoder.GetStats();
+	data->m_SecondaryStats.issued += stats.issued;
+	data->m_SecondaryStats.elided += stats.elided;
+}
+
+// Executes secondary command buffers in the main render pass, begun again for them when its contents are inline
+static void ExecuteSecondary(uint32_t count, const VkCommandBuffer* buffers)
+{
+	if (!data->m_InRenderPass || !data->m_SecondaryContents)
+	{
+		VkRenderPass renderPass = data->m_PendingRenderPass != VK_NULL_HANDLE ? data->m_PendingRenderPass : data->m_ResumeRenderPass;
+		if (data->m_InRenderPass)
+		{
+			vkCmdEndRenderPass(data->m_CommandBuffers[data->m_CurrentFrame]);
+		}
+		BeginMainRenderPass(renderPass, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	}
+	vkCmdExecuteCommands(data->m_CommandBuffers[data->m_CurrentFrame], count, buffers);
+
+	// What the frame's command buffer had bound is undefined after executing other command buffers
+	data->m_Main.m_Encoder.Invalidate();
+	data->m_Main.m_PipelinePending = data->m_Main.m_Pipeline != VK_NULL_HANDLE;
+}
+
+// Draws only need the pipeline bound once something is drawn with it
+static void BindPendingPipeline(Recording& recording)
+{
+	if (recording.m_PipelinePending)
+	{
+		recording.m_Encoder.BindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, recording.m_Pipeline);
+		recording.m_PipelinePending = false;
+	}
+}
+
 void VulkanProject::Graphics::CreateDepthResources()
 {
 	
 	VkFormat depthFormat = findDepthFormat(data->m_PhysicalDevice);
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(data->m_PhysicalDevice, depthFormat, &properties);
+	data->m_DepthSampled = (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
 
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (data->m_DepthSampled ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
 	Renderer::CreateImage(data->m_SwapChainExtent.width, data->m_SwapChainExtent.height, depthFormat,
-		VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_DepthImage, m_DepthImageMemory);
+		VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, data->m_DepthImage, data->m_DepthImageMemory);
 
-	m_DepthImageView = Renderer::CreateImageView(m_DepthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+	data->m_DepthImageView = Renderer::CreateImageView(data->m_DepthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
 	
 }
-void VulkanProject::Graphics::Init(uint& width, uint& height, std::string& name)
+void VulkanProject::Graphics::Init(uint& width, uint& height, std::string& name, const std::string& pipelineCachePath)
 {
+	m_PipelineCachePath = pipelineCachePath;
 
 	//Creating instance
 	{
@@ -160,8 +426,17 @@ void VulkanProject::Graphics::Init(uint& width, uint& height, std::string& name)
 			queueCreateInfos.push_back(queueCreateInfo);
 		}
 
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(data->m_PhysicalDevice, &supportedFeatures);
+
 		VkPhysicalDeviceFeatures deviceFeatures{};
 		deviceFeatures.samplerAnisotropy = VK_TRUE;
+		// Cooked textures are block compressed
+		deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+		// A whole pass in one indirect draw, each draw finds its data through its first instance
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+		data->m_EnabledFeatures = deviceFeatures;
 
 		VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -191,6 +466,9 @@ void VulkanProject::Graphics::Init(uint& width, uint& height, std::string& name)
 		vkGetDeviceQueue(data->m_Device, indices.presentFamily.value(), 0, &m_PresentQueue);
 	}
 
+	// Create pipeline cache
+	CreatePipelineCache();
+
 	// Create swapchain
 	CreateSwapChain();
 
@@ -198,64 +476,8 @@ void VulkanProject::Graphics::Init(uint& width, uint& height, std::string& name)
 	CreateImageViews();
 
 	//Creating render pass
-	{
-		VkAttachmentDescription colorAttachment{};
-		colorAttachment.format = m_SwapChainImageFormat;
-		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-		VkAttachmentDescription depthAttachment{};
-		depthAttachment.format = findDepthFormat(data->m_PhysicalDevice);
-		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-		VkAttachmentReference colorAttachmentRef{};
-		colorAttachmentRef.attachment = 0;
-		colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-		VkAttachmentReference depthAttachmentRef{};
-		depthAttachmentRef.attachment = 1;
-		depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-		VkSubpassDescription subpass{};
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.colorAttachmentCount = 1;
-		subpass.pColorAttachments = &colorAttachmentRef;
-		subpass.pDepthStencilAttachment = &depthAttachmentRef;
-
-		VkSubpassDependency dependency{};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency.dstSubpass = 0;
-		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-		dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-		std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
-		VkRenderPassCreateInfo renderPassInfo{};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-		renderPassInfo.pAttachments = attachments.data();
-		renderPassInfo.subpassCount = 1;
-		renderPassInfo.pSubpasses = &subpass;
-		renderPassInfo.dependencyCount = 1;
-		renderPassInfo.pDependencies = &dependency;
-
-		if (vkCreateRenderPass(data->m_Device, &renderPassInfo, nullptr, &data->m_RenderPass) != VK_SUCCESS) 
-		{
-			throw std::runtime_error("failed to create render pass!");
-		}
-	}
+	data->m_RenderPass = CreateMainRenderPass(m_SwapChainImageFormat, false);
+	data->m_ResumeRenderPass = CreateMainRenderPass(m_SwapChainImageFormat, true);
 
 	// Create Command Pool
 	{
@@ -265,6 +487,8 @@ void VulkanProject::Graphics::Init(uint& width, uint& height, std::string& name)
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+		data->m_GraphicsFamily = poolInfo.queueFamilyIndex;
+		data->m_RecordingPools.resize(MAX_FRAMES_IN_FLIGHT);
 
 		if (vkCreateCommandPool(data->m_Device, &poolInfo, nullptr, &data->m_CommandPool) != VK_SUCCESS) 
 		{
@@ -377,9 +601,9 @@ void VulkanProject::Graphics::CreateSwapChain()
 
 void VulkanProject::Graphics::ClearSwapChain()
 {
-	vkDestroyImageView(data->m_Device, m_DepthImageView, nullptr);
-	vkDestroyImage(data->m_Device, m_DepthImage, nullptr);
-	vkFreeMemory(data->m_Device, m_DepthImageMemory, nullptr);
+	vkDestroyImageView(data->m_Device, data->m_DepthImageView, nullptr);
+	vkDestroyImage(data->m_Device, data->m_DepthImage, nullptr);
+	vkFreeMemory(data->m_Device, data->m_DepthImageMemory, nullptr);
 
 	for (size_t i = 0; i < m_SwapChainFramebuffers.size(); i++)
 	{
@@ -412,7 +636,7 @@ void VulkanProject::Graphics::CreateFrameBuffers()
 		std::array<VkImageView, 2> attachments = 
 		{
 			m_SwapChainImageViews[i],
-			m_DepthImageView
+			data->m_DepthImageView
 		};
 
 		VkFramebufferCreateInfo framebufferInfo{};
@@ -431,9 +655,104 @@ void VulkanProject::Graphics::CreateFrameBuffers()
 	}
 }
 
+void VulkanProject::Graphics::CreatePipelineCache()
+{
+	std::vector<char> initialData;
+	std::ifstream file(m_PipelineCachePath, std::ios::binary | std::ios::ate);
+	if (file.is_open())
+	{
+		initialData.resize(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(initialData.data(), initialData.size());
+		if (!file.good())
+		{
+			initialData.clear();
+		}
+	}
+
+	// Drivers are supposed to reject foreign data themselves, not all of them do
+	if (!initialData.empty())
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(data->m_PhysicalDevice, &properties);
+
+		VkPipelineCacheHeaderVersionOne header{};
+		bool valid = initialData.size() >= sizeof(header);
+		if (valid)
+		{
+			memcpy(&header, initialData.data(), sizeof(header));
+			valid = header.headerSize >= sizeof(header) && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+				header.vendorID == properties.vendorID && header.deviceID == properties.deviceID &&
+				memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+		}
+		if (!valid)
+		{
+			printf("Pipeline cache: %s is from another device or driver, starting empty\n", m_PipelineCachePath.c_str());
+			initialData.clear();
+		}
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo{};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = initialData.size();
+	cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+	if (vkCreatePipelineCache(data->m_Device, &cacheInfo, nullptr, &data->m_PipelineCache) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pipeline cache!");
+	}
+	if (!initialData.empty())
+	{
+		printf("Pipeline cache: loaded %.1f KB from %s\n", initialData.size() / 1024.0, m_PipelineCachePath.c_str());
+	}
+}
+
+void VulkanProject::Graphics::SavePipelineCache()
+{
+	size_t size = 0;
+	if (vkGetPipelineCacheData(data->m_Device, data->m_PipelineCache, &size, nullptr) != VK_SUCCESS || size == 0)
+	{
+		return;
+	}
+	std::vector<char> cacheData(size);
+	if (vkGetPipelineCacheData(data->m_Device, data->m_PipelineCache, &size, cacheData.data()) != VK_SUCCESS)
+	{
+		return;
+	}
+
+	std::filesystem::path path = m_PipelineCachePath;
+	std::filesystem::path tempPath = path;
+	tempPath += ".tmp";
+	std::error_code error;
+	if (path.has_parent_path())
+	{
+		std::filesystem::create_directories(path.parent_path(), error);
+	}
+
+	// Replaced with a rename so a crash never leaves a half written cache for the next run
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(cacheData.data(), static_cast<std::streamsize>(size));
+		if (!file.good())
+		{
+			file.close();
+			std::filesystem::remove(tempPath, error);
+			return;
+		}
+	}
+	std::filesystem::rename(tempPath, path, error);
+	if (error)
+	{
+		std::filesystem::remove(tempPath, error);
+		return;
+	}
+	printf("Pipeline cache: saved %.1f KB to %s\n", size / 1024.0, m_PipelineCachePath.c_str());
+}
+
 void VulkanProject::Graphics::Shutdown()
 {
 	vkDeviceWaitIdle(data->m_Device);
+	SavePipelineCache();
 }
 
 VulkanProject::Graphics::~Graphics()
@@ -448,7 +767,18 @@ VulkanProject::Graphics::~Graphics()
 	}
 
 	vkDestroyCommandPool(data->m_Device, data->m_CommandPool, nullptr);
+	vkDestroyCommandPool(data->m_Device, data->m_StaticPool, nullptr);
+	for (std::vector<RecordingPool>& pools : data->m_RecordingPools)
+	{
+		for (RecordingPool& pool : pools)
+		{
+			vkDestroyCommandPool(data->m_Device, pool.m_Pool, nullptr);
+		}
+	}
 
+	vkDestroyPipelineCache(data->m_Device, data->m_PipelineCache, nullptr);
+
+	vkDestroyRenderPass(data->m_Device, data->m_ResumeRenderPass, nullptr);
 	vkDestroyRenderPass(data->m_Device, data->m_RenderPass, nullptr);
 
 	vkDestroyDevice(data->m_Device, nullptr);
@@ -473,6 +803,8 @@ void VulkanProject::Graphics::Resize()
 	CreateImageViews();
 	CreateDepthResources();
 	CreateFrameBuffers();
+	// The viewport of the static recordings has the old extent
+	data->m_SwapChainGeneration++;
 }
 
 void VulkanProject::Graphics::BeginFrame()
@@ -502,50 +834,47 @@ void VulkanProject::Graphics::BeginFrame()
 	{
 		throw std::runtime_error("failed to begin recording command buffer!");
 	}
+	data->m_Main.m_CommandBuffer = data->m_CommandBuffers[data->m_CurrentFrame];
+	data->m_Main.m_Encoder.Begin(data->m_Main.m_CommandBuffer);
+	// Nothing is bound in the new command buffer
+	data->m_Main.m_PipelinePending = data->m_Main.m_Pipeline != VK_NULL_HANDLE;
+	data->m_SecondaryStats = CommandEncoder::Stats();
+
+	// The fence says the secondary command buffers of this frame are done as well
+	for (RecordingPool& pool : data->m_RecordingPools[data->m_CurrentFrame])
+	{
+		if (pool.m_Used > 0)
+		{
+			vkResetCommandPool(data->m_Device, pool.m_Pool, 0);
+			pool.m_Used = 0;
+		}
+	}
 
-	VkRenderPassBeginInfo renderPassInfo{};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassInfo.renderPass = data->m_RenderPass;
-	renderPassInfo.framebuffer = m_SwapChainFramebuffers[m_ImageIndex];
-	renderPassInfo.renderArea.offset = { 0, 0 };
-	renderPassInfo.renderArea.extent = data->m_SwapChainExtent;
-
-
-	std::array<VkClearValue, 2> clearValues{};
-	clearValues[0].color = data->m_ClearColor.color;
-	clearValues[1].depthStencil = { 1.0f, 0 };
-
-	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-	renderPassInfo.pClearValues = clearValues.data();
-
-	vkCmdBeginRenderPass(data->m_CommandBuffers[data->m_CurrentFrame], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(data->m_CommandBuffers[data->m_CurrentFrame], VK_PIPELINE_BIND_POINT_GRAPHICS, data->m_BoundPipeline);
-
-	VkViewport viewport{};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)data->m_SwapChainExtent.width;
-	viewport.height = (float)data->m_SwapChainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-	vkCmdSetViewport(data->m_CommandBuffers[data->m_CurrentFrame], 0, 1, &viewport);
-
-	VkRect2D scissor{};
-	scissor.offset = { 0, 0 };
-	scissor.extent = data->m_SwapChainExtent;
-	vkCmdSetScissor(data->m_CommandBuffers[data->m_CurrentFrame], 0, 1, &scissor);
+	// Begun with the first recording, which decides whether its contents are inline or secondary
+	data->m_Framebuffer = m_SwapChainFramebuffers[m_ImageIndex];
+	data->m_PendingRenderPass = data->m_RenderPass;
 }
 
 void VulkanProject::Graphics::EndFrame()
 {
 	//vkCmdDraw(data->m_CommandBuffers[data->m_CurrentFrame], 3, 1, 0, 0);
 
-	vkCmdEndRenderPass(data->m_CommandBuffers[data->m_CurrentFrame]);
+	Renderer::EndRenderPass();
+	if (data->m_PostPassCallback)
+	{
+		// The callback binds its own state straight into the command buffer
+		data->m_Main.m_Encoder.Invalidate();
+		data->m_Main.m_PipelinePending = false;
+		data->m_PostPassCallback(data->m_CommandBuffers[data->m_CurrentFrame]);
+	}
 
 	if (vkEndCommandBuffer(data->m_CommandBuffers[data->m_CurrentFrame]) != VK_SUCCESS)
 	{
 		throw std::runtime_error("failed to record command buffer!");
 	}
+	data->m_LastFrameStats = data->m_Main.m_Encoder.GetStats();
+	data->m_LastFrameStats.issued += data->m_SecondaryStats.issued;
+	data->m_LastFrameStats.elided += data->m_SecondaryStats.elided;
 
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -607,8 +936,10 @@ void VulkanProject::Renderer::SetClearColor(glm::vec4& color)
 
 void VulkanProject::Renderer::BindPipeline(const VkPipeline& pipeline, const VkPipelineLayout layout)
 {
-	data->m_BoundPipeline = pipeline;
-	data->m_PipelineLayout = layout;
+	Recording& recording = t_Recording != nullptr ? *t_Recording : data->m_Main;
+	recording.m_Pipeline = pipeline;
+	recording.m_PipelineLayout = layout;
+	recording.m_PipelinePending = true;
 }
 
 const VkRenderPass VulkanProject::Renderer::GetRenderPass()
@@ -616,6 +947,243 @@ const VkRenderPass VulkanProject::Renderer::GetRenderPass()
 	return data->m_RenderPass;
 }
 
+const VkExtent2D VulkanProject::Renderer::GetSwapChainExtent()
+{
+	return data->m_SwapChainExtent;
+}
+
+void VulkanProject::Renderer::PushConstants(VkShaderStageFlags stages, uint32_t size, const void* values)
+{
+	Recording& recording = BeginRecording();
+	vkCmdPushConstants(recording.m_CommandBuffer, recording.m_PipelineLayout, stages, 0, size, values);
+}
+
+VkCommandBuffer VulkanProject::Renderer::GetCommandBuffer()
+{
+	return BeginRecording().m_CommandBuffer;
+}
+
+VulkanProject::CommandEncoder& VulkanProject::Renderer::GetEncoder()
+{
+	return BeginRecording().m_Encoder;
+}
+
+const VulkanProject::CommandEncoder::Stats& VulkanProject::Renderer::GetLastFrameStats()
+{
+	return data->m_LastFrameStats;
+}
+
+void VulkanProject::Renderer::EndRenderPass()
+{
+	// Nothing was recorded, only the clear still has to happen
+	if (data->m_PendingRenderPass == data->m_RenderPass)
+	{
+		BeginMainRenderPass(data->m_RenderPass, VK_SUBPASS_CONTENTS_INLINE);
+	}
+	data->m_PendingRenderPass = VK_NULL_HANDLE;
+	if (data->m_InRenderPass)
+	{
+		vkCmdEndRenderPass(data->m_CommandBuffers[data->m_CurrentFrame]);
+		data->m_InRenderPass = false;
+	}
+}
+
+void VulkanProject::Renderer::ResumeRenderPass()
+{
+	if (!data->m_InRenderPass && data->m_PendingRenderPass == VK_NULL_HANDLE)
+	{
+		data->m_PendingRenderPass = data->m_ResumeRenderPass;
+	}
+}
+
+void VulkanProject::Renderer::SetRecordingThreads(uint32_t threads)
+{
+	data->m_RecordingThreads = threads;
+}
+
+uint32_t VulkanProject::Renderer::GetRecordingThreads()
+{
+	return data->m_RecordingThreads != 0 ? data->m_RecordingThreads : ThreadPool::GetShared().GetThreadCount() + 1;
+}
+
+void VulkanProject::Renderer::RecordParallel(uint32_t jobCount, const std::function<void(uint32_t)>& job)
+{
+	if (t_Recording != nullptr || (!data->m_InRenderPass && data->m_PendingRenderPass == VK_NULL_HANDLE))
+	{
+		throw std::runtime_error("parallel recording has to start on the main thread inside the main render pass!");
+	}
+	if (jobCount > GetRecordingThreads())
+	{
+		throw std::runtime_error("more parallel recording jobs than recording threads!");
+	}
+	if (jobCount == 0)
+	{
+		return;
+	}
+
+	// A command pool per job, only the job's thread records into it
+	std::vector<RecordingPool>& pools = data->m_RecordingPools[data->m_CurrentFrame];
+	if (pools.size() < jobCount)
+	{
+		pools.resize(jobCount);
+	}
+	if (data->m_Jobs.size() < jobCount)
+	{
+		data->m_Jobs.resize(jobCount);
+	}
+	std::vector<VkCommandBuffer> buffers(jobCount);
+	for (uint32_t i = 0; i < jobCount; i++)
+	{
+		RecordingPool& pool = pools[i];
+		if (pool.m_Pool == VK_NULL_HANDLE)
+		{
+			VkCommandPoolCreateInfo poolInfo{};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			poolInfo.queueFamilyIndex = data->m_GraphicsFamily;
+			if (vkCreateCommandPool(data->m_Device, &poolInfo, nullptr, &pool.m_Pool) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create recording command pool!");
+			}
+		}
+		if (pool.m_Used == pool.m_Buffers.size())
+		{
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = pool.m_Pool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+			VkCommandBuffer buffer;
+			if (vkAllocateCommandBuffers(data->m_Device, &allocInfo, &buffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate secondary command buffer!");
+			}
+			pool.m_Buffers.push_back(buffer);
+		}
+		buffers[i] = pool.m_Buffers[pool.m_Used++];
+
+		// The pipeline carries over, nothing is bound in a secondary command buffer
+		Recording& recording = data->m_Jobs[i];
+		recording.m_CommandBuffer = buffers[i];
+		recording.m_Pipeline = data->m_Main.m_Pipeline;
+		recording.m_PipelineLayout = data->m_Main.m_PipelineLayout;
+		recording.m_PipelinePending = recording.m_Pipeline != VK_NULL_HANDLE;
+	}
+
+	// Compatible with both main render passes
+	VkCommandBufferInheritanceInfo inheritance{};
+	inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance.renderPass = data->m_ResumeRenderPass;
+	inheritance.subpass = 0;
+	inheritance.framebuffer = data->m_Framebuffer;
+
+	ThreadPool::GetShared().ParallelFor(jobCount, [&inheritance, &job](size_t index)
+	{
+		RecordSecondary(data->m_Jobs[index], VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, inheritance, [&job, index]()
+		{
+			job(static_cast<uint32_t>(index));
+		});
+	});
+	for (uint32_t i = 0; i < jobCount; i++)
+	{
+		AddSecondaryStats(data->m_Jobs[i]);
+	}
+	ExecuteSecondary(jobCount, buffers.data());
+}
+
+bool VulkanProject::Renderer::IsRecorded(const StaticRecording& recording)
+{
+	return recording.swapChain == data->m_SwapChainGeneration;
+}
+
+void VulkanProject::Renderer::ExecuteStatic(StaticRecording& recording, const std::function<void()>& record)
+{
+	if (t_Recording != nullptr || (!data->m_InRenderPass && data->m_PendingRenderPass == VK_NULL_HANDLE))
+	{
+		throw std::runtime_error("static recordings have to be executed on the main thread inside the main render pass!");
+	}
+
+	if (!IsRecorded(recording))
+	{
+		if (data->m_StaticPool == VK_NULL_HANDLE)
+		{
+			// Recorded again one buffer at a time
+			VkCommandPoolCreateInfo poolInfo{};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+			poolInfo.queueFamilyIndex = data->m_GraphicsFamily;
+			if (vkCreateCommandPool(data->m_Device, &poolInfo, nullptr, &data->m_StaticPool) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create static command pool!");
+			}
+		}
+		if (recording.commandBuffer == VK_NULL_HANDLE)
+		{
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = data->m_StaticPool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+			if (vkAllocateCommandBuffers(data->m_Device, &allocInfo, &recording.commandBuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate secondary command buffer!");
+			}
+		}
+
+		// Not tied to a framebuffer, so it runs on every image of the swap chain
+		VkCommandBufferInheritanceInfo inheritance{};
+		inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritance.renderPass = data->m_ResumeRenderPass;
+		inheritance.subpass = 0;
+		inheritance.framebuffer = VK_NULL_HANDLE;
+
+		Recording& target = data->m_Static;
+		target.m_CommandBuffer = recording.commandBuffer;
+		target.m_Pipeline = VK_NULL_HANDLE;
+		target.m_PipelineLayout = VK_NULL_HANDLE;
+		target.m_PipelinePending = false;
+		// The command buffer of this frame in flight that executed it last is done, BeginFrame waited for it
+		RecordSecondary(target, 0, inheritance, record);
+		AddSecondaryStats(target);
+		recording.swapChain = data->m_SwapChainGeneration;
+	}
+	ExecuteSecondary(1, &recording.commandBuffer);
+}
+
+void VulkanProject::Renderer::DestroyStaticRecording(StaticRecording& recording)
+{
+	if (recording.commandBuffer != VK_NULL_HANDLE)
+	{
+		vkFreeCommandBuffers(data->m_Device, data->m_StaticPool, 1, &recording.commandBuffer);
+	}
+	recording = StaticRecording();
+}
+
+VkFormat VulkanProject::Renderer::GetDepthFormat()
+{
+	return findDepthFormat(data->m_PhysicalDevice);
+}
+
+VkImage VulkanProject::Renderer::GetDepthImage()
+{
+	return data->m_DepthImage;
+}
+
+VkImageView VulkanProject::Renderer::GetDepthView()
+{
+	return data->m_DepthImageView;
+}
+
+bool VulkanProject::Renderer::IsDepthSampled()
+{
+	return data->m_DepthSampled;
+}
+
+void VulkanProject::Renderer::SetPostPassCallback(std::function<void(VkCommandBuffer)> callback)
+{
+	data->m_PostPassCallback = callback;
+}
+
 const VkDevice VulkanProject::Renderer::GetDevice()
 {
 	return data->m_Device;
@@ -626,7 +1194,12 @@ const VkPhysicalDevice VulkanProject::Renderer::GetPhysicalDevice()
 	return data->m_PhysicalDevice;
 }
 
-uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+const VkPipelineCache VulkanProject::Renderer::GetPipelineCache()
+{
+	return data->m_PipelineCache;
+}
+
+uint32_t VulkanProject::Renderer::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
 {
 	VkPhysicalDeviceMemoryProperties memProperties;
 	vkGetPhysicalDeviceMemoryProperties(data->m_PhysicalDevice, &memProperties);
@@ -645,23 +1218,48 @@ uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
 
 void VulkanProject::Renderer::UploadBuffer(const VkBuffer* buffer, uint32_t sizeOfBuffer)
 {
-	VkDeviceSize offsets = { 0 };
-	data->m_Offset.push_back(offsets);
-
-	vkCmdBindVertexBuffers(data->m_CommandBuffers[data->m_CurrentFrame], 0, 1, buffer, data->m_Offset.data());
-
-	vkCmdDraw(data->m_CommandBuffers[data->m_CurrentFrame], static_cast<uint32_t>(sizeOfBuffer), 1, 0, 0);
+	VkDeviceSize offset = 0;
+	Recording& recording = BeginRecording();
+	recording.m_Encoder.BindVertexBuffers(0, 1, buffer, &offset);
+	BindPendingPipeline(recording);
+	vkCmdDraw(recording.m_CommandBuffer, static_cast<uint32_t>(sizeOfBuffer), 1, 0, 0);
 }
-void VulkanProject::Renderer::UploadIndexedBuffer(const VkBuffer* buffer, VkBuffer indexBuffer, uint32_t sizeOfIndices)
+void VulkanProject::Renderer::BindGeometry(VkBuffer vertexBuffer, VkBuffer indexBuffer)
 {
-	VkDeviceSize offsets = { 0 };
-	data->m_Offset.push_back(offsets);
+	VkDeviceSize offset = 0;
+	Recording& recording = BeginRecording();
+	recording.m_Encoder.BindVertexBuffers(0, 1, &vertexBuffer, &offset);
+	recording.m_Encoder.BindIndexBuffer(indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+}
 
-	vkCmdBindVertexBuffers(data->m_CommandBuffers[data->m_CurrentFrame], 0, 1, buffer, data->m_Offset.data());
-	vkCmdBindIndexBuffer(data->m_CommandBuffers[data->m_CurrentFrame], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+void VulkanProject::Renderer::DrawIndexed(const VkDrawIndexedIndirectCommand& command)
+{
+	Recording& recording = BeginRecording();
+	BindPendingPipeline(recording);
+	vkCmdDrawIndexed(recording.m_CommandBuffer, command.indexCount, command.instanceCount, command.firstIndex, command.vertexOffset, command.firstInstance);
+}
 
-	vkCmdDrawIndexed(data->m_CommandBuffers[data->m_CurrentFrame], static_cast<uint32_t>(sizeOfIndices), 1, 0, 0, 0);
+void VulkanProject::Renderer::DrawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount)
+{
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	Recording& recording = BeginRecording();
+	BindPendingPipeline(recording);
+	if (data->m_EnabledFeatures.multiDrawIndirect)
+	{
+		vkCmdDrawIndexedIndirect(recording.m_CommandBuffer, buffer, offset, drawCount, stride);
+		return;
+	}
+	for (uint32_t i = 0; i < drawCount; i++)
+	{
+		vkCmdDrawIndexedIndirect(recording.m_CommandBuffer, buffer, offset + static_cast<VkDeviceSize>(i) * stride, 1, stride);
+	}
 }
+
+const VkPhysicalDeviceFeatures& VulkanProject::Renderer::GetEnabledFeatures()
+{
+	return data->m_EnabledFeatures;
+}
+
 //void VulkanProject::Renderer::UploadUniformBuffer(std::vector<void*> buffer, UniformBufferObject adata, size_t sizeOfData)
 //{
 //	memcpy(buffer[data->m_CurrentFrame], &adata, sizeOfData);
@@ -696,9 +1294,10 @@ void VulkanProject::Renderer::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags
 	vkBindBufferMemory(data->m_Device, buffer, bufferMemory, 0);
 	
 }
-void VulkanProject::Renderer::BindDescriptors(std::vector<VkDescriptorSet> descriptors)
+void VulkanProject::Renderer::BindDescriptors(VkDescriptorSet descriptors)
 {
-	vkCmdBindDescriptorSets(data->m_CommandBuffers[data->m_CurrentFrame], VK_PIPELINE_BIND_POINT_GRAPHICS, data->m_PipelineLayout, 0, 1, &descriptors[data->m_CurrentFrame], 0, nullptr);
+	Recording& recording = BeginRecording();
+	recording.m_Encoder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, recording.m_PipelineLayout, 0, 1, &descriptors);
 }
 void VulkanProject::Renderer::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
 {
@@ -769,7 +1368,39 @@ void VulkanProject::Renderer::EndSingleTimeCommands(VkCommandBuffer commandBuffe
 	vkFreeCommandBuffers(data->m_Device, data->m_CommandPool, 1, &commandBuffer);
 }
 
-VkImageView VulkanProject::Renderer::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+VkFence VulkanProject::Renderer::SubmitSingleTimeCommands(VkCommandBuffer commandBuffer)
+{
+	vkEndCommandBuffer(commandBuffer);
+
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	VkFence fence;
+	if (vkCreateFence(data->m_Device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create fence!");
+	}
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	if (vkQueueSubmit(data->m_GraphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS)
+	{
+		vkDestroyFence(data->m_Device, fence, nullptr);
+		throw std::runtime_error("failed to submit command buffer!");
+	}
+	return fence;
+}
+
+void VulkanProject::Renderer::FreeSingleTimeCommands(VkCommandBuffer commandBuffer, VkFence fence)
+{
+	vkDestroyFence(data->m_Device, fence, nullptr);
+	vkFreeCommandBuffers(data->m_Device, data->m_CommandPool, 1, &commandBuffer);
+}
+
+VkImageView VulkanProject::Renderer::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel)
 {
 	VkImageViewCreateInfo viewInfo{};
 	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -777,8 +1408,8 @@ VkImageView VulkanProject::Renderer::CreateImageView(VkImage image, VkFormat for
 	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 	viewInfo.format = format;
 	viewInfo.subresourceRange.aspectMask = aspectFlags;
-	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+	viewInfo.subresourceRange.levelCount = mipLevels;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
 	
@@ -791,15 +1422,16 @@ VkImageView VulkanProject::Renderer::CreateImageView(VkImage image, VkFormat for
 	return imageView;
 }
 
-void VulkanProject::Renderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+void VulkanProject::Renderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t mipLevels, VkImageCreateFlags flags)
 {
 	VkImageCreateInfo imageInfo{};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.flags = flags;
 	imageInfo.imageType = VK_IMAGE_TYPE_2D;
 	imageInfo.extent.width = width;
 	imageInfo.extent.height = height;
 	imageInfo.extent.depth = 1;
-	imageInfo.mipLevels = 1;
+	imageInfo.mipLevels = mipLevels;
 	imageInfo.arrayLayers = 1;
 	imageInfo.format = format;
 	imageInfo.tiling = tiling;
@@ -1,7 +1,9 @@
 #pragma once
 #include "Core/includes.h"
 #include "Core/Defines.h"
+#include "CommandEncoder.h"
 #include <vector>
+#include <functional>
 
 static const unsigned int MAX_FRAMES_IN_FLIGHT = 2;
 
@@ -28,32 +30,104 @@ namespace VulkanProject
 		};
 
 		void SetClearColor(glm::vec4& color);
+		// Bound by the next draw, also when that is in a later frame
 		void BindPipeline(const VkPipeline& pipeline, const VkPipelineLayout layout);
 		const VkRenderPass GetRenderPass();
 		const VkDevice GetDevice();
 		const VkPhysicalDevice GetPhysicalDevice();
+		// Persisted between runs, pass to every pipeline creation
+		const VkPipelineCache GetPipelineCache();
+
+		// Features the device was created with, the optional ones are only on when the GPU has them
+		const VkPhysicalDeviceFeatures& GetEnabledFeatures();
 
 		void UploadBuffer(const VkBuffer* buffer, uint32_t sizeOfBuffer);
-		void UploadIndexedBuffer(const VkBuffer* buffer, VkBuffer indexBuffer, uint32_t sizeOfIndices);
+		// Dropped by the encoder when the buffers are already bound in the current command buffer
+		void BindGeometry(VkBuffer vertexBuffer, VkBuffer indexBuffer);
+		void DrawIndexed(const VkDrawIndexedIndirectCommand& command);
+		// drawCount tightly packed commands from offset, a single multi draw when the device supports it
+		void DrawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount);
 
 		void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
 		void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 
-		void BindDescriptors(std::vector<VkDescriptorSet> descriptors);
+		// Set 0 of the bound pipeline's layout
+		void BindDescriptors(VkDescriptorSet descriptors);
 
-		void CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+		// A memory type out of typeFilter with all the properties
+		uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+		void CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t mipLevels = 1, VkImageCreateFlags flags = 0);
 
 		VkCommandBuffer BeginSingleTimeCommands();
 		void EndSingleTimeCommands(VkCommandBuffer commandBuffer);
+		// Submits without waiting, the returned fence signals once the commands are done
+		VkFence SubmitSingleTimeCommands(VkCommandBuffer commandBuffer);
+		void FreeSingleTimeCommands(VkCommandBuffer commandBuffer, VkFence fence);
+
+		VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT, uint32_t mipLevels = 1, uint32_t baseMipLevel = 0);
+
+		const VkExtent2D GetSwapChainExtent();
+		// Pushes to the layout of the bound pipeline
+		void PushConstants(VkShaderStageFlags stages, uint32_t size, const void* values);
+		// The frame's command buffer, valid between BeginFrame and EndFrame. Inside a RecordParallel job the
+		// job's secondary command buffer.
+		VkCommandBuffer GetCommandBuffer();
+		// Tracks the binds of the command buffer GetCommandBuffer returns, binds recorded around it are not seen
+		CommandEncoder& GetEncoder();
+		// Issued and dropped binds of the last frame that was recorded completely, those of the secondary command
+		// buffers recorded during the frame included
+		const CommandEncoder::Stats& GetLastFrameStats();
+		// Ends the main render pass mid frame so compute work can read what has been drawn so far
+		void EndRenderPass();
+		// Continues the main render pass with what was drawn before EndRenderPass, the binds stay.
+		// The main render pass begins with the first command recorded into it.
+		void ResumeRenderPass();
+
+		// Jobs RecordParallel runs at once, 0 is every thread of the shared ThreadPool and the caller
+		void SetRecordingThreads(uint32_t threads);
+		uint32_t GetRecordingThreads();
+		// Runs job(i) for i in [0, jobCount) on the shared ThreadPool, each recording into its own secondary
+		// command buffer from a command pool per job and frame in flight, and executes them in order in the
+		// main render pass. Inside a job the Renderer functions record into the job's buffer; the pipeline of
+		// the last BindPipeline carries in, nothing else is bound and nothing carries out. Switching between
+		// inline and secondary contents breaks the main render pass, so record the parallel part in one go.
+		void RecordParallel(uint32_t jobCount, const std::function<void(uint32_t)>& job);
+
+		// A secondary command buffer that is recorded once and executed every frame, see ExecuteStatic
+		struct StaticRecording
+		{
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			// of the swap chain it was recorded for, 0 before it is recorded
+			uint32_t swapChain = 0;
 
-		VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT);
+			// Recorded again by the next ExecuteStatic, for when what it draws has changed
+			void Invalidate() { swapChain = 0; }
+		};
+		// Whether recording holds commands for the current swap chain, it is recorded again for a new one
+		bool IsRecorded(const StaticRecording& recording);
+		// Executes recording in the main render pass, recorded first by record unless IsRecorded. Inside record the
+		// Renderer functions record into it and nothing is bound at the start. Every frame in flight needs its own
+		// recordings, whatever they use has to stay alive and unchanged until they are invalidated.
+		void ExecuteStatic(StaticRecording& recording, const std::function<void()>& record);
+		// Once the device is done with it
+		void DestroyStaticRecording(StaticRecording& recording);
+		// Depth target of the main render pass, in DEPTH_STENCIL_ATTACHMENT_OPTIMAL outside of it.
+		// Recreated on resize.
+		VkFormat GetDepthFormat();
+		VkImage GetDepthImage();
+		VkImageView GetDepthView();
+		// Whether the depth format supports sampling, compute passes can only read it then
+		bool IsDepthSampled();
+		// Recorded into the frame's command buffer once the main render pass has ended, nullptr removes it
+		void SetPostPassCallback(std::function<void(VkCommandBuffer)> callback);
 		
 	}
 	class Graphics
 	{
 	public:
 		Graphics(Window* window);
-		void Init(uint& width, uint& height, std::string& name);
+		// The pipeline cache is read from pipelineCachePath and written back in Shutdown
+		void Init(uint& width, uint& height, std::string& name, const std::string& pipelineCachePath);
 		void Shutdown();
 		~Graphics();
 		
@@ -66,12 +140,15 @@ namespace VulkanProject
 		void ClearSwapChain();
 		void CreateImageViews();
 		void CreateFrameBuffers();
+		void CreatePipelineCache();
+		void SavePipelineCache();
 		
 	
 		// variables
 		//uint32_t m_CurrentFrame = 0;
 
 		Window* m_WindowInstance = nullptr;
+		std::string m_PipelineCachePath;
 		
 		// Vulkan specific objects
 		VkInstance m_Instance = nullptr;
@@ -100,10 +177,6 @@ namespace VulkanProject
 		
 		uint32_t m_ImageIndex;
 		VkResult m_Result;
-
-		VkImage m_DepthImage;
-		VkDeviceMemory m_DepthImageMemory;
-		VkImageView m_DepthImageView;
 	};
 }
 
@@ -0,0 +1,280 @@
+#include "MeshOptimizer.h"
+#include <unordered_map>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	// Attributes of a vertex without the alignment padding of the glm types, so it can be compared and hashed bytewise
+	struct VertexKey
+	{
+		float values[15];
+
+		VertexKey(const VulkanProject::Vertex& vertex)
+		{
+			memcpy(values + 0, &vertex.pos[0], sizeof(float) * 3);
+			memcpy(values + 3, &vertex.color[0], sizeof(float) * 3);
+			memcpy(values + 6, &vertex.texCoord[0], sizeof(float) * 2);
+			memcpy(values + 8, &vertex.normal[0], sizeof(float) * 3);
+			memcpy(values + 11, &vertex.tangent[0], sizeof(float) * 4);
+		}
+
+		bool operator==(const VertexKey& other) const { return memcmp(values, other.values, sizeof(values)) == 0; }
+	};
+
+	struct VertexKeyHash
+	{
+		size_t operator()(const VertexKey& key) const
+		{
+			uint64_t hash = 0xcbf29ce484222325ull;
+			for (float value : key.values)
+			{
+				uint32_t bits;
+				memcpy(&bits, &value, sizeof(bits));
+				hash = (hash ^ bits) * 0x100000001b3ull;
+			}
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	const int c_CacheSize = 32;
+	const float c_CacheDecayPower = 1.5f;
+	const float c_LastTriangleScore = 0.75f;
+	const float c_ValenceBoostScale = 2.0f;
+	const float c_ValenceBoostPower = 0.5f;
+
+	float GetVertexScore(int cachePosition, uint32_t remainingTriangles)
+	{
+		// Vertices without triangles left are never picked again
+		if (remainingTriangles == 0)
+		{
+			return -1.0f;
+		}
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			// The three vertices of the last triangle get a fixed score so the next triangle does not simply reuse them
+			if (cachePosition < 3)
+			{
+				score = c_LastTriangleScore;
+			}
+			else
+			{
+				const float scaler = 1.0f / (c_CacheSize - 3);
+				score = powf(1.0f - (cachePosition - 3) * scaler, c_CacheDecayPower);
+			}
+		}
+
+		// Boost vertices with few triangles left so they are finished instead of leaving lone triangles behind
+		score += c_ValenceBoostScale * powf(static_cast<float>(remainingTriangles), -c_ValenceBoostPower);
+		return score;
+	}
+}
+
+void VulkanProject::MeshOptimizer::WeldVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	std::unordered_map<VertexKey, uint32_t, VertexKeyHash> unique;
+	unique.reserve(vertices.size());
+
+	std::vector<uint32_t> remap(vertices.size());
+	std::vector<Vertex> welded;
+	welded.reserve(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		auto result = unique.emplace(VertexKey(vertices[i]), static_cast<uint32_t>(welded.size()));
+		if (result.second)
+		{
+			welded.push_back(vertices[i]);
+		}
+		remap[i] = result.first->second;
+	}
+
+	for (auto& index : indices)
+	{
+		index = remap[index];
+	}
+	vertices = std::move(welded);
+}
+
+void VulkanProject::MeshOptimizer::OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Triangles adjacent to every vertex, as ranges into one array
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	for (uint32_t index : indices)
+	{
+		remaining[index]++;
+	}
+	std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		adjacencyOffset[i + 1] = adjacencyOffset[i] + remaining[i];
+	}
+	std::vector<uint32_t> adjacency(indices.size());
+	{
+		std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		vertexScore[i] = GetVertexScore(-1, remaining[i]);
+	}
+
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<float> triangleScore(triangleCount);
+	for (size_t i = 0; i < triangleCount; i++)
+	{
+		triangleScore[i] = vertexScore[indices[i * 3 + 0]] + vertexScore[indices[i * 3 + 1]] + vertexScore[indices[i * 3 + 2]];
+	}
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+
+	// One extra slot for the vertices pushed out of the cache by the latest triangle
+	std::vector<uint32_t> cache;
+	cache.reserve(c_CacheSize + 3);
+
+	size_t bestTriangle = 0;
+	float bestScore = triangleScore[0];
+	for (size_t i = 1; i < triangleCount; i++)
+	{
+		if (triangleScore[i] > bestScore)
+		{
+			bestScore = triangleScore[i];
+			bestTriangle = i;
+		}
+	}
+	size_t scanStart = 0;
+
+	for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+	{
+		// Fall back to the best remaining triangle when no triangle near the cache was found
+		if (bestTriangle == triangleCount)
+		{
+			bestScore = -1.0f;
+			while (scanStart < triangleCount && emitted[scanStart])
+			{
+				scanStart++;
+			}
+			for (size_t i = scanStart; i < triangleCount; i++)
+			{
+				if (!emitted[i] && triangleScore[i] > bestScore)
+				{
+					bestScore = triangleScore[i];
+					bestTriangle = i;
+				}
+			}
+		}
+
+		const uint32_t* triangle = &indices[bestTriangle * 3];
+		output.insert(output.end(), triangle, triangle + 3);
+		emitted[bestTriangle] = true;
+
+		// Move the triangle's vertices to the front of the cache
+		std::vector<uint32_t> newCache(triangle, triangle + 3);
+		for (uint32_t vertex : cache)
+		{
+			if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2])
+			{
+				newCache.push_back(vertex);
+			}
+		}
+
+		for (int v = 0; v < 3; v++)
+		{
+			uint32_t vertex = triangle[v];
+			uint32_t* begin = &adjacency[adjacencyOffset[vertex]];
+			uint32_t* end = begin + remaining[vertex];
+			uint32_t* found = std::find(begin, end, static_cast<uint32_t>(bestTriangle));
+			std::swap(*found, *(end - 1));
+			remaining[vertex]--;
+		}
+
+		// Update the scores of everything that was or still is in the cache
+		for (size_t i = 0; i < newCache.size(); i++)
+		{
+			uint32_t vertex = newCache[i];
+			cachePosition[vertex] = i < c_CacheSize ? static_cast<int>(i) : -1;
+			vertexScore[vertex] = GetVertexScore(cachePosition[vertex], remaining[vertex]);
+		}
+
+		bestTriangle = triangleCount;
+		bestScore = -1.0f;
+		for (size_t i = 0; i < newCache.size(); i++)
+		{
+			uint32_t vertex = newCache[i];
+			for (uint32_t a = 0; a < remaining[vertex]; a++)
+			{
+				uint32_t candidate = adjacency[adjacencyOffset[vertex] + a];
+				float score = vertexScore[indices[candidate * 3 + 0]] + vertexScore[indices[candidate * 3 + 1]] + vertexScore[indices[candidate * 3 + 2]];
+				triangleScore[candidate] = score;
+				if (score > bestScore)
+				{
+					bestScore = score;
+					bestTriangle = candidate;
+				}
+			}
+		}
+
+		if (newCache.size() > c_CacheSize)
+		{
+			newCache.resize(c_CacheSize);
+		}
+		cache = std::move(newCache);
+	}
+
+	indices = std::move(output);
+}
+
+void VulkanProject::MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	const uint32_t unused = 0xFFFFFFFF;
+	std::vector<uint32_t> remap(vertices.size(), unused);
+	std::vector<Vertex> ordered;
+	ordered.reserve(vertices.size());
+
+	for (auto& index : indices)
+	{
+		if (remap[index] == unused)
+		{
+			remap[index] = static_cast<uint32_t>(ordered.size());
+			ordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+	vertices = std::move(ordered);
+}
+
+float VulkanProject::MeshOptimizer::GetACMR(const std::vector<uint32_t>& indices, size_t vertexCount, unsigned int cacheSize)
+{
+	if (indices.size() < 3)
+	{
+		return 0.0f;
+	}
+
+	// Timestamp FIFO: a vertex is in the cache while fewer than cacheSize misses happened since it was loaded
+	std::vector<uint64_t> loadedAt(vertexCount, 0);
+	uint64_t misses = 0;
+	for (uint32_t index : indices)
+	{
+		if (loadedAt[index] == 0 || misses - loadedAt[index] + 1 > cacheSize)
+		{
+			misses++;
+			loadedAt[index] = misses;
+		}
+	}
+	return static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+}
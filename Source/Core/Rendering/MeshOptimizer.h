@@ -0,0 +1,23 @@
+#pragma once
+#include "Texture.h"
+#include <vector>
+#include <cstdint>
+
+namespace VulkanProject
+{
+    // Offline mesh processing, all functions work on indexed triangle lists
+    namespace MeshOptimizer
+    {
+        // Merges vertices with identical attributes and rewrites the indices to match
+        void WeldVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+        // Reorders triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm)
+        void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+        // Reorders vertices in the order the indices first use them and drops unreferenced ones
+        void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+        // Average number of vertex shader invocations per triangle for a FIFO cache of cacheSize entries
+        float GetACMR(const std::vector<uint32_t>& indices, size_t vertexCount, unsigned int cacheSize = 16);
+    }
+}
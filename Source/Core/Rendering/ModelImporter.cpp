@@ -0,0 +1,1104 @@
+#include "ModelImporter.h"
+#include "Core/MappedFile.h"
+#include "Core/AssetCache.h"
+#include "Core/ThreadPool.h"
+#include "Core/IOService.h"
+
+// Define these only in *one* .cc file.
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+// External images are read and decoded by Texture, tinygltf does not need to read them as well
+#define TINYGLTF_NO_EXTERNAL_IMAGE
+// #define TINYGLTF_NOEXCEPTION // optional. disable exception handling.
+#include "tiny_gltf.h"
+
+#include <stdexcept>
+#include <filesystem>
+#include <algorithm>
+
+void CalculateTangent(std::vector<VulkanProject::Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+	for (unsigned int i = 0; i < indices.size(); i += 3)
+	{
+		auto& vertex1 = vertices[indices[i + 0]];
+		auto& vertex2 = vertices[indices[i + 1]];
+		auto& vertex3 = vertices[indices[i + 2]];
+
+		glm::vec3 positionVertex1 = vertex1.pos;
+		glm::vec3 positionVertex2 = vertex2.pos;
+		glm::vec3 positionVertex3 = vertex3.pos;
+
+		glm::vec2 texCoordVertex1 = vertex1.texCoord;
+		glm::vec2 texCoordVertex2 = vertex2.texCoord;
+		glm::vec2 texCoordVertex3 = vertex3.texCoord;
+
+		glm::vec3 tangent;
+
+		// Edges of the triangle : position delta
+		glm::vec3 deltaPos1 = positionVertex2 - positionVertex1;
+		glm::vec3 deltaPos2 = positionVertex3 - positionVertex1;
+
+		// UV delta
+		glm::vec2 deltaUV1 = texCoordVertex2 - texCoordVertex1;
+		glm::vec2 deltaUV2 = texCoordVertex3 - texCoordVertex1;
+
+		float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
+		tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r;
+
+		tangent = glm::normalize(tangent);
+
+		glm::vec3 tangentVertex1 = vertex1.tangent;
+		glm::vec3 tangentVertex2 = vertex2.tangent;
+		glm::vec3 tangentVertex3 = vertex3.tangent;
+
+		tangentVertex1 += tangent;
+		tangentVertex2 += tangent;
+		tangentVertex3 += tangent;
+
+		tangentVertex1 = glm::normalize(tangentVertex1);
+		tangentVertex2 = glm::normalize(tangentVertex2);
+		tangentVertex3 = glm::normalize(tangentVertex3);
+
+		//wrong
+		vertex1.tangent = glm::vec4(tangentVertex1, 0.f);
+		vertex2.tangent = glm::vec4(tangentVertex2, 0.f);
+		vertex3.tangent = glm::vec4(tangentVertex3, 0.f);
+	
+	}
+}
+void CalculateNormal(std::vector<VulkanProject::Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+	for (unsigned int i = 0; i < indices.size(); i += 3)
+	{
+		auto& vertex1 = vertices[indices[i + 0]];
+		auto& vertex2 = vertices[indices[i + 1]];
+		auto& vertex3 = vertices[indices[i + 2]];
+
+		glm::vec3 positionVertex1 = { vertex1.pos[0], vertex1.pos[1], vertex1.pos[2] };
+		glm::vec3 positionVertex2 = { vertex2.pos[0], vertex2.pos[1], vertex2.pos[2] };
+		glm::vec3 positionVertex3 = { vertex3.pos[0], vertex3.pos[1], vertex3.pos[2] };
+
+
+		glm::vec3 v1v2 = positionVertex2 - positionVertex1;
+		glm::vec3 v1v3 = positionVertex3 - positionVertex1;
+
+		glm::vec3 normal;
+		normal = glm::cross(v1v2, v1v3);
+		normal = glm::normalize(normal);
+
+		glm::vec3 normalVertex1 = { vertex1.normal[0], vertex1.normal[1], vertex1.normal[2] };
+		glm::vec3 normalVertex2 = { vertex2.normal[0], vertex2.normal[1], vertex2.normal[2] };
+		glm::vec3 normalVertex3 = { vertex3.normal[0], vertex3.normal[1], vertex3.normal[2] };
+
+		normalVertex1 += normal;
+		normalVertex2 += normal;
+		normalVertex3 += normal;
+
+		normalVertex1 = glm::normalize(normalVertex1);
+		normalVertex2 = glm::normalize(normalVertex2);
+		normalVertex3 = glm::normalize(normalVertex3);
+
+		vertex1.normal[0] = normalVertex1.x;
+		vertex1.normal[1] = normalVertex1.y;
+		vertex1.normal[2] = normalVertex1.z;
+
+		vertex2.normal[0] = normalVertex2.x;
+		vertex2.normal[1] = normalVertex2.y;
+		vertex2.normal[2] = normalVertex2.z;
+
+		vertex3.normal[0] = normalVertex3.x;
+		vertex3.normal[1] = normalVertex3.y;
+		vertex3.normal[2] = normalVertex3.z;
+
+
+	}
+}
+bool GetData(std::vector<VulkanProject::Vertex>& vertices, const tinygltf::Primitive& primitive, const tinygltf::Model& model, const std::vector<const unsigned char*>& bufferData, std::string type, int numFloats, size_t vertexCount)
+{
+	int accessorIndex = -1;
+
+	if (primitive.attributes.find(type.c_str()) != primitive.attributes.end())
+	{
+		accessorIndex = primitive.attributes.at(type.c_str());
+	}
+	else
+	{
+		return false;
+	}
+	const auto& Accessor = model.accessors[accessorIndex];
+	const auto& BufferView = model.bufferViews[Accessor.bufferView];
+	const unsigned char* Buffer = bufferData[BufferView.buffer];
+
+	//vertices.resize(vertexCount);
+
+	int Stride = Accessor.ByteStride(BufferView);
+	if (vertexCount != Accessor.count)
+	{
+		throw std::runtime_error("Accessor does not allign with positionAccessor");
+	}
+
+	for (int i = 0; i < vertexCount; i++)
+	{
+		size_t index = BufferView.byteOffset + Accessor.byteOffset + i * Stride;
+
+		if (type == "TEXCOORD_0")
+		{
+			vertices[i].texCoord.x = *(float*)(&Buffer[index + sizeof(float) * 0]);
+			vertices[i].texCoord.y = *(float*)(&Buffer[index + sizeof(float) * 1]);
+		}
+		else if (type == "POSITION")
+		{
+			vertices[i].pos.x = *(float*)(&Buffer[index + sizeof(float) * 0]);
+			vertices[i].pos.y = *(float*)(&Buffer[index + sizeof(float) * 1]);
+			vertices[i].pos.z = *(float*)(&Buffer[index + sizeof(float) * 2]);
+		}
+		else if (type == "NORMAL")
+		{
+			vertices[i].normal.x = *(float*)(&Buffer[index + sizeof(float) * 0]);
+			vertices[i].normal.y = *(float*)(&Buffer[index + sizeof(float) * 1]);
+			vertices[i].normal.z = *(float*)(&Buffer[index + sizeof(float) * 2]);
+		}
+		else if (type == "TANGENT")
+		{
+			vertices[i].tangent[0] = *(float*)(&Buffer[index + sizeof(float) * 0]);
+			vertices[i].tangent[1] = *(float*)(&Buffer[index + sizeof(float) * 1]);
+			vertices[i].tangent[2] = *(float*)(&Buffer[index + sizeof(float) * 2]);
+			vertices[i].tangent[3] = *(float*)(&Buffer[index + sizeof(float) * 3]);
+
+		}
+	}
+
+	return true;
+}
+
+enum class eTextureTypes
+{
+	Diffuse = 0,
+	Normal = 1,
+	Metalic_Roughness = 2
+};
+
+VkSamplerAddressMode GetAddressMode(int wrap)
+{
+	switch (wrap)
+	{
+	case TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE: return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	case TINYGLTF_TEXTURE_WRAP_MIRRORED_REPEAT: return VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
+	default: return VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	}
+}
+
+// Filters the file leaves undefined stay trilinear
+VulkanProject::SamplerState GetSamplerState(const tinygltf::Sampler& sampler)
+{
+	VulkanProject::SamplerState state;
+	state.addressModeU = GetAddressMode(sampler.wrapS);
+	state.addressModeV = GetAddressMode(sampler.wrapT);
+	if (sampler.magFilter == TINYGLTF_TEXTURE_FILTER_NEAREST)
+	{
+		state.magFilter = VK_FILTER_NEAREST;
+	}
+	switch (sampler.minFilter)
+	{
+	case TINYGLTF_TEXTURE_FILTER_NEAREST:
+		state.minFilter = VK_FILTER_NEAREST;
+		state.maxLod = 0.0f;
+		break;
+	case TINYGLTF_TEXTURE_FILTER_LINEAR:
+		state.maxLod = 0.0f;
+		break;
+	case TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_NEAREST:
+		state.minFilter = VK_FILTER_NEAREST;
+		state.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		break;
+	case TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_NEAREST:
+		state.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		break;
+	case TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_LINEAR:
+		state.minFilter = VK_FILTER_NEAREST;
+		break;
+	}
+	// Point sampled textures are usually pixel art, anisotropy would blur them again
+	if (state.magFilter == VK_FILTER_NEAREST || state.minFilter == VK_FILTER_NEAREST)
+	{
+		state.anisotropyEnable = VK_FALSE;
+	}
+	return state;
+}
+
+VulkanProject::PipelineState GetMaterialState(const tinygltf::Material& material)
+{
+	VulkanProject::PipelineState state;
+	if (material.doubleSided)
+	{
+		state.cullMode = VK_CULL_MODE_NONE;
+	}
+	// Still tested against the depth of the opaque surfaces, but blended surfaces do not hide each other
+	if (material.alphaMode == "BLEND")
+	{
+		state.blendEnable = VK_TRUE;
+		state.depthWriteEnable = VK_FALSE;
+	}
+	if (material.alphaMode == "MASK")
+	{
+		state.SetConstant(VulkanProject::eMaterialConstant::AlphaMask, 1u);
+		state.SetFloatConstant(VulkanProject::eMaterialConstant::AlphaCutoff, static_cast<float>(material.alphaCutoff));
+	}
+	return state;
+}
+
+VulkanProject::TextureSource GetTextureSourceforPrimitive(const tinygltf::Primitive& primitive, const tinygltf::Model& model, const std::vector<const unsigned char*>& bufferData, std::string filepath, eTextureTypes type)
+{
+	std::filesystem::path fullPath = filepath;
+	std::string textureName;
+	int imageIndex = -1;
+	int textureIndex = -1;
+	// The slot decides how the image is decoded
+	VulkanProject::eTextureUsage usage = VulkanProject::eTextureUsage::Color;
+	switch (type)
+	{
+	case eTextureTypes::Diffuse:
+	{
+
+		textureIndex = model.materials[primitive.material].pbrMetallicRoughness.baseColorTexture.index;
+
+		break;
+	}
+	case eTextureTypes::Normal:
+	{
+
+		textureIndex = model.materials[primitive.material].normalTexture.index;
+		usage = VulkanProject::eTextureUsage::Normal;
+
+		break;
+	}
+	case eTextureTypes::Metalic_Roughness:
+	{
+
+
+		textureIndex = model.materials[primitive.material].pbrMetallicRoughness.metallicRoughnessTexture.index;
+		usage = VulkanProject::eTextureUsage::MetallicRoughness;
+
+		break;
+	}
+	}
+
+
+	imageIndex = model.textures[textureIndex].source;
+	const auto& image = model.images[imageIndex];
+
+	VulkanProject::TextureSource source;
+	source.usage = usage;
+	if (model.textures[textureIndex].sampler >= 0 && model.textures[textureIndex].sampler < static_cast<int>(model.samplers.size()))
+	{
+		source.sampler = GetSamplerState(model.samplers[model.textures[textureIndex].sampler]);
+	}
+	// Embedded images (.glb) point straight into the loaded buffer
+	if (image.bufferView != -1)
+	{
+		const auto& bufferView = model.bufferViews[image.bufferView];
+		source.data = bufferData[bufferView.buffer] + bufferView.byteOffset;
+		source.size = bufferView.byteLength;
+		return source;
+	}
+
+	textureName = image.uri;
+	source.path = fullPath.parent_path().string() + "/" + textureName;
+
+	
+	return source;
+}
+
+namespace
+{
+	const uint32_t c_GLBMagic = 0x46546C67; // "glTF"
+	const uint32_t c_GLBChunkJSON = 0x4E4F534A;
+	const uint32_t c_GLBChunkBIN = 0x004E4942;
+
+	int GetInt(const nlohmann::json& object, const char* key, int fallback)
+	{
+		auto it = object.find(key);
+		return it != object.end() && it->is_number_integer() ? it->get<int>() : fallback;
+	}
+
+	size_t GetSize(const nlohmann::json& object, const char* key, size_t fallback)
+	{
+		auto it = object.find(key);
+		return it != object.end() && it->is_number_unsigned() ? it->get<size_t>() : fallback;
+	}
+
+	std::string GetString(const nlohmann::json& object, const char* key)
+	{
+		auto it = object.find(key);
+		return it != object.end() && it->is_string() ? it->get<std::string>() : std::string();
+	}
+
+	bool GetBool(const nlohmann::json& object, const char* key, bool fallback)
+	{
+		auto it = object.find(key);
+		return it != object.end() && it->is_boolean() ? it->get<bool>() : fallback;
+	}
+
+	std::vector<double> GetNumbers(const nlohmann::json& object, const char* key)
+	{
+		std::vector<double> numbers;
+		auto it = object.find(key);
+		if (it != object.end() && it->is_array())
+		{
+			for (const auto& number : *it)
+			{
+				numbers.push_back(number.get<double>());
+			}
+		}
+		return numbers;
+	}
+
+	std::vector<int> GetInts(const nlohmann::json& object, const char* key)
+	{
+		std::vector<int> ints;
+		auto it = object.find(key);
+		if (it != object.end() && it->is_array())
+		{
+			for (const auto& number : *it)
+			{
+				ints.push_back(number.get<int>());
+			}
+		}
+		return ints;
+	}
+
+	int GetTextureIndex(const nlohmann::json& object, const char* key)
+	{
+		auto it = object.find(key);
+		return it != object.end() && it->is_object() ? GetInt(*it, "index", -1) : -1;
+	}
+
+	const nlohmann::json& GetArray(const nlohmann::json& root, const char* key)
+	{
+		static const nlohmann::json empty = nlohmann::json::array();
+		auto it = root.find(key);
+		return it != root.end() && it->is_array() ? *it : empty;
+	}
+
+	int GetAccessorType(const std::string& type)
+	{
+		if (type == "SCALAR") return TINYGLTF_TYPE_SCALAR;
+		if (type == "VEC2") return TINYGLTF_TYPE_VEC2;
+		if (type == "VEC3") return TINYGLTF_TYPE_VEC3;
+		if (type == "VEC4") return TINYGLTF_TYPE_VEC4;
+		if (type == "MAT2") return TINYGLTF_TYPE_MAT2;
+		if (type == "MAT3") return TINYGLTF_TYPE_MAT3;
+		if (type == "MAT4") return TINYGLTF_TYPE_MAT4;
+		return -1;
+	}
+
+	// -1 is allowed where the glTF property is optional
+	bool IsIndex(int index, size_t count, bool optional)
+	{
+		return (optional && index == -1) || (index >= 0 && static_cast<size_t>(index) < count);
+	}
+
+	// GetData reads floats only, the index reads take the integer types. Anything else would be read as the
+	// wrong type and past the range its accessor was checked for.
+	bool IsReadable(const std::string& attribute, const tinygltf::Accessor& accessor)
+	{
+		if (attribute == "POSITION" || attribute == "NORMAL")
+		{
+			return accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && accessor.type == TINYGLTF_TYPE_VEC3;
+		}
+		if (attribute == "TEXCOORD_0")
+		{
+			return accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && accessor.type == TINYGLTF_TYPE_VEC2;
+		}
+		if (attribute == "TANGENT")
+		{
+			return accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && accessor.type == TINYGLTF_TYPE_VEC4;
+		}
+		// attributes the importer does not read
+		return true;
+	}
+
+	bool IsReadableIndices(const tinygltf::Accessor& accessor)
+	{
+		return accessor.type == TINYGLTF_TYPE_SCALAR &&
+			(accessor.componentType == TINYGLTF_COMPONENT_TYPE_SHORT || accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT ||
+			accessor.componentType == TINYGLTF_COMPONENT_TYPE_INT || accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT);
+	}
+
+	// Reads the JSON chunk of a mapped .glb into the parts of tinygltf::Model the importer uses.
+	// Accessors and embedded images are left in the BIN chunk and read through bufferData, nothing is copied.
+	// Returns false for files this path does not handle (external or data uri buffers, sparse accessors), tinygltf loads those.
+	// Every index and accessor the importer follows is checked, a malformed file throws instead of reading out of range.
+	bool ParseGLBView(const VulkanProject::MappedFile& file, tinygltf::Model& model, std::vector<const unsigned char*>& bufferData)
+	{
+		const unsigned char* bytes = file.GetData();
+		size_t size = file.GetSize();
+
+		uint32_t header[5];
+		if (size < sizeof(header))
+		{
+			throw std::runtime_error("Failed to parse glTF: file is too small for a .glb");
+		}
+		memcpy(header, bytes, sizeof(header));
+
+		const uint32_t length = header[2];
+		const uint32_t jsonLength = header[3];
+		if (header[0] != c_GLBMagic || header[1] != 2 || header[4] != c_GLBChunkJSON || length > size || sizeof(header) + static_cast<uint64_t>(jsonLength) > length)
+		{
+			throw std::runtime_error("Failed to parse glTF: invalid .glb header");
+		}
+
+		const unsigned char* binData = nullptr;
+		size_t binSize = 0;
+		size_t binChunk = sizeof(header) + jsonLength;
+		if (binChunk + 8 <= length)
+		{
+			uint32_t chunk[2];
+			memcpy(chunk, bytes + binChunk, sizeof(chunk));
+			if (chunk[1] != c_GLBChunkBIN || binChunk + 8 + static_cast<uint64_t>(chunk[0]) > length)
+			{
+				throw std::runtime_error("Failed to parse glTF: invalid .glb BIN chunk");
+			}
+			binData = bytes + binChunk + 8;
+			binSize = chunk[0];
+		}
+
+		nlohmann::json root;
+		try
+		{
+			root = nlohmann::json::parse(bytes + sizeof(header), bytes + sizeof(header) + jsonLength);
+		}
+		catch (const std::exception& e)
+		{
+			throw std::runtime_error(std::string("Failed to parse glTF: ") + e.what());
+		}
+
+		for (const auto& object : GetArray(root, "buffers"))
+		{
+			if (object.contains("uri") || binData == nullptr || model.buffers.size() > 0)
+			{
+				return false;
+			}
+			tinygltf::Buffer buffer;
+			if (GetSize(object, "byteLength", 0) > binSize)
+			{
+				throw std::runtime_error("Failed to parse glTF: buffer is larger than the BIN chunk");
+			}
+			model.buffers.push_back(buffer);
+			bufferData.push_back(binData);
+		}
+
+		for (const auto& object : GetArray(root, "bufferViews"))
+		{
+			tinygltf::BufferView bufferView;
+			bufferView.buffer = GetInt(object, "buffer", -1);
+			bufferView.byteOffset = GetSize(object, "byteOffset", 0);
+			bufferView.byteLength = GetSize(object, "byteLength", 0);
+			bufferView.byteStride = GetSize(object, "byteStride", 0);
+			if (bufferView.buffer < 0 || bufferView.buffer >= static_cast<int>(model.buffers.size()) ||
+				bufferView.byteOffset > binSize || bufferView.byteLength > binSize - bufferView.byteOffset)
+			{
+				throw std::runtime_error("Failed to parse glTF: bufferView out of range");
+			}
+			model.bufferViews.push_back(bufferView);
+		}
+
+		for (const auto& object : GetArray(root, "accessors"))
+		{
+			if (object.contains("sparse"))
+			{
+				return false;
+			}
+			tinygltf::Accessor accessor;
+			accessor.bufferView = GetInt(object, "bufferView", -1);
+			accessor.byteOffset = GetSize(object, "byteOffset", 0);
+			accessor.componentType = GetInt(object, "componentType", -1);
+			accessor.count = GetSize(object, "count", 0);
+			accessor.type = GetAccessorType(GetString(object, "type"));
+			if (accessor.bufferView < 0 || accessor.bufferView >= static_cast<int>(model.bufferViews.size()))
+			{
+				throw std::runtime_error("Failed to parse glTF: accessor without a valid bufferView");
+			}
+
+			// Every element has to be inside the bufferView, reads go straight to the mapping. Indices are read
+			// tightly packed, which stays inside as long as elements do not overlap.
+			const auto& bufferView = model.bufferViews[accessor.bufferView];
+			int stride = accessor.ByteStride(bufferView);
+			int elementSize = tinygltf::GetComponentSizeInBytes(accessor.componentType) * tinygltf::GetNumComponentsInType(accessor.type);
+			if (stride <= 0 || elementSize <= 0 || stride < elementSize ||
+				(accessor.count > 0 && accessor.byteOffset + static_cast<uint64_t>(stride) * (accessor.count - 1) + elementSize > bufferView.byteLength))
+			{
+				throw std::runtime_error("Failed to parse glTF: accessor out of range");
+			}
+			model.accessors.push_back(accessor);
+		}
+
+		for (const auto& object : GetArray(root, "meshes"))
+		{
+			tinygltf::Mesh mesh;
+			for (const auto& primitiveObject : GetArray(object, "primitives"))
+			{
+				tinygltf::Primitive primitive;
+				primitive.indices = GetInt(primitiveObject, "indices", -1);
+				primitive.material = GetInt(primitiveObject, "material", -1);
+				primitive.mode = GetInt(primitiveObject, "mode", TINYGLTF_MODE_TRIANGLES);
+				auto attributes = primitiveObject.find("attributes");
+				if (attributes != primitiveObject.end() && attributes->is_object())
+				{
+					for (auto it = attributes->begin(); it != attributes->end(); ++it)
+					{
+						int accessor = it.value().get<int>();
+						if (!IsIndex(accessor, model.accessors.size(), false))
+						{
+							throw std::runtime_error("Failed to parse glTF: attribute accessor out of range");
+						}
+						if (!IsReadable(it.key(), model.accessors[accessor]))
+						{
+							throw std::runtime_error("Failed to parse glTF: unsupported " + it.key() + " accessor type");
+						}
+						primitive.attributes[it.key()] = accessor;
+					}
+				}
+				// ImportGeometry reads both unconditionally
+				if (primitive.attributes.count("POSITION") == 0)
+				{
+					throw std::runtime_error("Failed to parse glTF: primitive without POSITION");
+				}
+				if (!IsIndex(primitive.indices, model.accessors.size(), false))
+				{
+					throw std::runtime_error("Failed to parse glTF: primitive without a valid index accessor");
+				}
+				if (!IsReadableIndices(model.accessors[primitive.indices]))
+				{
+					throw std::runtime_error("Failed to parse glTF: unsupported index accessor type");
+				}
+				mesh.primitives.push_back(primitive);
+			}
+			model.meshes.push_back(mesh);
+		}
+
+		for (const auto& object : GetArray(root, "materials"))
+		{
+			tinygltf::Material material;
+			auto pbr = object.find("pbrMetallicRoughness");
+			if (pbr != object.end() && pbr->is_object())
+			{
+				material.pbrMetallicRoughness.baseColorTexture.index = GetTextureIndex(*pbr, "baseColorTexture");
+				material.pbrMetallicRoughness.metallicRoughnessTexture.index = GetTextureIndex(*pbr, "metallicRoughnessTexture");
+			}
+			material.normalTexture.index = GetTextureIndex(object, "normalTexture");
+			material.doubleSided = GetBool(object, "doubleSided", false);
+			auto alphaMode = object.find("alphaMode");
+			if (alphaMode != object.end() && alphaMode->is_string())
+			{
+				material.alphaMode = alphaMode->get<std::string>();
+			}
+			auto alphaCutoff = object.find("alphaCutoff");
+			if (alphaCutoff != object.end() && alphaCutoff->is_number())
+			{
+				material.alphaCutoff = alphaCutoff->get<double>();
+			}
+			model.materials.push_back(material);
+		}
+
+		for (const auto& object : GetArray(root, "textures"))
+		{
+			tinygltf::Texture texture;
+			texture.source = GetInt(object, "source", -1);
+			texture.sampler = GetInt(object, "sampler", -1);
+			model.textures.push_back(texture);
+		}
+
+		for (const auto& object : GetArray(root, "samplers"))
+		{
+			tinygltf::Sampler sampler;
+			sampler.magFilter = GetInt(object, "magFilter", -1);
+			sampler.minFilter = GetInt(object, "minFilter", -1);
+			sampler.wrapS = GetInt(object, "wrapS", TINYGLTF_TEXTURE_WRAP_REPEAT);
+			sampler.wrapT = GetInt(object, "wrapT", TINYGLTF_TEXTURE_WRAP_REPEAT);
+			model.samplers.push_back(sampler);
+		}
+
+		for (const auto& object : GetArray(root, "images"))
+		{
+			tinygltf::Image image;
+			image.uri = GetString(object, "uri");
+			image.mimeType = GetString(object, "mimeType");
+			image.bufferView = GetInt(object, "bufferView", -1);
+			if (!IsIndex(image.bufferView, model.bufferViews.size(), true))
+			{
+				throw std::runtime_error("Failed to parse glTF: image bufferView out of range");
+			}
+			model.images.push_back(image);
+		}
+
+		for (const auto& object : GetArray(root, "nodes"))
+		{
+			tinygltf::Node node;
+			node.mesh = GetInt(object, "mesh", -1);
+			node.children = GetInts(object, "children");
+			node.matrix = GetNumbers(object, "matrix");
+			node.translation = GetNumbers(object, "translation");
+			node.rotation = GetNumbers(object, "rotation");
+			node.scale = GetNumbers(object, "scale");
+			model.nodes.push_back(node);
+		}
+
+		for (const auto& object : GetArray(root, "scenes"))
+		{
+			tinygltf::Scene scene;
+			scene.nodes = GetInts(object, "nodes");
+			model.scenes.push_back(scene);
+		}
+		model.defaultScene = GetInt(root, "scene", -1);
+
+		// Everything below refers to arrays parsed after it, checked once they are all there
+		for (const auto& mesh : model.meshes)
+		{
+			for (const auto& primitive : mesh.primitives)
+			{
+				if (!IsIndex(primitive.material, model.materials.size(), true))
+				{
+					throw std::runtime_error("Failed to parse glTF: material out of range");
+				}
+			}
+		}
+		for (const auto& material : model.materials)
+		{
+			for (int texture : { material.pbrMetallicRoughness.baseColorTexture.index, material.normalTexture.index, material.pbrMetallicRoughness.metallicRoughnessTexture.index })
+			{
+				if (!IsIndex(texture, model.textures.size(), true))
+				{
+					throw std::runtime_error("Failed to parse glTF: material texture out of range");
+				}
+			}
+		}
+		for (const auto& texture : model.textures)
+		{
+			if (!IsIndex(texture.source, model.images.size(), false) || !IsIndex(texture.sampler, model.samplers.size(), true))
+			{
+				throw std::runtime_error("Failed to parse glTF: texture source or sampler out of range");
+			}
+		}
+
+		// Every node is the child of at most one other and scene roots of none, so drawing from the roots ends
+		std::vector<int> parents(model.nodes.size(), 0);
+		for (const auto& node : model.nodes)
+		{
+			if (!IsIndex(node.mesh, model.meshes.size(), true))
+			{
+				throw std::runtime_error("Failed to parse glTF: node mesh out of range");
+			}
+			if ((node.matrix.size() != 0 && node.matrix.size() != 16) || (node.translation.size() != 0 && node.translation.size() != 3) ||
+				(node.rotation.size() != 0 && node.rotation.size() != 4) || (node.scale.size() != 0 && node.scale.size() != 3))
+			{
+				throw std::runtime_error("Failed to parse glTF: invalid node transform");
+			}
+			for (int child : node.children)
+			{
+				if (!IsIndex(child, model.nodes.size(), false) || ++parents[child] > 1)
+				{
+					throw std::runtime_error("Failed to parse glTF: node children out of range or not a tree");
+				}
+			}
+		}
+		for (const auto& scene : model.scenes)
+		{
+			for (int node : scene.nodes)
+			{
+				if (!IsIndex(node, model.nodes.size(), false) || parents[node] != 0)
+				{
+					throw std::runtime_error("Failed to parse glTF: scene node out of range or not a root");
+				}
+			}
+		}
+		if (!IsIndex(model.defaultScene, model.scenes.size(), true))
+		{
+			throw std::runtime_error("Failed to parse glTF: default scene out of range");
+		}
+
+		return true;
+	}
+}
+
+namespace
+{
+	// Bump when the generated vertices or indices change so stale cache entries are no longer found
+	const uint64_t c_GeometryImporterVersion = 1;
+
+	void HashAccessor(VulkanProject::Hasher& hasher, const tinygltf::Model& model, const std::vector<const unsigned char*>& bufferData, int accessorIndex)
+	{
+		if (accessorIndex < 0)
+		{
+			hasher.Add(uint64_t(0));
+			return;
+		}
+
+		const auto& accessor = model.accessors[accessorIndex];
+		const auto& bufferView = model.bufferViews[accessor.bufferView];
+		int stride = accessor.ByteStride(bufferView);
+		size_t elementSize = tinygltf::GetComponentSizeInBytes(accessor.componentType) * tinygltf::GetNumComponentsInType(accessor.type);
+		size_t size = accessor.count > 0 ? stride * (accessor.count - 1) + elementSize : 0;
+
+		hasher.Add(uint64_t(1)).Add(uint64_t(accessor.componentType)).Add(uint64_t(accessor.count)).Add(uint64_t(stride));
+		hasher.Add(bufferData[bufferView.buffer] + bufferView.byteOffset + accessor.byteOffset, size);
+	}
+
+	// tinygltf file callback, blocks on the read but leaves the I/O to the shared service
+	bool ReadWholeFile(std::vector<unsigned char>* out, std::string* err, const std::string& filepath, void*)
+	{
+		try
+		{
+			*out = VulkanProject::IOService::GetShared().Read(filepath).get();
+			return true;
+		}
+		catch (const std::exception& exception)
+		{
+			if (err)
+			{
+				*err += std::string(exception.what()) + "\n";
+			}
+			return false;
+		}
+	}
+
+	int FindAttribute(const tinygltf::Primitive& primitive, const char* name)
+	{
+		auto it = primitive.attributes.find(name);
+		return it != primitive.attributes.end() ? it->second : -1;
+	}
+
+	// Key of the processed geometry, covers every accessor the vertices and indices are built from
+	uint64_t GetGeometryKey(const tinygltf::Primitive& primitive, const tinygltf::Model& model, const std::vector<const unsigned char*>& bufferData)
+	{
+		VulkanProject::Hasher hasher;
+		hasher.Add(c_GeometryImporterVersion).Add(uint64_t(sizeof(VulkanProject::Vertex)));
+		HashAccessor(hasher, model, bufferData, primitive.indices);
+		HashAccessor(hasher, model, bufferData, FindAttribute(primitive, "POSITION"));
+		HashAccessor(hasher, model, bufferData, FindAttribute(primitive, "TEXCOORD_0"));
+		HashAccessor(hasher, model, bufferData, FindAttribute(primitive, "NORMAL"));
+		HashAccessor(hasher, model, bufferData, FindAttribute(primitive, "TANGENT"));
+		return hasher.Get();
+	}
+
+	bool LoadGeometry(uint64_t key, VulkanProject::ModelData::Primitive& primitiveData)
+	{
+		VulkanProject::AssetCache::Entry entry = VulkanProject::AssetCache::Load(key);
+		uint32_t counts[2];
+		if (!entry || entry.size < sizeof(counts))
+		{
+			return false;
+		}
+		memcpy(counts, entry.data, sizeof(counts));
+		if (entry.size != sizeof(counts) + sizeof(VulkanProject::Vertex) * static_cast<uint64_t>(counts[0]) + sizeof(uint32_t) * static_cast<uint64_t>(counts[1]))
+		{
+			return false;
+		}
+
+		primitiveData.vertices.resize(counts[0]);
+		primitiveData.indices.resize(counts[1]);
+		memcpy(primitiveData.vertices.data(), entry.data + sizeof(counts), sizeof(VulkanProject::Vertex) * counts[0]);
+		memcpy(primitiveData.indices.data(), entry.data + sizeof(counts) + sizeof(VulkanProject::Vertex) * counts[0], sizeof(uint32_t) * counts[1]);
+		return true;
+	}
+
+	void StoreGeometry(uint64_t key, const VulkanProject::ModelData::Primitive& primitiveData)
+	{
+		uint32_t counts[2] = { static_cast<uint32_t>(primitiveData.vertices.size()), static_cast<uint32_t>(primitiveData.indices.size()) };
+		size_t vertexSize = sizeof(VulkanProject::Vertex) * primitiveData.vertices.size();
+		size_t indexSize = sizeof(uint32_t) * primitiveData.indices.size();
+
+		std::vector<unsigned char> entry(sizeof(counts) + vertexSize + indexSize);
+		memcpy(entry.data(), counts, sizeof(counts));
+		memcpy(entry.data() + sizeof(counts), primitiveData.vertices.data(), vertexSize);
+		memcpy(entry.data() + sizeof(counts) + vertexSize, primitiveData.indices.data(), indexSize);
+		VulkanProject::AssetCache::Store(key, entry.data(), entry.size());
+	}
+
+	void ImportGeometry(const tinygltf::Primitive& primitive, const tinygltf::Model& model, const std::vector<const unsigned char*>& bufferData, VulkanProject::ModelData::Primitive& primitiveData)
+	{
+		using namespace VulkanProject;
+
+		std::vector<unsigned int> indices;
+		//calculating indices
+		{
+			const auto& accessor = model.accessors[primitive.indices];
+			const auto& bufferView = model.bufferViews[accessor.bufferView];
+			const unsigned char* buffer = bufferData[bufferView.buffer];
+
+			indices.resize(accessor.count);
+			for (int i = 0; i < accessor.count; i++)
+			{
+				size_t index = bufferView.byteOffset + accessor.byteOffset;
+
+				if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_SHORT)
+				{
+					indices[i] = static_cast<unsigned int>(*(short*)(&buffer[index + i * sizeof(short)]));
+
+				}
+				else if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
+				{
+					indices[i] = static_cast<unsigned int>(*(unsigned short*)(&buffer[index + i * sizeof(unsigned short)]));
+
+				}
+				else if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_INT)
+				{
+					indices[i] = static_cast<unsigned int>(*(int*)(&buffer[index + i * sizeof(int)]));
+
+				}
+				else if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
+				{
+					indices[i] = static_cast<unsigned int>(*(unsigned int*)(&buffer[index + i * sizeof(unsigned int)]));
+
+				}
+				else throw std::runtime_error("unsupported indices type");
+
+			}
+			//vertexData.numIndices = static_cast<unsigned int>(accessor.count);
+		}
+
+
+		std::vector<Vertex> vertices;
+		//calcualting vertices
+		{
+
+			const auto& positionAccessor = model.accessors[primitive.attributes.at("POSITION")];
+			size_t vertexCount = positionAccessor.count;
+			vertices.resize(vertexCount);
+			// The normal and tangent generation and the draw index the vertices with these
+			if (indices.size() % 3 != 0 || std::any_of(indices.begin(), indices.end(), [vertexCount](unsigned int index) { return index >= vertexCount; }))
+			{
+				throw std::runtime_error("Failed to parse glTF: indices are not triangles of the primitive's vertices");
+			}
+			GetData(vertices, primitive, model, bufferData, "POSITION", 3, vertexCount);
+
+			GetData(vertices, primitive, model, bufferData, "TEXCOORD_0", 2, vertexCount);
+
+			if (!GetData(vertices, primitive, model, bufferData, "NORMAL", 3, vertexCount))
+			{
+				CalculateNormal(vertices, indices);
+			};
+
+			if (!GetData(vertices, primitive, model, bufferData, "TANGENT", 3, vertexCount))
+			{
+				CalculateTangent(vertices, indices);
+			}
+
+
+
+		
+			//vertexData.numVertices = static_cast<unsigned int>(vertexCount);
+			//vertexData.vertexStrideInBytes = sizeof(Vertex);
+		}
+
+		primitiveData.vertices = std::move(vertices);
+		primitiveData.indices = std::move(indices);
+	}
+}
+
+VulkanProject::ModelData VulkanProject::ImportModel(const std::string& path)
+{
+	ModelData data;
+	tinygltf::Model model;
+	// Bytes of every glTF buffer, owned by tinygltf or a view into the mapped .glb
+	std::vector<const unsigned char*> bufferData;
+
+	bool loaded = false;
+	if (std::filesystem::path(path).extension() == ".glb")
+	{
+		auto file = std::make_shared<MappedFile>(path);
+		if (ParseGLBView(*file, model, bufferData))
+		{
+			data.source = file;
+			loaded = true;
+		}
+		else
+		{
+			model = tinygltf::Model();
+			bufferData.clear();
+		}
+	}
+
+	if (!loaded)
+	{
+		tinygltf::TinyGLTF loader;
+		std::string err;
+		std::string warn;
+
+		// Images are decoded by Texture from their own files, tinygltf would otherwise decode every image a second time
+		loader.SetImageLoader([](tinygltf::Image*, const int, std::string*, std::string*, int, int, const unsigned char*, int, void*) { return true; }, nullptr);
+
+		// The .gltf and its buffers are read through the I/O service
+		tinygltf::FsCallbacks callbacks{ &tinygltf::FileExists, &tinygltf::ExpandFilePath, &ReadWholeFile, &tinygltf::WriteWholeFile, nullptr };
+		loader.SetFsCallbacks(callbacks);
+
+		bool ret = false;
+		if (std::filesystem::path(path).extension() == ".glb")
+		{
+			ret = loader.LoadBinaryFromFile(&model, &err, &warn, path);
+		}
+		else
+		{
+			ret = loader.LoadASCIIFromFile(&model, &err, &warn, path);
+		}
+
+		if (!warn.empty()) 
+		{
+			printf("Warn: %s\n", warn.c_str());
+		}
+
+		if (!err.empty())
+		{
+			printf("Err: %s\n", err.c_str());
+		}
+
+		if (!ret) 
+		{
+			throw std::runtime_error("Failed to parse glTF");
+		}
+
+		for (auto& buffer : model.buffers)
+		{
+			data.buffers.push_back(std::move(buffer.data));
+			bufferData.push_back(data.buffers.back().data());
+		}
+	}
+
+	// Primitives are independent, each one is decoded on its own job
+	std::vector<std::pair<size_t, size_t>> primitiveIndices;
+	data.meshes.resize(model.meshes.size());
+	for (size_t i = 0; i < model.meshes.size(); i++)
+	{
+		data.meshes[i].resize(model.meshes[i].primitives.size());
+		for (size_t j = 0; j < model.meshes[i].primitives.size(); j++)
+		{
+			primitiveIndices.push_back({ i, j });
+		}
+	}
+
+	ThreadPool::GetShared().ParallelFor(primitiveIndices.size(), [&](size_t index)
+	{
+		const auto& primtive = model.meshes[primitiveIndices[index].first].primitives[primitiveIndices[index].second];
+		ModelData::Primitive& primitiveData = data.meshes[primitiveIndices[index].first][primitiveIndices[index].second];
+
+		// Decoding the accessors and generating normals and tangents is skipped when the cache has the result
+		uint64_t geometryKey = GetGeometryKey(primtive, model, bufferData);
+		if (!LoadGeometry(geometryKey, primitiveData))
+		{
+			ImportGeometry(primtive, model, bufferData, primitiveData);
+			StoreGeometry(geometryKey, primitiveData);
+		}
+
+		//textures
+		if (primtive.material != -1)
+		{
+			primitiveData.state = GetMaterialState(model.materials[primtive.material]);
+			// Each map is optional on its own, the shader permutation skips the ones that are missing
+			if (model.materials[primtive.material].pbrMetallicRoughness.baseColorTexture.index != -1)
+			{
+				primitiveData.texture = GetTextureSourceforPrimitive(primtive, model, bufferData, path, eTextureTypes::Diffuse);
+			}
+			if (model.materials[primtive.material].normalTexture.index != -1)
+			{
+				primitiveData.normalTexture = GetTextureSourceforPrimitive(primtive, model, bufferData, path, eTextureTypes::Normal);
+			}
+			if (model.materials[primtive.material].pbrMetallicRoughness.metallicRoughnessTexture.index != -1)
+			{
+				primitiveData.metalic_roughnessTexture = GetTextureSourceforPrimitive(primtive, model, bufferData, path, eTextureTypes::Metalic_Roughness);
+			}
+		}
+	});
+
+	data.nodes.resize(model.nodes.size());
+	for (int i = 0; i < model.nodes.size(); i++)
+	{
+		for (int j = 0; j < model.nodes[i].children.size(); j++)
+			data.nodes[i].children.push_back(model.nodes[i].children[j]);
+
+		data.nodes[i].mesh = model.nodes[i].mesh;
+
+		glm::mat4 transform;
+
+		if (model.nodes[i].matrix.size() > 0)
+		{
+			//float value[16] = { 0.f };
+			for (int j = 0; j < model.nodes[i].matrix.size(); j++)
+			{
+				//value[j] = static_cast<float>(model.nodes[i].matrix[j]);
+				transform = model.nodes[i].matrix[j];
+			}
+			//transform = DirectX::SimpleMath::Matrix(value);
+		}
+		// Asuming that scale and rotation are present when translation is
+		else
+		{
+			glm::vec3 translation = { 0.f,0.f,0.f };
+			glm::quat rotation;
+			glm::vec3 scale = { 1.f,1.f,1.f };
+			if (model.nodes[i].translation.size() > 0)
+			{
+				auto trans = model.nodes[i].translation;
+				translation = { static_cast<float>(trans[0]), static_cast<float>(trans[1]), static_cast<float>(trans[2]) };
+			}
+			if (model.nodes[i].rotation.size() > 0)
+			{
+				auto rot = model.nodes[i].rotation;
+				rotation = { static_cast<float>(rot[0]), static_cast<float>(rot[1]), static_cast<float>(rot[2]), static_cast<float>(rot[3]) };
+			}
+			if (model.nodes[i].scale.size() > 0)
+			{
+
+				scale = { static_cast<float>(model.nodes[i].scale[0]), static_cast<float>(model.nodes[i].scale[1]), static_cast<float>(model.nodes[i].scale[2]) };
+
+			}
+
+			glm::mat4 translationM = glm::translate(translationM, translation);
+			glm::mat4 rotationM = glm::toMat4(rotation);
+			glm::mat4 scaleM = glm::scale(scaleM, scale);
+			transform = transform * rotationM * scaleM;
+		
+		}
+		data.nodes[i].transform = transform;
+	}
+	// Without a default scene the first one is shown, a file without scenes has nothing to show
+	int scene = model.defaultScene >= 0 ? model.defaultScene : 0;
+	if (scene < static_cast<int>(model.scenes.size()))
+	{
+		for (int i = 0; i < model.scenes[scene].nodes.size(); i++)
+		{
+			data.rootNodes.push_back(model.scenes[scene].nodes[i]);
+		}
+	}
+
+	auto addDependency = [&](const std::string& dependency)
+	{
+		if (std::find(data.dependencies.begin(), data.dependencies.end(), dependency) == data.dependencies.end())
+		{
+			data.dependencies.push_back(dependency);
+		}
+	};
+	addDependency(path);
+	for (const auto& buffer : model.buffers)
+	{
+		if (!buffer.uri.empty() && buffer.uri.rfind("data:", 0) != 0)
+		{
+			addDependency(std::filesystem::path(path).parent_path().string() + "/" + buffer.uri);
+		}
+	}
+	for (const auto& mesh : data.meshes)
+	{
+		for (const auto& primitive : mesh)
+		{
+			for (const TextureSource* texture : { &primitive.texture, &primitive.normalTexture, &primitive.metalic_roughnessTexture })
+			{
+				if (!texture->path.empty())
+				{
+					addDependency(texture->path);
+				}
+			}
+		}
+	}
+
+	return data;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "Texture.h"
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace VulkanProject
+{
+    class MappedFile;
+
+    // CPU side result of importing a model, no GPU resources are created while filling this
+    struct ModelData
+    {
+        struct Primitive
+        {
+            std::vector<Vertex> vertices;
+            std::vector<uint32_t> indices;
+
+            // invalid when the material does not provide the texture
+            TextureSource texture;
+            TextureSource normalTexture;
+            TextureSource metalic_roughnessTexture;
+
+            // glTF doubleSided and alphaMode, the rest of the state is the renderer's default
+            PipelineState state;
+        };
+
+        struct Node
+        {
+            glm::mat4 transform;
+            std::vector<unsigned int> children;
+            int mesh = -1;
+        };
+
+        std::vector<std::vector<Primitive>> meshes;
+        std::vector<Node> nodes;
+        std::vector<unsigned int> rootNodes;
+
+        // Every file the data was built from: the model, external buffers and referenced images
+        std::vector<std::string> dependencies;
+
+        // Mapped .glb that embedded textures point into, kept alive as long as the data
+        std::shared_ptr<MappedFile> source;
+        // Buffers loaded by tinygltf, embedded textures point into these when there is no mapping
+        std::vector<std::vector<unsigned char>> buffers;
+    };
+
+    // Parses a glTF (.gltf or .glb) file and generates the missing vertex attributes
+    ModelData ImportModel(const std::string& path);
+}
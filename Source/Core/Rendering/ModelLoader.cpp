@@ -0,0 +1,366 @@
+#include "ModelLoader.h"
+#include "UploadQueue.h"
+#include "VirtualTexture.h"
+#include "Core/ThreadPool.h"
+#include "Core/IOService.h"
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+namespace
+{
+	// Placeholder texels in the layout of each slot's eTextureUsage: white base color, a flat normal and a
+	// fully rough, non metallic surface
+	const unsigned char c_PlaceholderPixels[3][4] =
+	{
+		{ 255, 255, 255, 255 },
+		{ 128, 128 },
+		{ 255, 0 }
+	};
+}
+
+// Shared with the worker jobs, they can still be running after the loader is gone
+struct VulkanProject::ModelLoader::State
+{
+	enum class eItemType
+	{
+		// nodes and the primitive layout, no GPU work
+		Structure,
+		Mesh,
+		Texture,
+		// created on the render thread straight from its path, it streams its own pages
+		VirtualTexture
+	};
+
+	struct Item
+	{
+		eItemType type;
+		std::shared_ptr<Model> model;
+		// the Model::Source the item was read from
+		std::shared_ptr<const void> source;
+		size_t mesh = 0;
+		size_t primitive = 0;
+		size_t slot = 0;
+		TextureImage image;
+		SamplerState sampler;
+		std::string path;
+	};
+
+	void Push(Item item)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.push_back(std::move(item));
+	}
+
+	void Fail(std::exception_ptr exception)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!error)
+		{
+			error = exception;
+		}
+	}
+
+	void Finish()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending--;
+		finished.notify_all();
+	}
+
+	std::mutex mutex;
+	std::deque<Item> ready;
+	// jobs that are queued or running
+	size_t pending = 0;
+	std::condition_variable finished;
+	std::exception_ptr error;
+	std::atomic<bool> cancelled{ false };
+};
+
+VulkanProject::ModelLoader::ModelLoader(uint64_t uploadBudgetPerFrame) : m_State(std::make_shared<State>()), m_UploadBudgetPerFrame(uploadBudgetPerFrame)
+{
+	UploadQueue uploads;
+	for (int i = 0; i < 3; i++)
+	{
+		const eTextureUsage usage = static_cast<eTextureUsage>(i);
+		TextureImage image;
+		image.format = usage == eTextureUsage::Color ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8_UNORM;
+		image.width = 1;
+		image.height = 1;
+		image.pixels = c_PlaceholderPixels[i];
+		image.size = GetTexelSize(usage);
+
+		VkBufferImageCopy region{};
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = { 1, 1, 1 };
+		image.regions = { region };
+
+		m_Placeholders[i] = std::make_unique<Texture>(image, uploads);
+	}
+	uploads.Flush();
+}
+
+VulkanProject::ModelLoader::~ModelLoader()
+{
+	// The jobs use the GeometryPool, the AssetCache and the device, which are shut down after the loader
+	m_State->cancelled = true;
+	{
+		std::unique_lock<std::mutex> lock(m_State->mutex);
+		m_State->finished.wait(lock, [this]() { return m_State->pending == 0; });
+	}
+
+	// Whatever is already on its way to the GPU still reaches its model
+	for (auto& batch : m_InFlight)
+	{
+		batch.uploads->Flush();
+		for (auto& commit : batch.commits)
+		{
+			commit();
+		}
+	}
+	m_InFlight.clear();
+}
+
+std::shared_ptr<VulkanProject::Model> VulkanProject::ModelLoader::Load(const std::string& path)
+{
+	std::shared_ptr<Model> model(new Model());
+	std::shared_ptr<State> state = m_State;
+	{
+		std::lock_guard<std::mutex> lock(state->mutex);
+		state->pending++;
+	}
+
+	ThreadPool::GetShared().Submit([state, model, path]()
+	{
+		try
+		{
+			if (state->cancelled)
+			{
+				state->Finish();
+				return;
+			}
+
+			auto source = std::make_shared<Model::Source>(Model::ReadSource(path));
+
+			State::Item structure;
+			structure.type = State::eItemType::Structure;
+			structure.model = model;
+			structure.source = source;
+			state->Push(std::move(structure));
+
+			// Geometry is ready right away, textures follow as their decode jobs finish
+			for (size_t i = 0; i < source->meshes.size(); i++)
+			{
+				for (size_t j = 0; j < source->meshes[i].size(); j++)
+				{
+					State::Item mesh;
+					mesh.type = State::eItemType::Mesh;
+					mesh.model = model;
+					mesh.source = source;
+					mesh.mesh = i;
+					mesh.primitive = j;
+					state->Push(std::move(mesh));
+
+					for (size_t slot = 0; slot < 3; slot++)
+					{
+						if (!source->meshes[i][j].textures[slot].IsValid())
+						{
+							continue;
+						}
+						if (VirtualTexture::IsVirtualTexture(source->meshes[i][j].textures[slot].path))
+						{
+							State::Item texture;
+							texture.type = State::eItemType::VirtualTexture;
+							texture.model = model;
+							texture.mesh = i;
+							texture.primitive = j;
+							texture.slot = slot;
+							texture.path = source->meshes[i][j].textures[slot].path;
+							state->Push(std::move(texture));
+							continue;
+						}
+
+						{
+							std::lock_guard<std::mutex> lock(state->mutex);
+							state->pending++;
+						}
+
+						auto decode = [state, model, i, j, slot, sampler = source->meshes[i][j].textures[slot].sampler](auto decodeImage)
+						{
+							try
+							{
+								if (!state->cancelled)
+								{
+									State::Item texture;
+									texture.type = State::eItemType::Texture;
+									texture.model = model;
+									texture.mesh = i;
+									texture.primitive = j;
+									texture.slot = slot;
+									texture.sampler = sampler;
+									texture.image = decodeImage();
+									state->Push(std::move(texture));
+								}
+							}
+							catch (...)
+							{
+								state->Fail(std::current_exception());
+							}
+							state->Finish();
+						};
+
+						const TextureSource& textureSource = source->meshes[i][j].textures[slot];
+						if (textureSource.data != nullptr)
+						{
+							// Embedded in the model, already in memory
+							ThreadPool::GetShared().Submit([decode, source, &textureSource]()
+							{
+								decode([&]() { return Texture::Decode(textureSource); });
+							});
+							continue;
+						}
+
+						// Files are read by the I/O service, the pool threads only decode
+						std::string texturePath = textureSource.path;
+						eTextureUsage usage = textureSource.usage;
+						IOService::GetShared().Read(texturePath, [decode, texturePath, usage](std::vector<unsigned char>&& data, std::exception_ptr error)
+						{
+							auto fileData = std::make_shared<const std::vector<unsigned char>>(std::move(data));
+							ThreadPool::GetShared().Submit([decode, texturePath, usage, fileData, error]()
+							{
+								decode([&]()
+								{
+									if (error)
+									{
+										std::rethrow_exception(error);
+									}
+									return Texture::Decode(texturePath, usage, fileData);
+								});
+							});
+						});
+					}
+				}
+			}
+		}
+		catch (...)
+		{
+			state->Fail(std::current_exception());
+		}
+		state->Finish();
+	});
+
+	return model;
+}
+
+void VulkanProject::ModelLoader::Update()
+{
+	// Resources whose uploads are done on the GPU are handed to their models, in submit order
+	while (!m_InFlight.empty() && m_InFlight.front().uploads->IsComplete())
+	{
+		for (auto& commit : m_InFlight.front().commits)
+		{
+			commit();
+		}
+		m_InFlight.pop_front();
+	}
+
+	Batch batch;
+	batch.uploads = std::make_unique<UploadQueue>();
+	while (batch.uploads->GetStagedBytes() < m_UploadBudgetPerFrame)
+	{
+		State::Item item;
+		{
+			std::lock_guard<std::mutex> lock(m_State->mutex);
+			if (m_State->ready.empty())
+			{
+				break;
+			}
+			item = std::move(m_State->ready.front());
+			m_State->ready.pop_front();
+		}
+
+		std::shared_ptr<Model> model = item.model;
+		switch (item.type)
+		{
+		case State::eItemType::Structure:
+		{
+			// Every primitive starts out without a mesh and is skipped when drawing
+			const Model::Source& source = *static_cast<const Model::Source*>(item.source.get());
+			model->m_Nodes = source.nodes;
+			model->m_RootNodes = source.rootNodes;
+			model->m_Meshes.resize(source.meshes.size());
+			for (size_t i = 0; i < source.meshes.size(); i++)
+			{
+				model->m_Meshes[i].assign(source.meshes[i].size(), Model::Primitive{ nullptr, nullptr, nullptr, nullptr });
+			}
+			break;
+		}
+		case State::eItemType::Mesh:
+		{
+			const Model::Source& source = *static_cast<const Model::Source*>(item.source.get());
+			const Model::PrimitiveSource& primitive = source.meshes[item.mesh][item.primitive];
+			Mesh* mesh = new Mesh(primitive.vertices, primitive.vertexCount, primitive.indices, primitive.indexCount, *batch.uploads);
+
+			Texture* placeholders[3];
+			for (size_t slot = 0; slot < 3; slot++)
+			{
+				placeholders[slot] = primitive.textures[slot].IsValid() ? m_Placeholders[slot].get() : nullptr;
+			}
+			batch.commits.push_back([model, mesh, placeholders, state = primitive.state, meshIndex = item.mesh, primitiveIndex = item.primitive]()
+			{
+				Model::Primitive& created = model->m_Meshes[meshIndex][primitiveIndex];
+				created.mesh = mesh;
+				created.state = state;
+				created.texture = placeholders[0];
+				created.normalTexture = placeholders[1];
+				created.metalic_roughnessTexture = placeholders[2];
+			});
+			break;
+		}
+		case State::eItemType::Texture:
+		{
+			Texture* texture = new Texture(item.image, *batch.uploads, item.sampler);
+			batch.commits.push_back([model, texture, meshIndex = item.mesh, primitiveIndex = item.primitive, slot = item.slot]()
+			{
+				Model::Primitive& created = model->m_Meshes[meshIndex][primitiveIndex];
+				Texture** slots[3] = { &created.texture, &created.normalTexture, &created.metalic_roughnessTexture };
+				*slots[slot] = texture;
+			});
+			break;
+		}
+		case State::eItemType::VirtualTexture:
+		{
+			VirtualTexture* texture = new VirtualTexture(item.path, *batch.uploads);
+			batch.commits.push_back([model, texture, meshIndex = item.mesh, primitiveIndex = item.primitive, slot = item.slot]()
+			{
+				model->m_Meshes[meshIndex][primitiveIndex].virtualTextures[slot] = texture;
+			});
+			break;
+		}
+		}
+	}
+
+	if (!batch.commits.empty())
+	{
+		batch.uploads->Submit();
+		m_InFlight.push_back(std::move(batch));
+	}
+
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(m_State->mutex);
+		std::swap(error, m_State->error);
+	}
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+bool VulkanProject::ModelLoader::IsIdle() const
+{
+	std::lock_guard<std::mutex> lock(m_State->mutex);
+	return m_State->pending == 0 && m_State->ready.empty() && m_InFlight.empty();
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "Texture.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+
+namespace VulkanProject
+{
+    class UploadQueue;
+
+    // Loads models in the background. Parsing and decoding run on the shared thread pool,
+    // GPU resources are created from Update a few megabytes per frame and become visible once their
+    // upload has finished on the GPU. Nothing in here waits on I/O or the GPU while streaming.
+    // A primitive is drawn as soon as its mesh is in, textures that are still loading are
+    // replaced by 1x1 placeholders.
+    class ModelLoader
+    {
+    public:
+        ModelLoader(uint64_t uploadBudgetPerFrame = 32ull * 1024 * 1024);
+        // Waits for the jobs that are running and the uploads that are in flight, decoding that has not started
+        // is dropped
+        ~ModelLoader();
+
+        ModelLoader(const ModelLoader&) = delete;
+        ModelLoader& operator=(const ModelLoader&) = delete;
+
+        // Returns straight away, the model starts out empty and fills in as Update is called
+        std::shared_ptr<Model> Load(const std::string& path);
+
+        // Call once per frame on the render thread. Rethrows errors from the workers.
+        void Update();
+
+        // True when every requested model is completely on the GPU
+        bool IsIdle() const;
+
+        struct State;
+
+    private:
+        struct Batch
+        {
+            std::unique_ptr<UploadQueue> uploads;
+            // run once the uploads are done, they hand the new resources to their models
+            std::vector<std::function<void()>> commits;
+        };
+
+        std::shared_ptr<State> m_State;
+        std::deque<Batch> m_InFlight;
+        uint64_t m_UploadBudgetPerFrame;
+
+        // indexed by the texture slot: base color, normal, metallic roughness
+        std::unique_ptr<Texture> m_Placeholders[3];
+    };
+}
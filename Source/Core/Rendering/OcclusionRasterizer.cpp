@@ -0,0 +1,323 @@
+#include "OcclusionRasterizer.h"
+#include "Core/ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE2
+#endif
+
+namespace
+{
+	// Pixels per tile, the width has to be a multiple of 4 for the SIMD spans
+	const uint32_t c_TileWidth = 32;
+	const uint32_t c_TileHeight = 16;
+	// Vertices closer than this to the camera plane are not projected
+	const float c_MinW = 1e-5f;
+	// Twice the pixel area below which triangles cover nothing worth keeping
+	const float c_MinArea = 1e-4f;
+
+	// Writes the nearer depth into the pixels from minX to maxX on row y that are inside all three edges.
+	// minX is a multiple of 4 and the span may run up to 3 pixels past maxX, still inside the tile.
+	void RasterizeSpan(float* row, int minX, int maxX, int y, const glm::vec3* edges, const glm::vec3& depth)
+	{
+		float py = static_cast<float>(y) + 0.5f;
+#ifdef OCCLUSION_SSE2
+		__m128 a[3];
+		__m128 rowEdges[3];
+		for (int i = 0; i < 3; i++)
+		{
+			a[i] = _mm_set1_ps(edges[i].x);
+			rowEdges[i] = _mm_set1_ps(edges[i].y * py + edges[i].z);
+		}
+		__m128 depthA = _mm_set1_ps(depth.x);
+		__m128 rowDepth = _mm_set1_ps(depth.y * py + depth.z);
+		__m128 zero = _mm_setzero_ps();
+		__m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(minX)), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+		__m128 step = _mm_set1_ps(4.0f);
+		for (int x = minX; x <= maxX; x += 4)
+		{
+			__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[0], px), rowEdges[0]), zero);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[1], px), rowEdges[1]), zero));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[2], px), rowEdges[2]), zero));
+			if (_mm_movemask_ps(inside) != 0)
+			{
+				__m128 z = _mm_add_ps(_mm_mul_ps(depthA, px), rowDepth);
+				__m128 current = _mm_loadu_ps(row + x);
+				__m128 nearer = _mm_min_ps(current, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+			}
+			px = _mm_add_ps(px, step);
+		}
+#else
+		for (int x = minX; x <= maxX; x++)
+		{
+			float px = static_cast<float>(x) + 0.5f;
+			bool inside = true;
+			for (int i = 0; i < 3; i++)
+			{
+				inside = inside && edges[i].x * px + edges[i].y * py + edges[i].z >= 0.0f;
+			}
+			if (inside)
+			{
+				row[x] = std::min(row[x], depth.x * px + depth.y * py + depth.z);
+			}
+		}
+#endif
+	}
+
+	// Farthest depth of count pixels, count is a multiple of 4
+	float GetFarthest(const float* pixels, uint32_t count, float farthest)
+	{
+#ifdef OCCLUSION_SSE2
+		__m128 result = _mm_set1_ps(farthest);
+		for (uint32_t i = 0; i < count; i += 4)
+		{
+			result = _mm_max_ps(result, _mm_loadu_ps(pixels + i));
+		}
+		result = _mm_max_ps(result, _mm_shuffle_ps(result, result, _MM_SHUFFLE(1, 0, 3, 2)));
+		result = _mm_max_ps(result, _mm_shuffle_ps(result, result, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtss_f32(result);
+#else
+		for (uint32_t i = 0; i < count; i++)
+		{
+			farthest = std::max(farthest, pixels[i]);
+		}
+		return farthest;
+#endif
+	}
+}
+
+VulkanProject::OcclusionRasterizer::Occluder VulkanProject::OcclusionRasterizer::CreateBox(const glm::vec3& min, const glm::vec3& max)
+{
+	Occluder box;
+	for (int i = 0; i < 8; i++)
+	{
+		box.positions.push_back(glm::vec3((i & 1) != 0 ? max.x : min.x, (i & 2) != 0 ? max.y : min.y, (i & 4) != 0 ? max.z : min.z));
+	}
+	// two triangles per face, the rasterizer does not care about the winding
+	box.indices =
+	{
+		0, 2, 1, 1, 2, 3,
+		4, 5, 6, 5, 7, 6,
+		0, 1, 4, 1, 5, 4,
+		2, 6, 3, 3, 6, 7,
+		0, 4, 2, 2, 4, 6,
+		1, 3, 5, 3, 7, 5,
+	};
+	return box;
+}
+
+VulkanProject::OcclusionRasterizer::OcclusionRasterizer(uint32_t width, uint32_t height)
+{
+	m_TilesX = std::max(1u, (width + c_TileWidth - 1) / c_TileWidth);
+	m_TilesY = std::max(1u, (height + c_TileHeight - 1) / c_TileHeight);
+	m_Width = m_TilesX * c_TileWidth;
+	m_Height = m_TilesY * c_TileHeight;
+	m_Bins.resize(m_TilesX * m_TilesY);
+	m_Depth.assign(m_Width * m_Height, 1.0f);
+	m_TileDepth.assign(m_TilesX * m_TilesY, 1.0f);
+}
+
+void VulkanProject::OcclusionRasterizer::Begin(const glm::mat4& viewProjection)
+{
+	m_ViewProjection = viewProjection;
+	m_Occluders.clear();
+	std::fill(m_Depth.begin(), m_Depth.end(), 1.0f);
+	std::fill(m_TileDepth.begin(), m_TileDepth.end(), 1.0f);
+}
+
+void VulkanProject::OcclusionRasterizer::AddOccluder(const Occluder& occluder, const glm::mat4& model)
+{
+	m_Occluders.push_back({ &occluder, m_ViewProjection * model });
+}
+
+void VulkanProject::OcclusionRasterizer::Rasterize()
+{
+	SetupTriangles();
+	if (m_Triangles.empty())
+	{
+		return;
+	}
+	ThreadPool::GetShared().ParallelFor(m_Bins.size(), [this](size_t tile) { RasterizeTile(static_cast<uint32_t>(tile)); });
+}
+
+void VulkanProject::OcclusionRasterizer::SetupTriangles()
+{
+	m_Triangles.clear();
+	for (std::vector<uint32_t>& bin : m_Bins)
+	{
+		bin.clear();
+	}
+
+	std::vector<glm::vec4> clip;
+	for (const Instance& instance : m_Occluders)
+	{
+		const Occluder& occluder = *instance.occluder;
+		clip.resize(occluder.positions.size());
+		for (size_t i = 0; i < clip.size(); i++)
+		{
+			clip[i] = instance.transform * glm::vec4(occluder.positions[i], 1.0f);
+		}
+
+		for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3)
+		{
+			// Without clipping a triangle through the near plane cannot be drawn, leaving it out only hides less
+			glm::vec3 screen[3];
+			bool inFront = true;
+			for (int j = 0; j < 3; j++)
+			{
+				const glm::vec4& vertex = clip[occluder.indices[i + j]];
+				if (vertex.w <= c_MinW || vertex.z < 0.0f)
+				{
+					inFront = false;
+					break;
+				}
+				screen[j] = glm::vec3((vertex.x / vertex.w * 0.5f + 0.5f) * m_Width, (vertex.y / vertex.w * 0.5f + 0.5f) * m_Height, vertex.z / vertex.w);
+			}
+			if (!inFront)
+			{
+				continue;
+			}
+
+			glm::vec3 d1 = screen[1] - screen[0];
+			glm::vec3 d2 = screen[2] - screen[0];
+			float area = d1.x * d2.y - d2.x * d1.y;
+			if (std::abs(area) < c_MinArea)
+			{
+				continue;
+			}
+
+			Triangle triangle;
+			glm::vec2 minimum = glm::min(glm::vec2(screen[0]), glm::min(glm::vec2(screen[1]), glm::vec2(screen[2])));
+			glm::vec2 maximum = glm::max(glm::vec2(screen[0]), glm::max(glm::vec2(screen[1]), glm::vec2(screen[2])));
+			triangle.minX = std::max(0, static_cast<int>(std::floor(minimum.x)));
+			triangle.minY = std::max(0, static_cast<int>(std::floor(minimum.y)));
+			triangle.maxX = std::min(static_cast<int>(m_Width) - 1, static_cast<int>(std::floor(maximum.x)));
+			triangle.maxY = std::min(static_cast<int>(m_Height) - 1, static_cast<int>(std::floor(maximum.y)));
+			if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+			{
+				continue;
+			}
+
+			// Every edge function is the area at the opposite vertex, flipping by its sign makes the inside positive
+			float sign = area > 0.0f ? 1.0f : -1.0f;
+			for (int j = 0; j < 3; j++)
+			{
+				const glm::vec3& a = screen[j];
+				const glm::vec3& b = screen[(j + 1) % 3];
+				triangle.edges[j] = sign * glm::vec3(a.y - b.y, b.x - a.x, a.x * b.y - a.y * b.x);
+			}
+			// Depth as a plane over the screen
+			float depthX = (d1.z * d2.y - d2.z * d1.y) / area;
+			float depthY = (d1.x * d2.z - d2.x * d1.z) / area;
+			triangle.depth = glm::vec3(depthX, depthY, screen[0].z - depthX * screen[0].x - depthY * screen[0].y);
+
+			uint32_t index = static_cast<uint32_t>(m_Triangles.size());
+			m_Triangles.push_back(triangle);
+			for (int y = triangle.minY / static_cast<int>(c_TileHeight); y <= triangle.maxY / static_cast<int>(c_TileHeight); y++)
+			{
+				for (int x = triangle.minX / static_cast<int>(c_TileWidth); x <= triangle.maxX / static_cast<int>(c_TileWidth); x++)
+				{
+					m_Bins[y * m_TilesX + x].push_back(index);
+				}
+			}
+		}
+	}
+}
+
+void VulkanProject::OcclusionRasterizer::RasterizeTile(uint32_t tile)
+{
+	const std::vector<uint32_t>& bin = m_Bins[tile];
+	if (bin.empty())
+	{
+		return;
+	}
+
+	int tileX = static_cast<int>(tile % m_TilesX * c_TileWidth);
+	int tileY = static_cast<int>(tile / m_TilesX * c_TileHeight);
+	for (uint32_t index : bin)
+	{
+		const Triangle& triangle = m_Triangles[index];
+		// starts on a multiple of 4 for the SIMD spans
+		int minX = std::max(triangle.minX, tileX) & ~3;
+		int maxX = std::min(triangle.maxX, tileX + static_cast<int>(c_TileWidth) - 1);
+		int minY = std::max(triangle.minY, tileY);
+		int maxY = std::min(triangle.maxY, tileY + static_cast<int>(c_TileHeight) - 1);
+		for (int y = minY; y <= maxY; y++)
+		{
+			RasterizeSpan(&m_Depth[y * m_Width], minX, maxX, y, triangle.edges, triangle.depth);
+		}
+	}
+
+	float farthest = 0.0f;
+	for (uint32_t y = 0; y < c_TileHeight; y++)
+	{
+		farthest = GetFarthest(&m_Depth[(tileY + y) * m_Width + tileX], c_TileWidth, farthest);
+	}
+	m_TileDepth[tile] = farthest;
+}
+
+bool VulkanProject::OcclusionRasterizer::IsVisible(const glm::vec3& min, const glm::vec3& max, const glm::mat4& model) const
+{
+	glm::mat4 transform = m_ViewProjection * model;
+	glm::vec2 minimum = glm::vec2(FLT_MAX);
+	glm::vec2 maximum = glm::vec2(-FLT_MAX);
+	float nearest = FLT_MAX;
+	for (int i = 0; i < 8; i++)
+	{
+		glm::vec3 corner((i & 1) != 0 ? max.x : min.x, (i & 2) != 0 ? max.y : min.y, (i & 4) != 0 ? max.z : min.z);
+		glm::vec4 clip = transform * glm::vec4(corner, 1.0f);
+		if (clip.w <= c_MinW || clip.z < 0.0f)
+		{
+			return true;
+		}
+		minimum = glm::min(minimum, glm::vec2(clip) / clip.w);
+		maximum = glm::max(maximum, glm::vec2(clip) / clip.w);
+		nearest = std::min(nearest, clip.z / clip.w);
+	}
+
+	// Every pixel the box touches, not only the ones whose center it covers
+	int minX = static_cast<int>(std::floor((minimum.x * 0.5f + 0.5f) * m_Width));
+	int minY = static_cast<int>(std::floor((minimum.y * 0.5f + 0.5f) * m_Height));
+	int maxX = static_cast<int>(std::floor((maximum.x * 0.5f + 0.5f) * m_Width));
+	int maxY = static_cast<int>(std::floor((maximum.y * 0.5f + 0.5f) * m_Height));
+	if (maxX < 0 || maxY < 0 || minX >= static_cast<int>(m_Width) || minY >= static_cast<int>(m_Height))
+	{
+		return false;
+	}
+	minX = std::max(minX, 0);
+	minY = std::max(minY, 0);
+	maxX = std::min(maxX, static_cast<int>(m_Width) - 1);
+	maxY = std::min(maxY, static_cast<int>(m_Height) - 1);
+
+	for (int tileY = minY / static_cast<int>(c_TileHeight); tileY <= maxY / static_cast<int>(c_TileHeight); tileY++)
+	{
+		for (int tileX = minX / static_cast<int>(c_TileWidth); tileX <= maxX / static_cast<int>(c_TileWidth); tileX++)
+		{
+			// Behind everything in the tile
+			if (nearest > m_TileDepth[tileY * m_TilesX + tileX])
+			{
+				continue;
+			}
+			int x0 = std::max(minX, tileX * static_cast<int>(c_TileWidth));
+			int x1 = std::min(maxX, (tileX + 1) * static_cast<int>(c_TileWidth) - 1);
+			int y0 = std::max(minY, tileY * static_cast<int>(c_TileHeight));
+			int y1 = std::min(maxY, (tileY + 1) * static_cast<int>(c_TileHeight) - 1);
+			for (int y = y0; y <= y1; y++)
+			{
+				const float* row = &m_Depth[y * m_Width];
+				for (int x = x0; x <= x1; x++)
+				{
+					if (nearest <= row[x])
+					{
+						return true;
+					}
+				}
+			}
+		}
+	}
+	return false;
+}
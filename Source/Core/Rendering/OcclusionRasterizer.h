@@ -0,0 +1,76 @@
+#pragma once
+#include "Core/Includes.h"
+#include <vector>
+#include <cstdint>
+
+namespace VulkanProject
+{
+    // Occlusion culling on the CPU, for when GpuCulling is not available. A few simplified occluder meshes are
+    // rasterised into a small depth buffer every frame and the bounds of the draws are tested against it before
+    // they are submitted. Touches no GPU state.
+    class OcclusionRasterizer
+    {
+    public:
+        // Closed triangle mesh that stays inside the geometry it stands for, so it never hides what is in front of it
+        struct Occluder
+        {
+            std::vector<glm::vec3> positions;
+            std::vector<uint32_t> indices;
+        };
+        static Occluder CreateBox(const glm::vec3& min, const glm::vec3& max);
+
+        // The size is rounded up to whole tiles
+        OcclusionRasterizer(uint32_t width = 256, uint32_t height = 128);
+
+        // Clears the depth and the occluders, viewProjection maps depth to [0, 1]
+        void Begin(const glm::mat4& viewProjection);
+        // The occluder is only referenced, it has to stay alive until Rasterize
+        void AddOccluder(const Occluder& occluder, const glm::mat4& model);
+        // Bins the triangles into screen tiles and rasterises the tiles on the shared thread pool. A tile only
+        // depends on its own triangles, in the order they were added, so the depth does not depend on the threads.
+        // Triangles reaching in front of the near plane are skipped.
+        void Rasterize();
+
+        // Whether any part of the object space box could be seen past the occluders. Boxes reaching in front of
+        // the near plane always can, boxes outside the sides of the view never can.
+        bool IsVisible(const glm::vec3& min, const glm::vec3& max, const glm::mat4& model) const;
+
+        uint32_t GetWidth() const { return m_Width; }
+        uint32_t GetHeight() const { return m_Height; }
+        // Nearest occluder depth of every pixel, row by row from the top, 1 where nothing was rasterised
+        const std::vector<float>& GetDepth() const { return m_Depth; }
+        size_t GetTriangleCount() const { return m_Triangles.size(); }
+
+    private:
+        // Screen space triangle, the edge functions are positive inside
+        struct Triangle
+        {
+            // a * x + b * y + c per edge
+            glm::vec3 edges[3];
+            glm::vec3 depth;
+            int minX, minY, maxX, maxY;
+        };
+        struct Instance
+        {
+            const Occluder* occluder;
+            glm::mat4 transform;
+        };
+
+        void SetupTriangles();
+        void RasterizeTile(uint32_t tile);
+
+        uint32_t m_Width;
+        uint32_t m_Height;
+        uint32_t m_TilesX;
+        uint32_t m_TilesY;
+        glm::mat4 m_ViewProjection = glm::mat4(1.0f);
+
+        std::vector<Instance> m_Occluders;
+        std::vector<Triangle> m_Triangles;
+        // indices into m_Triangles for every tile
+        std::vector<std::vector<uint32_t>> m_Bins;
+        std::vector<float> m_Depth;
+        // farthest depth of every tile, decides most tests without looking at the pixels
+        std::vector<float> m_TileDepth;
+    };
+}
@@ -0,0 +1,387 @@
+#include "PipelineCache.h"
+#include "Graphics.h"
+#include "Texture.h"
+#include "Core/AssetCache.h"
+#include "Core/ThreadPool.h"
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <future>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+
+namespace
+{
+	struct PipelineKey
+	{
+		VulkanProject::PipelineProgram program;
+		VulkanProject::PipelineState state;
+
+		bool operator==(const PipelineKey& other) const { return program == other.program && state == other.state; }
+	};
+
+	struct PipelineKeyHash
+	{
+		size_t operator()(const PipelineKey& key) const
+		{
+			return static_cast<size_t>(VulkanProject::Hasher().Add(&key.program, sizeof(key.program)).Add(&key.state, sizeof(key.state)).Get());
+		}
+	};
+
+	struct PipelineEntry
+	{
+		// stays VK_NULL_HANDLE when the compile failed
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		bool pending = true;
+		std::shared_future<void> compiled;
+	};
+
+	struct PipelineCacheData
+	{
+		std::mutex mutex;
+		std::unordered_map<PipelineKey, PipelineEntry, PipelineKeyHash> pipelines;
+		uint32_t pendingCount = 0;
+	};
+
+	static PipelineCacheData* data = nullptr;
+
+	VkPipeline CreatePipeline(const PipelineKey& key)
+	{
+		const VulkanProject::PipelineState& state = key.state;
+
+		// Constant i of the state is constant_id i of every stage, ids a stage does not declare are ignored
+		VkSpecializationMapEntry constantEntries[VulkanProject::c_MaxSpecializationConstants];
+		for (uint32_t i = 0; i < VulkanProject::c_MaxSpecializationConstants; i++)
+		{
+			constantEntries[i] = { i, i * static_cast<uint32_t>(sizeof(uint32_t)), sizeof(uint32_t) };
+		}
+		VkSpecializationInfo specializationInfo{};
+		specializationInfo.mapEntryCount = VulkanProject::c_MaxSpecializationConstants;
+		specializationInfo.pMapEntries = constantEntries;
+		specializationInfo.dataSize = sizeof(state.constants);
+		specializationInfo.pData = state.constants;
+
+		VkPipelineShaderStageCreateInfo shaderStages[2]{};
+		shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		shaderStages[0].module = key.program.vertexShader;
+		shaderStages[0].pName = "main";
+		shaderStages[0].pSpecializationInfo = &specializationInfo;
+		shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		shaderStages[1].module = key.program.fragmentShader;
+		shaderStages[1].pName = "main";
+		shaderStages[1].pSpecializationInfo = &specializationInfo;
+
+		// Only the attributes the shader reads, the stride stays the one of the whole Vertex
+		auto bindingDescription = VulkanProject::Vertex::getBindingDescription();
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+		uint64_t missingInputs = key.program.vertexInputs;
+		for (const auto& attribute : VulkanProject::Vertex::getAttributeDescriptions())
+		{
+			if (key.program.vertexInputs & (1ull << attribute.location))
+			{
+				attributeDescriptions.push_back(attribute);
+				missingInputs &= ~(1ull << attribute.location);
+			}
+		}
+		if (missingInputs != 0)
+		{
+			throw std::runtime_error("vertex shader reads an input Vertex does not have!");
+		}
+
+		VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		vertexInputInfo.vertexBindingDescriptionCount = 1;
+		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+		vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+		vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+		VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+		inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		inputAssembly.topology = state.topology;
+		inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+		VkPipelineViewportStateCreateInfo viewportState{};
+		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportState.viewportCount = 1;
+		viewportState.scissorCount = 1;
+
+		VkPipelineRasterizationStateCreateInfo rasterizer{};
+		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizer.depthClampEnable = VK_FALSE;
+		rasterizer.rasterizerDiscardEnable = VK_FALSE;
+		rasterizer.polygonMode = state.polygonMode;
+		rasterizer.lineWidth = 1.0f;
+		rasterizer.cullMode = state.cullMode;
+		rasterizer.frontFace = state.frontFace;
+		rasterizer.depthBiasEnable = VK_FALSE;
+
+		VkPipelineMultisampleStateCreateInfo multisampling{};
+		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampling.sampleShadingEnable = VK_FALSE;
+		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+		VkPipelineDepthStencilStateCreateInfo depthStencil{};
+		depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depthStencil.depthTestEnable = state.depthTestEnable;
+		depthStencil.depthWriteEnable = state.depthWriteEnable;
+		depthStencil.depthCompareOp = state.depthCompareOp;
+		depthStencil.depthBoundsTestEnable = VK_FALSE;
+		depthStencil.stencilTestEnable = VK_FALSE;
+
+		VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+		colorBlendAttachment.colorWriteMask = state.colorWriteMask;
+		colorBlendAttachment.blendEnable = state.blendEnable;
+		colorBlendAttachment.srcColorBlendFactor = state.srcColorBlendFactor;
+		colorBlendAttachment.dstColorBlendFactor = state.dstColorBlendFactor;
+		colorBlendAttachment.colorBlendOp = state.colorBlendOp;
+		colorBlendAttachment.srcAlphaBlendFactor = state.srcAlphaBlendFactor;
+		colorBlendAttachment.dstAlphaBlendFactor = state.dstAlphaBlendFactor;
+		colorBlendAttachment.alphaBlendOp = state.alphaBlendOp;
+
+		VkPipelineColorBlendStateCreateInfo colorBlending{};
+		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		colorBlending.logicOpEnable = VK_FALSE;
+		colorBlending.logicOp = VK_LOGIC_OP_COPY;
+		colorBlending.attachmentCount = 1;
+		colorBlending.pAttachments = &colorBlendAttachment;
+
+		VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		VkPipelineDynamicStateCreateInfo dynamicState{};
+		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicState.dynamicStateCount = 2;
+		dynamicState.pDynamicStates = dynamicStates;
+
+		VkGraphicsPipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.stageCount = 2;
+		pipelineInfo.pStages = shaderStages;
+		pipelineInfo.pVertexInputState = &vertexInputInfo;
+		pipelineInfo.pInputAssemblyState = &inputAssembly;
+		pipelineInfo.pViewportState = &viewportState;
+		pipelineInfo.pRasterizationState = &rasterizer;
+		pipelineInfo.pMultisampleState = &multisampling;
+		pipelineInfo.pDepthStencilState = &depthStencil;
+		pipelineInfo.pColorBlendState = &colorBlending;
+		pipelineInfo.pDynamicState = &dynamicState;
+		pipelineInfo.layout = key.program.layout;
+		pipelineInfo.renderPass = key.program.renderPass;
+		pipelineInfo.subpass = 0;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+		// The VkPipelineCache is internally synchronised, compiles on several threads can share it
+		VkPipeline pipeline;
+		if (vkCreateGraphicsPipelines(VulkanProject::Renderer::GetDevice(), VulkanProject::Renderer::GetPipelineCache(), 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create graphics pipeline!");
+		}
+		return pipeline;
+	}
+
+	// The entry for key has to be registered as pending before
+	void Compile(const PipelineKey& key)
+	{
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		try
+		{
+			pipeline = CreatePipeline(key);
+		}
+		catch (const std::exception& e)
+		{
+			// Draws keep using their fallback
+			printf("Pipeline cache: %s\n", e.what());
+		}
+
+		std::lock_guard<std::mutex> lock(data->mutex);
+		PipelineEntry& entry = data->pipelines.at(key);
+		entry.pipeline = pipeline;
+		entry.pending = false;
+		data->pendingCount--;
+	}
+
+	void WaitAll(const std::vector<std::shared_future<void>>& compiles)
+	{
+		for (const auto& compiled : compiles)
+		{
+			compiled.wait();
+		}
+	}
+}
+
+bool VulkanProject::PipelineState::operator==(const PipelineState& other) const
+{
+	return memcmp(this, &other, sizeof(PipelineState)) == 0;
+}
+
+bool VulkanProject::PipelineProgram::operator==(const PipelineProgram& other) const
+{
+	return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader && layout == other.layout && renderPass == other.renderPass &&
+		vertexInputs == other.vertexInputs;
+}
+
+void VulkanProject::PipelineCache::Init()
+{
+	if (data)
+	{
+		throw std::runtime_error("pipeline cache is already initialised!");
+	}
+	data = new PipelineCacheData();
+}
+
+void VulkanProject::PipelineCache::Shutdown()
+{
+	if (!data)
+	{
+		return;
+	}
+
+	std::vector<std::shared_future<void>> compiles;
+	{
+		std::lock_guard<std::mutex> lock(data->mutex);
+		for (const auto& pipeline : data->pipelines)
+		{
+			compiles.push_back(pipeline.second.compiled);
+		}
+	}
+	WaitAll(compiles);
+
+	for (const auto& pipeline : data->pipelines)
+	{
+		vkDestroyPipeline(Renderer::GetDevice(), pipeline.second.pipeline, nullptr);
+	}
+	delete data;
+	data = nullptr;
+}
+
+VkPipeline VulkanProject::PipelineCache::Get(const PipelineProgram& program, const PipelineState& state)
+{
+	if (!data)
+	{
+		return VK_NULL_HANDLE;
+	}
+
+	PipelineKey key{ program, state };
+	std::lock_guard<std::mutex> lock(data->mutex);
+	auto it = data->pipelines.find(key);
+	if (it != data->pipelines.end())
+	{
+		return it->second.pipeline;
+	}
+
+	// The compile takes the lock once it is done, so it cannot finish before the entry is complete
+	PipelineEntry& entry = data->pipelines[key];
+	data->pendingCount++;
+	entry.compiled = ThreadPool::GetShared().Submit([key]() { Compile(key); }).share();
+	return VK_NULL_HANDLE;
+}
+
+VkPipeline VulkanProject::PipelineCache::GetBlocking(const PipelineProgram& program, const PipelineState& state)
+{
+	if (!data)
+	{
+		throw std::runtime_error("pipeline cache is not initialised!");
+	}
+
+	PipelineKey key{ program, state };
+	std::shared_future<void> compiled;
+	std::promise<void> compiledHere;
+	{
+		std::lock_guard<std::mutex> lock(data->mutex);
+		auto it = data->pipelines.find(key);
+		if (it != data->pipelines.end() && !it->second.pending)
+		{
+			return it->second.pipeline;
+		}
+		if (it != data->pipelines.end())
+		{
+			compiled = it->second.compiled;
+		}
+		else
+		{
+			// Not queued behind whatever the thread pool is busy with, a Get meanwhile waits for this compile instead of starting its own
+			PipelineEntry& entry = data->pipelines[key];
+			data->pendingCount++;
+			entry.compiled = compiledHere.get_future().share();
+		}
+	}
+
+	if (compiled.valid())
+	{
+		compiled.wait();
+	}
+	else
+	{
+		Compile(key);
+		compiledHere.set_value();
+	}
+
+	std::lock_guard<std::mutex> lock(data->mutex);
+	VkPipeline pipeline = data->pipelines.at(key).pipeline;
+	if (pipeline == VK_NULL_HANDLE)
+	{
+		throw std::runtime_error("failed to create graphics pipeline!");
+	}
+	return pipeline;
+}
+
+void VulkanProject::PipelineCache::Release(const PipelineProgram& program)
+{
+	if (!data)
+	{
+		return;
+	}
+
+	std::vector<std::shared_future<void>> compiles;
+	{
+		std::lock_guard<std::mutex> lock(data->mutex);
+		for (const auto& pipeline : data->pipelines)
+		{
+			if (pipeline.first.program == program)
+			{
+				compiles.push_back(pipeline.second.compiled);
+			}
+		}
+	}
+	WaitAll(compiles);
+
+	std::lock_guard<std::mutex> lock(data->mutex);
+	for (auto it = data->pipelines.begin(); it != data->pipelines.end();)
+	{
+		if (it->first.program == program)
+		{
+			vkDestroyPipeline(Renderer::GetDevice(), it->second.pipeline, nullptr);
+			it = data->pipelines.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+uint32_t VulkanProject::PipelineCache::GetPipelineCount()
+{
+	if (!data)
+	{
+		return 0;
+	}
+	std::lock_guard<std::mutex> lock(data->mutex);
+	uint32_t count = 0;
+	for (const auto& pipeline : data->pipelines)
+	{
+		count += pipeline.second.pipeline != VK_NULL_HANDLE ? 1 : 0;
+	}
+	return count;
+}
+
+uint32_t VulkanProject::PipelineCache::GetPendingCount()
+{
+	if (!data)
+	{
+		return 0;
+	}
+	std::lock_guard<std::mutex> lock(data->mutex);
+	return data->pendingCount;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "Core/Includes.h"
+#include <cstdint>
+#include <cstring>
+
+namespace VulkanProject
+{
+    const uint32_t c_MaxSpecializationConstants = 8;
+
+    // Fixed function state of a graphics pipeline and the values of its specialization constants.
+    // Every member is 32 bits, the state is hashed as bytes.
+    struct PipelineState
+    {
+        VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+        VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+        VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+        VkBool32 depthTestEnable = VK_TRUE;
+        VkBool32 depthWriteEnable = VK_TRUE;
+        VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+
+        VkBool32 blendEnable = VK_FALSE;
+        VkBlendFactor srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        VkBlendFactor dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        VkBlendOp colorBlendOp = VK_BLEND_OP_ADD;
+        VkBlendFactor srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        VkBlendFactor dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        VkBlendOp alphaBlendOp = VK_BLEND_OP_ADD;
+        VkColorComponentFlags colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+        // constant_id i of the shaders, every permutation is a pipeline of its own
+        uint32_t constants[c_MaxSpecializationConstants] = {};
+
+        template <typename Id> void SetConstant(Id id, uint32_t value) { constants[static_cast<uint32_t>(id)] = value; }
+        template <typename Id> void SetFloatConstant(Id id, float value) { memcpy(&constants[static_cast<uint32_t>(id)], &value, sizeof(value)); }
+        template <typename Id> uint32_t GetConstant(Id id) const { return constants[static_cast<uint32_t>(id)]; }
+        template <typename Id> float GetFloatConstant(Id id) const { float value; memcpy(&value, &constants[static_cast<uint32_t>(id)], sizeof(value)); return value; }
+
+        bool operator==(const PipelineState& other) const;
+        bool operator!=(const PipelineState& other) const { return !(*this == other); }
+    };
+
+    // Everything besides the state a pipeline is built from. The shader modules have to stay alive
+    // until Release, compiles that are still running read them.
+    struct PipelineProgram
+    {
+        VkShaderModule vertexShader = VK_NULL_HANDLE;
+        VkShaderModule fragmentShader = VK_NULL_HANDLE;
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+        // bit per Vertex attribute location the vertex shader reads
+        uint64_t vertexInputs = 0;
+
+        bool operator==(const PipelineProgram& other) const;
+    };
+
+    // Pipelines keyed on program and state. A state seen for the first time is compiled on the shared
+    // thread pool through the persistent VkPipelineCache, the caller draws with a fallback meanwhile.
+    namespace PipelineCache
+    {
+        // Needs the device, shut down before the Graphics it compiles against
+        void Init();
+        // Waits for the compiles in flight and destroys every pipeline
+        void Shutdown();
+
+        // VK_NULL_HANDLE while the pipeline is compiling or when it failed to compile, never blocks
+        VkPipeline Get(const PipelineProgram& program, const PipelineState& state);
+        // Compiles on the calling thread when the pipeline is not there yet, for pipelines that have to exist up front
+        VkPipeline GetBlocking(const PipelineProgram& program, const PipelineState& state);
+        // Waits for the program's compiles and destroys its pipelines, before its modules and layout go away
+        void Release(const PipelineProgram& program);
+
+        uint32_t GetPipelineCount();
+        uint32_t GetPendingCount();
+    }
+}
@@ -0,0 +1,827 @@
+#include "RenderGraph.h"
+#include "Graphics.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+
+namespace
+{
+	using eUsage = VulkanProject::RenderGraph::eUsage;
+
+	const VkAccessFlags c_WriteAccess = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	struct UsageInfo
+	{
+		VkPipelineStageFlags stages = 0;
+		VkAccessFlags access = 0;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		bool write = false;
+	};
+
+	UsageInfo GetUsageInfo(eUsage usage, bool depth)
+	{
+		const VkImageLayout sampledLayout = depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		switch (usage)
+		{
+		case eUsage::IndirectRead:
+			return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false };
+		case eUsage::TransferRead:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false };
+		case eUsage::TransferWrite:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true };
+		case eUsage::ComputeSampled:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT, sampledLayout, false };
+		case eUsage::FragmentSampled:
+			return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT, sampledLayout, false };
+		case eUsage::ComputeStorageRead:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false };
+		case eUsage::ComputeStorageWrite:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true };
+		case eUsage::ComputeStorageReadWrite:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true };
+		case eUsage::ColorAttachment:
+			return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true };
+		case eUsage::DepthAttachment:
+			return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true };
+		default:
+			return {};
+		}
+	}
+
+	bool IsAttachment(eUsage usage)
+	{
+		return usage == eUsage::ColorAttachment || usage == eUsage::DepthAttachment;
+	}
+
+	bool HasStencil(VkFormat format)
+	{
+		return format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+	}
+
+	bool IsDepth(VkFormat format)
+	{
+		return HasStencil(format) || format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_X8_D24_UNORM_PACK32 || format == VK_FORMAT_D32_SFLOAT;
+	}
+
+	// Layout transitions of a depth/stencil image have to include both aspects
+	VkImageAspectFlags GetBarrierAspect(VkFormat format)
+	{
+		if (HasStencil(format))
+		{
+			return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+		}
+		return IsDepth(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+
+	VkDeviceSize Align(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+VulkanProject::RenderGraph::~RenderGraph()
+{
+	if (m_Transients.empty() && m_RenderPasses.empty() && m_Framebuffers.empty())
+	{
+		return;
+	}
+	VkDevice device = Renderer::GetDevice();
+	DestroyTransients();
+	for (auto& renderPass : m_RenderPasses)
+	{
+		vkDestroyRenderPass(device, renderPass.second, nullptr);
+	}
+	for (std::vector<VkFramebuffer>& framebuffers : m_Framebuffers)
+	{
+		for (VkFramebuffer framebuffer : framebuffers)
+		{
+			vkDestroyFramebuffer(device, framebuffer, nullptr);
+		}
+	}
+}
+
+void VulkanProject::RenderGraph::Reset()
+{
+	m_Resources.clear();
+	m_Passes.clear();
+	m_FinalBarrier = Barrier();
+}
+
+VulkanProject::RenderGraph::Handle VulkanProject::RenderGraph::ImportImage(VkImage image, VkImageView view, const ImageDesc& desc, eUsage initial, eUsage final)
+{
+	Resource resource;
+	resource.imported = true;
+	resource.desc = desc;
+	resource.handle = image;
+	resource.view = view;
+	resource.initial = initial;
+	resource.final = final;
+	m_Resources.push_back(resource);
+	return static_cast<Handle>(m_Resources.size() - 1);
+}
+
+VulkanProject::RenderGraph::Handle VulkanProject::RenderGraph::ImportBuffer(VkBuffer buffer, eUsage initial, eUsage final)
+{
+	Resource resource;
+	resource.image = false;
+	resource.imported = true;
+	resource.buffer = buffer;
+	resource.initial = initial;
+	resource.final = final;
+	m_Resources.push_back(resource);
+	return static_cast<Handle>(m_Resources.size() - 1);
+}
+
+VulkanProject::RenderGraph::Handle VulkanProject::RenderGraph::CreateImage(const ImageDesc& desc)
+{
+	Resource resource;
+	resource.desc = desc;
+	m_Resources.push_back(resource);
+	return static_cast<Handle>(m_Resources.size() - 1);
+}
+
+VulkanProject::RenderGraph::Handle VulkanProject::RenderGraph::AddPass(const std::string& name, std::function<void(VkCommandBuffer)> execute)
+{
+	Pass pass;
+	pass.name = name;
+	pass.execute = std::move(execute);
+	m_Passes.push_back(std::move(pass));
+	return static_cast<Handle>(m_Passes.size() - 1);
+}
+
+void VulkanProject::RenderGraph::AddAccess(Handle pass, Handle resource, eUsage usage, uint32_t baseLevel, uint32_t levelCount, bool write)
+{
+	if (pass >= m_Passes.size() || resource >= m_Resources.size())
+	{
+		throw std::runtime_error("render graph pass or resource does not exist!");
+	}
+	const Resource& declared = m_Resources[resource];
+	const uint32_t levels = declared.image ? declared.desc.mipLevels : 1;
+	if (levelCount == 0 || baseLevel + levelCount > levels)
+	{
+		throw std::runtime_error("render graph access is outside of the resource's mip levels!");
+	}
+	if (usage == eUsage::None || GetUsageInfo(usage, false).write != write)
+	{
+		throw std::runtime_error("render graph usage does not match the access!");
+	}
+
+	Access access;
+	access.resource = resource;
+	access.usage = usage;
+	access.baseLevel = baseLevel;
+	access.levelCount = levelCount;
+	m_Passes[pass].accesses.push_back(access);
+}
+
+void VulkanProject::RenderGraph::Read(Handle pass, Handle resource, eUsage usage, uint32_t baseLevel, uint32_t levelCount)
+{
+	AddAccess(pass, resource, usage, baseLevel, levelCount, false);
+}
+
+void VulkanProject::RenderGraph::Write(Handle pass, Handle resource, eUsage usage, uint32_t baseLevel, uint32_t levelCount)
+{
+	AddAccess(pass, resource, usage, baseLevel, levelCount, true);
+}
+
+void VulkanProject::RenderGraph::Clear(Handle pass, Handle resource, const VkClearValue& value)
+{
+	for (Access& access : m_Passes.at(pass).accesses)
+	{
+		if (access.resource == resource && IsAttachment(access.usage))
+		{
+			access.clear = true;
+			access.clearValue = value;
+			return;
+		}
+	}
+	throw std::runtime_error("render graph can only clear an attachment the pass writes!");
+}
+
+void VulkanProject::RenderGraph::Compile()
+{
+	m_Stats = Stats();
+	CullPasses();
+	const bool placed = PlaceTransients();
+	ComputeBarriers();
+	if (placed)
+	{
+		printf("Render graph: %u passes (%u culled), %u barriers (%u image, %u memory) in %u batches, %.2f MB of transient images aliased from %.2f MB\n",
+			m_Stats.passes, m_Stats.culledPasses, m_Stats.imageBarriers + m_Stats.memoryBarriers, m_Stats.imageBarriers, m_Stats.memoryBarriers, m_Stats.barrierBatches,
+			m_Stats.transientMemory / (1024.0 * 1024.0), m_Stats.unaliasedMemory / (1024.0 * 1024.0));
+	}
+}
+
+void VulkanProject::RenderGraph::CullPasses()
+{
+	// Backwards, a pass is needed when it writes an imported resource or something a needed pass reads.
+	// Tracked per resource, not per mip level.
+	std::vector<bool> needed(m_Resources.size(), false);
+	for (size_t i = m_Passes.size(); i-- > 0;)
+	{
+		Pass& pass = m_Passes[i];
+		pass.culled = true;
+		for (const Access& access : pass.accesses)
+		{
+			if (GetUsageInfo(access.usage, false).write && (m_Resources[access.resource].imported || needed[access.resource]))
+			{
+				pass.culled = false;
+			}
+		}
+		if (pass.culled)
+		{
+			m_Stats.culledPasses++;
+			continue;
+		}
+		m_Stats.passes++;
+		for (const Access& access : pass.accesses)
+		{
+			// attachments that are not cleared load what was there
+			const bool reads = !GetUsageInfo(access.usage, false).write || access.usage == eUsage::ComputeStorageReadWrite || (IsAttachment(access.usage) && !access.clear);
+			if (reads)
+			{
+				needed[access.resource] = true;
+			}
+		}
+	}
+}
+
+bool VulkanProject::RenderGraph::PlaceTransients()
+{
+	// The transient images of this frame with the passes they live between
+	std::vector<Transient> wanted;
+	std::vector<uint32_t> owners;
+	for (uint32_t i = 0; i < m_Resources.size(); i++)
+	{
+		Resource& resource = m_Resources[i];
+		resource.transient = UINT32_MAX;
+		if (resource.imported)
+		{
+			continue;
+		}
+		Transient transient;
+		transient.desc = resource.desc;
+		transient.firstPass = UINT32_MAX;
+		for (uint32_t pass = 0; pass < m_Passes.size(); pass++)
+		{
+			for (const Access& access : m_Passes[pass].accesses)
+			{
+				if (access.resource == i && !m_Passes[pass].culled)
+				{
+					transient.firstPass = std::min(transient.firstPass, pass);
+					transient.lastPass = pass;
+				}
+			}
+		}
+		// Only used by culled passes
+		if (transient.firstPass == UINT32_MAX)
+		{
+			continue;
+		}
+		resource.transient = static_cast<uint32_t>(wanted.size());
+		wanted.push_back(transient);
+		owners.push_back(i);
+	}
+
+	bool same = wanted.size() == m_Transients.size();
+	for (size_t i = 0; i < wanted.size() && same; i++)
+	{
+		const ImageDesc& a = wanted[i].desc;
+		const ImageDesc& b = m_Transients[i].desc;
+		same = a.format == b.format && a.extent.width == b.extent.width && a.extent.height == b.extent.height && a.mipLevels == b.mipLevels && a.usage == b.usage &&
+			wanted[i].firstPass == m_Transients[i].firstPass && wanted[i].lastPass == m_Transients[i].lastPass;
+	}
+
+	if (!same)
+	{
+		if (!m_Transients.empty())
+		{
+			// The frames in flight still use them
+			vkDeviceWaitIdle(Renderer::GetDevice());
+			DestroyTransients();
+		}
+		m_Transients = wanted;
+
+		VkDevice device = Renderer::GetDevice();
+		std::vector<VkMemoryRequirements> requirements(m_Transients.size());
+		std::vector<uint32_t> memoryTypes;
+		for (size_t i = 0; i < m_Transients.size(); i++)
+		{
+			Transient& transient = m_Transients[i];
+			VkImageCreateInfo imageInfo{};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.extent = { transient.desc.extent.width, transient.desc.extent.height, 1 };
+			imageInfo.mipLevels = transient.desc.mipLevels;
+			imageInfo.arrayLayers = 1;
+			imageInfo.format = transient.desc.format;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageInfo.usage = transient.desc.usage;
+			imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			if (vkCreateImage(device, &imageInfo, nullptr, &transient.image) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create transient image!");
+			}
+			vkGetImageMemoryRequirements(device, transient.image, &requirements[i]);
+			transient.size = requirements[i].size;
+
+			uint32_t memoryType = Renderer::FindMemoryType(requirements[i].memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			auto found = std::find(memoryTypes.begin(), memoryTypes.end(), memoryType);
+			transient.memory = static_cast<uint32_t>(found - memoryTypes.begin());
+			if (found == memoryTypes.end())
+			{
+				memoryTypes.push_back(memoryType);
+			}
+		}
+
+		// Largest first, each at the lowest offset that is free for its whole lifetime
+		std::vector<size_t> order(m_Transients.size());
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return m_Transients[a].size > m_Transients[b].size; });
+		std::vector<VkDeviceSize> memorySizes(memoryTypes.size(), 0);
+		std::vector<const Transient*> placed;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			Transient& transient = m_Transients[order[i]];
+			std::vector<const Transient*> overlapping;
+			for (const Transient* other : placed)
+			{
+				if (other->memory == transient.memory && other->firstPass <= transient.lastPass && transient.firstPass <= other->lastPass)
+				{
+					overlapping.push_back(other);
+				}
+			}
+			std::sort(overlapping.begin(), overlapping.end(), [](const Transient* a, const Transient* b) { return a->offset < b->offset; });
+
+			const VkDeviceSize alignment = requirements[order[i]].alignment;
+			VkDeviceSize offset = 0;
+			for (const Transient* other : overlapping)
+			{
+				offset = Align(offset, alignment);
+				if (offset + transient.size <= other->offset)
+				{
+					break;
+				}
+				offset = std::max(offset, other->offset + other->size);
+			}
+			transient.offset = Align(offset, alignment);
+			memorySizes[transient.memory] = std::max(memorySizes[transient.memory], transient.offset + transient.size);
+			placed.push_back(&transient);
+		}
+
+		m_Memory.resize(memoryTypes.size());
+		for (size_t i = 0; i < m_Memory.size(); i++)
+		{
+			VkMemoryAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			allocInfo.allocationSize = memorySizes[i];
+			allocInfo.memoryTypeIndex = memoryTypes[i];
+			if (vkAllocateMemory(device, &allocInfo, nullptr, &m_Memory[i]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate transient image memory!");
+			}
+		}
+		for (Transient& transient : m_Transients)
+		{
+			vkBindImageMemory(device, transient.image, m_Memory[transient.memory], transient.offset);
+		}
+	}
+
+	// Stages of every pass that touches the memory, the first use of a transient waits for all of them
+	std::vector<VkPipelineStageFlags> stages(m_Transients.size(), 0);
+	std::vector<VkAccessFlags> writes(m_Transients.size(), 0);
+	for (const Pass& pass : m_Passes)
+	{
+		for (const Access& access : pass.accesses)
+		{
+			uint32_t transient = m_Resources[access.resource].transient;
+			if (!pass.culled && transient != UINT32_MAX)
+			{
+				UsageInfo info = GetUsageInfo(access.usage, IsDepth(m_Transients[transient].desc.format));
+				stages[transient] |= info.stages;
+				writes[transient] |= info.access & c_WriteAccess;
+			}
+		}
+	}
+	std::vector<VkDeviceSize> memorySizes(m_Memory.size(), 0);
+	for (Transient& transient : m_Transients)
+	{
+		transient.aliasStages = 0;
+		transient.aliasAccess = 0;
+		for (size_t i = 0; i < m_Transients.size(); i++)
+		{
+			const Transient& other = m_Transients[i];
+			if (other.memory == transient.memory && other.offset < transient.offset + transient.size && transient.offset < other.offset + other.size)
+			{
+				transient.aliasStages |= stages[i];
+				transient.aliasAccess |= writes[i];
+			}
+		}
+		memorySizes[transient.memory] = std::max(memorySizes[transient.memory], transient.offset + transient.size);
+		m_Stats.unaliasedMemory += transient.size;
+	}
+	for (VkDeviceSize size : memorySizes)
+	{
+		m_Stats.transientMemory += size;
+	}
+	return !same;
+}
+
+void VulkanProject::RenderGraph::DestroyTransients()
+{
+	VkDevice device = Renderer::GetDevice();
+	for (Transient& transient : m_Transients)
+	{
+		for (auto& view : transient.views)
+		{
+			vkDestroyImageView(device, view.second, nullptr);
+		}
+		vkDestroyImage(device, transient.image, nullptr);
+	}
+	m_Transients.clear();
+	for (VkDeviceMemory memory : m_Memory)
+	{
+		vkFreeMemory(device, memory, nullptr);
+	}
+	m_Memory.clear();
+}
+
+void VulkanProject::RenderGraph::ComputeBarriers()
+{
+	// Where every mip level and buffer stands before the first pass
+	std::vector<std::vector<State>> states(m_Resources.size());
+	for (size_t i = 0; i < m_Resources.size(); i++)
+	{
+		const Resource& resource = m_Resources[i];
+		State state;
+		if (resource.imported)
+		{
+			UsageInfo info = GetUsageInfo(resource.initial, IsDepth(resource.desc.format));
+			state.layout = resource.image ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+			if (info.write)
+			{
+				state.writeStages = info.stages;
+				state.writeAccess = info.access & c_WriteAccess;
+			}
+			else
+			{
+				state.readStages = info.stages;
+			}
+		}
+		else if (resource.transient != UINT32_MAX)
+		{
+			// Undefined contents, but last frame or an earlier transient may still use the memory
+			state.writeStages = m_Transients[resource.transient].aliasStages;
+			state.writeAccess = m_Transients[resource.transient].aliasAccess;
+		}
+		states[i].assign(resource.image ? resource.desc.mipLevels : 1, state);
+	}
+
+	// A frame in flight is done with the framebuffers of the last time it was compiled
+	m_Framebuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	std::vector<VkFramebuffer>& framebuffers = m_Framebuffers[Renderer::GetCurrentFrame()];
+	for (VkFramebuffer framebuffer : framebuffers)
+	{
+		vkDestroyFramebuffer(Renderer::GetDevice(), framebuffer, nullptr);
+	}
+	framebuffers.clear();
+
+	for (uint32_t i = 0; i < m_Passes.size(); i++)
+	{
+		Pass& pass = m_Passes[i];
+		pass.barrier = Barrier();
+		pass.renderPass = VK_NULL_HANDLE;
+		if (pass.culled)
+		{
+			continue;
+		}
+		// Load operations depend on the layouts before the barrier
+		CreateRenderPass(pass, states, i, framebuffers);
+		for (const Access& access : pass.accesses)
+		{
+			Transition(pass.barrier, access.resource, states[access.resource], access.usage, access.baseLevel, access.levelCount);
+		}
+		CountBarrier(pass.barrier);
+	}
+
+	m_FinalBarrier = Barrier();
+	for (size_t i = 0; i < m_Resources.size(); i++)
+	{
+		const Resource& resource = m_Resources[i];
+		if (resource.imported && resource.final != eUsage::None)
+		{
+			Transition(m_FinalBarrier, static_cast<Handle>(i), states[i], resource.final, 0, static_cast<uint32_t>(states[i].size()));
+		}
+	}
+	CountBarrier(m_FinalBarrier);
+}
+
+void VulkanProject::RenderGraph::Transition(Barrier& barrier, Handle handle, std::vector<State>& states, eUsage usage, uint32_t baseLevel, uint32_t levelCount)
+{
+	const Resource& resource = m_Resources[handle];
+	UsageInfo info = GetUsageInfo(usage, IsDepth(resource.desc.format));
+	for (uint32_t level = baseLevel; level < baseLevel + levelCount; level++)
+	{
+		State& state = states[level];
+		const bool layoutChange = resource.image && info.layout != state.layout;
+		VkPipelineStageFlags srcStages = 0;
+		VkAccessFlags srcAccess = 0;
+		bool needed = false;
+		if (info.write || layoutChange)
+		{
+			// after the last write and every read since
+			srcStages = state.writeStages | state.readStages;
+			srcAccess = state.writeAccess;
+			needed = srcStages != 0 || layoutChange;
+		}
+		else if (state.writeStages != 0 && ((info.stages & ~state.visibleStages) != 0 || (info.access & ~state.visibleAccess) != 0))
+		{
+			// a read that does not see the last write yet
+			srcStages = state.writeStages;
+			srcAccess = state.writeAccess;
+			needed = true;
+		}
+
+		if (needed)
+		{
+			barrier.srcStages |= srcStages;
+			barrier.dstStages |= info.stages;
+			if (layoutChange)
+			{
+				VkImageMemoryBarrier imageBarrier{};
+				imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				imageBarrier.oldLayout = state.layout;
+				imageBarrier.newLayout = info.layout;
+				imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageBarrier.image = GetImage(handle);
+				imageBarrier.subresourceRange.aspectMask = GetBarrierAspect(resource.desc.format);
+				imageBarrier.subresourceRange.baseMipLevel = level;
+				imageBarrier.subresourceRange.levelCount = 1;
+				imageBarrier.subresourceRange.layerCount = 1;
+				imageBarrier.srcAccessMask = srcAccess;
+				imageBarrier.dstAccessMask = info.access;
+
+				// Joins the barrier of the level before when only the level differs
+				VkImageMemoryBarrier* previous = barrier.images.empty() ? nullptr : &barrier.images.back();
+				if (previous && previous->image == imageBarrier.image && previous->oldLayout == imageBarrier.oldLayout && previous->newLayout == imageBarrier.newLayout &&
+					previous->srcAccessMask == imageBarrier.srcAccessMask && previous->dstAccessMask == imageBarrier.dstAccessMask &&
+					previous->subresourceRange.baseMipLevel + previous->subresourceRange.levelCount == level)
+				{
+					previous->subresourceRange.levelCount++;
+				}
+				else
+				{
+					barrier.images.push_back(imageBarrier);
+				}
+			}
+			else if (srcAccess != 0)
+			{
+				// Everything else shares one global memory barrier
+				barrier.srcAccess |= srcAccess;
+				barrier.dstAccess |= info.access;
+			}
+		}
+
+		if (info.write)
+		{
+			state = State();
+			state.layout = info.layout;
+			state.writeStages = info.stages;
+			state.writeAccess = info.access & c_WriteAccess;
+		}
+		else if (layoutChange)
+		{
+			// The transition is a write only the stages of this barrier see
+			state = State();
+			state.layout = info.layout;
+			state.writeStages = info.stages;
+			state.readStages = info.stages;
+			state.visibleStages = info.stages;
+			state.visibleAccess = info.access;
+		}
+		else
+		{
+			if (needed)
+			{
+				state.visibleStages |= info.stages;
+				state.visibleAccess |= info.access;
+			}
+			state.readStages |= info.stages;
+		}
+	}
+}
+
+void VulkanProject::RenderGraph::CreateRenderPass(Pass& pass, const std::vector<std::vector<State>>& states, uint32_t passIndex, std::vector<VkFramebuffer>& framebuffers)
+{
+	std::vector<VkAttachmentDescription> attachments;
+	std::vector<VkAttachmentReference> colorReferences;
+	VkAttachmentReference depthReference{};
+	bool hasDepth = false;
+	std::vector<VkImageView> views;
+	std::vector<uint32_t> key;
+	pass.clearValues.clear();
+	for (const Access& access : pass.accesses)
+	{
+		if (!IsAttachment(access.usage))
+		{
+			continue;
+		}
+		const Resource& resource = m_Resources[access.resource];
+		const VkImageLayout layout = GetUsageInfo(access.usage, IsDepth(resource.desc.format)).layout;
+		// Nothing to keep after the last use of a transient image, nothing to load before its first write
+		const bool lastUse = !resource.imported && m_Transients[resource.transient].lastPass == passIndex;
+		const bool defined = states[access.resource][access.baseLevel].layout != VK_IMAGE_LAYOUT_UNDEFINED;
+
+		VkAttachmentDescription attachment{};
+		attachment.format = resource.desc.format;
+		attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		attachment.loadOp = access.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : (defined ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+		attachment.storeOp = lastUse ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+		attachment.stencilLoadOp = HasStencil(resource.desc.format) ? attachment.loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = HasStencil(resource.desc.format) ? attachment.storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		// The graph's barriers do the transitions
+		attachment.initialLayout = layout;
+		attachment.finalLayout = layout;
+
+		VkAttachmentReference reference{};
+		reference.attachment = static_cast<uint32_t>(attachments.size());
+		reference.layout = layout;
+		if (access.usage == eUsage::DepthAttachment)
+		{
+			if (hasDepth)
+			{
+				throw std::runtime_error("render graph pass writes more than one depth attachment!");
+			}
+			depthReference = reference;
+			hasDepth = true;
+		}
+		else
+		{
+			colorReferences.push_back(reference);
+		}
+		attachments.push_back(attachment);
+		key.insert(key.end(), { static_cast<uint32_t>(access.usage), static_cast<uint32_t>(attachment.format), static_cast<uint32_t>(attachment.loadOp),
+			static_cast<uint32_t>(attachment.storeOp) });
+
+		views.push_back(GetImageView(access.resource, access.baseLevel, 1));
+		pass.extent = { std::max(1u, resource.desc.extent.width >> access.baseLevel), std::max(1u, resource.desc.extent.height >> access.baseLevel) };
+		pass.clearValues.push_back(access.clearValue);
+	}
+	if (attachments.empty())
+	{
+		return;
+	}
+
+	VkDevice device = Renderer::GetDevice();
+	auto found = m_RenderPasses.find(key);
+	if (found == m_RenderPasses.end())
+	{
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+		subpass.pColorAttachments = colorReferences.data();
+		subpass.pDepthStencilAttachment = hasDepth ? &depthReference : nullptr;
+
+		VkRenderPassCreateInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderPassInfo.pAttachments = attachments.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+
+		VkRenderPass renderPass;
+		if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create render graph render pass!");
+		}
+		found = m_RenderPasses.emplace(key, renderPass).first;
+	}
+	pass.renderPass = found->second;
+
+	VkFramebufferCreateInfo framebufferInfo{};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = pass.renderPass;
+	framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+	framebufferInfo.pAttachments = views.data();
+	framebufferInfo.width = pass.extent.width;
+	framebufferInfo.height = pass.extent.height;
+	framebufferInfo.layers = 1;
+	if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &pass.framebuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create render graph framebuffer!");
+	}
+	framebuffers.push_back(pass.framebuffer);
+}
+
+void VulkanProject::RenderGraph::CountBarrier(const Barrier& barrier)
+{
+	if (barrier.dstStages == 0)
+	{
+		return;
+	}
+	m_Stats.barrierBatches++;
+	m_Stats.imageBarriers += static_cast<uint32_t>(barrier.images.size());
+	if (barrier.srcAccess != 0)
+	{
+		m_Stats.memoryBarriers++;
+	}
+}
+
+void VulkanProject::RenderGraph::RecordBarrier(VkCommandBuffer commandBuffer, const Barrier& barrier)
+{
+	if (barrier.dstStages == 0)
+	{
+		return;
+	}
+	VkMemoryBarrier memoryBarrier{};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = barrier.srcAccess;
+	memoryBarrier.dstAccessMask = barrier.dstAccess;
+	// Transitions of resources nothing touched before wait for nothing
+	VkPipelineStageFlags srcStages = barrier.srcStages != 0 ? barrier.srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, srcStages, barrier.dstStages, 0, barrier.srcAccess != 0 ? 1 : 0, &memoryBarrier, 0, nullptr,
+		static_cast<uint32_t>(barrier.images.size()), barrier.images.data());
+}
+
+void VulkanProject::RenderGraph::Execute(VkCommandBuffer commandBuffer)
+{
+	for (const Pass& pass : m_Passes)
+	{
+		if (pass.culled)
+		{
+			continue;
+		}
+		RecordBarrier(commandBuffer, pass.barrier);
+		if (pass.renderPass == VK_NULL_HANDLE)
+		{
+			pass.execute(commandBuffer);
+			continue;
+		}
+
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = pass.renderPass;
+		renderPassInfo.framebuffer = pass.framebuffer;
+		renderPassInfo.renderArea.extent = pass.extent;
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(pass.clearValues.size());
+		renderPassInfo.pClearValues = pass.clearValues.data();
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		pass.execute(commandBuffer);
+		vkCmdEndRenderPass(commandBuffer);
+	}
+	RecordBarrier(commandBuffer, m_FinalBarrier);
+}
+
+VkImage VulkanProject::RenderGraph::GetImage(Handle resource) const
+{
+	const Resource& declared = m_Resources.at(resource);
+	if (declared.imported || declared.transient == UINT32_MAX)
+	{
+		return declared.handle;
+	}
+	return m_Transients[declared.transient].image;
+}
+
+VkImageView VulkanProject::RenderGraph::GetImageView(Handle resource, uint32_t baseLevel, uint32_t levelCount)
+{
+	const Resource& declared = m_Resources.at(resource);
+	if (declared.imported)
+	{
+		return declared.view;
+	}
+	if (declared.transient == UINT32_MAX)
+	{
+		throw std::runtime_error("render graph image is only used by culled passes!");
+	}
+
+	Transient& transient = m_Transients[declared.transient];
+	uint64_t key = (static_cast<uint64_t>(baseLevel) << 32) | levelCount;
+	auto found = transient.views.find(key);
+	if (found != transient.views.end())
+	{
+		return found->second;
+	}
+	VkImageAspectFlags aspect = IsDepth(transient.desc.format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+	VkImageView view = Renderer::CreateImageView(transient.image, transient.desc.format, aspect, levelCount, baseLevel);
+	transient.views.emplace(key, view);
+	return view;
+}
+
+VkBuffer VulkanProject::RenderGraph::GetBuffer(Handle resource) const
+{
+	return m_Resources.at(resource).buffer;
+}
+
+VkImageLayout VulkanProject::RenderGraph::GetLayout(Handle resource, eUsage usage) const
+{
+	return GetUsageInfo(usage, IsDepth(m_Resources.at(resource).desc.format)).layout;
+}
@@ -0,0 +1,198 @@
+#pragma once
+#include "Core/Includes.h"
+#include <vector>
+#include <map>
+#include <string>
+#include <functional>
+#include <cstdint>
+
+namespace VulkanProject
+{
+    // GPU work of a frame as passes that declare the images and buffers they read and write. Compile drops
+    // the passes whose results nothing uses, puts a single batched barrier in front of every pass that is
+    // left and places the transient images whose lifetimes do not overlap in the same memory. Passes run
+    // in the order they were added, a pass can only read what the passes before it wrote.
+    // Declared again every frame with Reset, the transient images and render passes are kept as long as
+    // the declarations stay the same.
+    class RenderGraph
+    {
+    public:
+        using Handle = uint32_t;
+
+        // How a pass uses a resource, decides the stages, accesses and image layout
+        enum class eUsage : uint32_t
+        {
+            // not used yet or written by the host, only as the state of an imported resource
+            None,
+            IndirectRead,
+            TransferRead,
+            TransferWrite,
+            // combined image sampler or uniform buffer, read only depth for depth formats
+            ComputeSampled,
+            FragmentSampled,
+            // storage images are in GENERAL
+            ComputeStorageRead,
+            ComputeStorageWrite,
+            ComputeStorageReadWrite,
+            // a pass with attachments runs in a render pass of them, all with the same extent
+            ColorAttachment,
+            DepthAttachment,
+        };
+
+        struct ImageDesc
+        {
+            VkFormat format = VK_FORMAT_UNDEFINED;
+            VkExtent2D extent = { 0, 0 };
+            uint32_t mipLevels = 1;
+            VkImageUsageFlags usage = 0;
+        };
+
+        struct Stats
+        {
+            uint32_t passes = 0;
+            uint32_t culledPasses = 0;
+            // vkCmdPipelineBarrier calls and the barriers recorded by them
+            uint32_t barrierBatches = 0;
+            uint32_t imageBarriers = 0;
+            uint32_t memoryBarriers = 0;
+            // memory of the transient images as placed, and what it would be without aliasing
+            VkDeviceSize transientMemory = 0;
+            VkDeviceSize unaliasedMemory = 0;
+        };
+
+        RenderGraph() = default;
+        RenderGraph(const RenderGraph&) = delete;
+        RenderGraph& operator=(const RenderGraph&) = delete;
+        // The device has to be done with the graph's images
+        ~RenderGraph();
+
+        // Forgets the passes and resources of the last frame
+        void Reset();
+
+        // A resource the graph does not own, in the state of initial. It is left in the state of final
+        // unless that is None. Passes that write an imported resource are never culled.
+        Handle ImportImage(VkImage image, VkImageView view, const ImageDesc& desc, eUsage initial, eUsage final = eUsage::None);
+        Handle ImportBuffer(VkBuffer buffer, eUsage initial, eUsage final = eUsage::None);
+        // Owned by the graph, lives from the first pass that uses it to the last one. The contents are
+        // undefined before the first write of every frame.
+        Handle CreateImage(const ImageDesc& desc);
+
+        Handle AddPass(const std::string& name, std::function<void(VkCommandBuffer)> execute);
+        // Mip levels from baseLevel, the levels of an image can be in different states
+        void Read(Handle pass, Handle resource, eUsage usage, uint32_t baseLevel = 0, uint32_t levelCount = 1);
+        void Write(Handle pass, Handle resource, eUsage usage, uint32_t baseLevel = 0, uint32_t levelCount = 1);
+        // Clears an attachment the pass writes when its render pass begins
+        void Clear(Handle pass, Handle resource, const VkClearValue& value);
+
+        // Culls, places the transient images and works out the barriers, once per frame. Waits for the device
+        // when the transient images have to be created again.
+        void Compile();
+        // Records the compiled passes, outside of any render pass
+        void Execute(VkCommandBuffer commandBuffer);
+        const Stats& GetStats() const { return m_Stats; }
+
+        // For the execute callbacks, valid after Compile. Views of transient images are created on first use.
+        VkImage GetImage(Handle resource) const;
+        VkImageView GetImageView(Handle resource, uint32_t baseLevel = 0, uint32_t levelCount = 1);
+        VkBuffer GetBuffer(Handle resource) const;
+        VkImageLayout GetLayout(Handle resource, eUsage usage) const;
+
+    private:
+        struct Resource
+        {
+            bool image = true;
+            bool imported = false;
+            ImageDesc desc;
+            VkImage handle = VK_NULL_HANDLE;
+            VkImageView view = VK_NULL_HANDLE;
+            VkBuffer buffer = VK_NULL_HANDLE;
+            eUsage initial = eUsage::None;
+            eUsage final = eUsage::None;
+            // index into m_Transients once placed
+            uint32_t transient = UINT32_MAX;
+        };
+        struct Access
+        {
+            Handle resource = 0;
+            eUsage usage = eUsage::None;
+            uint32_t baseLevel = 0;
+            uint32_t levelCount = 1;
+            bool clear = false;
+            VkClearValue clearValue{};
+        };
+        struct Barrier
+        {
+            VkPipelineStageFlags srcStages = 0;
+            VkPipelineStageFlags dstStages = 0;
+            VkAccessFlags srcAccess = 0;
+            VkAccessFlags dstAccess = 0;
+            std::vector<VkImageMemoryBarrier> images;
+        };
+        struct Pass
+        {
+            std::string name;
+            std::function<void(VkCommandBuffer)> execute;
+            std::vector<Access> accesses;
+            bool culled = false;
+            Barrier barrier;
+            // set for passes with attachments
+            VkRenderPass renderPass = VK_NULL_HANDLE;
+            VkFramebuffer framebuffer = VK_NULL_HANDLE;
+            VkExtent2D extent = { 0, 0 };
+            std::vector<VkClearValue> clearValues;
+        };
+        // Placed in memory shared with the transients whose lifetimes do not overlap
+        struct Transient
+        {
+            ImageDesc desc;
+            uint32_t firstPass = 0;
+            uint32_t lastPass = 0;
+            VkImage image = VK_NULL_HANDLE;
+            // index into m_Memory
+            uint32_t memory = 0;
+            VkDeviceSize offset = 0;
+            VkDeviceSize size = 0;
+            // every stage and write of the transients sharing its memory, last frame's included
+            VkPipelineStageFlags aliasStages = 0;
+            VkAccessFlags aliasAccess = 0;
+            std::map<uint64_t, VkImageView> views;
+        };
+        // What happened to a mip level or buffer since its last write
+        struct State
+        {
+            VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkPipelineStageFlags writeStages = 0;
+            VkAccessFlags writeAccess = 0;
+            VkPipelineStageFlags readStages = 0;
+            // stages and accesses that already see the last write
+            VkPipelineStageFlags visibleStages = 0;
+            VkAccessFlags visibleAccess = 0;
+        };
+
+        void AddAccess(Handle pass, Handle resource, eUsage usage, uint32_t baseLevel, uint32_t levelCount, bool write);
+        void CullPasses();
+        // Returns whether the transient images were created again
+        bool PlaceTransients();
+        void DestroyTransients();
+        void ComputeBarriers();
+        // Adds what the access needs to the barrier and moves the states on
+        void Transition(Barrier& barrier, Handle handle, std::vector<State>& states, eUsage usage, uint32_t baseLevel, uint32_t levelCount);
+        void CreateRenderPass(Pass& pass, const std::vector<std::vector<State>>& states, uint32_t passIndex, std::vector<VkFramebuffer>& framebuffers);
+        void RecordBarrier(VkCommandBuffer commandBuffer, const Barrier& barrier);
+        void CountBarrier(const Barrier& barrier);
+
+        std::vector<Resource> m_Resources;
+        std::vector<Pass> m_Passes;
+        // brings the imported resources to their final state after the last pass
+        Barrier m_FinalBarrier;
+        Stats m_Stats;
+
+        // kept from one Compile to the next while the transient images stay the same
+        std::vector<Transient> m_Transients;
+        // one block per memory type
+        std::vector<VkDeviceMemory> m_Memory;
+        std::map<std::vector<uint32_t>, VkRenderPass> m_RenderPasses;
+        // created every Compile, destroyed once the frame in flight that used them is done
+        std::vector<std::vector<VkFramebuffer>> m_Framebuffers;
+    };
+}
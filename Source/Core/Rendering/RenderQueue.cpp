@@ -0,0 +1,98 @@
+#include "RenderQueue.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	const uint32_t c_LayerBits = 2;
+	const uint32_t c_PipelineBits = 10;
+	const uint32_t c_MaterialBits = 16;
+	const uint32_t c_MeshBits = 16;
+	const uint32_t c_DepthBits = 20;
+	static_assert(c_LayerBits + c_PipelineBits + c_MaterialBits + c_MeshBits + c_DepthBits == 64, "the sort key has to fill 64 bits");
+
+	uint64_t Saturate(uint32_t value, uint32_t bits)
+	{
+		return std::min<uint64_t>(value, (1ull << bits) - 1);
+	}
+}
+
+uint64_t VulkanProject::RenderQueue::MakeKey(eLayer layer, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth)
+{
+	const uint64_t maxDepth = (1ull << c_DepthBits) - 1;
+	uint64_t quantized = static_cast<uint64_t>(std::round(std::min(std::max(depth, 0.0f), 1.0f) * maxDepth));
+
+	uint64_t key = static_cast<uint64_t>(layer) << (64 - c_LayerBits);
+	if (layer == eLayer::Opaque)
+	{
+		// layer | pipeline | material | mesh | depth
+		key |= Saturate(pipeline, c_PipelineBits) << (c_MaterialBits + c_MeshBits + c_DepthBits);
+		key |= Saturate(material, c_MaterialBits) << (c_MeshBits + c_DepthBits);
+		key |= Saturate(mesh, c_MeshBits) << c_DepthBits;
+		key |= quantized;
+	}
+	else
+	{
+		// layer | inverted depth | pipeline | material | mesh, blending needs the order more than the grouping
+		key |= (maxDepth - quantized) << (c_PipelineBits + c_MaterialBits + c_MeshBits);
+		key |= Saturate(pipeline, c_PipelineBits) << (c_MaterialBits + c_MeshBits);
+		key |= Saturate(material, c_MaterialBits) << c_MeshBits;
+		key |= Saturate(mesh, c_MeshBits);
+	}
+	return key;
+}
+
+void VulkanProject::RenderQueue::Clear()
+{
+	m_Keys.clear();
+}
+
+void VulkanProject::RenderQueue::Push(uint64_t key)
+{
+	m_Keys.push_back(key);
+}
+
+const std::vector<uint32_t>& VulkanProject::RenderQueue::Sort()
+{
+	const size_t count = m_Keys.size();
+	m_SortedKeys = m_Keys;
+	m_KeyScratch.resize(count);
+	m_Order.resize(count);
+	m_OrderScratch.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		m_Order[i] = static_cast<uint32_t>(i);
+	}
+
+	// One pass per byte from the lowest up, every pass is stable so the higher bytes decide last
+	for (uint32_t shift = 0; shift < 64; shift += 8)
+	{
+		size_t histogram[256] = {};
+		for (uint64_t key : m_SortedKeys)
+		{
+			histogram[(key >> shift) & 0xFF]++;
+		}
+		// The byte does not change the order
+		if (count == 0 || histogram[(m_SortedKeys[0] >> shift) & 0xFF] == count)
+		{
+			continue;
+		}
+
+		size_t offset = 0;
+		for (size_t& bucket : histogram)
+		{
+			size_t bucketCount = bucket;
+			bucket = offset;
+			offset += bucketCount;
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			size_t destination = histogram[(m_SortedKeys[i] >> shift) & 0xFF]++;
+			m_KeyScratch[destination] = m_SortedKeys[i];
+			m_OrderScratch[destination] = m_Order[i];
+		}
+		m_SortedKeys.swap(m_KeyScratch);
+		m_Order.swap(m_OrderScratch);
+	}
+	return m_Order;
+}
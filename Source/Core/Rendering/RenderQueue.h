@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace VulkanProject
+{
+    // Orders the draws of a frame by a 64 bit key. Opaque draws are grouped by pipeline, material and mesh
+    // and go front to back inside a group for early depth rejection. Transparent draws come after them and
+    // go back to front, grouped only where their depths are equal.
+    class RenderQueue
+    {
+    public:
+        enum class eLayer : uint32_t
+        {
+            Opaque = 0,
+            Transparent = 1,
+        };
+
+        // Ids past their bits (10 for the pipeline, 16 for material and mesh) share the largest value, the
+        // draws are still ordered, only grouped less. depth is 0 at the camera and 1 at the farthest draw.
+        static uint64_t MakeKey(eLayer layer, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth);
+
+        void Clear();
+        // Items are identified by the order they are pushed in
+        void Push(uint64_t key);
+        size_t GetCount() const { return m_Keys.size(); }
+
+        // Indices of the items by ascending key, equal keys keep the order they were pushed in.
+        // An LSD radix sort over the bytes of the keys, bytes that are the same for every key are skipped.
+        const std::vector<uint32_t>& Sort();
+
+    private:
+        std::vector<uint64_t> m_Keys;
+        std::vector<uint64_t> m_SortedKeys;
+        std::vector<uint64_t> m_KeyScratch;
+        std::vector<uint32_t> m_Order;
+        std::vector<uint32_t> m_OrderScratch;
+    };
+}
@@ -0,0 +1,105 @@
+#include "SamplerCache.h"
+#include "Graphics.h"
+#include "Core/AssetCache.h"
+#include <unordered_map>
+#include <mutex>
+#include <stdexcept>
+#include <cstring>
+
+namespace
+{
+	struct SamplerStateHash
+	{
+		size_t operator()(const VulkanProject::SamplerState& state) const
+		{
+			return static_cast<size_t>(VulkanProject::Hasher().Add(&state, sizeof(state)).Get());
+		}
+	};
+
+	struct SamplerCacheData
+	{
+		float maxAnisotropy = 1.0f;
+		std::mutex mutex;
+		std::unordered_map<VulkanProject::SamplerState, VkSampler, SamplerStateHash> samplers;
+	};
+
+	static SamplerCacheData* data = nullptr;
+}
+
+bool VulkanProject::SamplerState::operator==(const SamplerState& other) const
+{
+	return memcmp(this, &other, sizeof(SamplerState)) == 0;
+}
+
+void VulkanProject::SamplerCache::Init()
+{
+	if (data)
+	{
+		throw std::runtime_error("sampler cache is already initialised!");
+	}
+	data = new SamplerCacheData();
+
+	// Queried once instead of for every sampler
+	VkPhysicalDeviceProperties properties{};
+	vkGetPhysicalDeviceProperties(Renderer::GetPhysicalDevice(), &properties);
+	data->maxAnisotropy = properties.limits.maxSamplerAnisotropy;
+}
+
+void VulkanProject::SamplerCache::Shutdown()
+{
+	if (!data)
+	{
+		return;
+	}
+	for (auto& sampler : data->samplers)
+	{
+		vkDestroySampler(Renderer::GetDevice(), sampler.second, nullptr);
+	}
+	delete data;
+	data = nullptr;
+}
+
+VkSampler VulkanProject::SamplerCache::Get(const SamplerState& state)
+{
+	std::lock_guard<std::mutex> lock(data->mutex);
+	auto it = data->samplers.find(state);
+	if (it != data->samplers.end())
+	{
+		return it->second;
+	}
+
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = state.magFilter;
+	samplerInfo.minFilter = state.minFilter;
+	samplerInfo.addressModeU = state.addressModeU;
+	samplerInfo.addressModeV = state.addressModeV;
+	samplerInfo.addressModeW = state.addressModeV;
+	samplerInfo.anisotropyEnable = state.anisotropyEnable;
+	samplerInfo.maxAnisotropy = state.anisotropyEnable ? data->maxAnisotropy : 1.0f;
+	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerInfo.mipmapMode = state.mipmapMode;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = state.maxLod;
+
+	VkSampler sampler;
+	if (vkCreateSampler(Renderer::GetDevice(), &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create texture sampler!");
+	}
+	data->samplers.emplace(state, sampler);
+	return sampler;
+}
+
+uint32_t VulkanProject::SamplerCache::GetSamplerCount()
+{
+	if (!data)
+	{
+		return 0;
+	}
+	std::lock_guard<std::mutex> lock(data->mutex);
+	return static_cast<uint32_t>(data->samplers.size());
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "Core/Includes.h"
+#include <cstdint>
+
+namespace VulkanProject
+{
+    // The part of VkSamplerCreateInfo the renderer varies. Every member is 32 bits, the state is hashed as bytes.
+    struct SamplerState
+    {
+        VkFilter magFilter = VK_FILTER_LINEAR;
+        VkFilter minFilter = VK_FILTER_LINEAR;
+        VkSamplerMipmapMode mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        VkSamplerAddressMode addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        VkSamplerAddressMode addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        // at the device's maximum anisotropy
+        VkBool32 anisotropyEnable = VK_TRUE;
+        // 0 samples the first level only
+        float maxLod = VK_LOD_CLAMP_NONE;
+
+        bool operator==(const SamplerState& other) const;
+        bool operator!=(const SamplerState& other) const { return !(*this == other); }
+    };
+
+    // Global deduplicating sampler store. Every distinct state is created once and lives until Shutdown,
+    // so the sampler count stays bounded by the states in use rather than by pipelines or textures.
+    namespace SamplerCache
+    {
+        // Needs the device, shut down after everything that holds on to a sampler
+        void Init();
+        void Shutdown();
+
+        // Thread safe, the sampler can be baked into descriptor set layouts as an immutable sampler
+        VkSampler Get(const SamplerState& state);
+        uint32_t GetSamplerCount();
+    }
+}
@@ -1,211 +1,66 @@
 #include "Shader.h"
 #include "Graphics.h"
 #include <stdexcept>
-#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cfloat>
 #include "Texture.h"
+#include "VirtualTexture.h"
+#include "ShaderCompiler.h"
+#include "GpuCulling.h"
+#include "Core/ThreadPool.h"
+#include "Core/AssetCache.h"
 
-
-static std::vector<char> readFile(const std::string& filename)
+namespace
 {
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-	if (!file.is_open()) 
-    {
-		throw std::runtime_error("failed to open file!");
-	}
-
-	size_t fileSize = (size_t)file.tellg();
-	std::vector<char> buffer(fileSize);
-
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-
-	file.close();
-
-	return buffer;
+    // Recorded draw calls a parallel recording job needs before the extra command buffer is worth it
+    const uint32_t c_MinCallsPerJob = 512;
 }
 
-
 VulkanProject::GraphicsPipeline::GraphicsPipeline(PipelineDesc& desc)
 {
    
-    // Create descriptor layout
-    {
-        VkDescriptorSetLayoutBinding uboLayoutBinding{};
-        uboLayoutBinding.binding = 0;
-        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        uboLayoutBinding.descriptorCount = 1;
-        uboLayoutBinding.pImmutableSamplers = nullptr;
-        uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-        VkDescriptorSetLayoutBinding modelLayoutBinding{};
-        modelLayoutBinding.binding = 1;
-        modelLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        modelLayoutBinding.descriptorCount = 1;
-        modelLayoutBinding.pImmutableSamplers = nullptr;
-        modelLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-        std::array<VkDescriptorSetLayoutBinding, 3> texturesLayoutBinding{};
-        texturesLayoutBinding[0].binding = 2;
-        texturesLayoutBinding[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        texturesLayoutBinding[0].descriptorCount = 1;
-        texturesLayoutBinding[0].pImmutableSamplers = nullptr;
-        texturesLayoutBinding[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-        texturesLayoutBinding[1].binding = 3;
-        texturesLayoutBinding[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        texturesLayoutBinding[1].descriptorCount = 1;
-        texturesLayoutBinding[1].pImmutableSamplers = nullptr;
-        texturesLayoutBinding[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-        texturesLayoutBinding[2].binding = 4;
-        texturesLayoutBinding[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        texturesLayoutBinding[2].descriptorCount = 1;
-        texturesLayoutBinding[2].pImmutableSamplers = nullptr;
-        texturesLayoutBinding[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-     
-
-        std::array<VkDescriptorSetLayoutBinding, 5> bindings = { uboLayoutBinding, modelLayoutBinding, texturesLayoutBinding[0],texturesLayoutBinding[1] ,texturesLayoutBinding[2] };
-        VkDescriptorSetLayoutCreateInfo layoutInfo{};
-        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-        layoutInfo.pBindings = bindings.data();
-     
-        if (vkCreateDescriptorSetLayout(Renderer::GetDevice(), &layoutInfo, nullptr, &m_DescriptorSetLayout) != VK_SUCCESS)
-        {
-            throw std::runtime_error("failed to create descriptor set layout!");
-        }
-    }
     // Graphics pipeline object
     {
+        m_VertexShaderPath = desc.vertexShaderPath;
+        m_FragmentShaderPath = desc.fragmentShaderPath;
+        m_State = desc.state;
+        ShaderCode shaders = LoadShaders(m_VertexShaderPath, m_FragmentShaderPath);
+        WatchShaders(shaders.dependencies);
+
+        // Layouts, pool sizes and vertex inputs all follow from what the shaders declare
+        m_Interface = shaders.shaderInterface;
+        if (m_Interface.GetSetCount() != 1)
+        {
+            throw std::runtime_error("graphics pipelines have to use exactly one descriptor set!");
+        }
 
-        auto vertShaderCode = readFile(desc.vertexShaderPath);
-        auto fragShaderCode = readFile(desc.fragmentShaderPath);
-
-        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-        VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-        vertShaderStageInfo.module = vertShaderModule;
-        vertShaderStageInfo.pName = "main";
-
-        VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        fragShaderStageInfo.module = fragShaderModule;
-        fragShaderStageInfo.pName = "main";
-
-        VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
-
-        VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-
-        auto bindingDescription = Vertex::getBindingDescription();
-        auto attributeDescriptions = Vertex::getAttributeDescriptions();
-
-        vertexInputInfo.vertexBindingDescriptionCount = 1;
-        vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-        inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-        VkPipelineViewportStateCreateInfo viewportState{};
-        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-        viewportState.viewportCount = 1;
-        viewportState.scissorCount = 1;
-
-        VkPipelineRasterizationStateCreateInfo rasterizer{};
-        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-        rasterizer.depthClampEnable = VK_FALSE;
-        rasterizer.rasterizerDiscardEnable = VK_FALSE;
-        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-        rasterizer.lineWidth = 1.0f;
-        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-        rasterizer.depthBiasEnable = VK_FALSE;
-
-        VkPipelineMultisampleStateCreateInfo multisampling{};
-        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-        multisampling.sampleShadingEnable = VK_FALSE;
-        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-        VkPipelineDepthStencilStateCreateInfo depthStencil{};
-        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-        depthStencil.depthTestEnable = VK_TRUE;
-        depthStencil.depthWriteEnable = VK_TRUE;
-        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-        depthStencil.depthBoundsTestEnable = VK_FALSE;
-        depthStencil.stencilTestEnable = VK_FALSE;
-
-        VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-        colorBlendAttachment.blendEnable = VK_FALSE;
-
-        VkPipelineColorBlendStateCreateInfo colorBlending{};
-        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-        colorBlending.logicOpEnable = VK_FALSE;
-        colorBlending.logicOp = VK_LOGIC_OP_COPY;
-        colorBlending.attachmentCount = 1;
-        colorBlending.pAttachments = &colorBlendAttachment;
-        colorBlending.blendConstants[0] = 0.0f;
-        colorBlending.blendConstants[1] = 0.0f;
-        colorBlending.blendConstants[2] = 0.0f;
-        colorBlending.blendConstants[3] = 0.0f;
-
-        std::vector<VkDynamicState> dynamicStates = 
-        {
-            VK_DYNAMIC_STATE_VIEWPORT,
-            VK_DYNAMIC_STATE_SCISSOR
-        };
-        VkPipelineDynamicStateCreateInfo dynamicState{};
-        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
-        dynamicState.pDynamicStates = dynamicStates.data();
-
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount = 1;
-        pipelineLayoutInfo.pSetLayouts = &m_DescriptorSetLayout;
-
-        if (vkCreatePipelineLayout(Renderer::GetDevice(), &pipelineLayoutInfo, nullptr, &m_PipelineLayout) != VK_SUCCESS) 
-        {
-        throw std::runtime_error("failed to create pipeline layout!");
-        }
-
-        VkGraphicsPipelineCreateInfo pipelineInfo{};
-        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipelineInfo.stageCount = 2;
-        pipelineInfo.pDepthStencilState = &depthStencil;
-        pipelineInfo.pStages = shaderStages;
-        pipelineInfo.pVertexInputState = &vertexInputInfo;
-        pipelineInfo.pInputAssemblyState = &inputAssembly;
-        pipelineInfo.pViewportState = &viewportState;
-        pipelineInfo.pRasterizationState = &rasterizer;
-        pipelineInfo.pMultisampleState = &multisampling;
-        pipelineInfo.pColorBlendState = &colorBlending;
-        pipelineInfo.pDynamicState = &dynamicState;
-        pipelineInfo.layout = m_PipelineLayout;
-        pipelineInfo.renderPass = Renderer::GetRenderPass();
-        pipelineInfo.subpass = 0;
-        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-
-        if (vkCreateGraphicsPipelines(Renderer::GetDevice(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_GraphicsPipeline) != VK_SUCCESS) 
-        {
-        throw std::runtime_error("failed to create graphics pipeline!");
-        }
-
-        vkDestroyShaderModule(Renderer::GetDevice(), fragShaderModule, nullptr);
-        vkDestroyShaderModule(Renderer::GetDevice(), vertShaderModule, nullptr);
+        // Page tables are always fetched the same way, so their sampler is part of the layout
+        std::unordered_map<std::string, VkSampler> immutableSamplers;
+        for (const char* pageTable : { "diffusePages", "normalPages", "metallicPages" })
+        {
+            immutableSamplers[pageTable] = VirtualTexturing::GetPageTableSampler();
+        }
+        m_DescriptorSetLayout = LayoutCache::GetDescriptorSetLayout(ShaderReflection::GetSetLayoutBindings(m_Interface, 0, immutableSamplers));
+        m_PipelineLayout = LayoutCache::GetPipelineLayout({ m_DescriptorSetLayout }, m_Interface.pushConstants);
+
+        // The modules stay around for the states that are compiled later on
+        m_Program.vertexShader = createShaderModule(shaders.vertex);
+        m_Program.fragmentShader = createShaderModule(shaders.fragment);
+        m_Program.layout = m_PipelineLayout;
+        m_Program.renderPass = Renderer::GetRenderPass();
+        m_Program.vertexInputs = m_Interface.vertexInputs;
+
+        // The state of the description is compiled right away, draws with other states fall back to it until theirs is ready
+        auto start = std::chrono::high_resolution_clock::now();
+        m_GraphicsPipeline = PipelineCache::GetBlocking(m_Program, desc.state);
+        // Compare between a cold and a warm pipeline cache
+        float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        printf("Graphics pipeline %s created in %.2f ms\n", desc.fragmentShaderPath.c_str(), milliseconds);
     }
 
     // Samplers
-    CreateTextureSamplers();
 
    // Buffers
     {
@@ -221,112 +76,528 @@ VulkanProject::GraphicsPipeline::GraphicsPipeline(PipelineDesc& desc)
 
             vkMapMemory(Renderer::GetDevice(), m_UniformBuffersMemory[i], 0, ViewProjectionbufferSize, 0, &m_UniformBuffersMapped[i]);
         }
-        VkDeviceSize modelBufferSize = sizeof(glm::mat4);
+        // Per frame draw buffers and descriptor pools are created on first use
+        m_Frames.resize(MAX_FRAMES_IN_FLIGHT);
+    }
 
-        m_ModelBuffer.resize(MAX_FRAMES_IN_FLIGHT);
-        m_ModelBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-        m_ModelBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+}
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-        {
-            Renderer::CreateBuffer(modelBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_ModelBuffer[i], m_ModelBuffersMemory[i]);
+void VulkanProject::GraphicsPipeline::UpdateBuffers(UniformBufferObject& ubo)
+{
+    Renderer::UploadUniformBuffer(m_UniformBuffersMapped, ubo, sizeof(ubo));
+    m_ViewProjection = ubo.proj * ubo.view;
+    //Renderer::UploadUniformBuffer(m_ModelBuffersMapped, ubo.model, sizeof(glm::mat4));
+    //Renderer::BindDescriptors(m_DescriptorSets);
+
+}
 
-            vkMapMemory(Renderer::GetDevice(), m_ModelBuffersMemory[i], 0, modelBufferSize, 0, &m_ModelBuffersMapped[i]);
+void VulkanProject::GraphicsPipeline::Submit(const DrawItem& draw)
+{
+    if (draw.transforms != nullptr && draw.instanceCount == 0)
+    {
+        return;
+    }
+    m_Draws.push_back(draw);
+}
+
+void VulkanProject::GraphicsPipeline::SetStatic(bool enabled)
+{
+    m_Static = enabled;
+    for (FrameData& frame : m_Frames)
+    {
+        frame.signature = 0;
+    }
+}
+
+void VulkanProject::GraphicsPipeline::Flush()
+{
+    FrameData& frame = m_Frames[Renderer::GetCurrentFrame()];
+    const bool culling = GpuCulling::IsEnabled();
+    bool sorted = false;
+    const uint64_t signature = m_Static && !m_Draws.empty() ? SignDraws(sorted) : 0;
+    // The frame's buffers and descriptor sets still hold these draws, only the recordings are executed again
+    const bool replay = signature != 0 && signature == frame.signature &&
+        Renderer::IsRecorded(frame.recordings[0]) && (!culling || Renderer::IsRecorded(frame.recordings[1]));
+    if (!replay)
+    {
+        // BeginFrame waited for the frame that used these last
+        for (uint32_t i = 0; i < frame.usedPools; i++)
+        {
+            vkResetDescriptorPool(Renderer::GetDevice(), frame.descriptorPools[i], 0);
         }
-       
-        // Create descriptor pool
+        frame.usedPools = 0;
+        frame.signature = signature;
+        for (Renderer::StaticRecording& recording : frame.recordings)
         {
-            std::array<VkDescriptorPoolSize, 3 > poolSizes{};
-            poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-            poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-            poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * 3;
+            recording.Invalidate();
+        }
+        if (m_Draws.empty())
+        {
+            return;
+        }
+        WriteDraws(sorted);
+    }
 
+    const uint32_t drawCount = static_cast<uint32_t>(m_Draws.size());
+    if (!culling)
+    {
+        DrawBatches(frame.commands.buffer, frame.recordings[0]);
+        m_Draws.clear();
+        return;
+    }
 
-            VkDescriptorPoolCreateInfo poolInfo{};
-            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-            poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-            poolInfo.pPoolSizes = poolSizes.data();
-            poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    GpuCulling::DrawList list;
+    list.bounds = frame.bounds.buffer;
+    list.commands = frame.commands.buffer;
+    list.count = drawCount;
+    list.viewProjection = m_ViewProjection;
+
+    // What was visible last frame first, its depth decides what else is visible
+    Renderer::EndRenderPass();
+    GpuCulling::CullEarly(list, frame.earlyCommands.buffer);
+    Renderer::ResumeRenderPass();
+    DrawBatches(frame.earlyCommands.buffer, frame.recordings[0]);
+
+    Renderer::EndRenderPass();
+    GpuCulling::CullLate(list, frame.lateCommands.buffer);
+    Renderer::ResumeRenderPass();
+    DrawBatches(frame.lateCommands.buffer, frame.recordings[1]);
+    m_Draws.clear();
+}
 
-            if (vkCreateDescriptorPool(Renderer::GetDevice(), &poolInfo, nullptr, &m_DescriptorPool) != VK_SUCCESS)
+void VulkanProject::GraphicsPipeline::WriteDraws(bool sorted)
+{
+    FrameData& frame = m_Frames[Renderer::GetCurrentFrame()];
+    const uint32_t drawCount = static_cast<uint32_t>(m_Draws.size());
+    if (!sorted)
+    {
+        SortDraws();
+    }
+    uint32_t instanceCount = 0;
+    for (const DrawItem& draw : m_Draws)
+    {
+        instanceCount += draw.transforms != nullptr ? draw.instanceCount : 1;
+    }
+    const bool culling = GpuCulling::IsEnabled();
+    Reserve(frame.transforms, sizeof(glm::mat4) * instanceCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    Reserve(frame.commands, sizeof(VkDrawIndexedIndirectCommand) * drawCount, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    if (culling)
+    {
+        Reserve(frame.bounds, sizeof(glm::vec4) * drawCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        Reserve(frame.earlyCommands, sizeof(VkDrawIndexedIndirectCommand) * drawCount, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        Reserve(frame.lateCommands, sizeof(VkDrawIndexedIndirectCommand) * drawCount, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    }
+    glm::mat4* transforms = static_cast<glm::mat4*>(frame.transforms.mapped);
+    glm::vec4* bounds = static_cast<glm::vec4*>(frame.bounds.mapped);
+    m_Commands.resize(drawCount);
+    uint32_t firstInstance = 0;
+    for (uint32_t i = 0; i < drawCount; i++)
+    {
+        const DrawItem& draw = m_Draws[i];
+        const glm::mat4* instances = draw.transforms != nullptr ? draw.transforms : &draw.transform;
+        const uint32_t count = draw.transforms != nullptr ? draw.instanceCount : 1;
+        memcpy(transforms + firstInstance, instances, sizeof(glm::mat4) * count);
+        m_Commands[i] = draw.mesh->GetDrawCommand(firstInstance, count);
+        firstInstance += count;
+        if (culling)
+        {
+            // World space bounds, scaled by the largest axis of the transform
+            auto getSphere = [&draw](const glm::mat4& transform)
             {
-                throw std::runtime_error("failed to create descriptor pool!");
+                glm::vec3 center = glm::vec3(transform * glm::vec4(draw.mesh->GetBoundsCenter(), 1.0f));
+                float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+                return glm::vec4(center, draw.mesh->GetBoundsRadius() * scale);
+            };
+            bounds[i] = getSphere(instances[0]);
+            if (count > 1)
+            {
+                // The instances are culled together, with a sphere around the box of all their spheres
+                glm::vec3 minimum = glm::vec3(FLT_MAX);
+                glm::vec3 maximum = glm::vec3(-FLT_MAX);
+                for (uint32_t j = 0; j < count; j++)
+                {
+                    glm::vec4 sphere = getSphere(instances[j]);
+                    minimum = glm::min(minimum, glm::vec3(sphere) - sphere.w);
+                    maximum = glm::max(maximum, glm::vec3(sphere) + sphere.w);
+                }
+                bounds[i] = glm::vec4((minimum + maximum) * 0.5f, glm::length(maximum - minimum) * 0.5f);
             }
         }
+    }
+    memcpy(frame.commands.mapped, m_Commands.data(), sizeof(VkDrawIndexedIndirectCommand) * drawCount);
 
-        // Create descriptor sets
+    // A descriptor set per material, shared by its batches and both culling passes
+    m_Batches.clear();
+    m_Materials.assign(m_MaterialIds.size(), Batch{});
+    for (uint32_t first = 0; first < drawCount;)
+    {
+        const DrawItem& draw = m_Draws[first];
+        const uint32_t material = m_DrawMaterials[first];
+        uint32_t last = first + 1;
+        while (last < drawCount && m_DrawMaterials[last] == material && m_Draws[last].state == draw.state)
+        {
+            last++;
+        }
+        if (m_Materials[material].descriptorSet == VK_NULL_HANDLE)
+        {
+            m_Materials[material] = WriteMaterial(draw);
+        }
+        Batch batch = m_Materials[material];
+        batch.first = first;
+        batch.count = last - first;
+        // Looked up here, the recording jobs only read the batches
+        batch.pipeline = PipelineCache::Get(m_Program, draw.state);
+        if (batch.pipeline == VK_NULL_HANDLE)
         {
+            batch.pipeline = m_GraphicsPipeline;
+        }
+        m_Batches.push_back(batch);
+        first = last;
+    }
+}
 
-            std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, m_DescriptorSetLayout);
-            VkDescriptorSetAllocateInfo allocInfo{};
-            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-            allocInfo.descriptorPool = m_DescriptorPool;
-            allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-            allocInfo.pSetLayouts = layouts.data();
+uint64_t VulkanProject::GraphicsPipeline::SignDraws(bool& sorted)
+{
+    // Pipelines compile in the background, the batches switch from the fallback once they are done
+    Hasher hasher;
+    hasher.Add(uint64_t(GpuCulling::IsEnabled())).Add(&m_GraphicsPipeline, sizeof(m_GraphicsPipeline));
+    std::vector<PipelineState> states;
+    bool transparent = false;
+    for (const DrawItem& draw : m_Draws)
+    {
+        // The draw command covers where the mesh is in the GeometryPool
+        const uint32_t count = draw.transforms != nullptr ? draw.instanceCount : 1;
+        const VkDrawIndexedIndirectCommand command = draw.mesh->GetDrawCommand(0, count);
+        hasher.Add(&draw.mesh, sizeof(draw.mesh)).Add(&command, sizeof(command));
+        hasher.Add(draw.transforms != nullptr ? draw.transforms : &draw.transform, sizeof(glm::mat4) * count);
+        hasher.Add(&draw.state, sizeof(draw.state));
+        // Streaming replaces the views of the textures
+        const MaterialInputs inputs = GetMaterialInputs(draw);
+        hasher.Add(&inputs, sizeof(inputs));
+        if (std::find(states.begin(), states.end(), draw.state) == states.end())
+        {
+            states.push_back(draw.state);
+        }
+        transparent = transparent || draw.state.blendEnable;
+    }
+    for (const PipelineState& state : states)
+    {
+        VkPipeline pipeline = PipelineCache::Get(m_Program, state);
+        hasher.Add(&pipeline, sizeof(pipeline));
+    }
 
-            m_DescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-            if (vkAllocateDescriptorSets(Renderer::GetDevice(), &allocInfo, m_DescriptorSets.data()) != VK_SUCCESS)
+    // Transparent draws have to stay back to front, the opaque ones are only drawn in a less ideal order
+    sorted = transparent;
+    if (transparent)
+    {
+        SortDraws();
+        for (const DrawItem& draw : m_Draws)
+        {
+            if (draw.state.blendEnable)
             {
-                throw std::runtime_error("failed to allocate descriptor sets!");
+                const glm::mat4& transform = draw.transforms != nullptr ? draw.transforms[0] : draw.transform;
+                hasher.Add(&draw.mesh, sizeof(draw.mesh)).Add(&transform, sizeof(transform));
             }
         }
     }
+    return hasher.Get();
+}
+
+void VulkanProject::GraphicsPipeline::SortDraws()
+{
+    // Pipelines, materials and meshes are numbered in the order they first show up
+    std::vector<PipelineState> states;
+    std::unordered_map<const Mesh*, uint32_t> meshes;
+    m_MaterialIds.clear();
+
+    // Distance from the camera along the view direction, of the first instance for instanced draws
+    std::vector<float> distances(m_Draws.size());
+    float farthest = 0.0f;
+    for (size_t i = 0; i < m_Draws.size(); i++)
+    {
+        const DrawItem& draw = m_Draws[i];
+        const glm::mat4& transform = draw.transforms != nullptr ? draw.transforms[0] : draw.transform;
+        distances[i] = std::max((m_ViewProjection * transform * glm::vec4(draw.mesh->GetBoundsCenter(), 1.0f)).w, 0.0f);
+        farthest = std::max(farthest, distances[i]);
+    }
+
+    m_Queue.Clear();
+    std::vector<uint32_t> materials(m_Draws.size());
+    for (size_t i = 0; i < m_Draws.size(); i++)
+    {
+        const DrawItem& draw = m_Draws[i];
+        uint32_t pipeline = static_cast<uint32_t>(std::find(states.begin(), states.end(), draw.state) - states.begin());
+        if (pipeline == states.size())
+        {
+            states.push_back(draw.state);
+        }
+        MaterialKey materialKey;
+        std::copy(draw.textures, draw.textures + 3, materialKey.begin());
+        std::copy(draw.virtualTextures, draw.virtualTextures + 3, materialKey.begin() + 3);
+        auto material = m_MaterialIds.emplace(materialKey, static_cast<uint32_t>(m_MaterialIds.size())).first->second;
+        auto mesh = meshes.emplace(draw.mesh, static_cast<uint32_t>(meshes.size())).first->second;
+        materials[i] = material;
+
+        RenderQueue::eLayer layer = draw.state.blendEnable ? RenderQueue::eLayer::Transparent : RenderQueue::eLayer::Opaque;
+        m_Queue.Push(RenderQueue::MakeKey(layer, pipeline, material, mesh, farthest > 0.0f ? distances[i] / farthest : 0.0f));
+    }
 
+    // The order changes with the camera, GpuCulling then draws the moved draws in its late pass for a frame
+    const std::vector<uint32_t>& order = m_Queue.Sort();
+    m_SortedDraws.resize(m_Draws.size());
+    m_DrawMaterials.resize(m_Draws.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        m_SortedDraws[i] = m_Draws[order[i]];
+        m_DrawMaterials[i] = materials[order[i]];
+    }
+    m_Draws.swap(m_SortedDraws);
 }
 
-void VulkanProject::GraphicsPipeline::UpdateBuffers(UniformBufferObject& ubo)
+void VulkanProject::GraphicsPipeline::DrawBatches(VkBuffer commands, Renderer::StaticRecording& recording)
 {
-    Renderer::UploadUniformBuffer(m_UniformBuffersMapped, ubo, sizeof(ubo));
-    //Renderer::UploadUniformBuffer(m_ModelBuffersMapped, ubo.model, sizeof(glm::mat4));
-    //Renderer::BindDescriptors(m_DescriptorSets);
+    if (m_Static)
+    {
+        // Not recorded again while replaying, m_Batches may be of the other frame in flight then
+        Renderer::ExecuteStatic(recording, [this, commands]()
+        {
+            Renderer::BindGeometry(GeometryPool::GetVertexBuffer(), GeometryPool::GetIndexBuffer());
+            DrawRange(commands, 0, static_cast<uint32_t>(m_Draws.size()));
+        });
+        return;
+    }
+
+    // A multi draw per batch, or a call per draw without multi draw or first instance
+    const VkPhysicalDeviceFeatures& features = Renderer::GetEnabledFeatures();
+    const bool multiDraw = features.drawIndirectFirstInstance && features.multiDrawIndirect;
+    const uint32_t drawCount = static_cast<uint32_t>(m_Draws.size());
+    const uint32_t calls = multiDraw ? static_cast<uint32_t>(m_Batches.size()) : drawCount;
+    const uint32_t jobCount = std::min(Renderer::GetRecordingThreads(), calls / c_MinCallsPerJob);
+    // Every mesh is in the GeometryPool, the encoder drops the bind when it stayed bound
+    if (jobCount <= 1)
+    {
+        Renderer::BindGeometry(GeometryPool::GetVertexBuffer(), GeometryPool::GetIndexBuffer());
+        DrawRange(commands, 0, drawCount);
+        return;
+    }
+
+    // Even shares of the calls, whole batches when a batch is a single call
+    std::vector<uint32_t> bounds(jobCount + 1);
+    for (uint32_t i = 0; i <= jobCount; i++)
+    {
+        const uint32_t call = static_cast<uint32_t>(static_cast<uint64_t>(calls) * i / jobCount);
+        bounds[i] = !multiDraw ? call : (call < m_Batches.size() ? m_Batches[call].first : drawCount);
+    }
+    Renderer::RecordParallel(jobCount, [this, commands, &bounds](uint32_t job)
+    {
+        Renderer::BindGeometry(GeometryPool::GetVertexBuffer(), GeometryPool::GetIndexBuffer());
+        DrawRange(commands, bounds[job], bounds[job + 1]);
+    });
+}
+
+void VulkanProject::GraphicsPipeline::DrawRange(VkBuffer commands, uint32_t first, uint32_t last)
+{
+    const bool indirect = Renderer::GetEnabledFeatures().drawIndirectFirstInstance;
+    // Every pipeline shares the layout, so the descriptors and constants stay bound across pipeline changes.
+    // Nothing is known to be bound when the render pass was just resumed.
+    VkPipeline boundPipeline = VK_NULL_HANDLE;
+    VkDescriptorSet boundDescriptorSet = VK_NULL_HANDLE;
+    const VirtualTextureConstants* boundConstants = nullptr;
+    for (const Batch& batch : m_Batches)
+    {
+        const uint32_t begin = std::max(batch.first, first);
+        const uint32_t end = std::min(batch.first + batch.count, last);
+        if (begin >= end)
+        {
+            continue;
+        }
+        if (batch.pipeline != boundPipeline)
+        {
+            Renderer::BindPipeline(batch.pipeline, m_PipelineLayout);
+            boundPipeline = batch.pipeline;
+        }
+        if (batch.descriptorSet != boundDescriptorSet)
+        {
+            Renderer::BindDescriptors(batch.descriptorSet);
+            boundDescriptorSet = batch.descriptorSet;
+        }
+        if (boundConstants == nullptr || memcmp(boundConstants, &batch.constants, sizeof(batch.constants)) != 0)
+        {
+            Renderer::PushConstants(VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(batch.constants), &batch.constants);
+            boundConstants = &batch.constants;
+        }
+        if (indirect)
+        {
+            Renderer::DrawIndexedIndirect(commands, sizeof(VkDrawIndexedIndirectCommand) * begin, end - begin);
+        }
+        else
+        {
+            // Without first instance in indirect draws the index only reaches the shader through direct draws
+            for (uint32_t i = begin; i < end; i++)
+            {
+                Renderer::DrawIndexed(m_Commands[i]);
+            }
+        }
+    }
+}
 
+VulkanProject::GraphicsPipeline::MaterialInputs VulkanProject::GraphicsPipeline::GetMaterialInputs(const DrawItem& draw) const
+{
+    // Compared bytewise by SignDraws
+    MaterialInputs inputs{};
+    VkImageView* textureViews = inputs.textureViews;
+    VkSampler* textureSamplers = inputs.textureSamplers;
+    VkImageView* pageTableViews = inputs.pageTableViews;
+    if (draw.virtualTextures[0] != nullptr && draw.virtualTextures[1] != nullptr && draw.virtualTextures[2] != nullptr)
+    {
+        // The texture slots read the physical cache, sRGB for colour and linear for the normal and roughness/metalness pages
+        for (int i = 0; i < 3; i++)
+        {
+            textureViews[i] = VirtualTexturing::GetCacheView(i == 0);
+            textureSamplers[i] = VirtualTexturing::GetCacheSampler();
+            pageTableViews[i] = draw.virtualTextures[i]->GetPageTableView();
+        }
+        inputs.constants = VirtualTexturing::GetConstants(draw.virtualTextures);
+    }
+    else
+    {
+        // A missing map is never sampled by the material's permutation, its slot only needs some valid descriptor
+        const Texture* present = nullptr;
+        for (const Texture* texture : draw.textures)
+        {
+            present = present != nullptr ? present : texture;
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            const Texture* texture = draw.textures[i] != nullptr ? draw.textures[i] : present;
+            textureViews[i] = texture != nullptr ? texture->GetImageview() : VirtualTexturing::GetCacheView(i == 0);
+            textureSamplers[i] = texture != nullptr ? texture->GetSampler() : VirtualTexturing::GetCacheSampler();
+            pageTableViews[i] = VirtualTexturing::GetEmptyPageTableView();
+        }
+    }
+    return inputs;
 }
 
-void VulkanProject::GraphicsPipeline::UploadModelBuffer(glm::mat4 model)
+VulkanProject::GraphicsPipeline::Batch VulkanProject::GraphicsPipeline::WriteMaterial(const DrawItem& draw)
 {
-    Renderer::UploadUniformBuffer(m_ModelBuffersMapped, model, sizeof(glm::mat4));
+    const MaterialInputs inputs = GetMaterialInputs(draw);
+    Batch batch{};
+    batch.constants = inputs.constants;
+    batch.descriptorSet = AllocateDescriptorSet();
+    WriteDescriptorSets(batch.descriptorSet, inputs.textureViews, inputs.textureSamplers, inputs.pageTableViews);
+    return batch;
 }
 
-void VulkanProject::GraphicsPipeline::BindData()
+VkDescriptorSet VulkanProject::GraphicsPipeline::AllocateDescriptorSet()
 {
-    Renderer::BindDescriptors(m_DescriptorSets);
+    const uint32_t c_SetsPerPool = 64;
+    FrameData& frame = m_Frames[Renderer::GetCurrentFrame()];
+    if (frame.usedPools == 0 || frame.setsInPool == c_SetsPerPool)
+    {
+        if (frame.usedPools == frame.descriptorPools.size())
+        {
+            std::vector<VkDescriptorPoolSize> poolSizes = ShaderReflection::GetPoolSizes(m_Interface, c_SetsPerPool);
+
+            VkDescriptorPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+            poolInfo.pPoolSizes = poolSizes.data();
+            poolInfo.maxSets = c_SetsPerPool;
+
+            VkDescriptorPool pool;
+            if (vkCreateDescriptorPool(Renderer::GetDevice(), &poolInfo, nullptr, &pool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create descriptor pool!");
+            }
+            frame.descriptorPools.push_back(pool);
+        }
+        frame.usedPools++;
+        frame.setsInPool = 0;
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = frame.descriptorPools[frame.usedPools - 1];
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &m_DescriptorSetLayout;
+
+    VkDescriptorSet descriptorSet;
+    if (vkAllocateDescriptorSets(Renderer::GetDevice(), &allocInfo, &descriptorSet) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to allocate descriptor sets!");
+    }
+    frame.setsInPool++;
+    return descriptorSet;
+}
+
+void VulkanProject::GraphicsPipeline::Reserve(FrameBuffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
+{
+    if (buffer.size >= size)
+    {
+        return;
+    }
+    Destroy(buffer);
+    buffer.size = std::max(size, buffer.size * 2);
+    Renderer::CreateBuffer(buffer.size, usage, properties, buffer.buffer, buffer.memory);
+    if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        vkMapMemory(Renderer::GetDevice(), buffer.memory, 0, buffer.size, 0, &buffer.mapped);
+    }
 }
 
-void VulkanProject::GraphicsPipeline::UpdateDesctiptorSets(std::vector<Texture*> textures)
+void VulkanProject::GraphicsPipeline::Destroy(FrameBuffer& buffer)
 {
+    if (buffer.buffer == VK_NULL_HANDLE)
+    {
+        return;
+    }
+    vkDestroyBuffer(Renderer::GetDevice(), buffer.buffer, nullptr);
+    vkFreeMemory(Renderer::GetDevice(), buffer.memory, nullptr);
+    buffer.buffer = VK_NULL_HANDLE;
+    buffer.memory = VK_NULL_HANDLE;
+    buffer.mapped = nullptr;
+}
 
+void VulkanProject::GraphicsPipeline::WriteDescriptorSets(VkDescriptorSet descriptorSet, const VkImageView textureViews[3], const VkSampler textureSamplers[3], const VkImageView pageTableViews[3])
+{
     VkDescriptorBufferInfo bufferInfo{};
     bufferInfo.buffer = m_UniformBuffers[Renderer::GetCurrentFrame()];
     bufferInfo.offset = 0;
     bufferInfo.range = sizeof(UniformBufferObject);
 
     VkDescriptorBufferInfo bufferInfo1{};
-    bufferInfo1.buffer = m_ModelBuffer[Renderer::GetCurrentFrame()];
+    bufferInfo1.buffer = m_Frames[Renderer::GetCurrentFrame()].transforms.buffer;
     bufferInfo1.offset = 0;
-    bufferInfo1.range = sizeof(glm::mat4);
+    bufferInfo1.range = VK_WHOLE_SIZE;
 
     VkDescriptorImageInfo diffuseInfo;
     diffuseInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    diffuseInfo.imageView = textures[0]->GetImageview();
-    diffuseInfo.sampler = m_TextureSampler;
+    diffuseInfo.imageView = textureViews[0];
+    diffuseInfo.sampler = textureSamplers[0];
 
     VkDescriptorImageInfo normalInfo;
     normalInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    normalInfo.imageView = textures[1]->GetImageview();
-    normalInfo.sampler = m_TextureSampler;
+    normalInfo.imageView = textureViews[1];
+    normalInfo.sampler = textureSamplers[1];
 
     VkDescriptorImageInfo metalicInfo;
     metalicInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    metalicInfo.imageView = textures[2]->GetImageview();
-    metalicInfo.sampler = m_TextureSampler;
+    metalicInfo.imageView = textureViews[2];
+    metalicInfo.sampler = textureSamplers[2];
+
+    std::array<VkDescriptorImageInfo, 3> virtualInfos;
+    for (int i = 0; i < 3; i++)
+    {
+        virtualInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        virtualInfos[i].imageView = pageTableViews[i];
+        // immutable in the layout
+        virtualInfos[i].sampler = VK_NULL_HANDLE;
+    }
 
-    std::array<VkWriteDescriptorSet, 5> descriptorWrites{};
+    std::array<VkWriteDescriptorSet, 8> descriptorWrites{};
                       
     descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[0].dstSet = m_DescriptorSets[Renderer::GetCurrentFrame()];
+    descriptorWrites[0].dstSet = descriptorSet;
     descriptorWrites[0].dstBinding = 0;
     descriptorWrites[0].dstArrayElement = 0;
     descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -334,15 +605,15 @@ void VulkanProject::GraphicsPipeline::UpdateDesctiptorSets(std::vector<Texture*>
     descriptorWrites[0].pBufferInfo = &bufferInfo;
                     
     descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[1].dstSet = m_DescriptorSets[Renderer::GetCurrentFrame()];
+    descriptorWrites[1].dstSet = descriptorSet;
     descriptorWrites[1].dstBinding = 1;
     descriptorWrites[1].dstArrayElement = 0;
-    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     descriptorWrites[1].descriptorCount = 1;
     descriptorWrites[1].pBufferInfo = &bufferInfo1;
    
     descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[2].dstSet = m_DescriptorSets[Renderer::GetCurrentFrame()];
+    descriptorWrites[2].dstSet = descriptorSet;
     descriptorWrites[2].dstBinding = 2;
     descriptorWrites[2].dstArrayElement = 0;
     descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -350,7 +621,7 @@ void VulkanProject::GraphicsPipeline::UpdateDesctiptorSets(std::vector<Texture*>
     descriptorWrites[2].pImageInfo = &diffuseInfo;
 
     descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[3].dstSet = m_DescriptorSets[Renderer::GetCurrentFrame()];
+    descriptorWrites[3].dstSet = descriptorSet;
     descriptorWrites[3].dstBinding = 3;
     descriptorWrites[3].dstArrayElement = 0;
     descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -358,41 +629,74 @@ void VulkanProject::GraphicsPipeline::UpdateDesctiptorSets(std::vector<Texture*>
     descriptorWrites[3].pImageInfo = &normalInfo;
                     
     descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[4].dstSet = m_DescriptorSets[Renderer::GetCurrentFrame()];
+    descriptorWrites[4].dstSet = descriptorSet;
     descriptorWrites[4].dstBinding = 4;
     descriptorWrites[4].dstArrayElement = 0;
     descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     descriptorWrites[4].descriptorCount = 1;
     descriptorWrites[4].pImageInfo = &metalicInfo;
+
+    for (uint32_t i = 0; i < virtualInfos.size(); i++)
+    {
+        descriptorWrites[5 + i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[5 + i].dstSet = descriptorSet;
+        descriptorWrites[5 + i].dstBinding = 5 + i;
+        descriptorWrites[5 + i].dstArrayElement = 0;
+        descriptorWrites[5 + i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[5 + i].descriptorCount = 1;
+        descriptorWrites[5 + i].pImageInfo = &virtualInfos[i];
+    }
                  
 
 
     vkUpdateDescriptorSets(Renderer::GetDevice(), static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
-    
-    Renderer::BindDescriptors(m_DescriptorSets);
-
 }
 
 VulkanProject::GraphicsPipeline::~GraphicsPipeline()
 {
-    
-    vkDestroyDescriptorPool(Renderer::GetDevice(), m_DescriptorPool, nullptr);
+    if (m_Reload.valid())
+    {
+        try
+        {
+            Reload reload = m_Reload.get();
+            PipelineCache::Release(reload.program);
+            vkDestroyShaderModule(Renderer::GetDevice(), reload.program.fragmentShader, nullptr);
+            vkDestroyShaderModule(Renderer::GetDevice(), reload.program.vertexShader, nullptr);
+        }
+        catch (const std::exception&)
+        {
+            // a failed reload has nothing left to destroy
+        }
+    }
 
+    for (FrameData& frame : m_Frames)
+    {
+        for (VkDescriptorPool pool : frame.descriptorPools)
+        {
+            vkDestroyDescriptorPool(Renderer::GetDevice(), pool, nullptr);
+        }
+        Destroy(frame.transforms);
+        Destroy(frame.commands);
+        Destroy(frame.bounds);
+        Destroy(frame.earlyCommands);
+        Destroy(frame.lateCommands);
+        for (Renderer::StaticRecording& recording : frame.recordings)
+        {
+            Renderer::DestroyStaticRecording(recording);
+        }
+    }
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
         vkDestroyBuffer(Renderer::GetDevice(), m_UniformBuffers[i], nullptr);
         vkFreeMemory(Renderer::GetDevice(), m_UniformBuffersMemory[i], nullptr);
-
-        vkDestroyBuffer(Renderer::GetDevice(), m_ModelBuffer[i], nullptr);
-        vkFreeMemory(Renderer::GetDevice(), m_ModelBuffersMemory[i], nullptr);
     }
 
-	vkDestroyPipeline(Renderer::GetDevice(), m_GraphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(Renderer::GetDevice(), m_PipelineLayout, nullptr);
-
-    vkDestroySampler(Renderer::GetDevice(), m_TextureSampler, nullptr);
-    vkDestroyDescriptorSetLayout(Renderer::GetDevice(), m_DescriptorSetLayout, nullptr);
+	// m_GraphicsPipeline belongs to the cache
+	PipelineCache::Release(m_Program);
+	vkDestroyShaderModule(Renderer::GetDevice(), m_Program.fragmentShader, nullptr);
+	vkDestroyShaderModule(Renderer::GetDevice(), m_Program.vertexShader, nullptr);
+	// The layouts belong to the LayoutCache
 }
 
 void VulkanProject::GraphicsPipeline::Bind()
@@ -400,7 +704,13 @@ void VulkanProject::GraphicsPipeline::Bind()
 	Renderer::BindPipeline(m_GraphicsPipeline, m_PipelineLayout);
 }
 
-VkShaderModule VulkanProject::GraphicsPipeline::createShaderModule(const std::vector<char>& code)
+void VulkanProject::GraphicsPipeline::Bind(const PipelineState& state)
+{
+	VkPipeline pipeline = PipelineCache::Get(m_Program, state);
+	Renderer::BindPipeline(pipeline != VK_NULL_HANDLE ? pipeline : m_GraphicsPipeline, m_PipelineLayout);
+}
+
+VkShaderModule VulkanProject::GraphicsPipeline::createShaderModule(const std::vector<unsigned char>& code)
 {
 	VkShaderModuleCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -416,29 +726,127 @@ VkShaderModule VulkanProject::GraphicsPipeline::createShaderModule(const std::ve
 	return shaderModule;
 }
 
-void VulkanProject::GraphicsPipeline::CreateTextureSamplers()
+VulkanProject::GraphicsPipeline::ShaderCode VulkanProject::GraphicsPipeline::LoadShaders(const std::string& vertexShaderPath, const std::string& fragmentShaderPath)
+{
+    // Both stages compile at the same time, also when reloading from inside a pool job
+    ShaderCompiler::Result vertex;
+    ShaderCompiler::Result fragment;
+    ThreadPool::GetShared().ParallelFor(2, [&](size_t stage)
+    {
+        if (stage == 0)
+        {
+            vertex = ShaderCompiler::Compile(vertexShaderPath, VK_SHADER_STAGE_VERTEX_BIT);
+        }
+        else
+        {
+            fragment = ShaderCompiler::Compile(fragmentShaderPath, VK_SHADER_STAGE_FRAGMENT_BIT);
+        }
+    });
+
+    ShaderCode shaders;
+    shaders.shaderInterface = ShaderReflection::Merge(ShaderReflection::Reflect(vertex.code, VK_SHADER_STAGE_VERTEX_BIT), ShaderReflection::Reflect(fragment.code, VK_SHADER_STAGE_FRAGMENT_BIT));
+    shaders.vertex = std::move(vertex.code);
+    shaders.fragment = std::move(fragment.code);
+    shaders.dependencies = std::move(vertex.dependencies);
+    shaders.dependencies.insert(shaders.dependencies.end(), fragment.dependencies.begin(), fragment.dependencies.end());
+    return shaders;
+}
+
+VulkanProject::GraphicsPipeline::Reload VulkanProject::GraphicsPipeline::CompileReload() const
+{
+    ShaderCode shaders = LoadShaders(m_VertexShaderPath, m_FragmentShaderPath);
+
+    // The descriptor sets and the layouts stay, so the shaders have to keep declaring the same resources
+    const ShaderInterface& current = m_Interface;
+    const ShaderInterface& edited = shaders.shaderInterface;
+    bool sameLayout = current.bindings.size() == edited.bindings.size() &&
+        current.pushConstants.stageFlags == edited.pushConstants.stageFlags && current.pushConstants.size == edited.pushConstants.size;
+    for (size_t i = 0; sameLayout && i < current.bindings.size(); i++)
+    {
+        const ShaderInterface::Binding& a = current.bindings[i];
+        const ShaderInterface::Binding& b = edited.bindings[i];
+        sameLayout = a.set == b.set && a.binding == b.binding && a.type == b.type && a.count == b.count && a.stages == b.stages && a.name == b.name;
+    }
+    if (!sameLayout)
+    {
+        throw std::runtime_error("the shaders declare different resources now, restart to pick them up!");
+    }
+
+    Reload reload;
+    reload.program = m_Program;
+    reload.program.vertexShader = createShaderModule(shaders.vertex);
+    reload.program.fragmentShader = createShaderModule(shaders.fragment);
+    reload.program.vertexInputs = edited.vertexInputs;
+    reload.dependencies = std::move(shaders.dependencies);
+    try
+    {
+        reload.pipeline = PipelineCache::GetBlocking(reload.program, m_State);
+    }
+    catch (const std::exception&)
+    {
+        PipelineCache::Release(reload.program);
+        vkDestroyShaderModule(Renderer::GetDevice(), reload.program.fragmentShader, nullptr);
+        vkDestroyShaderModule(Renderer::GetDevice(), reload.program.vertexShader, nullptr);
+        throw;
+    }
+    return reload;
+}
+
+void VulkanProject::GraphicsPipeline::WatchShaders(const std::vector<std::string>& dependencies)
 {
-    VkPhysicalDeviceProperties properties{};
-    vkGetPhysicalDeviceProperties(Renderer::GetPhysicalDevice(), &properties);
-
-    VkSamplerCreateInfo samplerInfo{};
-    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerInfo.magFilter = VK_FILTER_LINEAR;
-    samplerInfo.minFilter = VK_FILTER_LINEAR;
-    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.anisotropyEnable = VK_TRUE;
-    samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
-    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-    samplerInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerInfo.compareEnable = VK_FALSE;
-    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-
-    if (vkCreateSampler(Renderer::GetDevice(), &samplerInfo, nullptr, &m_TextureSampler) != VK_SUCCESS)
-    {
-        throw std::runtime_error("failed to create texture sampler!");
+    m_Watcher.Clear();
+    for (const std::string& dependency : dependencies)
+    {
+        m_Watcher.Watch(dependency);
     }
 }
 
+void VulkanProject::GraphicsPipeline::Update()
+{
+    if (m_Reload.valid())
+    {
+        if (m_Reload.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            return;
+        }
+        try
+        {
+            Reload reload = m_Reload.get();
+            // Frames in flight still draw with the old pipelines
+            vkDeviceWaitIdle(Renderer::GetDevice());
+            PipelineCache::Release(m_Program);
+            vkDestroyShaderModule(Renderer::GetDevice(), m_Program.fragmentShader, nullptr);
+            vkDestroyShaderModule(Renderer::GetDevice(), m_Program.vertexShader, nullptr);
+
+            // The other states compile again the first time they are drawn
+            m_Program = reload.program;
+            m_GraphicsPipeline = reload.pipeline;
+            // The old pipelines are gone, their handles may come back for new ones
+            for (FrameData& frame : m_Frames)
+            {
+                frame.signature = 0;
+            }
+            // Watching again drops what the watcher has queued, edits saved during the compile start another reload
+            const bool edited = !m_Watcher.GetChanges().empty();
+            WatchShaders(reload.dependencies);
+            printf("Graphics pipeline %s reloaded\n", m_FragmentShaderPath.c_str());
+            if (edited)
+            {
+                m_Reload = ThreadPool::GetShared().Submit([this]() { return CompileReload(); });
+            }
+        }
+        catch (const std::exception& e)
+        {
+            // Keeps drawing with the last shaders that worked until the next edit
+            printf("Graphics pipeline %s not reloaded: %s\n", m_FragmentShaderPath.c_str(), e.what());
+        }
+        return;
+    }
+
+    // Edits made while a reload compiles are picked up once it is done
+    if (m_Watcher.GetChanges().empty())
+    {
+        return;
+    }
+    m_Reload = ThreadPool::GetShared().Submit([this]() { return CompileReload(); });
+}
@@ -3,7 +3,16 @@
 #include <string>
 #include "Core/Includes.h"
 #include "Core/Defines.h"
+#include "Graphics.h"
+#include "PipelineCache.h"
+#include "ShaderReflection.h"
+#include "VirtualTexture.h"
+#include "RenderQueue.h"
+#include "Core/FileWatcher.h"
 #include <unordered_map>
+#include <map>
+#include <array>
+#include <future>
 
 namespace VulkanProject
 {
@@ -13,8 +22,11 @@ namespace VulkanProject
    
     struct PipelineDesc
     {
+        // GLSL sources, compiled at runtime and recompiled when they are edited
         std::string vertexShaderPath;
         std::string fragmentShaderPath;
+        // compiled up front, the fallback while other states compile
+        PipelineState state;
 
 		//std::vector<Vertex> vertex;
 		
@@ -22,6 +34,23 @@ namespace VulkanProject
 
     struct UniformBufferObject;
     class Texture;
+    class VirtualTexture;
+    class Mesh;
+
+    // One draw of a mesh, queued with GraphicsPipeline::Submit
+    struct DrawItem
+    {
+        const Mesh* mesh = nullptr;
+        glm::mat4 transform = glm::mat4(1.0f);
+        // Set to draw instanceCount copies with one transform each instead of transform
+        const glm::mat4* transforms = nullptr;
+        uint32_t instanceCount = 1;
+        PipelineState state;
+        // nullptr for the maps the material does not have
+        Texture* textures[3] = {};
+        // set instead of the textures for virtual textured materials
+        VirtualTexture* virtualTextures[3] = {};
+    };
 
     class GraphicsPipeline
     {
@@ -29,34 +58,146 @@ namespace VulkanProject
         GraphicsPipeline(PipelineDesc& desc);
         ~GraphicsPipeline();
         void Bind();
+        // Draws with state once its pipeline is compiled and with the description's state until then
+        void Bind(const PipelineState& state);
         void UpdateBuffers(UniformBufferObject& ubo);
-        void UploadModelBuffer(glm::mat4 model);
-        void BindData();
-        void UpdateDesctiptorSets(std::vector<Texture*> textures);
+        // Queued until Flush, the mesh, textures and instance transforms have to stay alive until then
+        void Submit(const DrawItem& draw);
+        // Records the queued draws in RenderQueue order, between BeginFrame and EndFrame. Transforms and draw arguments go into
+        // per frame GPU buffers and every material is one indirect multi draw, so the recording cost
+        // follows the number of materials instead of the number of draws. Without multi draws the draws are
+        // recorded on several threads. With GpuCulling enabled the
+        // draws are culled on the GPU and recorded twice, the main render pass is broken up in between.
+        void Flush();
+        // Keeps what Flush recorded for every frame in flight and executes it again as long as the submitted draws,
+        // their textures, the pipelines and the swap chain stay the same. The draws are compared every frame and
+        // their buffers, descriptor sets and order are only written when they change, so the camera can move but
+        // the order of the opaque draws is that of the frame they were recorded in.
+        void SetStatic(bool enabled);
+        // Picks up edits to the shaders and what they include, call once per frame outside of BeginFrame/EndFrame.
+        // The edited shaders compile in the background and the old pipelines are used until they are done.
+        void Update();
     
     private:
-        VkShaderModule createShaderModule(const std::vector<char>& code);
-        void CreateTextureSamplers();
+        struct ShaderCode
+        {
+            std::vector<unsigned char> vertex;
+            std::vector<unsigned char> fragment;
+            ShaderInterface shaderInterface;
+            std::vector<std::string> dependencies;
+        };
+        struct Reload
+        {
+            PipelineProgram program;
+            VkPipeline pipeline;
+            std::vector<std::string> dependencies;
+        };
+
+        static ShaderCode LoadShaders(const std::string& vertexShaderPath, const std::string& fragmentShaderPath);
+        // Runs on the thread pool, throws when the shaders do not compile or no longer fit the layouts
+        Reload CompileReload() const;
+        void WatchShaders(const std::vector<std::string>& dependencies);
+        static VkShaderModule createShaderModule(const std::vector<unsigned char>& code);
+        // Draws of one material next to each other in m_Draws
+        struct Batch
+        {
+            uint32_t first;
+            uint32_t count;
+            VkPipeline pipeline;
+            VkDescriptorSet descriptorSet;
+            VirtualTextureConstants constants;
+        };
+        // What the descriptor set and push constants of a material are written from
+        struct MaterialInputs
+        {
+            VkImageView textureViews[3];
+            VkSampler textureSamplers[3];
+            VkImageView pageTableViews[3];
+            VirtualTextureConstants constants;
+        };
+        MaterialInputs GetMaterialInputs(const DrawItem& draw) const;
+        // Writes a descriptor set for the textures of draw and the virtual texture constants it pushes
+        Batch WriteMaterial(const DrawItem& draw);
+        // Hash of everything the recorded draws depend on. Sorts the draws when some are transparent, their
+        // order changes with the camera; sorted is set then.
+        uint64_t SignDraws(bool& sorted);
+        // Orders m_Draws by their RenderQueue keys and fills m_DrawMaterials to match
+        void SortDraws();
+        // Fills the frame's transforms, commands and bounds, writes the descriptor sets and builds m_Batches
+        void WriteDraws(bool sorted);
+        // Every batch with its arguments read from commands, one command per draw. Split across recording
+        // threads with Renderer::RecordParallel when there are enough draw calls to record, recorded into
+        // recording and executed from there when static.
+        void DrawBatches(VkBuffer commands, Renderer::StaticRecording& recording);
+        // The draws in [first, last) of the batches, binds only what changed from the batch before
+        void DrawRange(VkBuffer commands, uint32_t first, uint32_t last);
+        // Bindings 5 to 7 and the push constants come from VirtualTexturing, which has to be initialised
+        void WriteDescriptorSets(VkDescriptorSet descriptorSet, const VkImageView textureViews[3], const VkSampler textureSamplers[3], const VkImageView pageTableViews[3]);
 
+        // Buffer of the frame's draws, grows to the largest frame. Only host visible ones are mapped.
+        struct FrameBuffer
+        {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            void* mapped = nullptr;
+            VkDeviceSize size = 0;
+        };
+        struct FrameData
+        {
+            // mat4 per instance, a draw's first instance is the index of its first transform
+            FrameBuffer transforms;
+            FrameBuffer commands;
+            // GpuCulling input and output: world space bounding spheres around all instances of a draw and the
+            // commands of both passes
+            FrameBuffer bounds;
+            FrameBuffer earlyCommands;
+            FrameBuffer lateCommands;
+            // a descriptor set per material, reset at the start of the frame
+            std::vector<VkDescriptorPool> descriptorPools;
+            uint32_t usedPools = 0;
+            uint32_t setsInPool = 0;
+            // SignDraws of the draws in the buffers and descriptor sets while static, 0 when they were written otherwise
+            uint64_t signature = 0;
+            // of the main render pass, or of the early and the late pass with GpuCulling
+            Renderer::StaticRecording recordings[2];
+        };
+        static void Reserve(FrameBuffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage,
+            VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        static void Destroy(FrameBuffer& buffer);
+        VkDescriptorSet AllocateDescriptorSet();
+
+        ShaderInterface m_Interface;
         VkDescriptorSetLayout m_DescriptorSetLayout;
         VkPipelineLayout m_PipelineLayout;
         VkPipeline m_GraphicsPipeline;
+        PipelineProgram m_Program;
+
+        std::string m_VertexShaderPath;
+        std::string m_FragmentShaderPath;
+        PipelineState m_State;
+        FileWatcher m_Watcher;
+        std::future<Reload> m_Reload;
         
         std::vector<VkBuffer> m_UniformBuffers;
         std::vector<VkDeviceMemory> m_UniformBuffersMemory;
         std::vector<void*> m_UniformBuffersMapped;
+        // of the last UpdateBuffers, what the draws are culled with
+        glm::mat4 m_ViewProjection = glm::mat4(1.0f);
 
-
-        std::vector<VkBuffer> m_ModelBuffer;
-        std::vector<VkDeviceMemory> m_ModelBuffersMemory;
-        std::vector<void*> m_ModelBuffersMapped;
-
-        VkDescriptorPool m_DescriptorPool;
-        std::vector<VkDescriptorSet> m_DescriptorSets;
-       // VkRenderPass m_RenderPass;
-       
-        VkSampler m_TextureSampler;
-       
+        std::vector<FrameData> m_Frames;
+        std::vector<DrawItem> m_Draws;
+        std::vector<DrawItem> m_SortedDraws;
+        RenderQueue m_Queue;
+        // The textures and virtual textures of a material
+        using MaterialKey = std::array<const void*, 6>;
+        std::map<MaterialKey, uint32_t> m_MaterialIds;
+        // material id of every draw in m_Draws, after sorting
+        std::vector<uint32_t> m_DrawMaterials;
+        // descriptor set and constants by material id, written by the first batch that needs them
+        std::vector<Batch> m_Materials;
+        std::vector<VkDrawIndexedIndirectCommand> m_Commands;
+        std::vector<Batch> m_Batches;
+        bool m_Static = false;
     };
 
    
@@ -0,0 +1,230 @@
+#include "ShaderCompiler.h"
+#include "Core/AssetCache.h"
+#include "Core/MappedFile.h"
+#include <shaderc/shaderc.hpp>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <stdexcept>
+#include <chrono>
+
+namespace
+{
+	// Bump when the compile options change so stale cache entries are no longer found. shaderc has no version
+	// of its own to ask for; it ships with the Vulkan SDK, whose header version is part of the key. Bump this as
+	// well when shaderc is upgraded on its own.
+	const uint64_t c_ShaderCompilerVersion = 2;
+
+	using SourceFiles = std::unordered_map<std::string, std::string>;
+
+	std::string Normalize(const std::filesystem::path& path)
+	{
+		return path.lexically_normal().generic_string();
+	}
+
+	bool ReadSource(const std::string& path, std::string& source)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			return false;
+		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+		source = stream.str();
+		return true;
+	}
+
+	// "file" resolves next to the including file, <file> next to the shader that is compiled
+	std::string ResolveInclude(const std::string& requested, bool relative, const std::string& requesting, const std::string& root)
+	{
+		std::filesystem::path base = std::filesystem::path(relative ? requesting : root).parent_path();
+		return Normalize(base / requested);
+	}
+
+	// Every #include of source and of what it includes, also the ones in inactive #if blocks.
+	// A file that does not exist is kept empty, it only matters when the compiler actually asks for it.
+	void CollectIncludes(const std::string& path, const std::string& source, const std::string& root, SourceFiles& files, std::vector<std::string>& order)
+	{
+		std::istringstream lines(source);
+		std::string line;
+		while (std::getline(lines, line))
+		{
+			size_t hash = line.find_first_not_of(" \t");
+			if (hash == std::string::npos || line[hash] != '#')
+			{
+				continue;
+			}
+			size_t directive = line.find_first_not_of(" \t", hash + 1);
+			if (directive == std::string::npos || line.compare(directive, 7, "include") != 0)
+			{
+				continue;
+			}
+			size_t open = line.find_first_of("\"<", directive + 7);
+			if (open == std::string::npos)
+			{
+				continue;
+			}
+			size_t close = line.find(line[open] == '"' ? '"' : '>', open + 1);
+			if (close == std::string::npos)
+			{
+				continue;
+			}
+
+			std::string include = ResolveInclude(line.substr(open + 1, close - open - 1), line[open] == '"', path, root);
+			if (files.count(include))
+			{
+				continue;
+			}
+			std::string& includeSource = files[include];
+			order.push_back(include);
+			if (ReadSource(include, includeSource))
+			{
+				std::string copy = includeSource;
+				CollectIncludes(include, copy, root, files, order);
+			}
+		}
+	}
+
+	// Hands shaderc the sources that were read for the cache key, so the key always matches what got compiled
+	class Includer : public shaderc::CompileOptions::IncluderInterface
+	{
+	public:
+		Includer(const SourceFiles& files, const std::string& root) : m_Files(files), m_Root(root) {}
+
+		shaderc_include_result* GetInclude(const char* requested, shaderc_include_type type, const char* requesting, size_t) override
+		{
+			auto* include = new Include();
+			include->name = ResolveInclude(requested, type == shaderc_include_type_relative, requesting, m_Root);
+			auto file = m_Files.find(include->name);
+			if (file == m_Files.end() || !std::filesystem::exists(include->name))
+			{
+				include->content = "cannot find include file " + include->name;
+				include->name.clear();
+			}
+			else
+			{
+				include->content = file->second;
+			}
+
+			include->result.source_name = include->name.c_str();
+			include->result.source_name_length = include->name.size();
+			include->result.content = include->content.c_str();
+			include->result.content_length = include->content.size();
+			include->result.user_data = include;
+			return &include->result;
+		}
+
+		void ReleaseInclude(shaderc_include_result* result) override
+		{
+			delete static_cast<Include*>(result->user_data);
+		}
+
+	private:
+		struct Include
+		{
+			std::string name;
+			std::string content;
+			shaderc_include_result result;
+		};
+
+		const SourceFiles& m_Files;
+		std::string m_Root;
+	};
+
+	shaderc_shader_kind GetShaderKind(VkShaderStageFlagBits stage)
+	{
+		switch (stage)
+		{
+		case VK_SHADER_STAGE_VERTEX_BIT: return shaderc_vertex_shader;
+		case VK_SHADER_STAGE_FRAGMENT_BIT: return shaderc_fragment_shader;
+		case VK_SHADER_STAGE_COMPUTE_BIT: return shaderc_compute_shader;
+		case VK_SHADER_STAGE_GEOMETRY_BIT: return shaderc_geometry_shader;
+		case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT: return shaderc_tess_control_shader;
+		case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT: return shaderc_tess_evaluation_shader;
+		default: throw std::runtime_error("shader stage is not supported by the compiler!");
+		}
+	}
+}
+
+VulkanProject::ShaderCompiler::Result VulkanProject::ShaderCompiler::Compile(const std::string& path, VkShaderStageFlagBits stage, const std::vector<std::string>& defines)
+{
+	Result result;
+	std::string root = Normalize(path);
+	result.dependencies.push_back(root);
+
+	std::string source;
+	if (!ReadSource(root, source))
+	{
+		throw std::runtime_error("failed to open shader " + root + "!");
+	}
+	if (std::filesystem::path(root).extension() == ".spv")
+	{
+		result.code.assign(source.begin(), source.end());
+		return result;
+	}
+
+	SourceFiles files;
+	std::vector<std::string> includes;
+	CollectIncludes(root, source, root, files, includes);
+	result.dependencies.insert(result.dependencies.end(), includes.begin(), includes.end());
+
+	unsigned int spirvVersion = 0;
+	unsigned int spirvRevision = 0;
+	shaderc_get_spv_version(&spirvVersion, &spirvRevision);
+
+	// The compiler is identified by the SDK it came with, the SPIR-V version alone stays the same across upgrades
+	Hasher hasher;
+	hasher.Add(c_ShaderCompilerVersion).Add(static_cast<uint64_t>(VK_HEADER_VERSION_COMPLETE));
+	hasher.Add(static_cast<uint64_t>(spirvVersion)).Add(static_cast<uint64_t>(spirvRevision));
+	hasher.Add(static_cast<uint64_t>(stage)).Add(root).Add(source);
+	for (const std::string& include : includes)
+	{
+		hasher.Add(include).Add(files[include]);
+	}
+	for (const std::string& define : defines)
+	{
+		hasher.Add(define);
+	}
+	uint64_t key = hasher.Get();
+
+	AssetCache::Entry cached = AssetCache::Load(key);
+	if (cached && cached.size % sizeof(uint32_t) == 0)
+	{
+		result.code.assign(cached.data, cached.data + cached.size);
+		return result;
+	}
+
+	shaderc::CompileOptions options;
+	options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+	options.SetOptimizationLevel(shaderc_optimization_level_performance);
+	for (const std::string& define : defines)
+	{
+		size_t equals = define.find('=');
+		if (equals == std::string::npos)
+		{
+			options.AddMacroDefinition(define);
+		}
+		else
+		{
+			options.AddMacroDefinition(define.substr(0, equals), define.substr(equals + 1));
+		}
+	}
+	options.SetIncluder(std::make_unique<Includer>(files, root));
+
+	auto start = std::chrono::high_resolution_clock::now();
+	shaderc::Compiler compiler;
+	shaderc::SpvCompilationResult compiled = compiler.CompileGlslToSpv(source, GetShaderKind(stage), root.c_str(), options);
+	if (compiled.GetCompilationStatus() != shaderc_compilation_status_success)
+	{
+		throw std::runtime_error("failed to compile shader " + root + "!\n" + compiled.GetErrorMessage());
+	}
+	float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("Shader %s compiled in %.2f ms\n", root.c_str(), milliseconds);
+
+	const unsigned char* words = reinterpret_cast<const unsigned char*>(compiled.cbegin());
+	result.code.assign(words, reinterpret_cast<const unsigned char*>(compiled.cend()));
+	AssetCache::Store(key, result.code.data(), result.code.size());
+	return result;
+}
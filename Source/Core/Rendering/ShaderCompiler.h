@@ -0,0 +1,23 @@
+#pragma once
+#include "Core/Includes.h"
+#include <vector>
+#include <string>
+
+namespace VulkanProject
+{
+    // GLSL to SPIR-V through shaderc. Compiled code is kept in the AssetCache, keyed on the source,
+    // every file it includes, the defines and the compiler version, so unchanged shaders skip the compiler.
+    namespace ShaderCompiler
+    {
+        struct Result
+        {
+            std::vector<unsigned char> code;
+            // The source and everything it includes, what has to be watched to know when to recompile
+            std::vector<std::string> dependencies;
+        };
+
+        // Thread safe. defines are "NAME" or "NAME=VALUE". A path ending in .spv is read as is.
+        // Throws with the compiler's messages when the source does not compile.
+        Result Compile(const std::string& path, VkShaderStageFlagBits stage, const std::vector<std::string>& defines = {});
+    }
+}
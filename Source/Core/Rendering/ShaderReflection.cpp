@@ -0,0 +1,272 @@
+#include "ShaderReflection.h"
+#include "Graphics.h"
+#include "Core/AssetCache.h"
+#include <spirv_cross/spirv_cross.hpp>
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+
+namespace
+{
+	void AddBindings(const spirv_cross::Compiler& compiler, const spirv_cross::SmallVector<spirv_cross::Resource>& resources, VkDescriptorType type,
+		VkShaderStageFlagBits stage, VulkanProject::ShaderInterface& shader)
+	{
+		for (const auto& resource : resources)
+		{
+			const spirv_cross::SPIRType& resourceType = compiler.get_type(resource.type_id);
+			VulkanProject::ShaderInterface::Binding binding;
+			binding.set = compiler.get_decoration(resource.id, spv::DecorationDescriptorSet);
+			binding.binding = compiler.get_decoration(resource.id, spv::DecorationBinding);
+			binding.type = type;
+			binding.count = resourceType.array.empty() ? 1 : resourceType.array[0];
+			binding.stages = stage;
+			binding.name = resource.name;
+			// Texel buffers show up as images with a buffer dimension
+			if (resourceType.basetype == spirv_cross::SPIRType::Image && resourceType.image.dim == spv::DimBuffer)
+			{
+				binding.type = type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			}
+			if (binding.count == 0)
+			{
+				throw std::runtime_error("runtime sized descriptor arrays are not supported: " + binding.name);
+			}
+			shader.bindings.push_back(binding);
+		}
+	}
+
+	void SortBindings(VulkanProject::ShaderInterface& shader)
+	{
+		std::sort(shader.bindings.begin(), shader.bindings.end(), [](const auto& a, const auto& b)
+		{
+			return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+		});
+	}
+
+	struct LayoutCacheData
+	{
+		std::mutex mutex;
+		std::unordered_map<uint64_t, VkDescriptorSetLayout> setLayouts;
+		std::unordered_map<uint64_t, VkPipelineLayout> pipelineLayouts;
+	};
+
+	static LayoutCacheData* data = nullptr;
+}
+
+VulkanProject::ShaderInterface VulkanProject::ShaderReflection::Reflect(const std::vector<unsigned char>& code, VkShaderStageFlagBits stage)
+{
+	if (code.size() % sizeof(uint32_t) != 0)
+	{
+		throw std::runtime_error("shader code is not SPIR-V!");
+	}
+
+	ShaderInterface shader;
+	try
+	{
+		spirv_cross::Compiler compiler(reinterpret_cast<const uint32_t*>(code.data()), code.size() / sizeof(uint32_t));
+		// Everything declared, not only what the entry point reads, so descriptor writes stay valid when a binding is optimised out
+		spirv_cross::ShaderResources resources = compiler.get_shader_resources();
+
+		AddBindings(compiler, resources.uniform_buffers, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, stage, shader);
+		AddBindings(compiler, resources.storage_buffers, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, stage, shader);
+		AddBindings(compiler, resources.sampled_images, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, stage, shader);
+		AddBindings(compiler, resources.separate_images, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, stage, shader);
+		AddBindings(compiler, resources.separate_samplers, VK_DESCRIPTOR_TYPE_SAMPLER, stage, shader);
+		AddBindings(compiler, resources.storage_images, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, stage, shader);
+		AddBindings(compiler, resources.subpass_inputs, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, stage, shader);
+		SortBindings(shader);
+
+		if (!resources.push_constant_buffers.empty())
+		{
+			const auto& block = resources.push_constant_buffers[0];
+			shader.pushConstants.stageFlags = stage;
+			shader.pushConstants.offset = 0;
+			shader.pushConstants.size = static_cast<uint32_t>(compiler.get_declared_struct_size(compiler.get_type(block.base_type_id)));
+		}
+
+		if (stage == VK_SHADER_STAGE_VERTEX_BIT)
+		{
+			for (const auto& input : resources.stage_inputs)
+			{
+				uint32_t location = compiler.get_decoration(input.id, spv::DecorationLocation);
+				// Matrices and arrays take one location per column or element
+				const spirv_cross::SPIRType& type = compiler.get_type(input.type_id);
+				uint32_t locations = std::max(1u, type.columns) * (type.array.empty() ? 1u : type.array[0]);
+				for (uint32_t i = 0; i < locations && location + i < 64; i++)
+				{
+					shader.vertexInputs |= 1ull << (location + i);
+				}
+			}
+		}
+	}
+	catch (const spirv_cross::CompilerError& e)
+	{
+		throw std::runtime_error(std::string("failed to reflect shader: ") + e.what());
+	}
+	return shader;
+}
+
+VulkanProject::ShaderInterface VulkanProject::ShaderReflection::Merge(const ShaderInterface& a, const ShaderInterface& b)
+{
+	ShaderInterface merged = a;
+	for (const auto& binding : b.bindings)
+	{
+		auto existing = std::find_if(merged.bindings.begin(), merged.bindings.end(), [&](const ShaderInterface::Binding& other)
+		{
+			return other.set == binding.set && other.binding == binding.binding;
+		});
+		if (existing == merged.bindings.end())
+		{
+			merged.bindings.push_back(binding);
+			continue;
+		}
+		if (existing->type != binding.type || existing->count != binding.count)
+		{
+			throw std::runtime_error("shader stages disagree on binding " + std::to_string(binding.binding) + " of set " + std::to_string(binding.set) + "!");
+		}
+		existing->stages |= binding.stages;
+	}
+	SortBindings(merged);
+
+	// One range over both blocks, the stages see the same push constant memory
+	if (b.pushConstants.size > 0)
+	{
+		merged.pushConstants.stageFlags |= b.pushConstants.stageFlags;
+		merged.pushConstants.size = std::max(merged.pushConstants.size, b.pushConstants.size);
+	}
+	merged.vertexInputs |= b.vertexInputs;
+	return merged;
+}
+
+std::vector<VkDescriptorSetLayoutBinding> VulkanProject::ShaderReflection::GetSetLayoutBindings(const ShaderInterface& shader, uint32_t set, const std::unordered_map<std::string, VkSampler>& immutableSamplers)
+{
+	std::vector<VkDescriptorSetLayoutBinding> bindings;
+	for (const auto& binding : shader.bindings)
+	{
+		if (binding.set != set)
+		{
+			continue;
+		}
+		VkDescriptorSetLayoutBinding layoutBinding{};
+		layoutBinding.binding = binding.binding;
+		layoutBinding.descriptorType = binding.type;
+		layoutBinding.descriptorCount = binding.count;
+		layoutBinding.stageFlags = binding.stages;
+		auto sampler = immutableSamplers.find(binding.name);
+		if (sampler != immutableSamplers.end() && binding.count == 1 &&
+			(binding.type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || binding.type == VK_DESCRIPTOR_TYPE_SAMPLER))
+		{
+			// Points into the map, valid as long as the caller keeps it
+			layoutBinding.pImmutableSamplers = &sampler->second;
+		}
+		bindings.push_back(layoutBinding);
+	}
+	return bindings;
+}
+
+std::vector<VkDescriptorPoolSize> VulkanProject::ShaderReflection::GetPoolSizes(const ShaderInterface& shader, uint32_t setCount)
+{
+	std::vector<VkDescriptorPoolSize> sizes;
+	for (const auto& binding : shader.bindings)
+	{
+		auto size = std::find_if(sizes.begin(), sizes.end(), [&](const VkDescriptorPoolSize& other) { return other.type == binding.type; });
+		if (size == sizes.end())
+		{
+			sizes.push_back({ binding.type, 0 });
+			size = sizes.end() - 1;
+		}
+		size->descriptorCount += binding.count * setCount;
+	}
+	return sizes;
+}
+
+void VulkanProject::LayoutCache::Init()
+{
+	if (data)
+	{
+		throw std::runtime_error("layout cache is already initialised!");
+	}
+	data = new LayoutCacheData();
+}
+
+void VulkanProject::LayoutCache::Shutdown()
+{
+	if (!data)
+	{
+		return;
+	}
+	for (auto& layout : data->pipelineLayouts)
+	{
+		vkDestroyPipelineLayout(Renderer::GetDevice(), layout.second, nullptr);
+	}
+	for (auto& layout : data->setLayouts)
+	{
+		vkDestroyDescriptorSetLayout(Renderer::GetDevice(), layout.second, nullptr);
+	}
+	delete data;
+	data = nullptr;
+}
+
+VkDescriptorSetLayout VulkanProject::LayoutCache::GetDescriptorSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	// The immutable sampler handles are part of the layout, everything else is plain values
+	Hasher hasher;
+	for (const auto& binding : bindings)
+	{
+		hasher.Add(binding.binding).Add(binding.descriptorType).Add(binding.descriptorCount).Add(binding.stageFlags);
+		for (uint32_t i = 0; binding.pImmutableSamplers != nullptr && i < binding.descriptorCount; i++)
+		{
+			hasher.Add(&binding.pImmutableSamplers[i], sizeof(VkSampler));
+		}
+	}
+	uint64_t key = hasher.Get();
+
+	std::lock_guard<std::mutex> lock(data->mutex);
+	auto it = data->setLayouts.find(key);
+	if (it != data->setLayouts.end())
+	{
+		return it->second;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	VkDescriptorSetLayout layout;
+	if (vkCreateDescriptorSetLayout(Renderer::GetDevice(), &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor set layout!");
+	}
+	data->setLayouts.emplace(key, layout);
+	return layout;
+}
+
+VkPipelineLayout VulkanProject::LayoutCache::GetPipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, const VkPushConstantRange& pushConstants)
+{
+	Hasher hasher;
+	hasher.Add(setLayouts.data(), setLayouts.size() * sizeof(VkDescriptorSetLayout));
+	hasher.Add(pushConstants.stageFlags).Add(pushConstants.offset).Add(pushConstants.size);
+	uint64_t key = hasher.Get();
+
+	std::lock_guard<std::mutex> lock(data->mutex);
+	auto it = data->pipelineLayouts.find(key);
+	if (it != data->pipelineLayouts.end())
+	{
+		return it->second;
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = pushConstants.size > 0 ? 1 : 0;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+
+	VkPipelineLayout layout;
+	if (vkCreatePipelineLayout(Renderer::GetDevice(), &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+	data->pipelineLayouts.emplace(key, layout);
+	return layout;
+}
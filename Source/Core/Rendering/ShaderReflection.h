@@ -0,0 +1,59 @@
+#pragma once
+#include "Core/Includes.h"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+namespace VulkanProject
+{
+    // Resources a set of shader stages declares, read from their SPIR-V
+    struct ShaderInterface
+    {
+        struct Binding
+        {
+            uint32_t set;
+            uint32_t binding;
+            VkDescriptorType type;
+            uint32_t count;
+            VkShaderStageFlags stages;
+            // GLSL name, what immutable samplers are matched by
+            std::string name;
+        };
+
+        // sorted by set and binding
+        std::vector<Binding> bindings;
+        // size 0 when no stage has push constants
+        VkPushConstantRange pushConstants{};
+        // bit per vertex input location the vertex stage reads
+        uint64_t vertexInputs = 0;
+
+        uint32_t GetSetCount() const { return bindings.empty() ? 0 : bindings.back().set + 1; }
+    };
+
+    namespace ShaderReflection
+    {
+        // Throws when code is not valid SPIR-V
+        ShaderInterface Reflect(const std::vector<unsigned char>& code, VkShaderStageFlagBits stage);
+        // Union of the stages, a binding used by both has to agree on its type
+        ShaderInterface Merge(const ShaderInterface& a, const ShaderInterface& b);
+
+        // Bindings of one set, samplers found by name in immutableSamplers are baked into the layout
+        std::vector<VkDescriptorSetLayoutBinding> GetSetLayoutBindings(const ShaderInterface& shader, uint32_t set, const std::unordered_map<std::string, VkSampler>& immutableSamplers);
+        // Enough descriptors for setCount sets of every set of the interface
+        std::vector<VkDescriptorPoolSize> GetPoolSizes(const ShaderInterface& shader, uint32_t setCount);
+    }
+
+    // Layouts are deduplicated for the lifetime of the device, so pipelines with the same interface
+    // end up with the same (compatible) layouts and can share descriptor sets
+    namespace LayoutCache
+    {
+        // Needs the device, shut down after everything that holds on to a layout
+        void Init();
+        void Shutdown();
+
+        // Thread safe, the layouts are owned by the cache
+        VkDescriptorSetLayout GetDescriptorSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+        VkPipelineLayout GetPipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, const VkPushConstantRange& pushConstants);
+    }
+}
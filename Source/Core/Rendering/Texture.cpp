@@ -1,645 +1,632 @@
 #include "Texture.h"
-
-// Define these only in *one* .cc file.
-#define TINYGLTF_IMPLEMENTATION
-#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-// #define TINYGLTF_NOEXCEPTION // optional. disable exception handling.
-#include "tiny_gltf.h"
+#include "stb_image.h"
 
 #include <stdexcept>
+#include <filesystem>
 #include "Graphics.h"
 #include "Shader.h"
-namespace VulkanProject
-{
-void TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
-void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
-}
-
-VulkanProject::Texture::Texture(std::string filepath)
+#include "ModelImporter.h"
+#include "CookedModel.h"
+#include "CookedTexture.h"
+#include "Core/MappedFile.h"
+#include "Core/AssetCache.h"
+#include "Core/ThreadPool.h"
+#include "UploadQueue.h"
+#include "TextureStreaming.h"
+#include "VirtualTexture.h"
+#include "OcclusionRasterizer.h"
+#include <algorithm>
+
+namespace
 {
-    int texWidth, texHeight, texChannels;
-    stbi_uc* pixels = stbi_load(filepath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
-
-    if (!pixels) 
-    {
-        throw std::runtime_error("failed to load texture image!");
-    }
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    Renderer::CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(Renderer::GetDevice(), stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(Renderer::GetDevice(), stagingBufferMemory);
+	// Bump when the decoded output changes so stale cache entries are no longer found
+	const uint64_t c_TextureImporterVersion = 1;
+	// Share of the bounds an occluder box covers around their center, small enough to stay inside mostly solid meshes
+	const float c_OccluderScale = 0.5f;
 
-    stbi_image_free(pixels);
-
-    Renderer::CreateImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_TextureImage, m_TextureImageMemory);
-
-    TransitionImageLayout(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    CopyBufferToImage(stagingBuffer, m_TextureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-    TransitionImageLayout(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	struct DecodedTextureHeader
+	{
+		uint32_t width;
+		uint32_t height;
+	};
 
-    vkDestroyBuffer(Renderer::GetDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(Renderer::GetDevice(), stagingBufferMemory, nullptr);
+	VkFormat GetFormat(VulkanProject::CookedTexture::eFormat format)
+	{
+		switch (format)
+		{
+		case VulkanProject::CookedTexture::eFormat::RGBA8_SRGB: return VK_FORMAT_R8G8B8A8_SRGB;
+		case VulkanProject::CookedTexture::eFormat::BC1_SRGB: return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+		case VulkanProject::CookedTexture::eFormat::BC3_SRGB: return VK_FORMAT_BC3_SRGB_BLOCK;
+		case VulkanProject::CookedTexture::eFormat::RG8_UNORM: return VK_FORMAT_R8G8_UNORM;
+		case VulkanProject::CookedTexture::eFormat::BC5_UNORM: return VK_FORMAT_BC5_UNORM_BLOCK;
+		}
+		throw std::runtime_error("unknown cooked texture format!");
+	}
 
-	m_TextureImageView = Renderer::CreateImageView(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB);
+	const char* GetDecodeSettings(VulkanProject::eTextureUsage usage)
+	{
+		switch (usage)
+		{
+		case VulkanProject::eTextureUsage::Color: return "rgba8";
+		case VulkanProject::eTextureUsage::Normal: return "rg8-normal";
+		case VulkanProject::eTextureUsage::MetallicRoughness: return "rg8-metallic-roughness";
+		}
+		throw std::runtime_error("unknown texture usage!");
+	}
 
+	VkBufferImageCopy GetLevelCopy(VkDeviceSize offset, uint32_t mipLevel, uint32_t width, uint32_t height)
+	{
+		VkBufferImageCopy region{};
+		region.bufferOffset = offset;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = mipLevel;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { width, height, 1 };
+		return region;
+	}
 }
 
-VulkanProject::Texture::~Texture()
+VulkanProject::Texture::Texture(std::string filepath)
 {
-	vkDestroyImage(Renderer::GetDevice(), m_TextureImage, nullptr);
-	vkFreeMemory(Renderer::GetDevice(), m_TextureImageMemory, nullptr);
-	vkDestroyImageView(Renderer::GetDevice(), m_TextureImageView, nullptr);
+	TextureSource source;
+	source.path = filepath;
+	m_Sampler = SamplerCache::Get(source.sampler);
+	UploadQueue uploads;
+	Create(Decode(source), uploads);
+	uploads.Flush();
 }
 
-void VulkanProject::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout)
+VulkanProject::Texture::Texture(const TextureImage& image, UploadQueue& uploads, const SamplerState& sampler)
 {
-	VkCommandBuffer commandBuffer = Renderer::BeginSingleTimeCommands();
-
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-
-	VkPipelineStageFlags sourceStage;
-	VkPipelineStageFlags destinationStage;
+	m_Sampler = SamplerCache::Get(sampler);
+	Create(image, uploads);
+}
 
-	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+VulkanProject::TextureImage VulkanProject::Texture::Decode(const TextureSource& source)
+{
+	if (source.data != nullptr)
 	{
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		return DecodeEncoded(source.data, source.size, source.usage);
 	}
-	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+	if (CookedTexture::IsCookedTexture(source.path))
 	{
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	}
-	else {
-		throw std::invalid_argument("unsupported layout transition!");
+		auto file = std::make_shared<MappedFile>(source.path);
+		return DecodeCooked(file->GetData(), file->GetSize(), file);
 	}
 
-	vkCmdPipelineBarrier(
-		commandBuffer,
-		sourceStage, destinationStage,
-		0,
-		0, nullptr,
-		0, nullptr,
-		1, &barrier
-	);
-
-	Renderer::EndSingleTimeCommands(commandBuffer);
-}
-void VulkanProject::CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
-{
-	VkCommandBuffer commandBuffer = Renderer::BeginSingleTimeCommands();
-
-	VkBufferImageCopy region{};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent =
-	{
-			width,
-			height,
-			1
-	};
-
-	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-	Renderer::EndSingleTimeCommands(commandBuffer);
+	// The encoded bytes are needed for the cache key anyway, so decode from the same mapping
+	MappedFile file(source.path);
+	return DecodeEncoded(file.GetData(), file.GetSize(), source.usage);
 }
 
-VulkanProject::Mesh::Mesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices)
+VulkanProject::TextureImage VulkanProject::Texture::Decode(const std::string& path, eTextureUsage usage, std::shared_ptr<const std::vector<unsigned char>> fileData)
 {
-	// vertex buffer
+	if (CookedTexture::IsCookedTexture(path))
 	{
-
-		//sizeOfVertices = vertices.size();
-
-		VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-		Renderer::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-		void* data;
-		vkMapMemory(Renderer::GetDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, vertices.data(), (size_t)bufferSize);
-		vkUnmapMemory(Renderer::GetDevice(), stagingBufferMemory);
-
-		Renderer::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_VertexBuffer, m_VertexBufferMemory);
-
-		Renderer::CopyBuffer(stagingBuffer, m_VertexBuffer, bufferSize);
-
-		vkDestroyBuffer(Renderer::GetDevice(), stagingBuffer, nullptr);
-		vkFreeMemory(Renderer::GetDevice(), stagingBufferMemory, nullptr);
+		return DecodeCooked(fileData->data(), fileData->size(), fileData);
 	}
+	return DecodeEncoded(fileData->data(), fileData->size(), usage);
+}
 
-	// index buffer
+VulkanProject::TextureImage VulkanProject::Texture::DecodeEncoded(const unsigned char* encodedData, size_t size, eTextureUsage usage)
+{
+	TextureImage image;
+	image.format = usage == eTextureUsage::Color ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8_UNORM;
+	const uint32_t texelSize = GetTexelSize(usage);
+
+	// Decoded pixels are cached, the key covers the encoded bytes and the decode settings
+	uint64_t key = Hasher().Add(c_TextureImporterVersion).Add(std::string(GetDecodeSettings(usage))).Add(encodedData, size).Get();
+	AssetCache::Entry cached = AssetCache::Load(key);
+	if (cached && cached.size >= sizeof(DecodedTextureHeader))
 	{
-		sizeOfIndices = indices.size();
-		VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+		DecodedTextureHeader header;
+		memcpy(&header, cached.data, sizeof(header));
+		if (cached.size - sizeof(header) == static_cast<uint64_t>(header.width) * header.height * texelSize)
+		{
+			// Uploaded straight from the cache entry's mapping
+			image.width = header.width;
+			image.height = header.height;
+			image.pixels = cached.data + sizeof(header);
+			image.size = cached.size - sizeof(header);
+			image.owner = std::shared_ptr<MappedFile>(std::move(cached.file));
+			image.regions = { GetLevelCopy(0, 0, image.width, image.height) };
+			return image;
+		}
+	}
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-		Renderer::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+	int texWidth, texHeight, texChannels;
+	stbi_uc* pixels = stbi_load_from_memory(encodedData, static_cast<int>(size), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
 
-		void* data;
-		vkMapMemory(Renderer::GetDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, indices.data(), (size_t)bufferSize);
-		vkUnmapMemory(Renderer::GetDevice(), stagingBufferMemory);
+	if (!pixels)
+	{
+		throw std::runtime_error("failed to load texture image!");
+	}
 
-		Renderer::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_IndexBuffer, m_IndexBufferMemory);
+	// Linear maps drop the channels they do not use, the decoder's buffer is simply left partly unused
+	PackTextureChannels(pixels, static_cast<size_t>(texWidth) * texHeight, usage);
 
-		Renderer::CopyBuffer(stagingBuffer, m_IndexBuffer, bufferSize);
+	image.width = static_cast<uint32_t>(texWidth);
+	image.height = static_cast<uint32_t>(texHeight);
+	image.pixels = pixels;
+	image.size = static_cast<VkDeviceSize>(texWidth) * texHeight * texelSize;
+	image.owner = std::shared_ptr<stbi_uc>(pixels, stbi_image_free);
+	image.regions = { GetLevelCopy(0, 0, image.width, image.height) };
 
-		vkDestroyBuffer(Renderer::GetDevice(), stagingBuffer, nullptr);
-		vkFreeMemory(Renderer::GetDevice(), stagingBufferMemory, nullptr);
-	}
+	DecodedTextureHeader header{ image.width, image.height };
+	std::vector<unsigned char> entry(sizeof(header) + image.size);
+	memcpy(entry.data(), &header, sizeof(header));
+	memcpy(entry.data() + sizeof(header), pixels, static_cast<size_t>(image.size));
+	AssetCache::Store(key, entry.data(), entry.size());
+
+	return image;
 }
 
-void VulkanProject::Mesh::Draw(glm::mat4 model)
+VulkanProject::TextureImage VulkanProject::Texture::DecodeCooked(const unsigned char* data, size_t size, std::shared_ptr<const void> owner)
 {
+	// Every level is already in its GPU format, the whole chain goes up in one copy
+	CookedTexture::View view = CookedTexture::Parse(data, size);
 
-	VkBuffer vertexBuffers[] = { m_VertexBuffer };
-	Renderer::UploadIndexedBuffer(vertexBuffers, m_IndexBuffer, sizeOfIndices);
-}
+	TextureImage image;
+	image.format = GetFormat(view.header.format);
+	image.width = view.header.width;
+	image.height = view.header.height;
 
-VulkanProject::Mesh::~Mesh()
-{
-	vkDestroyBuffer(Renderer::GetDevice(), m_IndexBuffer, nullptr);
-	vkFreeMemory(Renderer::GetDevice(), m_IndexBufferMemory, nullptr);
+	const CookedTexture::Level& first = view.levels[0];
+	const CookedTexture::Level& last = view.levels[view.header.mipCount - 1];
+	for (uint32_t i = 0; i < view.header.mipCount; i++)
+	{
+		const CookedTexture::Level& level = view.levels[i];
+		image.regions.push_back(GetLevelCopy(level.offset - first.offset, i, level.width, level.height));
+	}
 
-	vkDestroyBuffer(Renderer::GetDevice(), m_VertexBuffer, nullptr);
-	vkFreeMemory(Renderer::GetDevice(), m_VertexBufferMemory, nullptr);
+	image.pixels = view.data + first.offset;
+	image.size = last.offset + last.size - first.offset;
+	image.owner = std::const_pointer_cast<void>(owner);
+	return image;
 }
-void CalculateTangent(std::vector<VulkanProject::Vertex>& vertices, std::vector<unsigned int>& indices)
+
+void VulkanProject::Texture::Create(const TextureImage& image, UploadQueue& uploads)
 {
-	for (unsigned int i = 0; i < indices.size(); i += 3)
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(Renderer::GetPhysicalDevice(), image.format, &properties);
+	if (!(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
 	{
-		auto& vertex1 = vertices[indices[i + 0]];
-		auto& vertex2 = vertices[indices[i + 1]];
-		auto& vertex3 = vertices[indices[i + 2]];
-
-		glm::vec3 positionVertex1 = vertex1.pos;
-		glm::vec3 positionVertex2 = vertex2.pos;
-		glm::vec3 positionVertex3 = vertex3.pos;
-
-		glm::vec2 texCoordVertex1 = vertex1.texCoord;
-		glm::vec2 texCoordVertex2 = vertex2.texCoord;
-		glm::vec2 texCoordVertex3 = vertex3.texCoord;
-
-		glm::vec3 tangent;
-
-		// Edges of the triangle : position delta
-		glm::vec3 deltaPos1 = positionVertex2 - positionVertex1;
-		glm::vec3 deltaPos2 = positionVertex3 - positionVertex1;
-
-		// UV delta
-		glm::vec2 deltaUV1 = texCoordVertex2 - texCoordVertex1;
-		glm::vec2 deltaUV2 = texCoordVertex3 - texCoordVertex1;
-
-		float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
-		tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r;
-
-		tangent = glm::normalize(tangent);
+		throw std::runtime_error("texture format is not supported by the GPU, recook without compression!");
+	}
 
-		glm::vec3 tangentVertex1 = vertex1.tangent;
-		glm::vec3 tangentVertex2 = vertex2.tangent;
-		glm::vec3 tangentVertex3 = vertex3.tangent;
+	m_Width = image.width;
+	m_Height = image.height;
+	m_MipCount = static_cast<uint32_t>(image.regions.size());
 
-		tangentVertex1 += tangent;
-		tangentVertex2 += tangent;
-		tangentVertex3 += tangent;
+	uint32_t firstMip = 0;
+	if (m_MipCount > 1 && image.owner && TextureStreaming::IsEnabled())
+	{
+		// Only the tail goes up now, higher levels follow once something on screen needs them
+		m_Source = image;
+		firstMip = TextureStreaming::GetTailMip(*this);
+	}
 
-		tangentVertex1 = glm::normalize(tangentVertex1);
-		tangentVertex2 = glm::normalize(tangentVertex2);
-		tangentVertex3 = glm::normalize(tangentVertex3);
+	Levels levels = CreateLevels(image, firstMip, uploads);
+	m_TextureImage = levels.image;
+	m_TextureImageMemory = levels.memory;
+	m_TextureImageView = levels.view;
+	m_FirstResidentMip = levels.firstMip;
 
-		//wrong
-		vertex1.tangent = glm::vec4(tangentVertex1, 0.f);
-		vertex2.tangent = glm::vec4(tangentVertex2, 0.f);
-		vertex3.tangent = glm::vec4(tangentVertex3, 0.f);
-	
+	if (IsStreamed())
+	{
+		TextureStreaming::Register(this);
 	}
 }
-void CalculateNormal(std::vector<VulkanProject::Vertex>& vertices, std::vector<unsigned int>& indices)
-{
-	for (unsigned int i = 0; i < indices.size(); i += 3)
-	{
-		auto& vertex1 = vertices[indices[i + 0]];
-		auto& vertex2 = vertices[indices[i + 1]];
-		auto& vertex3 = vertices[indices[i + 2]];
-
-		glm::vec3 positionVertex1 = { vertex1.pos[0], vertex1.pos[1], vertex1.pos[2] };
-		glm::vec3 positionVertex2 = { vertex2.pos[0], vertex2.pos[1], vertex2.pos[2] };
-		glm::vec3 positionVertex3 = { vertex3.pos[0], vertex3.pos[1], vertex3.pos[2] };
-
-
-		glm::vec3 v1v2 = positionVertex2 - positionVertex1;
-		glm::vec3 v1v3 = positionVertex3 - positionVertex1;
 
-		glm::vec3 normal;
-		normal = glm::cross(v1v2, v1v3);
-		normal = glm::normalize(normal);
-
-		glm::vec3 normalVertex1 = { vertex1.normal[0], vertex1.normal[1], vertex1.normal[2] };
-		glm::vec3 normalVertex2 = { vertex2.normal[0], vertex2.normal[1], vertex2.normal[2] };
-		glm::vec3 normalVertex3 = { vertex3.normal[0], vertex3.normal[1], vertex3.normal[2] };
-
-		normalVertex1 += normal;
-		normalVertex2 += normal;
-		normalVertex3 += normal;
-
-		normalVertex1 = glm::normalize(normalVertex1);
-		normalVertex2 = glm::normalize(normalVertex2);
-		normalVertex3 = glm::normalize(normalVertex3);
+VulkanProject::Texture::Levels VulkanProject::Texture::CreateLevels(uint32_t firstMip, UploadQueue& uploads) const
+{
+	return CreateLevels(m_Source, firstMip, uploads);
+}
 
-		vertex1.normal[0] = normalVertex1.x;
-		vertex1.normal[1] = normalVertex1.y;
-		vertex1.normal[2] = normalVertex1.z;
+VulkanProject::Texture::Levels VulkanProject::Texture::CreateLevels(const TextureImage& image, uint32_t firstMip, UploadQueue& uploads)
+{
+	// The levels are contiguous in pixels, so the missing ones are simply skipped at the front
+	const VkDeviceSize base = image.regions[firstMip].bufferOffset;
+	std::vector<VkBufferImageCopy> regions(image.regions.begin() + firstMip, image.regions.end());
+	for (auto& region : regions)
+	{
+		region.bufferOffset -= base;
+		region.imageSubresource.mipLevel -= firstMip;
+	}
 
-		vertex2.normal[0] = normalVertex2.x;
-		vertex2.normal[1] = normalVertex2.y;
-		vertex2.normal[2] = normalVertex2.z;
+	const uint32_t mipLevels = static_cast<uint32_t>(regions.size());
+	const uint32_t width = std::max(1u, image.width >> firstMip);
+	const uint32_t height = std::max(1u, image.height >> firstMip);
 
-		vertex3.normal[0] = normalVertex3.x;
-		vertex3.normal[1] = normalVertex3.y;
-		vertex3.normal[2] = normalVertex3.z;
+	Levels levels;
+	levels.firstMip = firstMip;
+	Renderer::CreateImage(width, height, image.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, levels.image, levels.memory, mipLevels);
+	uploads.CopyToImage(image.pixels + base, image.size - base, levels.image, mipLevels, regions);
 
+	levels.view = Renderer::CreateImageView(levels.image, image.format, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+	return levels;
+}
 
-	}
+VulkanProject::Texture::Levels VulkanProject::Texture::ReplaceLevels(const Levels& levels)
+{
+	Levels previous{ m_TextureImage, m_TextureImageMemory, m_TextureImageView, m_FirstResidentMip };
+	m_TextureImage = levels.image;
+	m_TextureImageMemory = levels.memory;
+	m_TextureImageView = levels.view;
+	m_FirstResidentMip = levels.firstMip;
+	return previous;
 }
-bool GetData(std::vector<VulkanProject::Vertex>& vertices, const tinygltf::Primitive& primitive, const tinygltf::Model& model, std::string type, int numFloats, size_t vertexCount)
+
+void VulkanProject::Texture::DestroyLevels(const Levels& levels)
 {
-	int accessorIndex = -1;
+	vkDestroyImageView(Renderer::GetDevice(), levels.view, nullptr);
+	vkDestroyImage(Renderer::GetDevice(), levels.image, nullptr);
+	vkFreeMemory(Renderer::GetDevice(), levels.memory, nullptr);
+}
 
-	if (primitive.attributes.find(type.c_str()) != primitive.attributes.end())
+VkDeviceSize VulkanProject::Texture::GetLevelBytes(uint32_t firstMip) const
+{
+	if (!IsStreamed())
 	{
-		accessorIndex = primitive.attributes.at(type.c_str());
+		return 0;
 	}
-	else
+	return m_Source.size - m_Source.regions[firstMip].bufferOffset;
+}
+
+VulkanProject::Texture::~Texture()
+{
+	if (IsStreamed())
 	{
-		return false;
+		TextureStreaming::Unregister(this);
 	}
-	const auto& Accessor = model.accessors[accessorIndex];
-	const auto& BufferView = model.bufferViews[Accessor.bufferView];
-	const auto& Buffer = model.buffers[BufferView.buffer];
+	vkDestroyImage(Renderer::GetDevice(), m_TextureImage, nullptr);
+	vkFreeMemory(Renderer::GetDevice(), m_TextureImageMemory, nullptr);
+	vkDestroyImageView(Renderer::GetDevice(), m_TextureImageView, nullptr);
+}
 
-	//vertices.resize(vertexCount);
+VulkanProject::Mesh::Mesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices) : Mesh(vertices.data(), vertices.size(), indices.data(), indices.size())
+{
+}
 
-	int Stride = Accessor.ByteStride(BufferView);
-	if(!vertexCount == Accessor.count)
-	{
-		throw std::runtime_error("Accessor does not allign with positionAccessor");
-	}
+VulkanProject::Mesh::Mesh(const Vertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount)
+{
+	UploadQueue uploads;
+	Create(vertices, vertexCount, indices, indexCount, uploads);
+	uploads.Flush();
+}
 
-	for (int i = 0; i < vertexCount; i++)
-	{
-		size_t index = BufferView.byteOffset + Accessor.byteOffset + i * Stride;
+VulkanProject::Mesh::Mesh(const Vertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount, UploadQueue& uploads)
+{
+	Create(vertices, vertexCount, indices, indexCount, uploads);
+}
 
-		if (type == "TEXCOORD_0")
-		{
-			vertices[i].texCoord.x = *(float*)(&Buffer.data[index + sizeof(float) * 0]);
-			vertices[i].texCoord.y = *(float*)(&Buffer.data[index + sizeof(float) * 1]);
-		}
-		else if (type == "POSITION")
-		{
-			vertices[i].pos.x = *(float*)(&Buffer.data[index + sizeof(float) * 0]);
-			vertices[i].pos.y = *(float*)(&Buffer.data[index + sizeof(float) * 1]);
-			vertices[i].pos.z = *(float*)(&Buffer.data[index + sizeof(float) * 2]);
-		}
-		else if (type == "NORMAL")
-		{
-			vertices[i].normal.x = *(float*)(&Buffer.data[index + sizeof(float) * 0]);
-			vertices[i].normal.y = *(float*)(&Buffer.data[index + sizeof(float) * 1]);
-			vertices[i].normal.z = *(float*)(&Buffer.data[index + sizeof(float) * 2]);
-		}
-		else if (type == "TANGENT")
+void VulkanProject::Mesh::Create(const Vertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount, UploadQueue& uploads)
+{
+	// bounding sphere around the box of the positions, loose but cheap
+	if (vertexCount > 0)
+	{
+		glm::vec3 min = vertices[0].pos;
+		glm::vec3 max = vertices[0].pos;
+		for (size_t i = 1; i < vertexCount; i++)
 		{
-			vertices[i].tangent[0] = *(float*)(&Buffer.data[index + sizeof(float) * 0]);
-			vertices[i].tangent[1] = *(float*)(&Buffer.data[index + sizeof(float) * 1]);
-			vertices[i].tangent[2] = *(float*)(&Buffer.data[index + sizeof(float) * 2]);
-			vertices[i].tangent[3] = *(float*)(&Buffer.data[index + sizeof(float) * 3]);
-
+			min = glm::min(min, vertices[i].pos);
+			max = glm::max(max, vertices[i].pos);
 		}
+		m_BoundsCenter = (min + max) * 0.5f;
+		m_BoundsRadius = glm::length(max - min) * 0.5f;
+		m_BoundsMin = min;
+		m_BoundsMax = max;
 	}
 
-	return true;
+	// Suballocated from the shared buffers, every mesh is drawn with the same bindings
+	m_Geometry = GeometryPool::Allocate(static_cast<uint32_t>(vertexCount), static_cast<uint32_t>(indexCount));
+	uploads.CopyToBuffer(vertices, sizeof(Vertex) * vertexCount, GeometryPool::GetVertexBuffer(), sizeof(Vertex) * static_cast<VkDeviceSize>(m_Geometry.firstVertex));
+	uploads.CopyToBuffer(indices, sizeof(uint32_t) * indexCount, GeometryPool::GetIndexBuffer(), sizeof(uint32_t) * static_cast<VkDeviceSize>(m_Geometry.firstIndex));
 }
 
-enum class eTextureTypes
+VkDrawIndexedIndirectCommand VulkanProject::Mesh::GetDrawCommand(uint32_t firstInstance, uint32_t instanceCount) const
 {
-	Diffuse = 0,
-	Normal = 1,
-	Metalic_Roughness = 2
-};
+	VkDrawIndexedIndirectCommand command{};
+	command.indexCount = m_Geometry.indexCount;
+	command.instanceCount = instanceCount;
+	command.firstIndex = m_Geometry.firstIndex;
+	command.vertexOffset = static_cast<int32_t>(m_Geometry.firstVertex);
+	command.firstInstance = firstInstance;
+	return command;
+}
 
-std::string GetTexturePathforPrimitive(const tinygltf::Primitive& primitive, const tinygltf::Model& model, std::string filepath, eTextureTypes type)
+void VulkanProject::Mesh::Draw(glm::mat4 model)
 {
-	std::filesystem::path fullPath = filepath;
-	std::string textureName;
-	int imageIndex = -1;
-	int textureIndex = -1;
-	switch (type)
-	{
-	case eTextureTypes::Diffuse:
-	{
+	Renderer::BindGeometry(GeometryPool::GetVertexBuffer(), GeometryPool::GetIndexBuffer());
+	Renderer::DrawIndexed(GetDrawCommand(0));
+}
 
-		textureIndex = model.materials[primitive.material].pbrMetallicRoughness.baseColorTexture.index;
+VulkanProject::Mesh::~Mesh()
+{
+	GeometryPool::Free(m_Geometry);
+}
+VulkanProject::Model::Model(std::string path)
+{
+	Source source = ReadSource(path);
+	CreatePrimitives(source.meshes);
+	m_Nodes = std::move(source.nodes);
+	m_RootNodes = std::move(source.rootNodes);
+}
 
-		break;
-	}
-	case eTextureTypes::Normal:
-	{
+VulkanProject::Model::Source VulkanProject::Model::ReadSource(const std::string& path)
+{
+	return CookedModel::IsCookedModel(path) ? ReadCooked(path) : ReadImported(path);
+}
 
-		textureIndex = model.materials[primitive.material].normalTexture.index;
+VulkanProject::Model::Source VulkanProject::Model::ReadImported(const std::string& path)
+{
+	auto data = std::make_shared<ModelData>(ImportModel(path));
 
-		break;
-	}
-	case eTextureTypes::Metalic_Roughness:
+	Source source;
+	for (const auto& mesh : data->meshes)
 	{
-
-
-		textureIndex = model.materials[primitive.material].pbrMetallicRoughness.metallicRoughnessTexture.index;
-
-		break;
-	}
+		std::vector<PrimitiveSource> primitives;
+		for (const auto& primitive : mesh)
+		{
+			primitives.push_back({ primitive.vertices.data(), primitive.vertices.size(), primitive.indices.data(), primitive.indices.size(),
+				{ primitive.texture, primitive.normalTexture, primitive.metalic_roughnessTexture }, primitive.state });
+		}
+		source.meshes.push_back(primitives);
 	}
 
-
-	imageIndex = model.textures[textureIndex].source;
-	textureName = model.images[imageIndex].uri;
-	std::string texturePath = fullPath.parent_path().string() + "/" + textureName;
-
-	
-	return texturePath;
+	source.nodes.resize(data->nodes.size());
+	for (int i = 0; i < data->nodes.size(); i++)
+	{
+		source.nodes[i].transform = data->nodes[i].transform;
+		source.nodes[i].children = data->nodes[i].children;
+		source.nodes[i].mesh = data->nodes[i].mesh;
+	}
+	source.rootNodes = data->rootNodes;
+	source.owner = data;
+	return source;
 }
-VulkanProject::Model::Model(std::string path)
-{
-	tinygltf::Model model;
-	tinygltf::TinyGLTF loader;
-	std::string err;
-	std::string warn;
 
-	bool ret = loader.LoadASCIIFromFile(&model, &err, &warn, path);
-	//bool ret = loader.LoadBinaryFromFile(&model, &err, &warn, argv[1]); // for binary glTF(.glb)
+VulkanProject::Model::Source VulkanProject::Model::ReadCooked(const std::string& path)
+{
+	// The vertex and index sections are copied from the mapping straight into staging memory
+	auto file = std::make_shared<MappedFile>(path);
+	CookedModel::View view = CookedModel::Parse(file->GetData(), file->GetSize());
 
-	if (!warn.empty()) 
+	std::filesystem::path directory = std::filesystem::path(path).parent_path();
+	auto getTexture = [&](uint32_t offset, eTextureUsage usage, uint32_t sampler) -> TextureSource
 	{
-		printf("Warn: %s\n", warn.c_str());
-	}
+		TextureSource source;
+		source.usage = usage;
+		source.sampler = CookedModel::UnpackSampler(sampler);
+		std::string relative = view.GetString(offset);
+		if (!relative.empty())
+		{
+			source.path = (directory / relative).generic_string();
+		}
+		return source;
+	};
 
-	if (!err.empty())
+	Source source;
+	for (uint32_t i = 0; i < view.meshCount; i++)
 	{
-		printf("Err: %s\n", err.c_str());
+		std::vector<PrimitiveSource> primitives;
+		for (uint32_t j = 0; j < view.meshes[i].primitiveCount; j++)
+		{
+			const auto& primitive = view.primitives[view.meshes[i].firstPrimitive + j];
+			primitives.push_back({ view.vertices + primitive.firstVertex, primitive.vertexCount, view.indices + primitive.firstIndex, primitive.indexCount,
+				{ getTexture(primitive.texturePath, eTextureUsage::Color, primitive.samplers[0]), getTexture(primitive.normalTexturePath, eTextureUsage::Normal, primitive.samplers[1]),
+				getTexture(primitive.metalic_roughnessTexturePath, eTextureUsage::MetallicRoughness, primitive.samplers[2]) }, CookedModel::UnpackPipelineState(primitive.state) });
+		}
+		source.meshes.push_back(primitives);
 	}
 
-	if (!ret) 
+	source.nodes.resize(view.nodeCount);
+	for (uint32_t i = 0; i < view.nodeCount; i++)
 	{
-		throw std::runtime_error("Failed to parse glTF");
+		const auto& node = view.nodes[i];
+		memcpy(&source.nodes[i].transform[0][0], node.transform, sizeof(node.transform));
+		source.nodes[i].children.assign(view.children + node.firstChild, view.children + node.firstChild + node.childCount);
+		source.nodes[i].mesh = node.mesh;
 	}
+	source.rootNodes.assign(view.rootNodes, view.rootNodes + view.rootNodeCount);
+	source.owner = file;
+	return source;
+}
 
-	for (const auto& mesh : model.meshes)
+void VulkanProject::Model::CreatePrimitives(const std::vector<std::vector<PrimitiveSource>>& meshes)
+{
+	// Decoding is the expensive part and touches no GPU state, so every texture of the model is decoded at once
+	std::vector<const TextureSource*> sources;
+	for (const auto& mesh : meshes)
 	{
-		std::vector<Primitive> primitives;
-		for (const auto& primtive : mesh.primitives)
+		for (const auto& primitive : mesh)
 		{
-			std::vector<unsigned int> indices;
-			//calculating indices
+			for (const auto& texture : primitive.textures)
 			{
-				const auto& accessor = model.accessors[primtive.indices];
-				const auto& bufferView = model.bufferViews[accessor.bufferView];
-				const auto& buffer = model.buffers[bufferView.buffer];
-
-				indices.resize(accessor.count);
-				for (int i = 0; i < accessor.count; i++)
-				{
-					size_t index = bufferView.byteOffset + accessor.byteOffset;
-
-					if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_SHORT)
-					{
-						indices[i] = static_cast<unsigned int>(*(short*)(&buffer.data[index + i * sizeof(short)]));
-
-					}
-					else if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
-					{
-						indices[i] = static_cast<unsigned int>(*(unsigned short*)(&buffer.data[index + i * sizeof(unsigned short)]));
-
-					}
-					else if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_INT)
-					{
-						indices[i] = static_cast<unsigned int>(*(int*)(&buffer.data[index + i * sizeof(int)]));
-
-					}
-					else if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
-					{
-						indices[i] = static_cast<unsigned int>(*(unsigned int*)(&buffer.data[index + i * sizeof(unsigned int)]));
-
-					}
-					else throw std::runtime_error("unsupported indices type");
-
-				}
-				//vertexData.numIndices = static_cast<unsigned int>(accessor.count);
+				sources.push_back(&texture);
 			}
+		}
+	}
 
+	std::vector<TextureImage> images(sources.size());
+	ThreadPool::GetShared().ParallelFor(sources.size(), [&](size_t i)
+	{
+		if (sources[i]->IsValid() && !VirtualTexture::IsVirtualTexture(sources[i]->path))
+		{
+			images[i] = Texture::Decode(*sources[i]);
+		}
+	});
 
-			std::vector<Vertex> vertices;
-			//calcualting vertices
-			{
-
-				const auto& positionAccessor = model.accessors[primtive.attributes.at("POSITION")];
-				size_t vertexCount = positionAccessor.count;
-				vertices.resize(vertexCount);
-				GetData(vertices, primtive, model, "POSITION", 3, vertexCount);
-
-				GetData(vertices, primtive, model, "TEXCOORD_0", 2, vertexCount);
-
-				if (!GetData(vertices, primtive, model, "NORMAL", 3, vertexCount))
-				{
-					CalculateNormal(vertices, indices);
-				};
-
-				if (!GetData(vertices, primtive, model, "TANGENT", 3, vertexCount))
-				{
-					CalculateTangent(vertices, indices);
-				}
-
-
-
-				
-				//vertexData.numVertices = static_cast<unsigned int>(vertexCount);
-				//vertexData.vertexStrideInBytes = sizeof(Vertex);
-			}
+	// Resource creation stays on this thread, every copy goes through one queue and a single submit
+	UploadQueue uploads;
+	size_t imageIndex = 0;
+	auto createTexture = [&]() -> Texture*
+	{
+		const TextureSource& source = *sources[imageIndex];
+		TextureImage& image = images[imageIndex++];
+		if (image.pixels == nullptr)
+		{
+			return nullptr;
+		}
+		Texture* texture = new Texture(image, uploads, source.sampler);
+		// The pixels are in staging memory now
+		image = TextureImage();
+		return texture;
+	};
 
-			//textures
-			if (primtive.material != -1)
+	for (const auto& mesh : meshes)
+	{
+		std::vector<Primitive> primitives;
+		for (const auto& primitive : mesh)
+		{
+			//when there are no textures we return a nullptr
+			Primitive created{ new Mesh(primitive.vertices, primitive.vertexCount, primitive.indices, primitive.indexCount, uploads), nullptr, nullptr, nullptr };
+			created.texture = createTexture();
+			created.normalTexture = createTexture();
+			created.metalic_roughnessTexture = createTexture();
+			created.state = primitive.state;
+			for (int i = 0; i < 3; i++)
 			{
-
-				if (model.materials[primtive.material].pbrMetallicRoughness.baseColorTexture.index != -1)
+				if (VirtualTexture::IsVirtualTexture(primitive.textures[i].path))
 				{
-
-					std::string texturePath = GetTexturePathforPrimitive(primtive, model, path, eTextureTypes::Diffuse);
-
-
-					if (model.materials[primtive.material].normalTexture.index != -1)
-					{
-
-						std::string normalPath = GetTexturePathforPrimitive(primtive, model, path, eTextureTypes::Normal);
-
-						if (model.materials[primtive.material].pbrMetallicRoughness.metallicRoughnessTexture.index != -1)
-						{
-							std::string metallicPath = GetTexturePathforPrimitive(primtive, model, path, eTextureTypes::Metalic_Roughness);
-
-							primitives.push_back({ new Mesh(vertices, indices), new Texture(texturePath), new Texture(normalPath), new Texture(metallicPath)});
-							continue;
-						}
-
-						primitives.push_back({ new Mesh(vertices, indices), new Texture(texturePath), new Texture(normalPath)});
-						continue;
-					}
-
-
-					primitives.push_back({ new Mesh(vertices, indices), new Texture(texturePath)});
-					continue;
+					created.virtualTextures[i] = new VirtualTexture(primitive.textures[i].path, uploads);
 				}
-
 			}
-			//when there are no textures we return a nullptr
-			primitives.push_back({ new Mesh(vertices, indices),nullptr });
+			primitives.push_back(created);
 		}
 		m_Meshes.push_back(primitives);
 	}
+	uploads.Flush();
+}
 
-	m_Nodes.resize(model.nodes.size());
-	for (int i = 0; i < model.nodes.size(); i++)
+VulkanProject::Model::~Model()
+{
+}
+void VulkanProject::Model::DrawNode(int index, glm::mat4 parentTransform, const glm::mat4* modelMatrices, uint32_t instanceCount, GraphicsPipeline& pipeline, const OcclusionRasterizer* occlusion)
+{
+	const auto& node = m_Nodes[index];
+	auto transform = node.transform * parentTransform;
+	if (node.mesh >= 0)
 	{
-		for (int j = 0; j < model.nodes[i].children.size(); j++)
-			m_Nodes[i].children.push_back(model.nodes[i].children[j]);
-
-		m_Nodes[i].mesh = model.nodes[i].mesh;
-
-		glm::mat4 transform;
-
-		if (model.nodes[i].matrix.size() > 0)
+		for (const auto& primitve : m_Meshes[node.mesh])
 		{
-			//float value[16] = { 0.f };
-			for (int j = 0; j < model.nodes[i].matrix.size(); j++)
+			if (primitve.mesh == nullptr)
 			{
-				//value[j] = static_cast<float>(model.nodes[i].matrix[j]);
-				transform = model.nodes[i].matrix[j];
+				continue;
 			}
-			//transform = DirectX::SimpleMath::Matrix(value);
-		}
-		// Asuming that scale and rotation are present when translation is
-		else
-		{
-			glm::vec3 translation = { 0.f,0.f,0.f };
-			glm::quat rotation;
-			glm::vec3 scale = { 1.f,1.f,1.f };
-			if (model.nodes[i].translation.size() > 0)
+			// At the transform the draw and the occlusion test use
+			for (uint32_t i = 0; i < instanceCount; i++)
 			{
-				auto trans = model.nodes[i].translation;
-				translation = { static_cast<float>(trans[0]), static_cast<float>(trans[1]), static_cast<float>(trans[2]) };
+				RequestTextureMips(primitve, modelMatrices[i]);
 			}
-			if (model.nodes[i].rotation.size() > 0)
+			// Still streamed above, so it is sharp once it comes out from behind the occluders
+			if (occlusion != nullptr && instanceCount == 1 && !occlusion->IsVisible(primitve.mesh->GetBoundsMin(), primitve.mesh->GetBoundsMax(), modelMatrices[0]))
 			{
-				auto rot = model.nodes[i].rotation;
-				rotation = { static_cast<float>(rot[0]), static_cast<float>(rot[1]), static_cast<float>(rot[2]), static_cast<float>(rot[3]) };
+				continue;
 			}
-			if (model.nodes[i].scale.size() > 0)
+			bool isVirtual = primitve.virtualTextures[0] != nullptr && primitve.virtualTextures[1] != nullptr && primitve.virtualTextures[2] != nullptr;
+			DrawItem draw;
+			draw.mesh = primitve.mesh;
+			draw.transform = modelMatrices[0];
+			if (instanceCount > 1)
 			{
-
-				scale = { static_cast<float>(model.nodes[i].scale[0]), static_cast<float>(model.nodes[i].scale[1]), static_cast<float>(model.nodes[i].scale[2]) };
-
+				draw.transforms = modelMatrices;
+				draw.instanceCount = instanceCount;
 			}
-
-			glm::mat4 translationM = glm::translate(translationM, translation);
-			glm::mat4 rotationM = glm::toMat4(rotation);
-			glm::mat4 scaleM = glm::scale(scaleM, scale);
-			transform = transform * rotationM * scaleM;
-		
+			// The permutation without the maps the material does not have
+			draw.state = primitve.state;
+			draw.state.SetConstant(eMaterialConstant::DiffuseMap, isVirtual || primitve.texture != nullptr ? 1u : 0u);
+			draw.state.SetConstant(eMaterialConstant::NormalMap, isVirtual || primitve.normalTexture != nullptr ? 1u : 0u);
+			draw.state.SetConstant(eMaterialConstant::MetallicRoughnessMap, isVirtual || primitve.metalic_roughnessTexture != nullptr ? 1u : 0u);
+			if (isVirtual)
+			{
+				std::copy(primitve.virtualTextures, primitve.virtualTextures + 3, draw.virtualTextures);
+				for (uint32_t i = 0; i < instanceCount; i++)
+				{
+					VirtualTexturing::AddFeedbackDraw(primitve.mesh, modelMatrices[i], primitve.virtualTextures);
+				}
+			}
+			else
+			{
+				draw.textures[0] = primitve.texture;
+				draw.textures[1] = primitve.normalTexture;
+				draw.textures[2] = primitve.metalic_roughnessTexture;
+			}
+			pipeline.Submit(draw);
 		}
-		m_Nodes[i].transform = transform;
 	}
-	for (int i = 0; i < model.scenes[model.defaultScene].nodes.size(); i++)
+	for (int i = 0; i < node.children.size(); i++)
 	{
-		m_RootNodes.push_back(model.scenes[model.defaultScene].nodes[i]);
+		DrawNode(node.children[i], transform, modelMatrices, instanceCount, pipeline, occlusion);
 	}
-}
 
-VulkanProject::Model::~Model()
-{
 }
-void VulkanProject::Model::DrawNode(int index, glm::mat4 parentTransform, GraphicsPipeline& pipeline)
+void VulkanProject::Model::GetOccluders(std::vector<OcclusionRasterizer::Occluder>& occluders) const
 {
-	const auto& node = m_Nodes[index];
-	auto transform = node.transform * parentTransform;
-	if (node.mesh >= 0)
+	if (!m_BoxOccluders)
 	{
-		for (const auto& primitve : m_Meshes[node.mesh])
+		return;
+	}
+	for (const auto& mesh : m_Meshes)
+	{
+		for (const auto& primitive : mesh)
 		{
-			std::vector<Texture*> textures;
-			//making sure that only present textures are bound
-			if (primitve.texture != nullptr)
-			{
-				textures.push_back(primitve.texture);
-				textures.push_back(primitve.normalTexture);
-				textures.push_back(primitve.metalic_roughnessTexture);
-			
-				pipeline.UpdateDesctiptorSets(textures);
-				//primitve.texture->Bind(0);
-			}
-			/*if (primitve.normalTexture != nullptr)
+			// Blended and cut out surfaces have holes, double sided ones are usually thin or open
+			if (primitive.mesh == nullptr || primitive.state.blendEnable || primitive.state.cullMode == VK_CULL_MODE_NONE ||
+				primitive.state.GetConstant(eMaterialConstant::AlphaMask) != 0)
 			{
-				primitve.normalTexture->Bind(1);
+				continue;
 			}
-			if (primitve.metalic_roughnessTexture != nullptr)
-			{
-				primitve.metalic_roughnessTexture->Bind(1);
-
-			}*/
-			primitve.mesh->Draw(transform);
+			glm::vec3 center = (primitive.mesh->GetBoundsMin() + primitive.mesh->GetBoundsMax()) * 0.5f;
+			glm::vec3 extent = (primitive.mesh->GetBoundsMax() - primitive.mesh->GetBoundsMin()) * (0.5f * c_OccluderScale);
+			occluders.push_back(OcclusionRasterizer::CreateBox(center - extent, center + extent));
 		}
 	}
-	for (int i = 0; i < node.children.size(); i++)
+}
+
+void VulkanProject::Model::RequestTextureMips(const Primitive& primitive, const glm::mat4& transform)
+{
+	if (!TextureStreaming::IsEnabled())
 	{
-		DrawNode(node.children[i], transform, pipeline);
+		return;
 	}
 
+	// World space bounds, scaled by the largest axis of the transform
+	glm::vec3 center = glm::vec3(transform * glm::vec4(primitive.mesh->GetBoundsCenter(), 1.0f));
+	float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+	float radius = primitive.mesh->GetBoundsRadius() * scale;
+
+	Texture* textures[3] = { primitive.texture, primitive.normalTexture, primitive.metalic_roughnessTexture };
+	for (Texture* texture : textures)
+	{
+		if (texture != nullptr && texture->IsStreamed())
+		{
+			TextureStreaming::Request(texture, TextureStreaming::GetRequiredMip(*texture, center, radius));
+		}
+	}
 }
-void VulkanProject::Model::Draw(glm::mat4 modelmatrix, GraphicsPipeline& pipeline)
+
+void VulkanProject::Model::Draw(glm::mat4 modelmatrix, GraphicsPipeline& pipeline, const OcclusionRasterizer* occlusion)
 {
-	pipeline.UploadModelBuffer(modelmatrix);
+	for (int i = 0; i < m_RootNodes.size(); i++)
+	{
+		DrawNode(m_RootNodes[i], glm::mat4(1.0f), &modelmatrix, 1, pipeline, occlusion);
+	}
+}
 
+void VulkanProject::Model::DrawInstanced(const std::vector<glm::mat4>& transforms, GraphicsPipeline& pipeline)
+{
+	if (transforms.empty())
+	{
+		return;
+	}
 	for (int i = 0; i < m_RootNodes.size(); i++)
 	{
-		DrawNode(m_RootNodes[i], modelmatrix, pipeline);
+		DrawNode(m_RootNodes[i], glm::mat4(1.0f), transforms.data(), static_cast<uint32_t>(transforms.size()), pipeline, nullptr);
 	}
 }
 
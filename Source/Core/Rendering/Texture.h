@@ -1,8 +1,13 @@
 #pragma once
 #include "Core/Includes.h"
+#include "SamplerCache.h"
+#include "PipelineCache.h"
+#include "GeometryPool.h"
+#include "OcclusionRasterizer.h"
 #include <string>
 #include <array>
 #include <vector>
+#include <memory>
 
 namespace VulkanProject
 {
@@ -58,54 +63,233 @@ namespace VulkanProject
         }
     };
 
+    // What a texture holds, picks its format. Only colour is sRGB, linear data keeps just the channels it uses.
+    enum class eTextureUsage : uint32_t
+    {
+        // RGBA8 sRGB
+        Color = 0,
+        // tangent space xy in RG8, z is reconstructed in the shader
+        Normal = 1,
+        // roughness in R and metalness in G of an RG8 image, glTF stores them in G and B
+        MetallicRoughness = 2
+    };
+
+    // Material features shader.frag is specialised on, the constant_id and the index into PipelineState::constants.
+    // A map the material does not have is never sampled.
+    enum class eMaterialConstant : uint32_t
+    {
+        DiffuseMap = 0,
+        NormalMap = 1,
+        MetallicRoughnessMap = 2,
+        // glTF alphaMode MASK, discards below the cutoff
+        AlphaMask = 3,
+        // float
+        AlphaCutoff = 4
+    };
+
+    // Bytes per texel of an uncompressed texture with this usage
+    inline uint32_t GetTexelSize(eTextureUsage usage)
+    {
+        return usage == eTextureUsage::Color ? 4 : 2;
+    }
+
+    // Moves the two channels a linear usage keeps to the front of each RGBA8 texel, in place. The first
+    // texelCount * 2 bytes are the RG8 image afterwards. Colour is left as it is.
+    inline void PackTextureChannels(unsigned char* pixels, size_t texelCount, eTextureUsage usage)
+    {
+        if (usage == eTextureUsage::Color)
+        {
+            return;
+        }
+        const size_t first = usage == eTextureUsage::Normal ? 0 : 1;
+        for (size_t i = 0; i < texelCount; i++)
+        {
+            unsigned char red = pixels[i * 4 + first];
+            unsigned char green = pixels[i * 4 + first + 1];
+            pixels[i * 2] = red;
+            pixels[i * 2 + 1] = green;
+        }
+    }
+
+    // Where a texture is loaded from, a file on disk or encoded image bytes already in memory
+    struct TextureSource
+    {
+        std::string path;
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+        // how encoded images are decoded, cooked textures already are in their format
+        eTextureUsage usage = eTextureUsage::Color;
+        // from the glTF sampler of the texture
+        SamplerState sampler;
+
+        bool IsValid() const { return !path.empty() || data != nullptr; }
+    };
+
+    // Texture data prepared on the CPU, ready to be copied to the GPU
+    struct TextureImage
+    {
+        VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // one region per mip level, offsets are relative to pixels
+        std::vector<VkBufferImageCopy> regions;
+
+        const unsigned char* pixels = nullptr;
+        VkDeviceSize size = 0;
+        // keeps pixels alive: decoded memory, a cache entry or a mapped cooked texture
+        std::shared_ptr<void> owner;
+    };
+
+    class UploadQueue;
+
 	class Texture
 	{
 	public: 
 		Texture(std::string filepath);
+		// The copy is recorded into uploads, the texture can be used once uploads is flushed.
+		// While TextureStreaming is enabled a mip chain starts out with only its tail levels,
+		// image.owner then has to keep the rest of the chain alive for the streamer.
+		Texture(const TextureImage& image, UploadQueue& uploads, const SamplerState& sampler = SamplerState());
 		~Texture();
 		const VkImageView GetImageview() const {  return m_TextureImageView; }
+		// Shared through the SamplerCache, not owned by the texture
+		VkSampler GetSampler() const { return m_Sampler; }
+
+		// Size and level count of the full chain, not just what is on the GPU
+		uint32_t GetWidth() const { return m_Width; }
+		uint32_t GetHeight() const { return m_Height; }
+		uint32_t GetMipCount() const { return m_MipCount; }
+		// Levels above this one are not on the GPU (yet), the image view only covers the resident ones
+		uint32_t GetFirstResidentMip() const { return m_FirstResidentMip; }
+		bool IsStreamed() const { return m_Source.owner != nullptr; }
+
+		// Touches no GPU state, safe to call from worker threads
+		static TextureImage Decode(const TextureSource& source);
+		// Same for a file that has already been read into memory, e.g. by the IOService
+		static TextureImage Decode(const std::string& path, eTextureUsage usage, std::shared_ptr<const std::vector<unsigned char>> fileData);
+
+		// GPU image holding the levels from firstMip to the end of the chain
+		struct Levels
+		{
+			VkImage image = VK_NULL_HANDLE;
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+			uint32_t firstMip = 0;
+		};
+		// Used by TextureStreaming on streamed textures. The new levels are uploaded from the kept source,
+		// the old ones returned by ReplaceLevels may still be used by frames in flight.
+		Levels CreateLevels(uint32_t firstMip, UploadQueue& uploads) const;
+		Levels ReplaceLevels(const Levels& levels);
+		static void DestroyLevels(const Levels& levels);
+		// Bytes on the GPU with the levels from firstMip on resident
+		VkDeviceSize GetLevelBytes(uint32_t firstMip) const;
      
 	private:
+		// Decodes through the asset cache, a hit skips the image decoder
+		static TextureImage DecodeEncoded(const unsigned char* encodedData, size_t size, eTextureUsage usage);
+		// Texture written by the asset cooker, including its mip chain. owner keeps data alive.
+		static TextureImage DecodeCooked(const unsigned char* data, size_t size, std::shared_ptr<const void> owner);
+		static Levels CreateLevels(const TextureImage& image, uint32_t firstMip, UploadQueue& uploads);
+		void Create(const TextureImage& image, UploadQueue& uploads);
 		
 		VkImage m_TextureImage;
 		VkDeviceMemory m_TextureImageMemory;
 		VkImageView m_TextureImageView;
+		VkSampler m_Sampler = VK_NULL_HANDLE;
+
+		uint32_t m_Width = 0;
+		uint32_t m_Height = 0;
+		uint32_t m_MipCount = 1;
+		uint32_t m_FirstResidentMip = 0;
+		// only kept for streamed textures
+		TextureImage m_Source;
 	};
 
     class Mesh
     {
     public:
         Mesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices);
+        Mesh(const Vertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount);
+        // The copies are recorded into uploads, the mesh can be drawn once uploads is flushed
+        Mesh(const Vertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount, UploadQueue& uploads);
         ~Mesh();
+        // Draws right away, for passes that do not go through GraphicsPipeline::Submit
         void Draw(glm::mat4 model);
+        // Indirect arguments of the whole mesh, into the GeometryPool buffers
+        VkDrawIndexedIndirectCommand GetDrawCommand(uint32_t firstInstance, uint32_t instanceCount = 1) const;
+
+        // Bounding sphere in object space
+        glm::vec3 GetBoundsCenter() const { return m_BoundsCenter; }
+        float GetBoundsRadius() const { return m_BoundsRadius; }
+        // Box around the positions in object space
+        glm::vec3 GetBoundsMin() const { return m_BoundsMin; }
+        glm::vec3 GetBoundsMax() const { return m_BoundsMax; }
     private:
-        VkBuffer m_VertexBuffer = VK_NULL_HANDLE;
-        VkDeviceMemory m_VertexBufferMemory;
+        void Create(const Vertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount, UploadQueue& uploads);
 
-        VkBuffer m_IndexBuffer = VK_NULL_HANDLE;
-        VkDeviceMemory m_IndexBufferMemory;
+        GeometryPool::Allocation m_Geometry;
 
-        //size_t sizeOfVertices;
-        uint32_t sizeOfIndices;
+        glm::vec3 m_BoundsCenter = glm::vec3(0.0f);
+        float m_BoundsRadius = 0.0f;
+        glm::vec3 m_BoundsMin = glm::vec3(0.0f);
+        glm::vec3 m_BoundsMax = glm::vec3(0.0f);
     };
     class GraphicsPipeline;
+    class VirtualTexture;
+    struct ModelData;
+    class ModelLoader;
     class Model
     {
     public:
+        // Blocks until every mesh and texture is on the GPU, ModelLoader loads in the background
         Model(std::string path);
         ~Model();
-        void Draw(glm::mat4 modelmatrix, GraphicsPipeline& pipeline);
+        // Submits a draw per primitive that has streamed in, GraphicsPipeline::Flush records them.
+        // With occlusion the primitives whose bounds are hidden behind its occluders are left out.
+        void Draw(glm::mat4 modelmatrix, GraphicsPipeline& pipeline, const OcclusionRasterizer* occlusion = nullptr);
+        // Submits a draw per primitive for all of transforms at once, each primitive is one instanced draw.
+        // transforms has to stay alive until GraphicsPipeline::Flush.
+        void DrawInstanced(const std::vector<glm::mat4>& transforms, GraphicsPipeline& pipeline);
+        // Adds a box inside the bounds of every opaque, single sided primitive that has streamed in, in the space
+        // of the model matrix Draw is given. Nothing unless SetBoxOccluders opted the model in.
+        void GetOccluders(std::vector<OcclusionRasterizer::Occluder>& occluders) const;
+        // The boxes are only right for closed, solid meshes. A shell, ring or open mesh is empty where its box
+        // is and would hide what is visible through it.
+        void SetBoxOccluders(bool enabled) { m_BoxOccluders = enabled; }
     private:
+        friend class ModelLoader;
+        // Empty model that ModelLoader fills in
+        Model() = default;
   
-        void DrawNode(int index,glm::mat4 parentTransform, GraphicsPipeline& pipeline);
+        // modelMatrices are what the vertex shader transforms the instances with, the virtual texture feedback
+        // has to match them. parentTransform is relative to the model. Occlusion is only tested for single instances.
+        void DrawNode(int index, glm::mat4 parentTransform, const glm::mat4* modelMatrices, uint32_t instanceCount, GraphicsPipeline& pipeline, const OcclusionRasterizer* occlusion);
         struct Primitive
         {
+           // nullptr while the primitive is still streaming in, it is not drawn until then
            Mesh* mesh;
            Texture* texture;
            Texture* normalTexture;
            Texture* metalic_roughnessTexture;
+           // set instead of the textures above for materials cooked as virtual textures, once all three are in
+           VirtualTexture* virtualTextures[3] = {};
+           // culling and blending of the material
+           PipelineState state;
         };
         Primitive LoadPrimitive();
+        // Asks TextureStreaming for the levels the primitive's textures need from the current view
+        void RequestTextureMips(const Primitive& primitive, const glm::mat4& transform);
+
+        // Geometry and textures of one primitive before anything is on the GPU
+        struct PrimitiveSource
+        {
+            const Vertex* vertices;
+            size_t vertexCount;
+            const uint32_t* indices;
+            size_t indexCount;
+            TextureSource textures[3];
+            PipelineState state;
+        };
 
         struct Node
         {
@@ -114,10 +298,29 @@ namespace VulkanProject
            int mesh = -1;
         };
 
+        // Everything read from the file, no GPU resources yet
+        struct Source
+        {
+            std::vector<std::vector<PrimitiveSource>> meshes;
+            std::vector<Node> nodes;
+            std::vector<unsigned int> rootNodes;
+            // keeps the vertices, indices and embedded images alive: the imported ModelData or the mapped cooked model
+            std::shared_ptr<void> owner;
+        };
+        // Touches no GPU state, safe to call from worker threads
+        static Source ReadSource(const std::string& path);
+        static Source ReadImported(const std::string& path);
+        // Reads a model written by CookedModel::Write
+        static Source ReadCooked(const std::string& path);
+
+        // Decodes every texture in parallel, then creates all meshes and textures with one batched upload
+        void CreatePrimitives(const std::vector<std::vector<PrimitiveSource>>& meshes);
+
         std::vector<Node> m_Nodes;
         std::vector<unsigned int> m_RootNodes;
 
         std::vector<std::vector<Primitive>> m_Meshes;
+
+        bool m_BoxOccluders = false;
     };
 }
-
@@ -0,0 +1,326 @@
+#include "TextureProcessing.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+namespace
+{
+	const float* GetSRGBToLinearTable()
+	{
+		static float table[256];
+		static bool initialised = []()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				float c = i / 255.0f;
+				table[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			}
+			return true;
+		}();
+		(void)initialised;
+		return table;
+	}
+
+	unsigned char LinearToSRGB(float linear)
+	{
+		float c = linear <= 0.0031308f ? linear * 12.92f : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+		return static_cast<unsigned char>(std::clamp(c * 255.0f + 0.5f, 0.0f, 255.0f));
+	}
+
+	uint16_t To565(const int color[3])
+	{
+		return static_cast<uint16_t>(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+	}
+
+	void From565(uint16_t packed, int color[3])
+	{
+		int r = (packed >> 11) & 31;
+		int g = (packed >> 5) & 63;
+		int b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	// BC1 colour block, always in four colour mode so it is also valid inside a BC3 block
+	void EncodeColorBlock(const unsigned char block[16][4], unsigned char* out)
+	{
+		int minColor[3] = { 255, 255, 255 };
+		int maxColor[3] = { 0, 0, 0 };
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				minColor[c] = std::min(minColor[c], static_cast<int>(block[i][c]));
+				maxColor[c] = std::max(maxColor[c], static_cast<int>(block[i][c]));
+			}
+		}
+
+		// The bounding box diagonal runs from min to max on the widest channel, flip the others that correlate negatively with it
+		int axis = 0;
+		for (int c = 1; c < 3; c++)
+		{
+			if (maxColor[c] - minColor[c] > maxColor[axis] - minColor[axis])
+			{
+				axis = c;
+			}
+		}
+		int center[3];
+		for (int c = 0; c < 3; c++)
+		{
+			center[c] = (minColor[c] + maxColor[c]) / 2;
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			if (c == axis)
+			{
+				continue;
+			}
+			int covariance = 0;
+			for (int i = 0; i < 16; i++)
+			{
+				covariance += (block[i][axis] - center[axis]) * (block[i][c] - center[c]);
+			}
+			if (covariance < 0)
+			{
+				std::swap(minColor[c], maxColor[c]);
+			}
+		}
+
+		// Inset the endpoints a little, the extremes are usually outliers
+		for (int c = 0; c < 3; c++)
+		{
+			int inset = (maxColor[c] - minColor[c]) / 16;
+			maxColor[c] -= inset;
+			minColor[c] += inset;
+		}
+
+		uint16_t color0 = To565(maxColor);
+		uint16_t color1 = To565(minColor);
+		if (color0 < color1)
+		{
+			std::swap(color0, color1);
+		}
+
+		uint32_t indices = 0;
+		if (color0 != color1)
+		{
+			int palette[4][3];
+			From565(color0, palette[0]);
+			From565(color1, palette[1]);
+			for (int c = 0; c < 3; c++)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0;
+				int bestDistance = INT32_MAX;
+				for (int p = 0; p < 4; p++)
+				{
+					int distance = 0;
+					for (int c = 0; c < 3; c++)
+					{
+						int delta = block[i][c] - palette[p][c];
+						distance += delta * delta;
+					}
+					if (distance < bestDistance)
+					{
+						bestDistance = distance;
+						best = p;
+					}
+				}
+				indices |= static_cast<uint32_t>(best) << (i * 2);
+			}
+		}
+
+		out[0] = static_cast<unsigned char>(color0 & 0xFF);
+		out[1] = static_cast<unsigned char>(color0 >> 8);
+		out[2] = static_cast<unsigned char>(color1 & 0xFF);
+		out[3] = static_cast<unsigned char>(color1 >> 8);
+		memcpy(out + 4, &indices, sizeof(indices));
+	}
+
+	// BC3 alpha block in eight value mode, BC5 is two of these
+	void EncodeAlphaBlock(const unsigned char block[16][4], int channel, unsigned char* out)
+	{
+		int minAlpha = 255;
+		int maxAlpha = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			minAlpha = std::min(minAlpha, static_cast<int>(block[i][channel]));
+			maxAlpha = std::max(maxAlpha, static_cast<int>(block[i][channel]));
+		}
+
+		uint64_t indices = 0;
+		if (maxAlpha != minAlpha)
+		{
+			int palette[8];
+			palette[0] = maxAlpha;
+			palette[1] = minAlpha;
+			for (int p = 1; p < 7; p++)
+			{
+				palette[p + 1] = ((7 - p) * maxAlpha + p * minAlpha) / 7;
+			}
+
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0;
+				int bestDistance = INT32_MAX;
+				for (int p = 0; p < 8; p++)
+				{
+					int distance = std::abs(block[i][channel] - palette[p]);
+					if (distance < bestDistance)
+					{
+						bestDistance = distance;
+						best = p;
+					}
+				}
+				indices |= static_cast<uint64_t>(best) << (i * 3);
+			}
+		}
+
+		out[0] = static_cast<unsigned char>(maxAlpha);
+		out[1] = static_cast<unsigned char>(minAlpha);
+		for (int i = 0; i < 6; i++)
+		{
+			out[2 + i] = static_cast<unsigned char>(indices >> (i * 8));
+		}
+	}
+}
+
+std::vector<VulkanProject::CookedTexture::LevelData> VulkanProject::TextureProcessing::GenerateMips(const unsigned char* pixels, uint32_t width, uint32_t height, bool srgb)
+{
+	std::vector<CookedTexture::LevelData> levels;
+	levels.push_back({ width, height, std::vector<unsigned char>(pixels, pixels + static_cast<size_t>(width) * height * 4) });
+
+	const float* toLinear = GetSRGBToLinearTable();
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		const CookedTexture::LevelData& source = levels.back();
+		CookedTexture::LevelData level;
+		level.width = std::max(1u, source.width / 2);
+		level.height = std::max(1u, source.height / 2);
+		level.data.resize(static_cast<size_t>(level.width) * level.height * 4);
+
+		for (uint32_t y = 0; y < level.height; y++)
+		{
+			for (uint32_t x = 0; x < level.width; x++)
+			{
+				// 2x2 box, clamped at the edge for levels with an odd or unit size
+				const uint32_t x0 = std::min(x * 2, source.width - 1);
+				const uint32_t x1 = std::min(x * 2 + 1, source.width - 1);
+				const uint32_t y0 = std::min(y * 2, source.height - 1);
+				const uint32_t y1 = std::min(y * 2 + 1, source.height - 1);
+				const unsigned char* samples[4] =
+				{
+					&source.data[(static_cast<size_t>(y0) * source.width + x0) * 4],
+					&source.data[(static_cast<size_t>(y0) * source.width + x1) * 4],
+					&source.data[(static_cast<size_t>(y1) * source.width + x0) * 4],
+					&source.data[(static_cast<size_t>(y1) * source.width + x1) * 4]
+				};
+
+				unsigned char* out = &level.data[(static_cast<size_t>(y) * level.width + x) * 4];
+				for (int c = 0; c < 4; c++)
+				{
+					if (srgb && c < 3)
+					{
+						float sum = toLinear[samples[0][c]] + toLinear[samples[1][c]] + toLinear[samples[2][c]] + toLinear[samples[3][c]];
+						out[c] = LinearToSRGB(sum * 0.25f);
+					}
+					else
+					{
+						out[c] = static_cast<unsigned char>((samples[0][c] + samples[1][c] + samples[2][c] + samples[3][c] + 2) / 4);
+					}
+				}
+			}
+		}
+		levels.push_back(std::move(level));
+	}
+	return levels;
+}
+
+bool VulkanProject::TextureProcessing::HasAlpha(const CookedTexture::LevelData& level)
+{
+	for (size_t i = 3; i < level.data.size(); i += 4)
+	{
+		if (level.data[i] != 255)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void VulkanProject::TextureProcessing::NormalizeNormals(CookedTexture::LevelData& level)
+{
+	for (size_t i = 0; i + 3 < level.data.size(); i += 4)
+	{
+		float normal[3];
+		for (int c = 0; c < 3; c++)
+		{
+			normal[c] = level.data[i + c] / 255.0f * 2.0f - 1.0f;
+		}
+		float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length < 1e-4f)
+		{
+			continue;
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			level.data[i + c] = static_cast<unsigned char>(std::clamp((normal[c] / length * 0.5f + 0.5f) * 255.0f + 0.5f, 0.0f, 255.0f));
+		}
+	}
+}
+
+VulkanProject::CookedTexture::LevelData VulkanProject::TextureProcessing::Compress(const CookedTexture::LevelData& level, CookedTexture::eFormat format)
+{
+	if (format != CookedTexture::eFormat::BC1_SRGB && format != CookedTexture::eFormat::BC3_SRGB && format != CookedTexture::eFormat::BC5_UNORM)
+	{
+		throw std::runtime_error("texture format is not block compressed!");
+	}
+
+	const size_t blockSize = format == CookedTexture::eFormat::BC1_SRGB ? 8 : 16;
+	const size_t texelSize = format == CookedTexture::eFormat::BC5_UNORM ? 2 : 4;
+	const uint32_t blocksX = (level.width + 3) / 4;
+	const uint32_t blocksY = (level.height + 3) / 4;
+
+	CookedTexture::LevelData compressed;
+	compressed.width = level.width;
+	compressed.height = level.height;
+	compressed.data.resize(static_cast<size_t>(blocksX) * blocksY * blockSize);
+
+	unsigned char block[16][4] = {};
+	for (uint32_t by = 0; by < blocksY; by++)
+	{
+		for (uint32_t bx = 0; bx < blocksX; bx++)
+		{
+			// Blocks past the edge repeat the last row and column
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				uint32_t x = std::min(bx * 4 + i % 4, level.width - 1);
+				uint32_t y = std::min(by * 4 + i / 4, level.height - 1);
+				memcpy(block[i], &level.data[(static_cast<size_t>(y) * level.width + x) * texelSize], texelSize);
+			}
+
+			unsigned char* out = &compressed.data[(static_cast<size_t>(by) * blocksX + bx) * blockSize];
+			if (format == CookedTexture::eFormat::BC5_UNORM)
+			{
+				EncodeAlphaBlock(block, 0, out);
+				EncodeAlphaBlock(block, 1, out + 8);
+				continue;
+			}
+			if (format == CookedTexture::eFormat::BC3_SRGB)
+			{
+				EncodeAlphaBlock(block, 3, out);
+				out += 8;
+			}
+			EncodeColorBlock(block, out);
+		}
+	}
+	return compressed;
+}
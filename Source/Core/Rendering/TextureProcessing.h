@@ -0,0 +1,24 @@
+#pragma once
+#include "CookedTexture.h"
+#include <vector>
+#include <cstdint>
+
+namespace VulkanProject
+{
+    // Offline texture processing on RGBA8 images
+    namespace TextureProcessing
+    {
+        // Full chain down to 1x1 with a box filter, level 0 is a copy of pixels.
+        // sRGB images are filtered in linear space.
+        std::vector<CookedTexture::LevelData> GenerateMips(const unsigned char* pixels, uint32_t width, uint32_t height, bool srgb);
+
+        bool HasAlpha(const CookedTexture::LevelData& level);
+
+        // Box filtered normals come out shorter than unit length, rescales the xyz of an RGBA8 normal map level
+        void NormalizeNormals(CookedTexture::LevelData& level);
+
+        // Block compresses one level, format has to be BC1_SRGB or BC3_SRGB for an RGBA8 level
+        // and BC5_UNORM for an RG8 level
+        CookedTexture::LevelData Compress(const CookedTexture::LevelData& level, CookedTexture::eFormat format);
+    }
+}
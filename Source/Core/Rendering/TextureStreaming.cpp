@@ -0,0 +1,323 @@
+#include "TextureStreaming.h"
+#include "Texture.h"
+#include "UploadQueue.h"
+#include "Graphics.h"
+#include <unordered_map>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+	// Levels up to this size are always resident
+	const uint32_t c_TailSize = 64;
+	// Textures nobody asked for in this many frames only keep their tail when memory runs out
+	const uint64_t c_UnusedFrames = 120;
+
+	struct Entry
+	{
+		// finest level asked for, and when
+		uint32_t requestedMip = 0;
+		uint64_t requestFrame = 0;
+		// resident level once the change in flight (if any) is done
+		uint32_t plannedMip = 0;
+		bool pending = false;
+	};
+
+	struct Change
+	{
+		VulkanProject::Texture* texture;
+		VulkanProject::Texture::Levels levels;
+	};
+
+	struct Batch
+	{
+		std::unique_ptr<VulkanProject::UploadQueue> uploads;
+		std::vector<Change> changes;
+	};
+
+	struct Retired
+	{
+		VulkanProject::Texture::Levels levels;
+		uint64_t frame;
+	};
+
+	struct StreamingData
+	{
+		uint64_t memoryBudget = 0;
+		uint64_t uploadBudgetPerFrame = 0;
+		uint64_t plannedBytes = 0;
+		uint64_t frame = 0;
+
+		glm::vec3 cameraPosition = glm::vec3(0.0f);
+		// projected size in pixels of one unit at distance one
+		float pixelsPerUnit = 1.0f;
+
+		std::unordered_map<VulkanProject::Texture*, Entry> textures;
+		std::deque<Batch> inFlight;
+		// replaced levels, frames in flight may still sample them
+		std::deque<Retired> retired;
+	};
+
+	static StreamingData* data = nullptr;
+
+	void Retire(const VulkanProject::Texture::Levels& levels)
+	{
+		data->retired.push_back({ levels, data->frame });
+	}
+
+	void Commit(Batch& batch)
+	{
+		for (auto& change : batch.changes)
+		{
+			if (change.texture == nullptr)
+			{
+				// the texture was destroyed while its levels were uploading
+				Retire(change.levels);
+				continue;
+			}
+			Retire(change.texture->ReplaceLevels(change.levels));
+			data->textures[change.texture].pending = false;
+		}
+	}
+}
+
+void VulkanProject::TextureStreaming::Init(uint64_t memoryBudget, uint64_t uploadBudgetPerFrame)
+{
+	if (data)
+	{
+		throw std::runtime_error("texture streaming is already initialised!");
+	}
+	data = new StreamingData();
+	data->memoryBudget = memoryBudget;
+	data->uploadBudgetPerFrame = uploadBudgetPerFrame;
+}
+
+void VulkanProject::TextureStreaming::Shutdown()
+{
+	if (!data)
+	{
+		return;
+	}
+
+	for (auto& batch : data->inFlight)
+	{
+		batch.uploads->Flush();
+		Commit(batch);
+	}
+	data->inFlight.clear();
+
+	vkDeviceWaitIdle(Renderer::GetDevice());
+	for (auto& retired : data->retired)
+	{
+		Texture::DestroyLevels(retired.levels);
+	}
+
+	delete data;
+	data = nullptr;
+}
+
+bool VulkanProject::TextureStreaming::IsEnabled()
+{
+	return data != nullptr;
+}
+
+void VulkanProject::TextureStreaming::SetView(const glm::mat4& view, const glm::mat4& projection, float viewportHeight)
+{
+	data->cameraPosition = glm::vec3(glm::inverse(view)[3]);
+	data->pixelsPerUnit = std::abs(projection[1][1]) * viewportHeight * 0.5f;
+}
+
+uint32_t VulkanProject::TextureStreaming::GetRequiredMip(const Texture& texture, const glm::vec3& center, float radius)
+{
+	// Compares the texels across the texture with the pixels across the primitive's bounds on screen
+	float distance = std::max(glm::length(center - data->cameraPosition) - radius, 0.001f);
+	float pixels = 2.0f * radius * data->pixelsPerUnit / distance;
+	float texels = static_cast<float>(std::max(texture.GetWidth(), texture.GetHeight()));
+	if (pixels >= texels)
+	{
+		return 0;
+	}
+
+	uint32_t mip = static_cast<uint32_t>(std::floor(std::log2(texels / std::max(pixels, 1.0f))));
+	return std::min(mip, texture.GetMipCount() - 1);
+}
+
+void VulkanProject::TextureStreaming::Request(Texture* texture, uint32_t mip)
+{
+	auto it = data->textures.find(texture);
+	if (it == data->textures.end())
+	{
+		return;
+	}
+
+	Entry& entry = it->second;
+	if (entry.requestFrame != data->frame)
+	{
+		entry.requestFrame = data->frame;
+		entry.requestedMip = mip;
+	}
+	else
+	{
+		entry.requestedMip = std::min(entry.requestedMip, mip);
+	}
+}
+
+void VulkanProject::TextureStreaming::Update()
+{
+	while (!data->retired.empty() && data->retired.front().frame + MAX_FRAMES_IN_FLIGHT < data->frame)
+	{
+		Texture::DestroyLevels(data->retired.front().levels);
+		data->retired.pop_front();
+	}
+
+	// Levels whose upload is done replace the old ones, in submit order
+	while (!data->inFlight.empty() && data->inFlight.front().uploads->IsComplete())
+	{
+		Commit(data->inFlight.front());
+		data->inFlight.pop_front();
+	}
+
+	struct Candidate
+	{
+		Texture* texture;
+		Entry* entry;
+		uint32_t target;
+	};
+	std::vector<Candidate> grow;
+	std::vector<Candidate> shrink;
+	for (auto& texture : data->textures)
+	{
+		Entry& entry = texture.second;
+		if (entry.pending)
+		{
+			continue;
+		}
+
+		// The tail always stays, it is what the texture falls back to
+		uint32_t tail = GetTailMip(*texture.first);
+		bool used = data->frame - entry.requestFrame <= c_UnusedFrames;
+		uint32_t wanted = used ? std::min(entry.requestedMip, tail) : tail;
+		if (wanted < entry.plannedMip)
+		{
+			grow.push_back({ texture.first, &entry, wanted });
+		}
+		else if (wanted > entry.plannedMip)
+		{
+			shrink.push_back({ texture.first, &entry, wanted });
+		}
+	}
+
+	// The blurriest textures first, memory is taken from the ones that went unused the longest
+	std::sort(grow.begin(), grow.end(), [](const Candidate& a, const Candidate& b) { return a.entry->plannedMip - a.target > b.entry->plannedMip - b.target; });
+	std::sort(shrink.begin(), shrink.end(), [](const Candidate& a, const Candidate& b) { return a.entry->requestFrame < b.entry->requestFrame; });
+
+	Batch batch;
+	batch.uploads = std::make_unique<UploadQueue>();
+	auto change = [&](const Candidate& candidate)
+	{
+		data->plannedBytes += candidate.texture->GetLevelBytes(candidate.target);
+		data->plannedBytes -= candidate.texture->GetLevelBytes(candidate.entry->plannedMip);
+		candidate.entry->plannedMip = candidate.target;
+		candidate.entry->pending = true;
+		batch.changes.push_back({ candidate.texture, candidate.texture->CreateLevels(candidate.target, *batch.uploads) });
+	};
+
+	size_t nextShrink = 0;
+	for (Candidate& candidate : grow)
+	{
+		if (batch.uploads->GetStagedBytes() >= data->uploadBudgetPerFrame)
+		{
+			break;
+		}
+
+		auto fits = [&](uint32_t target)
+		{
+			return data->plannedBytes + candidate.texture->GetLevelBytes(target) - candidate.texture->GetLevelBytes(candidate.entry->plannedMip) <= data->memoryBudget;
+		};
+		while (!fits(candidate.target) && nextShrink < shrink.size())
+		{
+			change(shrink[nextShrink++]);
+		}
+		// Still too much, settle for a coarser level
+		while (candidate.target < candidate.entry->plannedMip && !fits(candidate.target))
+		{
+			candidate.target++;
+		}
+		if (candidate.target < candidate.entry->plannedMip)
+		{
+			change(candidate);
+		}
+	}
+
+	// Over budget without anything to load, e.g. after a lot of textures were created
+	while (data->plannedBytes > data->memoryBudget && nextShrink < shrink.size())
+	{
+		change(shrink[nextShrink++]);
+	}
+
+	if (!batch.changes.empty())
+	{
+		batch.uploads->Submit();
+		data->inFlight.push_back(std::move(batch));
+	}
+	data->frame++;
+}
+
+uint32_t VulkanProject::TextureStreaming::GetTailMip(const Texture& texture)
+{
+	uint32_t mip = 0;
+	while (mip + 1 < texture.GetMipCount() && (std::max(texture.GetWidth(), texture.GetHeight()) >> mip) > c_TailSize)
+	{
+		mip++;
+	}
+	return mip;
+}
+
+uint64_t VulkanProject::TextureStreaming::GetResidentBytes()
+{
+	return data ? data->plannedBytes : 0;
+}
+
+void VulkanProject::TextureStreaming::Register(Texture* texture)
+{
+	Entry entry;
+	entry.plannedMip = texture->GetFirstResidentMip();
+	entry.requestedMip = entry.plannedMip;
+	entry.requestFrame = data->frame;
+	data->textures[texture] = entry;
+	data->plannedBytes += texture->GetLevelBytes(entry.plannedMip);
+}
+
+void VulkanProject::TextureStreaming::Unregister(Texture* texture)
+{
+	if (!data)
+	{
+		return;
+	}
+
+	auto it = data->textures.find(texture);
+	if (it == data->textures.end())
+	{
+		return;
+	}
+
+	if (it->second.pending)
+	{
+		// Another texture may get the same address, the upload must not end up in it
+		for (auto& batch : data->inFlight)
+		{
+			for (auto& change : batch.changes)
+			{
+				if (change.texture == texture)
+				{
+					change.texture = nullptr;
+				}
+			}
+		}
+	}
+	data->plannedBytes -= texture->GetLevelBytes(it->second.plannedMip);
+	data->textures.erase(it);
+}
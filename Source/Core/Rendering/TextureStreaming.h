@@ -0,0 +1,41 @@
+#pragma once
+#include "Core/Includes.h"
+#include <cstdint>
+
+namespace VulkanProject
+{
+    class Texture;
+
+    // Keeps only the mip levels of textures on the GPU that the view actually needs.
+    // Textures with a mip chain start out with their tail levels, models request the level their
+    // primitives need while drawing and Update uploads the missing levels a few megabytes per frame.
+    // When the memory budget runs out, levels of textures that are no longer needed are dropped first.
+    namespace TextureStreaming
+    {
+        // Without Init every texture is created with its whole mip chain
+        void Init(uint64_t memoryBudget, uint64_t uploadBudgetPerFrame = 16ull * 1024 * 1024);
+        // Waits for the device, textures keep whatever levels they have
+        void Shutdown();
+        bool IsEnabled();
+
+        // Camera of the coming frame, set before the models are drawn
+        void SetView(const glm::mat4& view, const glm::mat4& projection, float viewportHeight);
+        // Finest level of texture worth having on a primitive with these world space bounds.
+        // Assumes the texture is spread over the bounds about once.
+        uint32_t GetRequiredMip(const Texture& texture, const glm::vec3& center, float radius);
+        // The finest request of a frame wins
+        void Request(Texture* texture, uint32_t mip);
+
+        // Once per frame on the render thread, before the frame is recorded
+        void Update();
+
+        // Level a streamed texture is created with
+        uint32_t GetTailMip(const Texture& texture);
+        // Streamed levels on the GPU, including changes that are still uploading
+        uint64_t GetResidentBytes();
+
+        // Called by Texture for textures that keep their source
+        void Register(Texture* texture);
+        void Unregister(Texture* texture);
+    }
+}
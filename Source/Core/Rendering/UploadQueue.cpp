@@ -0,0 +1,208 @@
+#include "UploadQueue.h"
+#include "Graphics.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	const VkDeviceSize c_StagingBlockSize = 64ull * 1024 * 1024;
+	// Flushes on its own past this, so a large batch does not hold on to unbounded staging memory
+	const VkDeviceSize c_MaxStagedBytes = 256ull * 1024 * 1024;
+	// Covers the 4 byte texel of RGBA8 and the 8/16 byte blocks of BC formats
+	const VkDeviceSize c_StagingAlignment = 16;
+
+	void RecordImageBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t mipLevels, VkImageLayout oldLayout, VkImageLayout newLayout,
+		VkAccessFlags srcAccess, VkAccessFlags dstAccess, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+
+		vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+}
+
+VulkanProject::UploadQueue::~UploadQueue()
+{
+	try
+	{
+		Flush();
+	}
+	catch (...)
+	{
+		ReleaseStaging();
+	}
+}
+
+void VulkanProject::UploadQueue::CopyToBuffer(const void* data, VkDeviceSize size, VkBuffer buffer, VkDeviceSize dstOffset)
+{
+	VkDeviceSize offset;
+	StagingBlock& block = Stage(data, size, offset);
+
+	VkBufferCopy copyRegion{};
+	copyRegion.srcOffset = offset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(GetCommandBuffer(), block.buffer, buffer, 1, &copyRegion);
+}
+
+void VulkanProject::UploadQueue::CopyToImage(const void* data, VkDeviceSize size, VkImage image, uint32_t mipLevels, const std::vector<VkBufferImageCopy>& regions)
+{
+	VkDeviceSize offset;
+	StagingBlock& block = Stage(data, size, offset);
+	VkCommandBuffer commandBuffer = GetCommandBuffer();
+
+	std::vector<VkBufferImageCopy> stagedRegions = regions;
+	for (auto& region : stagedRegions)
+	{
+		region.bufferOffset += offset;
+	}
+
+	RecordImageBarrier(commandBuffer, image, mipLevels, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	vkCmdCopyBufferToImage(commandBuffer, block.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(stagedRegions.size()), stagedRegions.data());
+	RecordImageBarrier(commandBuffer, image, mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+void VulkanProject::UploadQueue::UpdateImage(const void* data, VkDeviceSize size, VkImage image, uint32_t mipLevels, const std::vector<VkBufferImageCopy>& regions)
+{
+	VkDeviceSize offset;
+	StagingBlock& block = Stage(data, size, offset);
+	VkCommandBuffer commandBuffer = GetCommandBuffer();
+
+	std::vector<VkBufferImageCopy> stagedRegions = regions;
+	for (auto& region : stagedRegions)
+	{
+		region.bufferOffset += offset;
+	}
+
+	RecordImageBarrier(commandBuffer, image, mipLevels, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	vkCmdCopyBufferToImage(commandBuffer, block.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(stagedRegions.size()), stagedRegions.data());
+	RecordImageBarrier(commandBuffer, image, mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+void VulkanProject::UploadQueue::Flush()
+{
+	if (m_Fence != VK_NULL_HANDLE)
+	{
+		vkWaitForFences(Renderer::GetDevice(), 1, &m_Fence, VK_TRUE, UINT64_MAX);
+		IsComplete();
+		return;
+	}
+	if (m_CommandBuffer != VK_NULL_HANDLE)
+	{
+		VkCommandBuffer commandBuffer = m_CommandBuffer;
+		m_CommandBuffer = VK_NULL_HANDLE;
+		Renderer::EndSingleTimeCommands(commandBuffer);
+	}
+	ReleaseStaging();
+}
+
+void VulkanProject::UploadQueue::Submit()
+{
+	if (m_CommandBuffer != VK_NULL_HANDLE && m_Fence == VK_NULL_HANDLE)
+	{
+		m_Fence = Renderer::SubmitSingleTimeCommands(m_CommandBuffer);
+	}
+}
+
+bool VulkanProject::UploadQueue::IsComplete()
+{
+	if (m_Fence != VK_NULL_HANDLE)
+	{
+		if (vkGetFenceStatus(Renderer::GetDevice(), m_Fence) != VK_SUCCESS)
+		{
+			return false;
+		}
+		Renderer::FreeSingleTimeCommands(m_CommandBuffer, m_Fence);
+		m_Fence = VK_NULL_HANDLE;
+		m_CommandBuffer = VK_NULL_HANDLE;
+		ReleaseStaging();
+	}
+	return m_CommandBuffer == VK_NULL_HANDLE;
+}
+
+VulkanProject::UploadQueue::StagingBlock& VulkanProject::UploadQueue::Stage(const void* data, VkDeviceSize size, VkDeviceSize& offset)
+{
+	if (m_Fence != VK_NULL_HANDLE)
+	{
+		throw std::runtime_error("upload queue is still in flight!");
+	}
+	if (m_StagedBytes + size > c_MaxStagedBytes)
+	{
+		Flush();
+	}
+
+	StagingBlock* target = nullptr;
+	if (!m_Blocks.empty())
+	{
+		StagingBlock& last = m_Blocks.back();
+		VkDeviceSize aligned = (last.used + c_StagingAlignment - 1) & ~(c_StagingAlignment - 1);
+		if (aligned + size <= last.size)
+		{
+			last.used = aligned;
+			target = &last;
+		}
+	}
+
+	if (target == nullptr)
+	{
+		// Uploads larger than a block get a block of their own
+		StagingBlock block;
+		block.size = std::max(c_StagingBlockSize, size);
+		Renderer::CreateBuffer(block.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, block.buffer, block.memory);
+
+		void* mapped;
+		if (vkMapMemory(Renderer::GetDevice(), block.memory, 0, block.size, 0, &mapped) != VK_SUCCESS)
+		{
+			vkDestroyBuffer(Renderer::GetDevice(), block.buffer, nullptr);
+			vkFreeMemory(Renderer::GetDevice(), block.memory, nullptr);
+			throw std::runtime_error("failed to map staging memory!");
+		}
+		block.mapped = static_cast<unsigned char*>(mapped);
+		m_Blocks.push_back(block);
+		target = &m_Blocks.back();
+	}
+
+	offset = target->used;
+	memcpy(target->mapped + offset, data, static_cast<size_t>(size));
+	target->used += size;
+	m_StagedBytes += size;
+	return *target;
+}
+
+VkCommandBuffer VulkanProject::UploadQueue::GetCommandBuffer()
+{
+	if (m_CommandBuffer == VK_NULL_HANDLE)
+	{
+		m_CommandBuffer = Renderer::BeginSingleTimeCommands();
+	}
+	return m_CommandBuffer;
+}
+
+void VulkanProject::UploadQueue::ReleaseStaging()
+{
+	for (auto& block : m_Blocks)
+	{
+		vkUnmapMemory(Renderer::GetDevice(), block.memory);
+		vkDestroyBuffer(Renderer::GetDevice(), block.buffer, nullptr);
+		vkFreeMemory(Renderer::GetDevice(), block.memory, nullptr);
+	}
+	m_Blocks.clear();
+	m_StagedBytes = 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "Core/Includes.h"
+#include <vector>
+
+namespace VulkanProject
+{
+    // Collects buffer and image uploads into one command buffer, so loading many meshes and textures
+    // costs one submit and one wait instead of one (or three) per resource.
+    // Staging memory is suballocated from persistently mapped blocks and released after the submit.
+    class UploadQueue
+    {
+    public:
+        UploadQueue() = default;
+        // Pending uploads are flushed
+        ~UploadQueue();
+
+        UploadQueue(const UploadQueue&) = delete;
+        UploadQueue& operator=(const UploadQueue&) = delete;
+
+        // data is copied into staging memory right away, it does not have to outlive the call
+        void CopyToBuffer(const void* data, VkDeviceSize size, VkBuffer buffer, VkDeviceSize dstOffset = 0);
+        // Regions are relative to data, the image ends up in SHADER_READ_ONLY_OPTIMAL
+        void CopyToImage(const void* data, VkDeviceSize size, VkImage image, uint32_t mipLevels, const std::vector<VkBufferImageCopy>& regions);
+        // Same for an image that is already in SHADER_READ_ONLY_OPTIMAL, texels outside the regions are kept
+        void UpdateImage(const void* data, VkDeviceSize size, VkImage image, uint32_t mipLevels, const std::vector<VkBufferImageCopy>& regions);
+
+        // Submits everything recorded so far and waits until the GPU is done with it
+        void Flush();
+
+        // Submits without waiting, IsComplete releases the staging memory once the GPU is done.
+        // Nothing can be recorded until then.
+        void Submit();
+        bool IsComplete();
+
+        VkDeviceSize GetStagedBytes() const { return m_StagedBytes; }
+
+    private:
+        struct StagingBlock
+        {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            unsigned char* mapped = nullptr;
+            VkDeviceSize size = 0;
+            VkDeviceSize used = 0;
+        };
+
+        // Copies data into staging memory and returns the block and offset it went to
+        StagingBlock& Stage(const void* data, VkDeviceSize size, VkDeviceSize& offset);
+        VkCommandBuffer GetCommandBuffer();
+        void ReleaseStaging();
+
+        VkCommandBuffer m_CommandBuffer = VK_NULL_HANDLE;
+        // set between Submit and completion
+        VkFence m_Fence = VK_NULL_HANDLE;
+        std::vector<StagingBlock> m_Blocks;
+        VkDeviceSize m_StagedBytes = 0;
+    };
+}
@@ -0,0 +1,1070 @@
+#include "VirtualTexture.h"
+#include "Texture.h"
+#include "UploadQueue.h"
+#include "Graphics.h"
+#include "SamplerCache.h"
+#include "Core/MappedFile.h"
+#include "Core/ThreadPool.h"
+#include "ShaderCompiler.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+	using VulkanProject::VirtualTextureFile::c_PageSize;
+	using VulkanProject::VirtualTextureFile::c_PageBorder;
+	using VulkanProject::VirtualTextureFile::c_StoredPageSize;
+	using VulkanProject::VirtualTextureFile::c_PageBytes;
+
+	// Colour pages are read through an sRGB view of the cache, normal and roughness/metalness pages through a UNORM one
+	const VkFormat c_CacheFormat = VK_FORMAT_R8G8B8A8_SRGB;
+	const VkFormat c_LinearCacheFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	const VkFormat c_PageTableFormat = VK_FORMAT_R8G8B8A8_UINT;
+	const VkFormat c_FeedbackFormat = VK_FORMAT_R8G8B8A8_UINT;
+	const VkFormat c_FeedbackDepthFormat = VK_FORMAT_D16_UNORM;
+
+	const uint32_t c_MaxUploadsPerFrame = 16;
+	const uint32_t c_MaxLoadsInFlight = 64;
+	// Page and page table uploads of one frame
+	const VkDeviceSize c_StagingSize = 4ull * 1024 * 1024;
+	// Pages requested this recently are not evicted, the feedback lags behind by the frames in flight
+	const uint64_t c_KeepFrames = MAX_FRAMES_IN_FLIGHT + 2;
+	// Feedback pixels of this group asked for nothing
+	const uint32_t c_NoGroup = 255;
+
+	uint32_t MakeKey(uint32_t mip, uint32_t x, uint32_t y)
+	{
+		return (mip << 24) | (y << 12) | x;
+	}
+
+	struct Slot
+	{
+		// 0 while the slot is free
+		uint32_t texture = 0;
+		uint32_t key = 0;
+		uint64_t lastUsed = 0;
+		// the coarsest page of a texture never leaves
+		bool pinned = false;
+	};
+
+	struct Record
+	{
+		VulkanProject::VirtualTexture* texture = nullptr;
+		// page key to cache slot
+		std::unordered_map<uint32_t, uint32_t> resident;
+		std::unordered_set<uint32_t> loading;
+		bool dirty = false;
+	};
+
+	struct LoadedPage
+	{
+		uint32_t texture;
+		uint32_t key;
+		std::vector<unsigned char> pixels;
+	};
+
+	// Shared with the load jobs, they can still be running after Shutdown
+	struct Loads
+	{
+		std::mutex mutex;
+		std::vector<LoadedPage> ready;
+		uint32_t inFlight = 0;
+	};
+
+	// Textures drawn with the same uvs, the feedback only renders the first one
+	using Group = std::array<uint32_t, 3>;
+
+	struct FeedbackDraw
+	{
+		VulkanProject::Mesh* mesh;
+		glm::mat4 model;
+		uint32_t group;
+	};
+
+	struct FeedbackConstants
+	{
+		glm::mat4 mvp;
+		// width, height and mip count of the texture
+		glm::vec4 info;
+		// page size, lod bias, group
+		glm::vec4 params;
+	};
+
+	struct FrameResources
+	{
+		VkBuffer readback = VK_NULL_HANDLE;
+		VkDeviceMemory readbackMemory = VK_NULL_HANDLE;
+		const uint32_t* readbackMapped = nullptr;
+		// the readback holds feedback of the groups below once the frame's fence signalled
+		bool hasFeedback = false;
+		std::vector<Group> groups;
+
+		VkBuffer staging = VK_NULL_HANDLE;
+		VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+		unsigned char* stagingMapped = nullptr;
+	};
+
+	struct VirtualTexturingData
+	{
+		uint32_t slotsPerSide = 0;
+		VkImage cache = VK_NULL_HANDLE;
+		VkDeviceMemory cacheMemory = VK_NULL_HANDLE;
+		VkImageView cacheView = VK_NULL_HANDLE;
+		VkImageView linearCacheView = VK_NULL_HANDLE;
+
+		VkImage emptyPageTable = VK_NULL_HANDLE;
+		VkDeviceMemory emptyPageTableMemory = VK_NULL_HANDLE;
+		VkImageView emptyPageTableView = VK_NULL_HANDLE;
+
+		std::vector<Slot> slots;
+		std::vector<uint32_t> freeSlots;
+		std::unordered_map<uint32_t, Record> textures;
+		uint32_t nextID = 1;
+		uint64_t frame = 0;
+
+		std::shared_ptr<Loads> loads = std::make_shared<Loads>();
+		// loaded pages waiting for a slot or for room in the frame's staging
+		std::vector<LoadedPage> loaded;
+
+		// feedback pass
+		uint32_t feedbackDivisor = 8;
+		VkRenderPass feedbackPass = VK_NULL_HANDLE;
+		VkPipelineLayout feedbackLayout = VK_NULL_HANDLE;
+		VkPipeline feedbackPipeline = VK_NULL_HANDLE;
+		// swap chain extent the target was created for
+		VkExtent2D extent = { 0, 0 };
+		VkExtent2D feedbackExtent = { 0, 0 };
+		VkImage feedbackImage = VK_NULL_HANDLE;
+		VkDeviceMemory feedbackMemory = VK_NULL_HANDLE;
+		VkImageView feedbackView = VK_NULL_HANDLE;
+		VkImage feedbackDepth = VK_NULL_HANDLE;
+		VkDeviceMemory feedbackDepthMemory = VK_NULL_HANDLE;
+		VkImageView feedbackDepthView = VK_NULL_HANDLE;
+		VkFramebuffer feedbackFramebuffer = VK_NULL_HANDLE;
+
+		FrameResources frames[MAX_FRAMES_IN_FLIGHT];
+		glm::mat4 viewProjection = glm::mat4(1.0f);
+		std::vector<Group> groups;
+		std::vector<FeedbackDraw> draws;
+	};
+
+	static VirtualTexturingData* data = nullptr;
+
+	VkBufferImageCopy GetSlotRegion(uint32_t slot, VkDeviceSize bufferOffset)
+	{
+		VkBufferImageCopy region{};
+		region.bufferOffset = bufferOffset;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { static_cast<int32_t>(slot % data->slotsPerSide * c_StoredPageSize), static_cast<int32_t>(slot / data->slotsPerSide * c_StoredPageSize), 0 };
+		region.imageExtent = { c_StoredPageSize, c_StoredPageSize, 1 };
+		return region;
+	}
+
+	void RecordImageBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t mipLevels, VkImageLayout oldLayout, VkImageLayout newLayout,
+		VkAccessFlags srcAccess, VkAccessFlags dstAccess, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.levelCount = mipLevels;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+
+		vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	// Copies into an image that fragment shaders sample, keeping what is already in it
+	void RecordImageUpdate(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, uint32_t mipLevels, const std::vector<VkBufferImageCopy>& regions)
+	{
+		RecordImageBarrier(commandBuffer, image, mipLevels, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+		vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+		RecordImageBarrier(commandBuffer, image, mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+
+	// Every page and level gets the slot of its own page if it is resident, otherwise whatever its parent got.
+	// The coarsest page is always resident so every entry ends up valid.
+	std::vector<uint32_t> BuildPageTable(const Record& record, std::vector<VkBufferImageCopy>& regions)
+	{
+		const VulkanProject::VirtualTextureFile::View& file = record.texture->GetFile();
+		std::vector<uint32_t> entries(file.header.pageCount, 0);
+		regions.resize(file.header.mipCount);
+		for (uint32_t mip = file.header.mipCount; mip-- > 0;)
+		{
+			const auto& level = file.levels[mip];
+			for (uint32_t y = 0; y < level.pagesY; y++)
+			{
+				for (uint32_t x = 0; x < level.pagesX; x++)
+				{
+					uint32_t& entry = entries[level.firstPage + y * level.pagesX + x];
+					auto it = record.resident.find(MakeKey(mip, x, y));
+					if (it != record.resident.end())
+					{
+						uint32_t slot = it->second;
+						entry = (slot % data->slotsPerSide) | ((slot / data->slotsPerSide) << 8) | (mip << 16) | (1u << 24);
+					}
+					else if (mip + 1 < file.header.mipCount)
+					{
+						const auto& parent = file.levels[mip + 1];
+						entry = entries[parent.firstPage + std::min(y / 2, parent.pagesY - 1) * parent.pagesX + std::min(x / 2, parent.pagesX - 1)];
+					}
+				}
+			}
+
+			VkBufferImageCopy& region = regions[mip];
+			region = VkBufferImageCopy{};
+			region.bufferOffset = static_cast<VkDeviceSize>(level.firstPage) * sizeof(uint32_t);
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = mip;
+			region.imageSubresource.layerCount = 1;
+			region.imageExtent = { level.pagesX, level.pagesY, 1 };
+		}
+		return entries;
+	}
+
+	// A free slot, or the least recently used page that was not asked for lately. UINT32_MAX when the cache is full.
+	uint32_t AllocateSlot()
+	{
+		if (!data->freeSlots.empty())
+		{
+			uint32_t slot = data->freeSlots.back();
+			data->freeSlots.pop_back();
+			return slot;
+		}
+
+		uint32_t oldest = UINT32_MAX;
+		for (uint32_t i = 0; i < data->slots.size(); i++)
+		{
+			const Slot& slot = data->slots[i];
+			if (!slot.pinned && slot.lastUsed + c_KeepFrames < data->frame && (oldest == UINT32_MAX || slot.lastUsed < data->slots[oldest].lastUsed))
+			{
+				oldest = i;
+			}
+		}
+		if (oldest == UINT32_MAX)
+		{
+			return UINT32_MAX;
+		}
+
+		Slot& slot = data->slots[oldest];
+		auto owner = data->textures.find(slot.texture);
+		if (owner != data->textures.end())
+		{
+			owner->second.resident.erase(slot.key);
+			owner->second.dirty = true;
+		}
+		slot = Slot();
+		return oldest;
+	}
+
+	void FreeSlot(uint32_t slot)
+	{
+		data->slots[slot] = Slot();
+		data->freeSlots.push_back(slot);
+	}
+
+	struct PageRequest
+	{
+		uint32_t texture;
+		uint32_t mip;
+		uint32_t x;
+		uint32_t y;
+	};
+
+	void StartLoad(Record& record, const PageRequest& request)
+	{
+		uint32_t key = MakeKey(request.mip, request.x, request.y);
+		record.loading.insert(key);
+		{
+			std::lock_guard<std::mutex> lock(data->loads->mutex);
+			data->loads->inFlight++;
+		}
+
+		// Reading the page faults it in from disk, that happens on the pool and not on the render thread
+		std::shared_ptr<Loads> loads = data->loads;
+		std::shared_ptr<VulkanProject::MappedFile> file = record.texture->GetMapping();
+		const unsigned char* pixels = record.texture->GetFile().GetPage(request.mip, request.x, request.y);
+		VulkanProject::ThreadPool::GetShared().Submit([loads, file, pixels, texture = request.texture, key]()
+		{
+			LoadedPage page{ texture, key, std::vector<unsigned char>(pixels, pixels + c_PageBytes) };
+			std::lock_guard<std::mutex> lock(loads->mutex);
+			loads->ready.push_back(std::move(page));
+			loads->inFlight--;
+		});
+	}
+
+	// Reads the feedback the GPU wrote for this frame slot's previous frame
+	void ProcessFeedback(FrameResources& frame)
+	{
+		std::unordered_set<uint64_t> unique;
+		size_t pixelCount = static_cast<size_t>(data->feedbackExtent.width) * data->feedbackExtent.height;
+		for (size_t i = 0; i < pixelCount; i++)
+		{
+			uint32_t pixel = frame.readbackMapped[i];
+			if ((pixel >> 24) < frame.groups.size())
+			{
+				unique.insert(pixel);
+			}
+		}
+
+		// Every texture of the group needs the page under the same uvs, and so do the coarser levels it falls back to
+		std::unordered_set<uint64_t> touched;
+		std::vector<PageRequest> missing;
+		for (uint64_t pixel : unique)
+		{
+			const Group& group = frame.groups[pixel >> 24];
+			auto first = data->textures.find(group[0]);
+			if (first == data->textures.end())
+			{
+				continue;
+			}
+			const VulkanProject::VirtualTexture& drawn = *first->second.texture;
+			uint32_t mip = (pixel >> 16) & 0xFF;
+			float scale = static_cast<float>(c_PageSize) * std::exp2(static_cast<float>(mip));
+			float u = ((pixel & 0xFF) + 0.5f) * scale / drawn.GetWidth();
+			float v = (((pixel >> 8) & 0xFF) + 0.5f) * scale / drawn.GetHeight();
+
+			for (uint32_t id : group)
+			{
+				auto it = data->textures.find(id);
+				if (it == data->textures.end())
+				{
+					continue;
+				}
+				Record& record = it->second;
+				const VulkanProject::VirtualTextureFile::View& file = record.texture->GetFile();
+				int bias = static_cast<int>(std::lround(std::log2(static_cast<float>(record.texture->GetWidth()) / drawn.GetWidth())));
+				uint32_t finest = static_cast<uint32_t>(std::clamp(static_cast<int>(mip) + bias, 0, static_cast<int>(file.header.mipCount) - 1));
+				for (uint32_t level = finest; level < file.header.mipCount; level++)
+				{
+					float pageTexels = static_cast<float>(c_PageSize) * std::exp2(static_cast<float>(level));
+					uint32_t x = std::min(static_cast<uint32_t>(std::min(u, 0.9999f) * record.texture->GetWidth() / pageTexels), file.levels[level].pagesX - 1);
+					uint32_t y = std::min(static_cast<uint32_t>(std::min(v, 0.9999f) * record.texture->GetHeight() / pageTexels), file.levels[level].pagesY - 1);
+					uint32_t key = MakeKey(level, x, y);
+					if (!touched.insert((static_cast<uint64_t>(id) << 32) | key).second)
+					{
+						break;
+					}
+
+					auto resident = record.resident.find(key);
+					if (resident != record.resident.end())
+					{
+						data->slots[resident->second].lastUsed = data->frame;
+					}
+					else if (record.loading.count(key) == 0)
+					{
+						missing.push_back({ id, level, x, y });
+					}
+				}
+			}
+		}
+
+		// Coarse pages first, they cover the most screen and everything finer falls back to them
+		std::sort(missing.begin(), missing.end(), [](const PageRequest& a, const PageRequest& b) { return a.mip > b.mip; });
+		uint32_t inFlight;
+		{
+			std::lock_guard<std::mutex> lock(data->loads->mutex);
+			inFlight = data->loads->inFlight;
+		}
+		for (const PageRequest& request : missing)
+		{
+			if (inFlight + data->loaded.size() >= c_MaxLoadsInFlight)
+			{
+				break;
+			}
+			StartLoad(data->textures[request.texture], request);
+			inFlight++;
+		}
+	}
+
+	void RecordUploads(VkCommandBuffer commandBuffer, FrameResources& frame)
+	{
+		{
+			std::lock_guard<std::mutex> lock(data->loads->mutex);
+			for (auto& page : data->loads->ready)
+			{
+				data->loaded.push_back(std::move(page));
+			}
+			data->loads->ready.clear();
+		}
+
+		VkDeviceSize staged = 0;
+		std::vector<VkBufferImageCopy> regions;
+		size_t used = 0;
+		for (; used < data->loaded.size() && regions.size() < c_MaxUploadsPerFrame; used++)
+		{
+			LoadedPage& page = data->loaded[used];
+			auto it = data->textures.find(page.texture);
+			if (it == data->textures.end())
+			{
+				continue;
+			}
+
+			uint32_t slot = AllocateSlot();
+			if (slot == UINT32_MAX)
+			{
+				// Everything in the cache is still in use, the page is dropped and asked for again later
+				it->second.loading.erase(page.key);
+				continue;
+			}
+			memcpy(frame.stagingMapped + staged, page.pixels.data(), c_PageBytes);
+			regions.push_back(GetSlotRegion(slot, staged));
+			staged += c_PageBytes;
+
+			data->slots[slot].texture = page.texture;
+			data->slots[slot].key = page.key;
+			data->slots[slot].lastUsed = data->frame;
+			it->second.resident[page.key] = slot;
+			it->second.loading.erase(page.key);
+			it->second.dirty = true;
+		}
+		data->loaded.erase(data->loaded.begin(), data->loaded.begin() + used);
+
+		if (!regions.empty())
+		{
+			RecordImageUpdate(commandBuffer, frame.staging, data->cache, 1, regions);
+		}
+
+		// Page tables of textures that gained or lost pages, the rest of the staging space is plenty for those
+		for (auto& texture : data->textures)
+		{
+			Record& record = texture.second;
+			if (!record.dirty)
+			{
+				continue;
+			}
+
+			std::vector<VkBufferImageCopy> tableRegions;
+			std::vector<uint32_t> entries = BuildPageTable(record, tableRegions);
+			VkDeviceSize size = entries.size() * sizeof(uint32_t);
+			if (staged + size > c_StagingSize)
+			{
+				break;
+			}
+			memcpy(frame.stagingMapped + staged, entries.data(), static_cast<size_t>(size));
+			for (auto& region : tableRegions)
+			{
+				region.bufferOffset += staged;
+			}
+			staged += size;
+
+			RecordImageUpdate(commandBuffer, frame.staging, record.texture->GetPageTable(), record.texture->GetMipCount(), tableRegions);
+			record.dirty = false;
+		}
+	}
+
+	void DestroyFeedbackTarget()
+	{
+		VkDevice device = VulkanProject::Renderer::GetDevice();
+		vkDestroyFramebuffer(device, data->feedbackFramebuffer, nullptr);
+		vkDestroyImageView(device, data->feedbackView, nullptr);
+		vkDestroyImage(device, data->feedbackImage, nullptr);
+		vkFreeMemory(device, data->feedbackMemory, nullptr);
+		vkDestroyImageView(device, data->feedbackDepthView, nullptr);
+		vkDestroyImage(device, data->feedbackDepth, nullptr);
+		vkFreeMemory(device, data->feedbackDepthMemory, nullptr);
+		data->feedbackFramebuffer = VK_NULL_HANDLE;
+
+		for (auto& frame : data->frames)
+		{
+			vkUnmapMemory(device, frame.readbackMemory);
+			vkDestroyBuffer(device, frame.readback, nullptr);
+			vkFreeMemory(device, frame.readbackMemory, nullptr);
+			frame.readbackMapped = nullptr;
+			frame.hasFeedback = false;
+		}
+	}
+
+	// The target follows the swap chain size, the readbacks of the old size are thrown away
+	void UpdateFeedbackTarget()
+	{
+		VkExtent2D extent = VulkanProject::Renderer::GetSwapChainExtent();
+		if (data->feedbackFramebuffer != VK_NULL_HANDLE && extent.width == data->extent.width && extent.height == data->extent.height)
+		{
+			return;
+		}
+		if (data->feedbackFramebuffer != VK_NULL_HANDLE)
+		{
+			vkDeviceWaitIdle(VulkanProject::Renderer::GetDevice());
+			DestroyFeedbackTarget();
+		}
+
+		data->extent = extent;
+		data->feedbackExtent = { std::max(extent.width / data->feedbackDivisor, 1u), std::max(extent.height / data->feedbackDivisor, 1u) };
+
+		VulkanProject::Renderer::CreateImage(data->feedbackExtent.width, data->feedbackExtent.height, c_FeedbackFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, data->feedbackImage, data->feedbackMemory);
+		data->feedbackView = VulkanProject::Renderer::CreateImageView(data->feedbackImage, c_FeedbackFormat);
+		VulkanProject::Renderer::CreateImage(data->feedbackExtent.width, data->feedbackExtent.height, c_FeedbackDepthFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, data->feedbackDepth, data->feedbackDepthMemory);
+		data->feedbackDepthView = VulkanProject::Renderer::CreateImageView(data->feedbackDepth, c_FeedbackDepthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+		std::array<VkImageView, 2> attachments = { data->feedbackView, data->feedbackDepthView };
+		VkFramebufferCreateInfo framebufferInfo{};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferInfo.renderPass = data->feedbackPass;
+		framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		framebufferInfo.pAttachments = attachments.data();
+		framebufferInfo.width = data->feedbackExtent.width;
+		framebufferInfo.height = data->feedbackExtent.height;
+		framebufferInfo.layers = 1;
+		if (vkCreateFramebuffer(VulkanProject::Renderer::GetDevice(), &framebufferInfo, nullptr, &data->feedbackFramebuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create feedback framebuffer!");
+		}
+
+		VkDeviceSize readbackSize = static_cast<VkDeviceSize>(data->feedbackExtent.width) * data->feedbackExtent.height * sizeof(uint32_t);
+		for (auto& frame : data->frames)
+		{
+			VulkanProject::Renderer::CreateBuffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				frame.readback, frame.readbackMemory);
+			void* mapped;
+			if (vkMapMemory(VulkanProject::Renderer::GetDevice(), frame.readbackMemory, 0, readbackSize, 0, &mapped) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to map feedback readback memory!");
+			}
+			frame.readbackMapped = static_cast<const uint32_t*>(mapped);
+		}
+	}
+
+	void RecordFeedback(VkCommandBuffer commandBuffer, FrameResources& frame)
+	{
+		frame.hasFeedback = !data->draws.empty();
+		if (!frame.hasFeedback)
+		{
+			return;
+		}
+
+		std::array<VkClearValue, 2> clearValues{};
+		clearValues[0].color.uint32[3] = c_NoGroup;
+		clearValues[1].depthStencil = { 1.0f, 0 };
+
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = data->feedbackPass;
+		renderPassInfo.framebuffer = data->feedbackFramebuffer;
+		renderPassInfo.renderArea.extent = data->feedbackExtent;
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, data->feedbackPipeline);
+
+		VkViewport viewport{};
+		viewport.width = static_cast<float>(data->feedbackExtent.width);
+		viewport.height = static_cast<float>(data->feedbackExtent.height);
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		VkRect2D scissor{};
+		scissor.extent = data->feedbackExtent;
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		// Derivatives are feedbackDivisor times larger at this resolution
+		float lodBias = -std::log2(static_cast<float>(data->feedbackDivisor));
+		for (const FeedbackDraw& draw : data->draws)
+		{
+			auto it = data->textures.find(frame.groups[draw.group][0]);
+			if (it == data->textures.end())
+			{
+				continue;
+			}
+			const VulkanProject::VirtualTexture& texture = *it->second.texture;
+			FeedbackConstants constants;
+			constants.mvp = data->viewProjection * draw.model;
+			constants.info = glm::vec4(texture.GetWidth(), texture.GetHeight(), texture.GetMipCount(), 0.0f);
+			constants.params = glm::vec4(c_PageSize, lodBias, draw.group, 0.0f);
+			vkCmdPushConstants(commandBuffer, data->feedbackLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+			draw.mesh->Draw(draw.model);
+		}
+		vkCmdEndRenderPass(commandBuffer);
+
+		// Read on the CPU once the frame's fence has signalled
+		VkBufferImageCopy region{};
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = { data->feedbackExtent.width, data->feedbackExtent.height, 1 };
+		vkCmdCopyImageToBuffer(commandBuffer, data->feedbackImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, frame.readback, 1, &region);
+
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = frame.readback;
+		barrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	}
+
+	// Runs after the main render pass, the frame slot's previous readback is done since BeginFrame waited for its fence
+	void RecordFrame(VkCommandBuffer commandBuffer)
+	{
+		FrameResources& frame = data->frames[VulkanProject::Renderer::GetCurrentFrame()];
+		UpdateFeedbackTarget();
+		if (frame.hasFeedback)
+		{
+			ProcessFeedback(frame);
+		}
+		frame.groups = std::move(data->groups);
+		data->groups.clear();
+
+		RecordUploads(commandBuffer, frame);
+		RecordFeedback(commandBuffer, frame);
+
+		data->draws.clear();
+		data->frame++;
+	}
+
+	VkShaderModule CreateShaderModule(const std::vector<unsigned char>& code)
+	{
+		VkShaderModuleCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = code.size();
+		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+		VkShaderModule shaderModule;
+		if (vkCreateShaderModule(VulkanProject::Renderer::GetDevice(), &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create shader module!");
+		}
+		return shaderModule;
+	}
+
+	void CreateFeedbackPipeline()
+	{
+		VkDevice device = VulkanProject::Renderer::GetDevice();
+
+		// Render pass, the color target is copied out right after
+		{
+			VkAttachmentDescription colorAttachment{};
+			colorAttachment.format = c_FeedbackFormat;
+			colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+			colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+			VkAttachmentDescription depthAttachment{};
+			depthAttachment.format = c_FeedbackDepthFormat;
+			depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+			depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+			VkAttachmentReference colorAttachmentRef{ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+			VkAttachmentReference depthAttachmentRef{ 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+			VkSubpassDescription subpass{};
+			subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+			subpass.colorAttachmentCount = 1;
+			subpass.pColorAttachments = &colorAttachmentRef;
+			subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+			// The target is shared by the frames in flight: the previous frame's copy and depth writes come first
+			std::array<VkSubpassDependency, 2> dependencies{};
+			dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+			dependencies[0].dstSubpass = 0;
+			dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+			dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			dependencies[1].srcSubpass = 0;
+			dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+			dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+			dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+			std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
+			VkRenderPassCreateInfo renderPassInfo{};
+			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+			renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+			renderPassInfo.pAttachments = attachments.data();
+			renderPassInfo.subpassCount = 1;
+			renderPassInfo.pSubpasses = &subpass;
+			renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+			renderPassInfo.pDependencies = dependencies.data();
+
+			if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &data->feedbackPass) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create feedback render pass!");
+			}
+		}
+
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+		pushConstantRange.size = sizeof(FeedbackConstants);
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &data->feedbackLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create feedback pipeline layout!");
+		}
+
+		VkShaderModule vertShaderModule = CreateShaderModule(VulkanProject::ShaderCompiler::Compile("Resources/Shaders/feedback.vert", VK_SHADER_STAGE_VERTEX_BIT).code);
+		VkShaderModule fragShaderModule = CreateShaderModule(VulkanProject::ShaderCompiler::Compile("Resources/Shaders/feedback.frag", VK_SHADER_STAGE_FRAGMENT_BIT).code);
+
+		VkPipelineShaderStageCreateInfo shaderStages[2]{};
+		shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		shaderStages[0].module = vertShaderModule;
+		shaderStages[0].pName = "main";
+		shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		shaderStages[1].module = fragShaderModule;
+		shaderStages[1].pName = "main";
+
+		// Only the position and the uvs
+		auto bindingDescription = VulkanProject::Vertex::getBindingDescription();
+		auto allAttributes = VulkanProject::Vertex::getAttributeDescriptions();
+		std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions = { allAttributes[0], allAttributes[2] };
+
+		VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		vertexInputInfo.vertexBindingDescriptionCount = 1;
+		vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+		vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+		VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+		inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+		VkPipelineViewportStateCreateInfo viewportState{};
+		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportState.viewportCount = 1;
+		viewportState.scissorCount = 1;
+
+		// Same culling as the main pipeline so the feedback sees the same surfaces
+		VkPipelineRasterizationStateCreateInfo rasterizer{};
+		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterizer.lineWidth = 1.0f;
+		rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+		rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+		VkPipelineMultisampleStateCreateInfo multisampling{};
+		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+		VkPipelineDepthStencilStateCreateInfo depthStencil{};
+		depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depthStencil.depthTestEnable = VK_TRUE;
+		depthStencil.depthWriteEnable = VK_TRUE;
+		depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+		VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+		VkPipelineColorBlendStateCreateInfo colorBlending{};
+		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		colorBlending.attachmentCount = 1;
+		colorBlending.pAttachments = &colorBlendAttachment;
+
+		std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		VkPipelineDynamicStateCreateInfo dynamicState{};
+		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+		dynamicState.pDynamicStates = dynamicStates.data();
+
+		VkGraphicsPipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.stageCount = 2;
+		pipelineInfo.pStages = shaderStages;
+		pipelineInfo.pVertexInputState = &vertexInputInfo;
+		pipelineInfo.pInputAssemblyState = &inputAssembly;
+		pipelineInfo.pViewportState = &viewportState;
+		pipelineInfo.pRasterizationState = &rasterizer;
+		pipelineInfo.pMultisampleState = &multisampling;
+		pipelineInfo.pDepthStencilState = &depthStencil;
+		pipelineInfo.pColorBlendState = &colorBlending;
+		pipelineInfo.pDynamicState = &dynamicState;
+		pipelineInfo.layout = data->feedbackLayout;
+		pipelineInfo.renderPass = data->feedbackPass;
+		pipelineInfo.subpass = 0;
+
+		VkResult result = vkCreateGraphicsPipelines(device, VulkanProject::Renderer::GetPipelineCache(), 1, &pipelineInfo, nullptr, &data->feedbackPipeline);
+		vkDestroyShaderModule(device, fragShaderModule, nullptr);
+		vkDestroyShaderModule(device, vertShaderModule, nullptr);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create feedback pipeline!");
+		}
+	}
+
+	// Pages carry their own border, filtering never leaves the slot. Levels are pages of their own, the cache has none.
+	VulkanProject::SamplerState GetCacheSamplerState()
+	{
+		VulkanProject::SamplerState state;
+		state.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		state.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		state.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		state.anisotropyEnable = VK_FALSE;
+		state.maxLod = 0.0f;
+		return state;
+	}
+
+	// Integer page tables are only ever fetched
+	VulkanProject::SamplerState GetPageTableSamplerState()
+	{
+		VulkanProject::SamplerState state = GetCacheSamplerState();
+		state.magFilter = VK_FILTER_NEAREST;
+		state.minFilter = VK_FILTER_NEAREST;
+		state.maxLod = VK_LOD_CLAMP_NONE;
+		return state;
+	}
+}
+
+VulkanProject::VirtualTexture::VirtualTexture(const std::string& path, UploadQueue& uploads)
+{
+	if (!VirtualTexturing::IsEnabled())
+	{
+		throw std::runtime_error("virtual texturing is not initialised!");
+	}
+
+	m_File = std::make_shared<MappedFile>(path);
+	m_View = VirtualTextureFile::Parse(m_File->GetData(), m_File->GetSize());
+
+	const VirtualTextureFile::Level& level = m_View.levels[0];
+	Renderer::CreateImage(level.pagesX, level.pagesY, c_PageTableFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_PageTable, m_PageTableMemory, m_View.header.mipCount);
+	m_PageTableView = Renderer::CreateImageView(m_PageTable, c_PageTableFormat, VK_IMAGE_ASPECT_COLOR_BIT, m_View.header.mipCount);
+
+	m_ID = VirtualTexturing::Register(this, uploads);
+}
+
+VulkanProject::VirtualTexture::~VirtualTexture()
+{
+	VirtualTexturing::Unregister(this);
+
+	vkDestroyImageView(Renderer::GetDevice(), m_PageTableView, nullptr);
+	vkDestroyImage(Renderer::GetDevice(), m_PageTable, nullptr);
+	vkFreeMemory(Renderer::GetDevice(), m_PageTableMemory, nullptr);
+}
+
+void VulkanProject::VirtualTexturing::Init(uint32_t cachePages, uint32_t feedbackDivisor)
+{
+	if (data)
+	{
+		throw std::runtime_error("virtual texturing is already initialised!");
+	}
+	data = new VirtualTexturingData();
+	data->feedbackDivisor = std::max(feedbackDivisor, 1u);
+
+	VkPhysicalDeviceProperties properties{};
+	vkGetPhysicalDeviceProperties(Renderer::GetPhysicalDevice(), &properties);
+	// Slot coordinates are stored in 8 bits of the page table
+	data->slotsPerSide = std::min({ std::max(cachePages, 1u), properties.limits.maxImageDimension2D / c_StoredPageSize, 256u });
+
+	uint32_t cacheSize = data->slotsPerSide * c_StoredPageSize;
+	Renderer::CreateImage(cacheSize, cacheSize, c_CacheFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, data->cache, data->cacheMemory, 1, VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT);
+	data->cacheView = Renderer::CreateImageView(data->cache, c_CacheFormat);
+	data->linearCacheView = Renderer::CreateImageView(data->cache, c_LinearCacheFormat);
+	Renderer::CreateImage(1, 1, c_PageTableFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, data->emptyPageTable, data->emptyPageTableMemory);
+	data->emptyPageTableView = Renderer::CreateImageView(data->emptyPageTable, c_PageTableFormat);
+
+	// Both end up in SHADER_READ_ONLY_OPTIMAL, pages are copied in later without discarding the rest
+	{
+		const uint32_t texel = 0;
+		VkBufferImageCopy region{};
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = { 1, 1, 1 };
+
+		UploadQueue uploads;
+		uploads.CopyToImage(&texel, sizeof(texel), data->cache, 1, { region });
+		uploads.CopyToImage(&texel, sizeof(texel), data->emptyPageTable, 1, { region });
+		uploads.Flush();
+	}
+
+	data->slots.resize(data->slotsPerSide * data->slotsPerSide);
+	for (uint32_t i = static_cast<uint32_t>(data->slots.size()); i-- > 0;)
+	{
+		data->freeSlots.push_back(i);
+	}
+
+	for (auto& frame : data->frames)
+	{
+		Renderer::CreateBuffer(c_StagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			frame.staging, frame.stagingMemory);
+		void* mapped;
+		if (vkMapMemory(Renderer::GetDevice(), frame.stagingMemory, 0, c_StagingSize, 0, &mapped) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to map staging memory!");
+		}
+		frame.stagingMapped = static_cast<unsigned char*>(mapped);
+	}
+
+	CreateFeedbackPipeline();
+	Renderer::SetPostPassCallback(RecordFrame);
+}
+
+void VulkanProject::VirtualTexturing::Shutdown()
+{
+	if (!data)
+	{
+		return;
+	}
+
+	Renderer::SetPostPassCallback(nullptr);
+	VkDevice device = Renderer::GetDevice();
+	vkDeviceWaitIdle(device);
+
+	if (data->feedbackFramebuffer != VK_NULL_HANDLE)
+	{
+		DestroyFeedbackTarget();
+	}
+	for (auto& frame : data->frames)
+	{
+		vkUnmapMemory(device, frame.stagingMemory);
+		vkDestroyBuffer(device, frame.staging, nullptr);
+		vkFreeMemory(device, frame.stagingMemory, nullptr);
+	}
+
+	vkDestroyPipeline(device, data->feedbackPipeline, nullptr);
+	vkDestroyPipelineLayout(device, data->feedbackLayout, nullptr);
+	vkDestroyRenderPass(device, data->feedbackPass, nullptr);
+
+	vkDestroyImageView(device, data->emptyPageTableView, nullptr);
+	vkDestroyImage(device, data->emptyPageTable, nullptr);
+	vkFreeMemory(device, data->emptyPageTableMemory, nullptr);
+	vkDestroyImageView(device, data->cacheView, nullptr);
+	vkDestroyImageView(device, data->linearCacheView, nullptr);
+	vkDestroyImage(device, data->cache, nullptr);
+	vkFreeMemory(device, data->cacheMemory, nullptr);
+
+	delete data;
+	data = nullptr;
+}
+
+bool VulkanProject::VirtualTexturing::IsEnabled()
+{
+	return data != nullptr;
+}
+
+void VulkanProject::VirtualTexturing::SetView(const glm::mat4& view, const glm::mat4& projection)
+{
+	data->viewProjection = projection * view;
+}
+
+void VulkanProject::VirtualTexturing::AddFeedbackDraw(Mesh* mesh, const glm::mat4& model, VirtualTexture* const textures[3])
+{
+	Group group = { textures[0]->GetID(), textures[1]->GetID(), textures[2]->GetID() };
+	auto it = std::find(data->groups.begin(), data->groups.end(), group);
+	if (it == data->groups.end())
+	{
+		// The group id is stored in 8 bits of the feedback, draws past that get no feedback this frame
+		if (data->groups.size() >= c_NoGroup)
+		{
+			return;
+		}
+		it = data->groups.insert(data->groups.end(), group);
+	}
+	data->draws.push_back({ mesh, model, static_cast<uint32_t>(it - data->groups.begin()) });
+}
+
+VkImageView VulkanProject::VirtualTexturing::GetCacheView(bool srgb)
+{
+	return srgb ? data->cacheView : data->linearCacheView;
+}
+
+VkSampler VulkanProject::VirtualTexturing::GetCacheSampler()
+{
+	return SamplerCache::Get(GetCacheSamplerState());
+}
+
+VkSampler VulkanProject::VirtualTexturing::GetPageTableSampler()
+{
+	return SamplerCache::Get(GetPageTableSamplerState());
+}
+
+VkImageView VulkanProject::VirtualTexturing::GetEmptyPageTableView()
+{
+	return data->emptyPageTableView;
+}
+
+VulkanProject::VirtualTextureConstants VulkanProject::VirtualTexturing::GetConstants(VirtualTexture* const textures[3])
+{
+	VirtualTextureConstants constants{};
+	for (int i = 0; i < 3; i++)
+	{
+		constants.textures[i] = glm::vec4(textures[i]->GetWidth(), textures[i]->GetHeight(), textures[i]->GetMipCount(), 0.0f);
+	}
+	constants.cache = glm::vec4(data->slotsPerSide * c_StoredPageSize, c_PageSize, c_PageBorder, 1.0f);
+	return constants;
+}
+
+uint32_t VulkanProject::VirtualTexturing::GetResidentPages()
+{
+	return data ? static_cast<uint32_t>(data->slots.size() - data->freeSlots.size()) : 0;
+}
+
+uint32_t VulkanProject::VirtualTexturing::Register(VirtualTexture* texture, UploadQueue& uploads)
+{
+	uint32_t id = data->nextID++;
+	Record& record = data->textures[id];
+	record.texture = texture;
+
+	// The coarsest page is what everything falls back to, it goes up with the texture and stays
+	uint32_t slot = AllocateSlot();
+	if (slot == UINT32_MAX)
+	{
+		data->textures.erase(id);
+		throw std::runtime_error("virtual texture cache is full!");
+	}
+	uint32_t tail = texture->GetMipCount() - 1;
+	data->slots[slot].texture = id;
+	data->slots[slot].key = MakeKey(tail, 0, 0);
+	data->slots[slot].lastUsed = data->frame;
+	data->slots[slot].pinned = true;
+	record.resident[MakeKey(tail, 0, 0)] = slot;
+	uploads.UpdateImage(texture->GetFile().GetPage(tail, 0, 0), c_PageBytes, data->cache, 1, { GetSlotRegion(slot, 0) });
+
+	std::vector<VkBufferImageCopy> regions;
+	std::vector<uint32_t> entries = BuildPageTable(record, regions);
+	uploads.CopyToImage(entries.data(), entries.size() * sizeof(uint32_t), texture->GetPageTable(), texture->GetMipCount(), regions);
+	return id;
+}
+
+void VulkanProject::VirtualTexturing::Unregister(VirtualTexture* texture)
+{
+	if (!data)
+	{
+		return;
+	}
+
+	auto it = data->textures.find(texture->GetID());
+	if (it == data->textures.end())
+	{
+		return;
+	}
+	// Pages still loading are dropped when they arrive
+	for (const auto& page : it->second.resident)
+	{
+		FreeSlot(page.second);
+	}
+	data->textures.erase(it);
+}
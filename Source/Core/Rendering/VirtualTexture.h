@@ -0,0 +1,94 @@
+#pragma once
+#include "Core/Includes.h"
+#include "VirtualTextureFile.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace VulkanProject
+{
+    class UploadQueue;
+    class MappedFile;
+    class Mesh;
+
+    // Texture cooked into pages (.vpvt) that are streamed into a shared physical cache as the view needs them.
+    // The texture itself only owns its page table: one texel per page and mip level pointing at the cache slot
+    // the page (or the closest coarser page that is resident) lives in.
+    class VirtualTexture
+    {
+    public:
+        // The page table and the coarsest page are recorded into uploads, the texture can be used once uploads is flushed
+        VirtualTexture(const std::string& path, UploadQueue& uploads);
+        ~VirtualTexture();
+
+        VirtualTexture(const VirtualTexture&) = delete;
+        VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+        static bool IsVirtualTexture(const std::string& path) { return VirtualTextureFile::IsVirtualTexture(path); }
+
+        VkImage GetPageTable() const { return m_PageTable; }
+        VkImageView GetPageTableView() const { return m_PageTableView; }
+        const VirtualTextureFile::View& GetFile() const { return m_View; }
+        // Keeps the pages of GetFile mapped
+        const std::shared_ptr<MappedFile>& GetMapping() const { return m_File; }
+        uint32_t GetID() const { return m_ID; }
+
+        uint32_t GetWidth() const { return m_View.header.width; }
+        uint32_t GetHeight() const { return m_View.header.height; }
+        uint32_t GetMipCount() const { return m_View.header.mipCount; }
+
+    private:
+        std::shared_ptr<MappedFile> m_File;
+        VirtualTextureFile::View m_View;
+        uint32_t m_ID = 0;
+
+        VkImage m_PageTable = VK_NULL_HANDLE;
+        VkDeviceMemory m_PageTableMemory = VK_NULL_HANDLE;
+        VkImageView m_PageTableView = VK_NULL_HANDLE;
+    };
+
+    // Push constants of the main pipeline, selects the virtual texture path of the fragment shader
+    struct VirtualTextureConstants
+    {
+        // width, height and mip count of each texture slot
+        glm::vec4 textures[3];
+        // cache size in texels, page size, page border, 1 when the material is virtual textured
+        glm::vec4 cache;
+    };
+
+    // Software virtual texturing without sparse binding. Every frame the virtual textured draws are rendered
+    // again at a fraction of the resolution into a feedback target that records the page and mip each pixel
+    // needs. The target is read back asynchronously, the pages missing from the cache are read from their
+    // .vpvt files on the thread pool and uploaded a few per frame, least recently used pages make room.
+    namespace VirtualTexturing
+    {
+        // cachePages is the number of pages on each side of the physical cache, clamped to what the device supports
+        void Init(uint32_t cachePages = 32, uint32_t feedbackDivisor = 8);
+        // Waits for the device, virtual textures that are still around stop streaming
+        void Shutdown();
+        bool IsEnabled();
+
+        // Camera of the coming frame, set before the models are drawn
+        void SetView(const glm::mat4& view, const glm::mat4& projection);
+        // Draw of a virtual textured mesh with the model matrix the vertex shader uses.
+        // The textures are rendered into the feedback pass as a group that shares its uvs.
+        void AddFeedbackDraw(Mesh* mesh, const glm::mat4& model, VirtualTexture* const textures[3]);
+
+        // What the main pipeline binds for virtual textured materials, the colour slot reads the cache as sRGB
+        VkImageView GetCacheView(bool srgb);
+        // From the SamplerCache, also valid before Init
+        VkSampler GetCacheSampler();
+        VkSampler GetPageTableSampler();
+        // Bound in the page table slots of regular materials
+        VkImageView GetEmptyPageTableView();
+        VirtualTextureConstants GetConstants(VirtualTexture* const textures[3]);
+
+        // Pages resident in the cache, including the pinned coarsest page of every texture
+        uint32_t GetResidentPages();
+
+        // Called by VirtualTexture, returns the id the feedback refers to the texture by
+        uint32_t Register(VirtualTexture* texture, UploadQueue& uploads);
+        void Unregister(VirtualTexture* texture);
+    }
+}
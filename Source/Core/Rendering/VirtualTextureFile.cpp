@@ -0,0 +1,159 @@
+#include "VirtualTextureFile.h"
+#include <stdexcept>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	uint64_t GetPageStride()
+	{
+		using namespace VulkanProject::VirtualTextureFile;
+		return (c_PageBytes + c_PageAlignment - 1) & ~(c_PageAlignment - 1);
+	}
+
+	uint32_t NextPowerOfTwo(uint32_t value)
+	{
+		uint32_t result = 1;
+		while (result < value)
+		{
+			result *= 2;
+		}
+		return result;
+	}
+}
+
+const unsigned char* VulkanProject::VirtualTextureFile::View::GetPage(uint32_t mip, uint32_t x, uint32_t y) const
+{
+	const Level& level = levels[mip];
+	uint64_t page = level.firstPage + static_cast<uint64_t>(y) * level.pagesX + x;
+	return data + header.pageDataOffset + page * GetPageStride();
+}
+
+bool VulkanProject::VirtualTextureFile::IsVirtualTexture(const std::string& path)
+{
+	return std::filesystem::path(path).extension() == c_Extension;
+}
+
+VulkanProject::VirtualTextureFile::View VulkanProject::VirtualTextureFile::Parse(const unsigned char* data, size_t size)
+{
+	if (size < sizeof(Header))
+	{
+		throw std::runtime_error("virtual texture is truncated!");
+	}
+
+	View view;
+	memcpy(&view.header, data, sizeof(Header));
+	if (view.header.magic != c_Magic)
+	{
+		throw std::runtime_error("file is not a virtual texture!");
+	}
+	if (view.header.version != c_Version)
+	{
+		throw std::runtime_error("virtual texture is out of date, recook it!");
+	}
+	if (view.header.mipCount == 0 || view.header.mipCount > 16 || sizeof(Header) + sizeof(Level) * static_cast<uint64_t>(view.header.mipCount) > size)
+	{
+		throw std::runtime_error("virtual texture is truncated!");
+	}
+	if (view.header.pageDataOffset > size || view.header.pageCount * GetPageStride() > size - view.header.pageDataOffset)
+	{
+		throw std::runtime_error("virtual texture pages out of range!");
+	}
+
+	view.levels = reinterpret_cast<const Level*>(data + sizeof(Header));
+	view.data = data;
+
+	// Every level halves the one before, down to a single page
+	uint32_t pages = 0;
+	for (uint32_t i = 0; i < view.header.mipCount; i++)
+	{
+		const Level& level = view.levels[i];
+		bool halved = i == 0 || (level.pagesX == std::max(view.levels[i - 1].pagesX / 2, 1u) && level.pagesY == std::max(view.levels[i - 1].pagesY / 2, 1u));
+		if (!halved || level.pagesX == 0 || level.pagesY == 0 || level.pagesX > 256 || level.pagesY > 256 || level.firstPage != pages)
+		{
+			throw std::runtime_error("virtual texture level out of range!");
+		}
+		pages += level.pagesX * level.pagesY;
+	}
+	const Level& last = view.levels[view.header.mipCount - 1];
+	if (pages != view.header.pageCount || last.pagesX != 1 || last.pagesY != 1)
+	{
+		throw std::runtime_error("virtual texture level out of range!");
+	}
+	return view;
+}
+
+void VulkanProject::VirtualTextureFile::Write(const std::string& path, const std::vector<CookedTexture::LevelData>& levels)
+{
+	if (levels.empty())
+	{
+		throw std::runtime_error("virtual texture needs at least one level!");
+	}
+
+	Header header{};
+	header.magic = c_Magic;
+	header.version = c_Version;
+	header.width = levels[0].width;
+	header.height = levels[0].height;
+
+	std::vector<Level> table;
+	uint32_t pagesX = NextPowerOfTwo((header.width + c_PageSize - 1) / c_PageSize);
+	uint32_t pagesY = NextPowerOfTwo((header.height + c_PageSize - 1) / c_PageSize);
+	while (true)
+	{
+		table.push_back({ pagesX, pagesY, header.pageCount });
+		header.pageCount += pagesX * pagesY;
+		if (pagesX == 1 && pagesY == 1)
+		{
+			break;
+		}
+		pagesX = std::max(pagesX / 2, 1u);
+		pagesY = std::max(pagesY / 2, 1u);
+	}
+	header.mipCount = static_cast<uint32_t>(table.size());
+	uint64_t tableEnd = sizeof(Header) + sizeof(Level) * table.size();
+	header.pageDataOffset = (tableEnd + c_PageAlignment - 1) & ~(c_PageAlignment - 1);
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("failed to open file: " + path);
+	}
+
+	std::vector<unsigned char> head(header.pageDataOffset, 0);
+	memcpy(head.data(), &header, sizeof(Header));
+	memcpy(head.data() + sizeof(Header), table.data(), sizeof(Level) * table.size());
+	file.write(reinterpret_cast<const char*>(head.data()), static_cast<std::streamsize>(head.size()));
+
+	// One level at a time, a whole padded chain of a large texture does not have to be in memory
+	std::vector<unsigned char> page(GetPageStride(), 0);
+	for (uint32_t mip = 0; mip < header.mipCount; mip++)
+	{
+		const CookedTexture::LevelData& source = levels[std::min<size_t>(mip, levels.size() - 1)];
+		for (uint32_t y = 0; y < table[mip].pagesY; y++)
+		{
+			for (uint32_t x = 0; x < table[mip].pagesX; x++)
+			{
+				for (uint32_t row = 0; row < c_StoredPageSize; row++)
+				{
+					int64_t sourceY = static_cast<int64_t>(y) * c_PageSize + row - c_PageBorder;
+					sourceY = ((sourceY % source.height) + source.height) % source.height;
+					for (uint32_t column = 0; column < c_StoredPageSize; column++)
+					{
+						int64_t sourceX = static_cast<int64_t>(x) * c_PageSize + column - c_PageBorder;
+						sourceX = ((sourceX % source.width) + source.width) % source.width;
+						memcpy(&page[(static_cast<size_t>(row) * c_StoredPageSize + column) * 4], &source.data[(sourceY * source.width + sourceX) * 4], 4);
+					}
+				}
+				file.write(reinterpret_cast<const char*>(page.data()), static_cast<std::streamsize>(page.size()));
+			}
+		}
+	}
+
+	if (!file.good())
+	{
+		throw std::runtime_error("failed to write virtual texture: " + path);
+	}
+}
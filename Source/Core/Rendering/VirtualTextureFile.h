@@ -0,0 +1,71 @@
+#pragma once
+#include "CookedTexture.h"
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace VulkanProject
+{
+    // Offline cooked texture cut into fixed size RGBA8 pages for virtual texturing.
+    // Level 0 is padded to a power of two number of pages on each side, every coarser level halves the
+    // page count down to a single page. Pages carry a border of neighbouring texels (wrapped at the image
+    // edges) so bilinear filtering inside the physical cache never reads from the next page.
+    //
+    // File layout:
+    //   Header
+    //   Level[mipCount], finest level first
+    //   pages, row major per level, every page starts on a c_PageAlignment boundary
+    namespace VirtualTextureFile
+    {
+        const uint32_t c_Magic = 0x54565056; // "VPVT"
+        const uint32_t c_Version = 1;
+        const std::string c_Extension = ".vpvt";
+
+        // texels of content on each side of a page
+        const uint32_t c_PageSize = 128;
+        const uint32_t c_PageBorder = 4;
+        const uint32_t c_StoredPageSize = c_PageSize + 2 * c_PageBorder;
+        const uint64_t c_PageBytes = static_cast<uint64_t>(c_StoredPageSize) * c_StoredPageSize * 4;
+        const uint64_t c_PageAlignment = 4096;
+
+        struct Header
+        {
+            uint32_t magic;
+            uint32_t version;
+            // size of the image, the pages cover at least this much
+            uint32_t width;
+            uint32_t height;
+            uint32_t mipCount;
+            uint32_t pageCount;
+            uint64_t pageDataOffset;
+        };
+
+        struct Level
+        {
+            uint32_t pagesX;
+            uint32_t pagesY;
+            // index of the level's first page in the file
+            uint32_t firstPage;
+        };
+
+        // Validated pointers into a virtual texture that is already in memory
+        struct View
+        {
+            Header header;
+            const Level* levels = nullptr;
+            const unsigned char* data = nullptr;
+
+            // c_PageBytes of RGBA8 texels, c_StoredPageSize texels per row
+            const unsigned char* GetPage(uint32_t mip, uint32_t x, uint32_t y) const;
+        };
+
+        bool IsVirtualTexture(const std::string& path);
+
+        // Throws when the data is not a virtual texture of this version
+        View Parse(const unsigned char* data, size_t size);
+
+        // levels is a full RGBA8 chain as made by TextureProcessing::GenerateMips
+        void Write(const std::string& path, const std::vector<CookedTexture::LevelData>& levels);
+    }
+}
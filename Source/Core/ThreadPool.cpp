@@ -0,0 +1,124 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+VulkanProject::ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	m_Threads.reserve(threadCount);
+	for (unsigned int i = 0; i < threadCount; i++)
+	{
+		m_Threads.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
+}
+
+VulkanProject::ThreadPool::~ThreadPool()
+{
+	// Jobs that are already queued still run before the workers exit
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_Condition.notify_all();
+
+	for (auto& thread : m_Threads)
+	{
+		thread.join();
+	}
+}
+
+void VulkanProject::ThreadPool::WorkerLoop()
+{
+	while (true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Condition.wait(lock, [this]() { return m_Stopping || !m_Jobs.empty(); });
+			if (m_Jobs.empty())
+			{
+				return;
+			}
+			job = std::move(m_Jobs.front());
+			m_Jobs.pop();
+		}
+		job();
+	}
+}
+
+namespace
+{
+	// Shared between the caller of ParallelFor and its helper jobs, helpers can start after the call returned
+	struct ParallelForState
+	{
+		std::function<void(size_t)> job;
+		size_t count = 0;
+		std::atomic<size_t> next{ 0 };
+		size_t finished = 0;
+		std::exception_ptr exception;
+		std::mutex mutex;
+		std::condition_variable condition;
+
+		void Run()
+		{
+			size_t index;
+			while ((index = next.fetch_add(1)) < count)
+			{
+				std::exception_ptr error;
+				try
+				{
+					job(index);
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				if (error && !exception)
+				{
+					exception = error;
+				}
+				if (++finished == count)
+				{
+					condition.notify_all();
+				}
+			}
+		}
+	};
+}
+
+void VulkanProject::ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& job)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	auto state = std::make_shared<ParallelForState>();
+	state->job = job;
+	state->count = count;
+
+	size_t helpers = std::min(static_cast<size_t>(GetThreadCount()), count - 1);
+	for (size_t i = 0; i < helpers; i++)
+	{
+		Submit([state]() { state->Run(); });
+	}
+	state->Run();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->condition.wait(lock, [&]() { return state->finished == state->count; });
+	if (state->exception)
+	{
+		std::rethrow_exception(state->exception);
+	}
+}
+
+VulkanProject::ThreadPool& VulkanProject::ThreadPool::GetShared()
+{
+	static ThreadPool pool;
+	return pool;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <exception>
+
+namespace VulkanProject
+{
+    // Fixed set of worker threads executing submitted jobs in FIFO order
+    class ThreadPool
+    {
+    public:
+        // 0 uses one thread per hardware thread
+        ThreadPool(unsigned int threadCount = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Exceptions thrown by the job are rethrown from the returned future
+        template <typename F> auto Submit(F&& job) -> std::future<decltype(job())>
+        {
+            using Result = decltype(job());
+            auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+            std::future<Result> future = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Jobs.push([task]() { (*task)(); });
+            }
+            m_Condition.notify_one();
+            return future;
+        }
+
+        // Runs job(i) for every i in [0, count). The calling thread takes part and only waits for indices
+        // that are already running on a worker, so it is safe to call from inside another job of the same pool.
+        // The first exception thrown by a job is rethrown once every index has finished.
+        void ParallelFor(size_t count, const std::function<void(size_t)>& job);
+
+        unsigned int GetThreadCount() const { return static_cast<unsigned int>(m_Threads.size()); }
+
+        // Pool shared by the loaders, created on first use
+        static ThreadPool& GetShared();
+
+    private:
+        void WorkerLoop();
+
+        std::vector<std::thread> m_Threads;
+        std::queue<std::function<void()>> m_Jobs;
+        std::mutex m_Mutex;
+        std::condition_variable m_Condition;
+        bool m_Stopping = false;
+    };
+}
@@ -1,17 +1,91 @@
 
 #include "Application.h"
+#include "AssetCache.h"
 
 #include <iostream>
 #include <vector>
+#include <string>
+#include <cctype>
+#include <cstdint>
 
+namespace
+{
+    const char* c_Usage = "usage: VulkanProject [--cache-stats] [--cache-clear] [--benchmark-instancing [copies]] [--recording-threads count] [--static-scene] [--box-occluders]";
 
+    // Only plain decimal numbers that fit in 32 bits, value is left alone otherwise
+    bool ParseCount(const char* text, uint32_t& value)
+    {
+        std::string digits = text;
+        if (digits.empty() || digits.size() > 10)
+        {
+            return false;
+        }
+        for (char c : digits)
+        {
+            if (!std::isdigit(static_cast<unsigned char>(c)))
+            {
+                return false;
+            }
+        }
+        unsigned long long parsed = std::stoull(digits);
+        if (parsed > UINT32_MAX)
+        {
+            return false;
+        }
+        value = static_cast<uint32_t>(parsed);
+        return true;
+    }
+}
 
-int main() 
+int main(int argc, char** argv) 
 {
     //sets default 600-900, window
     VulkanProject::AppConfig config;
     config.name = "VulkanProject";
 
+    // Asset cache maintenance, these run without opening a window
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument == "--cache-stats")
+        {
+            VulkanProject::AssetCache::PrintStats(config.assetCacheDirectory);
+            return 0;
+        }
+        if (argument == "--cache-clear")
+        {
+            VulkanProject::AssetCache::Clear(config.assetCacheDirectory);
+            return 0;
+        }
+        // --benchmark-instancing [copies], the next argument is only the count when it is a number
+        if (argument == "--benchmark-instancing")
+        {
+            config.instancingBenchmark = 10000;
+            if (i + 1 < argc && ParseCount(argv[i + 1], config.instancingBenchmark))
+            {
+                i++;
+            }
+        }
+        // --recording-threads count, 1 records on the main thread only
+        if (argument == "--recording-threads")
+        {
+            if (i + 1 >= argc || !ParseCount(argv[i + 1], config.recordingThreads))
+            {
+                std::cerr << "--recording-threads needs a thread count" << std::endl << c_Usage << std::endl;
+                return EXIT_FAILURE;
+            }
+            i++;
+        }
+        if (argument == "--static-scene")
+        {
+            config.staticScene = true;
+        }
+        if (argument == "--box-occluders")
+        {
+            config.boxOccluders = true;
+        }
+    }
+
     try
     {
         VulkanProject::Application app{ config };
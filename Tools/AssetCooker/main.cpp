@@ -0,0 +1,490 @@
+#include "Core/Rendering/ModelImporter.h"
+#include "Core/Rendering/CookedModel.h"
+#include "Core/Rendering/CookedTexture.h"
+#include "Core/Rendering/VirtualTextureFile.h"
+#include "Core/Rendering/MeshOptimizer.h"
+#include "Core/Rendering/TextureProcessing.h"
+#include "Core/ThreadPool.h"
+#include "Core/AssetCache.h"
+#include "Core/MappedFile.h"
+#include "stb_image.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <cstdint>
+
+// Offline cooker: imports every glTF under a content directory and writes .vpmodel/.vptex files the game loads without processing.
+// Usage: AssetCooker [content directory] [output directory] [--threads N] [--no-compress] [--no-optimize] [--virtual-textures] [--force]
+
+using namespace VulkanProject;
+
+namespace
+{
+	// Bump when the cooked output changes so everything is recooked
+	const uint64_t c_CookerVersion = 5;
+	const char* c_ManifestName = "cook.manifest";
+
+	struct Options
+	{
+		std::filesystem::path contentDirectory = "Resources/Models";
+		std::filesystem::path outputDirectory = "Resources/Models/Cooked";
+		unsigned int threadCount = 0;
+		bool compress = true;
+		bool optimize = true;
+		// materials with all three textures are cooked into pages for virtual texturing
+		bool virtualTextures = false;
+		bool force = false;
+	};
+
+	// What one cooked model was built from and what it wrote
+	struct ManifestEntry
+	{
+		std::string key;
+		std::vector<std::string> dependencies;
+		std::vector<std::string> outputs;
+	};
+
+	// Keyed on the source model path
+	using Manifest = std::map<std::string, ManifestEntry>;
+
+	struct TextureJob
+	{
+		TextureSource source;
+		std::string output;
+	};
+
+	struct ModelJob
+	{
+		std::filesystem::path source;
+		std::filesystem::path output;
+		ModelData data;
+		std::vector<TextureJob> textures;
+		bool failed = false;
+	};
+
+	Manifest ReadManifest(const std::filesystem::path& path)
+	{
+		Manifest manifest;
+		std::ifstream file(path);
+		std::string line;
+		ManifestEntry* entry = nullptr;
+		while (std::getline(file, line))
+		{
+			size_t space = line.find(' ');
+			if (space == std::string::npos)
+			{
+				continue;
+			}
+			std::string type = line.substr(0, space);
+			std::string value = line.substr(space + 1);
+			if (type == "source") entry = &manifest[value];
+			else if (entry == nullptr) continue;
+			else if (type == "key") entry->key = value;
+			else if (type == "dependency") entry->dependencies.push_back(value);
+			else if (type == "output") entry->outputs.push_back(value);
+		}
+		return manifest;
+	}
+
+	void WriteManifest(const std::filesystem::path& path, const Manifest& manifest)
+	{
+		std::ofstream file(path, std::ios::trunc);
+		for (const auto& entry : manifest)
+		{
+			file << "source " << entry.first << "\n";
+			file << "key " << entry.second.key << "\n";
+			for (const auto& dependency : entry.second.dependencies)
+			{
+				file << "dependency " << dependency << "\n";
+			}
+			for (const auto& output : entry.second.outputs)
+			{
+				file << "output " << output << "\n";
+			}
+			file << "\n";
+		}
+	}
+
+	// Hash of the cooker version, the settings and the contents of every dependency, throws when a dependency is missing
+	std::string GetKey(const std::vector<std::string>& dependencies, const Options& options)
+	{
+		Hasher hasher;
+		hasher.Add(c_CookerVersion).Add(uint64_t(options.compress)).Add(uint64_t(options.optimize)).Add(uint64_t(options.virtualTextures));
+		for (const auto& dependency : dependencies)
+		{
+			hasher.Add(dependency);
+			if (std::filesystem::file_size(dependency) > 0)
+			{
+				MappedFile file(dependency);
+				hasher.Add(file.GetData(), file.GetSize());
+			}
+		}
+
+		char key[17];
+		snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hasher.Get()));
+		return key;
+	}
+
+	bool IsUpToDate(const Manifest& manifest, const std::string& source, const Options& options)
+	{
+		auto entry = manifest.find(source);
+		if (entry == manifest.end())
+		{
+			return false;
+		}
+		for (const auto& output : entry->second.outputs)
+		{
+			if (!std::filesystem::exists(output))
+			{
+				return false;
+			}
+		}
+
+		try
+		{
+			return GetKey(entry->second.dependencies, options) == entry->second.key;
+		}
+		catch (const std::exception&)
+		{
+			return false;
+		}
+	}
+
+	bool IsInside(const std::filesystem::path& path, const std::filesystem::path& directory)
+	{
+		auto relative = std::filesystem::absolute(path).lexically_relative(std::filesystem::absolute(directory));
+		return !relative.empty() && *relative.begin() != "..";
+	}
+
+	// The layout of a packed RG8 level spread over RGBA8 texels, blue is zero and alpha opaque
+	void WidenPackedChannels(CookedTexture::LevelData& level, eTextureUsage usage)
+	{
+		const size_t texels = static_cast<size_t>(level.width) * level.height;
+		PackTextureChannels(level.data.data(), texels, usage);
+		for (size_t i = texels; i-- > 0;)
+		{
+			unsigned char red = level.data[i * 2];
+			unsigned char green = level.data[i * 2 + 1];
+			level.data[i * 4] = red;
+			level.data[i * 4 + 1] = green;
+			level.data[i * 4 + 2] = 0;
+			level.data[i * 4 + 3] = 255;
+		}
+	}
+
+	void CookTexture(const TextureJob& job, const Options& options)
+	{
+		int width, height, channels;
+		stbi_uc* pixels = job.source.data != nullptr ?
+			stbi_load_from_memory(job.source.data, static_cast<int>(job.source.size), &width, &height, &channels, STBI_rgb_alpha) :
+			stbi_load(job.source.path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+		if (!pixels)
+		{
+			throw std::runtime_error("failed to load texture image: " + (job.source.path.empty() ? job.output : job.source.path));
+		}
+
+		// Colour is sampled as sRGB and its mips are filtered to match, linear maps are averaged as they are
+		const eTextureUsage usage = job.source.usage;
+		std::vector<CookedTexture::LevelData> levels = TextureProcessing::GenerateMips(pixels, static_cast<uint32_t>(width), static_cast<uint32_t>(height), usage == eTextureUsage::Color);
+		stbi_image_free(pixels);
+		if (usage == eTextureUsage::Normal)
+		{
+			for (size_t i = 1; i < levels.size(); i++)
+			{
+				TextureProcessing::NormalizeNormals(levels[i]);
+			}
+		}
+
+		// Pages are uploaded into one RGBA8 cache, they stay uncompressed and keep four channels
+		if (VirtualTextureFile::IsVirtualTexture(job.output))
+		{
+			if (usage != eTextureUsage::Color)
+			{
+				for (auto& level : levels)
+				{
+					WidenPackedChannels(level, usage);
+				}
+			}
+			VirtualTextureFile::Write(job.output, levels);
+			return;
+		}
+
+		CookedTexture::eFormat format = CookedTexture::eFormat::RGBA8_SRGB;
+		if (usage != eTextureUsage::Color)
+		{
+			format = CookedTexture::eFormat::RG8_UNORM;
+			for (auto& level : levels)
+			{
+				PackTextureChannels(level.data.data(), static_cast<size_t>(level.width) * level.height, usage);
+				level.data.resize(static_cast<size_t>(level.width) * level.height * GetTexelSize(usage));
+			}
+		}
+		if (options.compress)
+		{
+			if (usage != eTextureUsage::Color)
+			{
+				format = CookedTexture::eFormat::BC5_UNORM;
+			}
+			else
+			{
+				format = TextureProcessing::HasAlpha(levels[0]) ? CookedTexture::eFormat::BC3_SRGB : CookedTexture::eFormat::BC1_SRGB;
+			}
+			for (auto& level : levels)
+			{
+				level = TextureProcessing::Compress(level, format);
+			}
+		}
+		CookedTexture::Write(job.output, format, levels);
+	}
+
+	void OptimizePrimitive(ModelData::Primitive& primitive, float& acmrBefore, float& acmrAfter)
+	{
+		acmrBefore = MeshOptimizer::GetACMR(primitive.indices, primitive.vertices.size());
+		MeshOptimizer::WeldVertices(primitive.vertices, primitive.indices);
+		MeshOptimizer::OptimizeVertexCache(primitive.indices, primitive.vertices.size());
+		MeshOptimizer::OptimizeVertexFetch(primitive.vertices, primitive.indices);
+		acmrAfter = MeshOptimizer::GetACMR(primitive.indices, primitive.vertices.size());
+	}
+
+	// Gives every distinct texture of the model a cooked file next to it and points the primitives at those files
+	void AssignTextures(ModelJob& job, const Options& options)
+	{
+		std::map<std::string, std::string> cooked;
+		auto assign = [&](TextureSource& texture, bool isVirtual)
+		{
+			if (!texture.IsValid())
+			{
+				return;
+			}
+
+			// Embedded images are told apart by where they live in memory
+			std::string identity = texture.data != nullptr ? "embedded:" + std::to_string(reinterpret_cast<uintptr_t>(texture.data)) : texture.path;
+			// An image used in two slots is cooked once per format
+			identity = std::to_string(static_cast<uint32_t>(texture.usage)) + ":" + identity;
+			if (isVirtual)
+			{
+				identity = "virtual:" + identity;
+			}
+			auto existing = cooked.find(identity);
+			if (existing == cooked.end())
+			{
+				std::filesystem::path output = job.output;
+				output.replace_filename(job.output.stem().string() + "_" + std::to_string(cooked.size()) + (isVirtual ? VirtualTextureFile::c_Extension : CookedTexture::c_Extension));
+				existing = cooked.emplace(identity, output.generic_string()).first;
+				job.textures.push_back({ texture, existing->second });
+			}
+
+			eTextureUsage usage = texture.usage;
+			SamplerState sampler = texture.sampler;
+			texture = TextureSource();
+			texture.path = existing->second;
+			texture.usage = usage;
+			texture.sampler = sampler;
+		};
+
+		for (auto& mesh : job.data.meshes)
+		{
+			for (auto& primitive : mesh)
+			{
+				// The renderer only draws a material virtual textured when all three slots are
+				bool isVirtual = options.virtualTextures && primitive.texture.IsValid() && primitive.normalTexture.IsValid() && primitive.metalic_roughnessTexture.IsValid();
+				assign(primitive.texture, isVirtual);
+				assign(primitive.normalTexture, isVirtual);
+				assign(primitive.metalic_roughnessTexture, isVirtual);
+			}
+		}
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		int positional = 0;
+		for (int i = 1; i < argc; i++)
+		{
+			std::string argument = argv[i];
+			if (argument == "--threads" && i + 1 < argc) options.threadCount = static_cast<unsigned int>(std::stoul(argv[++i]));
+			else if (argument == "--no-compress") options.compress = false;
+			else if (argument == "--no-optimize") options.optimize = false;
+			else if (argument == "--virtual-textures") options.virtualTextures = true;
+			else if (argument == "--force") options.force = true;
+			else if (argument.rfind("--", 0) == 0) return false;
+			else if (positional == 0) { options.contentDirectory = argument; positional++; }
+			else if (positional == 1) { options.outputDirectory = argument; positional++; }
+			else return false;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		std::cerr << "usage: AssetCooker [content directory] [output directory] [--threads N] [--no-compress] [--no-optimize] [--virtual-textures] [--force]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	std::filesystem::create_directories(options.outputDirectory);
+	const std::filesystem::path manifestPath = options.outputDirectory / c_ManifestName;
+	Manifest manifest = ReadManifest(manifestPath);
+
+	// Sorted so the cook order and the manifest do not depend on the file system
+	std::vector<std::filesystem::path> sources;
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(options.contentDirectory))
+	{
+		std::filesystem::path extension = entry.path().extension();
+		if (entry.is_regular_file() && (extension == ".gltf" || extension == ".glb") && !IsInside(entry.path(), options.outputDirectory))
+		{
+			sources.push_back(entry.path());
+		}
+	}
+	std::sort(sources.begin(), sources.end());
+
+	Manifest updated;
+	std::vector<ModelJob> jobs;
+	for (const auto& source : sources)
+	{
+		std::string key = source.generic_string();
+		if (!options.force && IsUpToDate(manifest, key, options))
+		{
+			updated[key] = manifest[key];
+			continue;
+		}
+
+		ModelJob job;
+		job.source = source;
+		job.output = options.outputDirectory / std::filesystem::relative(source, options.contentDirectory);
+		job.output.replace_extension(CookedModel::c_Extension);
+		jobs.push_back(std::move(job));
+	}
+
+	ThreadPool pool(options.threadCount);
+	int failed = 0;
+	auto wait = [&](std::vector<std::pair<size_t, std::future<void>>>& futures)
+	{
+		for (auto& future : futures)
+		{
+			try
+			{
+				future.second.get();
+			}
+			catch (const std::exception& e)
+			{
+				ModelJob& job = jobs[future.first];
+				if (!job.failed)
+				{
+					std::cerr << "failed to cook " << job.source.generic_string() << ": " << e.what() << std::endl;
+					job.failed = true;
+					failed++;
+				}
+			}
+		}
+		futures.clear();
+	};
+
+	// Import every model in parallel
+	std::vector<std::pair<size_t, std::future<void>>> futures;
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		futures.emplace_back(i, pool.Submit([&jobs, &options, i]()
+		{
+			jobs[i].data = ImportModel(jobs[i].source.string());
+			std::filesystem::create_directories(jobs[i].output.parent_path());
+			AssignTextures(jobs[i], options);
+		}));
+	}
+	wait(futures);
+
+	// Every primitive and every texture is its own job, a model with a few large textures still uses all cores
+	std::vector<std::vector<std::pair<float, float>>> acmr(jobs.size());
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		if (jobs[i].failed)
+		{
+			continue;
+		}
+
+		if (options.optimize)
+		{
+			size_t primitiveCount = 0;
+			for (const auto& mesh : jobs[i].data.meshes)
+			{
+				primitiveCount += mesh.size();
+			}
+			acmr[i].resize(primitiveCount);
+
+			size_t index = 0;
+			for (auto& mesh : jobs[i].data.meshes)
+			{
+				for (auto& primitive : mesh)
+				{
+					auto* result = &acmr[i][index++];
+					futures.emplace_back(i, pool.Submit([&primitive, result]() { OptimizePrimitive(primitive, result->first, result->second); }));
+				}
+			}
+		}
+
+		for (const auto& texture : jobs[i].textures)
+		{
+			futures.emplace_back(i, pool.Submit([&texture, &options]() { CookTexture(texture, options); }));
+		}
+	}
+	wait(futures);
+
+	// Write the models and record what they were built from
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		if (!jobs[i].failed)
+		{
+			futures.emplace_back(i, pool.Submit([&jobs, i]() { CookedModel::Write(jobs[i].data, jobs[i].output.string()); }));
+		}
+	}
+	wait(futures);
+
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		ModelJob& job = jobs[i];
+		if (job.failed)
+		{
+			continue;
+		}
+
+		ManifestEntry entry;
+		entry.dependencies = job.data.dependencies;
+		entry.outputs.push_back(job.output.generic_string());
+		for (const auto& texture : job.textures)
+		{
+			entry.outputs.push_back(texture.output);
+		}
+		entry.key = GetKey(entry.dependencies, options);
+		updated[job.source.generic_string()] = entry;
+
+		float before = 0.0f;
+		float after = 0.0f;
+		for (const auto& primitive : acmr[i])
+		{
+			before += primitive.first / acmr[i].size();
+			after += primitive.second / acmr[i].size();
+		}
+		printf("cooked %s -> %s (%zu textures", job.source.generic_string().c_str(), job.output.generic_string().c_str(), job.textures.size());
+		if (options.optimize)
+		{
+			printf(", ACMR %.3f -> %.3f", before, after);
+		}
+		printf(")\n");
+	}
+	WriteManifest(manifestPath, updated);
+
+	float seconds = std::chrono::duration<float, std::chrono::seconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+	printf("%zu cooked, %zu up to date, %d failed in %.2fs on %u threads\n",
+		jobs.size() - failed, sources.size() - jobs.size(), failed, seconds, pool.GetThreadCount());
+
+	return failed > 0 ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,86 @@
+#include "Core/Rendering/OcclusionRasterizer.h"
+#include "Core/ThreadPool.h"
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+// Checks the CPU occlusion rasterizer against a scene whose depth is known, without a GPU.
+// Usage: OcclusionCheck, prints every failed check and exits with 1 when there is one.
+
+using namespace VulkanProject;
+
+namespace
+{
+	int g_Failures = 0;
+
+	void Check(bool condition, const char* what)
+	{
+		if (!condition)
+		{
+			printf("FAILED: %s\n", what);
+			g_Failures++;
+		}
+	}
+
+	float GetDepth(const OcclusionRasterizer& rasterizer, uint32_t x, uint32_t y)
+	{
+		return rasterizer.GetDepth()[y * rasterizer.GetWidth() + x];
+	}
+}
+
+int main()
+{
+	// Looking down -z from 5 units away at a 2x2x1 box around the origin, it covers the middle of the view
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 2.0f, 0.1f, 100.0f);
+	proj[1][1] *= -1;
+	glm::mat4 viewProjection = proj * view;
+
+	OcclusionRasterizer::Occluder box = OcclusionRasterizer::CreateBox(glm::vec3(-1.0f, -1.0f, -0.5f), glm::vec3(1.0f, 1.0f, 0.5f));
+	OcclusionRasterizer rasterizer;
+	rasterizer.Begin(viewProjection);
+	rasterizer.AddOccluder(box, glm::mat4(1.0f));
+	rasterizer.Rasterize();
+	Check(rasterizer.GetTriangleCount() == 12, "every face of the box is set up");
+
+	// The front face at z = 0.5 is what the middle pixel sees
+	glm::vec4 front = viewProjection * glm::vec4(0.0f, 0.0f, 0.5f, 1.0f);
+	const float expected = front.z / front.w;
+	const uint32_t width = rasterizer.GetWidth();
+	const uint32_t height = rasterizer.GetHeight();
+	const float center = GetDepth(rasterizer, width / 2, height / 2);
+	Check(std::abs(center - expected) < 1e-4f, "depth of the front face in the middle of the view");
+	Check(GetDepth(rasterizer, 0, 0) == 1.0f && GetDepth(rasterizer, width - 1, height - 1) == 1.0f, "nothing rasterised in the corners");
+
+	// Boxes of half a unit at different places around it
+	auto isVisible = [&rasterizer](const glm::vec3& position)
+	{
+		return rasterizer.IsVisible(glm::vec3(-0.25f), glm::vec3(0.25f), glm::translate(glm::mat4(1.0f), position));
+	};
+	Check(!isVisible(glm::vec3(0.0f, 0.0f, -3.0f)), "a box right behind the occluder is hidden");
+	Check(isVisible(glm::vec3(0.0f, 0.0f, 2.0f)), "a box in front of the occluder is visible");
+	Check(isVisible(glm::vec3(3.5f, 0.0f, -3.0f)), "a box behind but beside the occluder is visible");
+	Check(!isVisible(glm::vec3(50.0f, 0.0f, -3.0f)), "a box outside the view is not visible");
+	Check(isVisible(glm::vec3(0.0f, 0.0f, 5.0f)), "a box around the camera is visible");
+
+	// The same scene gives the same depth however the tiles were spread over the threads
+	std::vector<float> depth = rasterizer.GetDepth();
+	rasterizer.Begin(viewProjection);
+	rasterizer.AddOccluder(box, glm::mat4(1.0f));
+	rasterizer.Rasterize();
+	Check(depth == rasterizer.GetDepth(), "rasterising again gives the same depth");
+
+	// Nothing added, nothing hidden
+	rasterizer.Begin(viewProjection);
+	rasterizer.Rasterize();
+	Check(isVisible(glm::vec3(0.0f, 0.0f, -3.0f)), "without occluders everything in view is visible");
+
+	if (g_Failures > 0)
+	{
+		printf("%d occlusion checks failed\n", g_Failures);
+		return 1;
+	}
+	printf("All occlusion checks passed on %u threads\n", ThreadPool::GetShared().GetThreadCount());
+	return 0;
+}